@@ -226,7 +226,7 @@ private:
 	
 	int							m_nRestoreFrame;
 
-	CUtlVector< KeyValues * >	m_SoundscapeScripts;	// The whole script file in memory
+	CUtlVector< CKeyValuesDocument * >	m_SoundscapeScripts;	// The whole script file in memory
 	CUtlVector<KeyValues *>		m_soundscapes;			// Lookup by index of each root section
 	audioparams_t				m_params;				// current player audio params
 	CUtlVector<loopingsound_t>	m_loopingSounds;		// list of currently playing sounds
@@ -269,15 +269,14 @@ void Soundscape_Update( audioparams_t &audio )
 
 void C_SoundscapeSystem::AddSoundScapeFile( const char *filename )
 {
-	KeyValues *script = new KeyValues( filename );
-#ifndef _XBOX
-	if ( script->LoadFromFile( filesystem, filename ) )
-#else
-	if ( filesystem->LoadKeyValues( *script, IFileSystem::TYPE_SOUNDSCAPE, filename, "GAME" ) )
-#endif
+	// Soundscapes are only ever read, so each file is kept as a document:
+	// its nodes come from a few blocks and an unchanged file loads from the
+	// binary cache instead of being parsed
+	CKeyValuesDocument *script = new CKeyValuesDocument;
+	if ( script->LoadFromFileCached( filesystem, filename ) )
 	{
 		// parse out all of the top level sections and save their names
-		KeyValues *pKeys = script;
+		KeyValues *pKeys = script->GetRoot();
 		while ( pKeys )
 		{
 			// save pointers to all sections in the root
@@ -294,7 +293,7 @@ void C_SoundscapeSystem::AddSoundScapeFile( const char *filename )
 	}
 	else
 	{
-		script->deleteThis();
+		delete script;
 	}
 }
 
@@ -395,9 +394,9 @@ void C_SoundscapeSystem::Shutdown()
 
 	while ( m_SoundscapeScripts.Count() > 0 )
 	{
-		KeyValues *kv = m_SoundscapeScripts[ 0 ];
+		CKeyValuesDocument *pScript = m_SoundscapeScripts[ 0 ];
 		m_SoundscapeScripts.Remove( 0 );
-		kv->deleteThis();
+		delete pScript;
 	}
 }
 
@@ -84,6 +84,7 @@
 #include "scenefilecache/ISceneFileCache.h"
 #include "tier2/tier2dm.h"
 #include "tier3/tier3.h"
+#include "tier1/framearena.h"
 #include "ihudlcd.h"
 #include "toolframework_client.h"
 #include "hltvcamera.h"
@@ -2303,6 +2304,18 @@ void OnRenderEnd()
 }
 
 
+//-----------------------------------------------------------------------------
+// Purpose: High-water marks of the per-thread frame scratch arenas
+//-----------------------------------------------------------------------------
+CON_COMMAND( cl_frame_arena_report, "Reports client frame scratch arena high-water marks. Usage: cl_frame_arena_report [reset]" )
+{
+	if ( args.ArgC() > 1 && !Q_stricmp( args[1], "reset" ) )
+	{
+		CFrameArena::ResetStats();
+		return;
+	}
+	CFrameArena::ReportStats();
+}
 
 void CHLClient::FrameStageNotify( ClientFrameStage_t curStage )
 {
@@ -2375,6 +2388,9 @@ void CHLClient::FrameStageNotify( ClientFrameStage_t curStage )
 		break;
 	case FRAME_START:
 		{
+			// Last frame's unscoped scratch goes away
+			CFrameArena::NewFrame();
+
 			// Mark the frame as open for client fx additions
 			SetFXCreationAllowed( true );
 			SetBeamCreationAllowed( true );
@@ -7,6 +7,7 @@
 #include "cbase.h"
 
 #include "tier0/vprof.h"
+#include "tier1/framearena.h"
 
 // memdbgon must be the last include file in a .cpp file!!!
 #include "tier0/memdbgon.h"
@@ -276,7 +277,8 @@ void CClientThinkList::PerformThinkFunctions()
 	// Build a list of entities to think this frame, in order of hierarchy.
 	// Do this because the list may be modified during the thinking and also to
 	// prevent bad situations where an entity can think more than once in a frame.
-	ThinkEntry_t **ppThinkEntryList = (ThinkEntry_t**)stackalloc( nMaxList * sizeof(ThinkEntry_t*) );
+	CFrameArenaScope scratch;
+	ThinkEntry_t **ppThinkEntryList = scratch.AllocArray<ThinkEntry_t *>( nMaxList );
 	int nThinkCount = 0;
 	for ( unsigned short iCur=m_ThinkEntries.Head(); iCur != m_ThinkEntries.InvalidIndex(); iCur = m_ThinkEntries.Next( iCur ) )
 	{
@@ -23,6 +23,7 @@
 #include "datacache/imdlcache.h"
 #include "view.h"
 #include "viewrender.h"
+#include "mathlib/ssemath.h"
 
 // memdbgon must be the last include file in a .cpp file!!!
 #include "tier0/memdbgon.h"
@@ -32,7 +33,8 @@ class VMatrix;  // forward decl
 static ConVar cl_drawleaf("cl_drawleaf", "-1", FCVAR_CHEAT );
 static ConVar r_PortalTestEnts( "r_PortalTestEnts", "1", FCVAR_CHEAT, "Clip entities against portal frustums." );
 static ConVar r_portalsopenall( "r_portalsopenall", "0", FCVAR_CHEAT, "Open all portals" );
-static ConVar cl_threaded_client_leaf_system("cl_threaded_client_leaf_system", "0"  );
+static ConVar cl_threaded_client_leaf_system("cl_threaded_client_leaf_system", "0", 0, "Enumerate the leaves of dirty renderables on the job pool" );
+static ConVar cl_threaded_client_leaf_system_min("cl_threaded_client_leaf_system_min", "16", 0, "Minimum number of dirty renderables before leaf enumeration is threaded" );
 
 
 DEFINE_FIXEDSIZE_ALLOCATOR( CClientRenderablesList, 1, CUtlMemoryPool::GROW_SLOW );
@@ -144,6 +146,9 @@ public:
 	// Get leaves this renderable is in
 	virtual bool GetRenderableLeaf ( ClientRenderHandle_t handle, int* pOutLeaf, const int* pInIterator = 0, int* pOutIterator = 0 );
 
+	// Moves renderables every frame and times reinsertion into the tree
+	void BenchmarkReinsertion( int nRenderables, int nFrames );
+
 	// Singleton instance...
 	static CClientLeafSystem s_ClientLeafSystem;
 
@@ -156,6 +161,9 @@ private:
 
 	void SortEntities(  const Vector &vecRenderOrigin, const Vector &vecRenderForward, CClientRenderablesList::CEntry *pEntities, int nEntities );
 
+	// Returns the depth sort center of a renderable, cached until it next changes
+	void GetRenderableSortCenter( ClientRenderHandle_t handle, IClientRenderable *pRenderable, Vector &center );
+
 	// Returns -1 if the renderable spans more than one area. If it's totally in one area, then this returns the leaf.
 	short GetRenderableArea( ClientRenderHandle_t handle );
 
@@ -163,6 +171,12 @@ private:
 	void InsertIntoTree( ClientRenderHandle_t &handle );
 	void RemoveFromTree( ClientRenderHandle_t handle );
 
+	// Reinserts everything in the dirty list, optionally enumerating leaves on the job pool
+	void UpdateDirtyRenderables( bool bThreaded );
+	void InsertIntoTreeThreaded( int nDirty );
+	struct EnumBatch_t;
+	void EnumerateBatchLeaves( EnumBatch_t *&pBatch );
+
 	// Returns if it's a view model render group
 	inline bool IsViewModelRenderGroup( RenderGroup_t group ) const;
 
@@ -280,16 +294,37 @@ private:
 		unsigned short	m_Flags;
 	};
 
-	struct EnumResult_t
+	// Context handed to EnumerateLeaf. When pLeaves is set the leaves are only
+	// recorded (worker threads), otherwise the renderable is added immediately.
+	struct EnumResultList_t
 	{
-		int leaf;
-		EnumResult_t *pNext;
+		CUtlVector< int > *pLeaves;
+		ClientRenderHandle_t handle;
 	};
 
-	struct EnumResultList_t
+	// A dirty renderable whose leaves are being enumerated off the main thread
+	struct DeferredInsert_t
 	{
-		EnumResult_t *pHead;
-		ClientRenderHandle_t handle;
+		ClientRenderHandle_t m_Handle;
+		Vector m_vecAbsMins;
+		Vector m_vecAbsMaxs;
+		int m_nFirstLeaf;
+		int m_nLeafCount;
+	};
+
+	// A contiguous run of deferred inserts processed by one job. Each batch owns
+	// its leaf buffer so jobs never share memory; batches are merged in order.
+	struct EnumBatch_t
+	{
+		int m_nFirstInsert;
+		int m_nInsertCount;
+		CUtlVector< int > m_Leaves;
+	};
+
+	enum
+	{
+		MAX_ENUM_BATCHES = 32,
+		ENUM_BATCHES_PER_THREAD = 4,
 	};
 
 	// Stores data associated with each leaf.
@@ -323,7 +358,26 @@ private:
 	// A little enumerator to help us when adding shadows to renderables
 	int	m_ShadowEnum;
 
-	CTSList<EnumResultList_t> m_DeferredInserts;
+	// Structure-of-arrays cache of translucent sort centers, indexed by render handle. Filled in
+	// by SortEntities the first time a renderable is sorted and dropped by RenderableChanged().
+	CUtlVector< float > m_RenderableCenterX;
+	CUtlVector< float > m_RenderableCenterY;
+	CUtlVector< float > m_RenderableCenterZ;
+	CUtlVector< bool > m_RenderableCenterValid;
+
+	// Scratch for SortEntities. The center lanes are padded out to whole fltx4s.
+	fltx4 m_SortCenterX[ CClientRenderablesList::MAX_GROUP_ENTITIES / 4 ];
+	fltx4 m_SortCenterY[ CClientRenderablesList::MAX_GROUP_ENTITIES / 4 ];
+	fltx4 m_SortCenterZ[ CClientRenderablesList::MAX_GROUP_ENTITIES / 4 ];
+	fltx4 m_SortKeys[ CClientRenderablesList::MAX_GROUP_ENTITIES / 4 ];
+	uint32 m_SortKeysTemp[ CClientRenderablesList::MAX_GROUP_ENTITIES ];
+	unsigned short m_SortIndices[ CClientRenderablesList::MAX_GROUP_ENTITIES ];
+	unsigned short m_SortIndicesTemp[ CClientRenderablesList::MAX_GROUP_ENTITIES ];
+	CClientRenderablesList::CEntry m_SortEntries[ CClientRenderablesList::MAX_GROUP_ENTITIES ];
+
+	// Scratch for threaded reinsertion, kept around to avoid per-frame allocation
+	CUtlVector< DeferredInsert_t > m_DeferredInserts;
+	EnumBatch_t m_EnumBatches[MAX_ENUM_BATCHES];
 };
 
 
@@ -518,6 +572,17 @@ void CClientLeafSystem::LevelShutdownPostEntity()
 	m_ShadowsInLeaf.Purge();
 	m_ShadowsOnRenderable.Purge();
 	m_DirtyRenderables.Purge();
+
+	m_RenderableCenterX.Purge();
+	m_RenderableCenterY.Purge();
+	m_RenderableCenterZ.Purge();
+	m_RenderableCenterValid.Purge();
+
+	m_DeferredInserts.Purge();
+	for ( int i = 0; i < MAX_ENUM_BATCHES; ++i )
+	{
+		m_EnumBatches[i].m_Leaves.Purge();
+	}
 }
 
 
@@ -528,6 +593,14 @@ void CClientLeafSystem::PreRender()
 {
 	VPROF_BUDGET( "CClientLeafSystem::PreRender", "PreRender" );
 
+	bool bThreaded = cl_threaded_client_leaf_system.GetBool() && g_pThreadPool && g_pThreadPool->NumThreads() &&
+		m_DirtyRenderables.Count() >= cl_threaded_client_leaf_system_min.GetInt();
+
+	UpdateDirtyRenderables( bThreaded );
+}
+
+void CClientLeafSystem::UpdateDirtyRenderables( bool bThreaded )
+{
 	int i;
 	int nIterations = 0;
 
@@ -549,8 +622,6 @@ void CClientLeafSystem::PreRender()
 			RemoveFromTree( handle );
 		}
 
-		bool bThreaded = false;//( nDirty > 5 && cl_threaded_client_leaf_system.GetBool() && g_pThreadPool->NumThreads() );
-
 		if ( !bThreaded )
 		{
 			for ( i = nDirty; --i >= 0; )
@@ -560,26 +631,7 @@ void CClientLeafSystem::PreRender()
 		}
 		else
 		{
-			// InsertIntoTree can result in new renderables being added, so copy:
-			ClientRenderHandle_t *pDirtyRenderables = (ClientRenderHandle_t *)alloca( sizeof(ClientRenderHandle_t) * nDirty );
-			memcpy( pDirtyRenderables, m_DirtyRenderables.Base(), sizeof(ClientRenderHandle_t) * nDirty );
-			ParallelProcess( "CClientLeafSystem::PreRender", pDirtyRenderables, nDirty, this, &CClientLeafSystem::InsertIntoTree, &CClientLeafSystem::FrameLock, &CClientLeafSystem::FrameUnlock );
-		}
-
-		if ( m_DeferredInserts.Count() )
-		{
-			EnumResultList_t enumResultList;
-			while ( m_DeferredInserts.PopItem( &enumResultList ) )
-			{
-				m_ShadowEnum++;
-				while ( enumResultList.pHead )
-				{
-					EnumResult_t *p = enumResultList.pHead;
-					enumResultList.pHead = p->pNext;
-					AddRenderableToLeaf( p->leaf, enumResultList.handle );
-					delete p;
-				}
-			}
+			InsertIntoTreeThreaded( nDirty );
 		}
 
 		for ( i = nDirty; --i >= 0; )
@@ -597,6 +649,141 @@ void CClientLeafSystem::PreRender()
 }
 
 
+//-----------------------------------------------------------------------------
+// Threaded reinsertion. Bounds are computed on the main thread since they call
+// back into client entity code; only the BSP leaf enumeration runs on the job
+// pool. Results are merged in the same order as the serial path, so the leaf
+// lists and shadow receivers end up identical regardless of thread timing.
+//-----------------------------------------------------------------------------
+void CClientLeafSystem::InsertIntoTreeThreaded( int nDirty )
+{
+	// Computing bounds can result in new renderables being added to the dirty
+	// list, so only the first nDirty entries are handled here.
+	m_DeferredInserts.SetCount( nDirty );
+	for ( int i = 0; i < nDirty; ++i )
+	{
+		DeferredInsert_t &insert = m_DeferredInserts[i];
+		insert.m_Handle = m_DirtyRenderables[nDirty - 1 - i];
+		insert.m_nFirstLeaf = 0;
+		insert.m_nLeafCount = 0;
+
+		IClientRenderable* pRenderable = m_Renderables[insert.m_Handle].m_pRenderable;
+		CalcRenderableWorldSpaceAABB_Fast( pRenderable, insert.m_vecAbsMins, insert.m_vecAbsMaxs );
+		Assert( insert.m_vecAbsMins.IsValid() && insert.m_vecAbsMaxs.IsValid() );
+	}
+
+	int nBatches = MIN( ( g_pThreadPool->NumThreads() + 1 ) * ENUM_BATCHES_PER_THREAD, (int)MAX_ENUM_BATCHES );
+	nBatches = MIN( nBatches, nDirty );
+
+	EnumBatch_t *pBatches[MAX_ENUM_BATCHES];
+	int nFirst = 0;
+	for ( int i = 0; i < nBatches; ++i )
+	{
+		EnumBatch_t &batch = m_EnumBatches[i];
+		int nLast = ( nDirty * ( i + 1 ) ) / nBatches;
+		batch.m_nFirstInsert = nFirst;
+		batch.m_nInsertCount = nLast - nFirst;
+		batch.m_Leaves.RemoveAll();
+		pBatches[i] = &batch;
+		nFirst = nLast;
+	}
+
+	ParallelProcess( "CClientLeafSystem::PreRender", pBatches, nBatches, this, &CClientLeafSystem::EnumerateBatchLeaves );
+
+	// Merge back into the leaf lists in a deterministic order
+	for ( int i = 0; i < nBatches; ++i )
+	{
+		const EnumBatch_t &batch = m_EnumBatches[i];
+		for ( int j = 0; j < batch.m_nInsertCount; ++j )
+		{
+			const DeferredInsert_t &insert = m_DeferredInserts[ batch.m_nFirstInsert + j ];
+
+			// Make sure each shadow is added exactly once to each renderable
+			m_ShadowEnum++;
+
+			const int *pLeaf = batch.m_Leaves.Base() + insert.m_nFirstLeaf;
+			for ( int k = 0; k < insert.m_nLeafCount; ++k )
+			{
+				AddRenderableToLeaf( pLeaf[k], insert.m_Handle );
+			}
+		}
+	}
+}
+
+void CClientLeafSystem::EnumerateBatchLeaves( EnumBatch_t *&pBatch )
+{
+	ISpatialQuery* pQuery = engine->GetBSPTreeQuery();
+
+	EnumResultList_t list = { &pBatch->m_Leaves, INVALID_CLIENT_RENDER_HANDLE };
+	for ( int i = 0; i < pBatch->m_nInsertCount; ++i )
+	{
+		DeferredInsert_t &insert = m_DeferredInserts[ pBatch->m_nFirstInsert + i ];
+		list.handle = insert.m_Handle;
+		insert.m_nFirstLeaf = pBatch->m_Leaves.Count();
+		pQuery->EnumerateLeavesInBox( insert.m_vecAbsMins, insert.m_vecAbsMaxs, this, (int)&list );
+		insert.m_nLeafCount = pBatch->m_Leaves.Count() - insert.m_nFirstLeaf;
+	}
+}
+
+
+//-----------------------------------------------------------------------------
+// Marks renderables dirty every frame and compares serial and threaded reinsertion
+//-----------------------------------------------------------------------------
+void CClientLeafSystem::BenchmarkReinsertion( int nRenderables, int nFrames )
+{
+	if ( m_Leaf.Count() == 0 )
+	{
+		Msg( "No map loaded.\n" );
+		return;
+	}
+
+	// Flush anything that's already pending so it isn't counted
+	UpdateDirtyRenderables( false );
+
+	CUtlVector< ClientRenderHandle_t > handles;
+	for ( ClientRenderHandle_t h = m_Renderables.Head(); h != m_Renderables.InvalidIndex() && handles.Count() < nRenderables; h = m_Renderables.Next( h ) )
+	{
+		if ( m_Renderables[h].m_Flags & RENDER_FLAGS_STATIC_PROP )
+			continue;
+		if ( IsViewModelRenderGroup( (RenderGroup_t)m_Renderables[h].m_RenderGroup ) )
+			continue;
+		handles.AddToTail( h );
+	}
+
+	bool bCanThread = g_pThreadPool && g_pThreadPool->NumThreads();
+	double flTime[2] = { 0.0, 0.0 };
+	for ( int nMode = 0; nMode < ( bCanThread ? 2 : 1 ); ++nMode )
+	{
+		CFastTimer timer;
+		timer.Start();
+		for ( int nFrame = 0; nFrame < nFrames; ++nFrame )
+		{
+			for ( int i = 0; i < handles.Count(); ++i )
+			{
+				RenderableChanged( handles[i] );
+			}
+			UpdateDirtyRenderables( nMode != 0 );
+		}
+		timer.End();
+		flTime[nMode] = timer.GetDuration().GetMillisecondsF();
+	}
+
+	Msg( "Reinserted %d renderables x %d frames\n", handles.Count(), nFrames );
+	Msg( "  serial:   %8.3f ms total, %6.3f ms/frame\n", flTime[0], flTime[0] / MAX( nFrames, 1 ) );
+	if ( bCanThread )
+	{
+		Msg( "  threaded: %8.3f ms total, %6.3f ms/frame (%d threads)\n", flTime[1], flTime[1] / MAX( nFrames, 1 ), g_pThreadPool->NumThreads() );
+	}
+}
+
+CON_COMMAND_F( cl_leafsystem_benchmark, "Times reinsertion of moving renderables. Usage: cl_leafsystem_benchmark [renderables] [frames]", FCVAR_CHEAT )
+{
+	int nRenderables = ( args.ArgC() > 1 ) ? atoi( args[1] ) : 512;
+	int nFrames = ( args.ArgC() > 2 ) ? atoi( args[2] ) : 100;
+	CClientLeafSystem::s_ClientLeafSystem.BenchmarkReinsertion( MAX( nRenderables, 1 ), MAX( nFrames, 1 ) );
+}
+
+
 //-----------------------------------------------------------------------------
 // Creates a new renderable
 //-----------------------------------------------------------------------------
@@ -630,6 +817,17 @@ void CClientLeafSystem::NewRenderable( IClientRenderable* pRenderable, RenderGro
 	info.m_RenderGroup = (unsigned char)type;
 	info.m_EnumCount = 0;
 	info.m_RenderLeaf = 0xFFFF;
+
+	if ( handle >= m_RenderableCenterValid.Count() )
+	{
+		int nCount = m_Renderables.NumAllocated();
+		m_RenderableCenterX.SetCount( nCount );
+		m_RenderableCenterY.SetCount( nCount );
+		m_RenderableCenterZ.SetCount( nCount );
+		m_RenderableCenterValid.SetCount( nCount );
+	}
+	m_RenderableCenterValid[handle] = false;
+
 	if ( IsViewModelRenderGroup( (RenderGroup_t)info.m_RenderGroup ) )
 	{
 		AddToViewModelList( handle );
@@ -1135,28 +1333,23 @@ void CClientLeafSystem::AddRenderableToLeaves( ClientRenderHandle_t handle, int
 bool CClientLeafSystem::EnumerateLeaf( int leaf, int context )
 {
 	EnumResultList_t *pList = (EnumResultList_t *)context;
-	if ( ThreadInMainThread() )
+	if ( pList->pLeaves )
 	{
-		AddRenderableToLeaf( leaf, pList->handle );
+		pList->pLeaves->AddToTail( leaf );
 	}
 	else
 	{
-		EnumResult_t *p = new EnumResult_t;
-		p->leaf = leaf;
-		p->pNext = pList->pHead;
-		pList->pHead = p;
+		Assert( ThreadInMainThread() );
+		AddRenderableToLeaf( leaf, pList->handle );
 	}
 	return true;
 }
 
 void CClientLeafSystem::InsertIntoTree( ClientRenderHandle_t &handle )
 {
-	if ( ThreadInMainThread() )
-	{
-		// When we insert into the tree, increase the shadow enumerator
-		// to make sure each shadow is added exactly once to each renderable
-		m_ShadowEnum++;
-	}
+	// When we insert into the tree, increase the shadow enumerator
+	// to make sure each shadow is added exactly once to each renderable
+	m_ShadowEnum++;
 
 	EnumResultList_t list = { NULL, handle };
 
@@ -1169,11 +1362,6 @@ void CClientLeafSystem::InsertIntoTree( ClientRenderHandle_t &handle )
 
 	ISpatialQuery* pQuery = engine->GetBSPTreeQuery();
 	pQuery->EnumerateLeavesInBox( absMins, absMaxs, this, (int)&list );
-
-	if ( list.pHead )
-	{
-		m_DeferredInserts.PushItem( list );
-	}
 }
 
 //-----------------------------------------------------------------------------
@@ -1210,6 +1398,9 @@ void CClientLeafSystem::RenderableChanged( ClientRenderHandle_t handle )
 	if ( !m_Renderables.IsValidIndex( handle ) )
 		return;
 
+	// It moved or changed bounds, so its sort center has to be recomputed
+	m_RenderableCenterValid[handle] = false;
+
 	if ( (m_Renderables[handle].m_Flags & RENDER_FLAGS_HASCHANGED ) == 0 )
 	{
 		m_Renderables[handle].m_Flags |= RENDER_FLAGS_HASCHANGED;
@@ -1331,7 +1522,9 @@ void CClientLeafSystem::ComputeTranslucentRenderLeaf( int count, const LeafIndex
 
 	// For better sorting, we're gonna choose the leaf that is closest to the camera.
 	// The leaf list passed in here is sorted front to back
-	bool bThreaded = false;//( cl_threaded_client_leaf_system.GetBool() && g_pThreadPool->NumThreads() );
+	// NOTE: ComputeFxBlend draws from the shared random stream and can recompute
+	// abs origins, so it stays on the main thread even when cl_threaded_client_leaf_system is set.
+	bool bThreaded = false;
 	int globalFrameCount = gpGlobals->framecount;
 	int i;
 
@@ -1684,6 +1877,89 @@ void CClientLeafSystem::CollateRenderablesInLeaf( int leaf, int worldListLeafInd
 }
 
 
+//-----------------------------------------------------------------------------
+// The point translucent renderables are depth sorted by: the render origin
+// offset by the center of the local render bounds (needed for translucent
+// brush models). Every sort key must come from here so cached and uncached
+// renderables order the same way.
+//-----------------------------------------------------------------------------
+static inline void ComputeSortCenter( IClientRenderable *pRenderable, Vector &center )
+{
+	Vector mins, maxs;
+	pRenderable->GetRenderBounds( mins, maxs );
+	VectorAdd( mins, maxs, center );
+	VectorMA( pRenderable->GetRenderOrigin(), 0.5f, center, center );
+}
+
+
+//-----------------------------------------------------------------------------
+// Returns the sort center of a renderable, computing it only if the renderable
+// has changed since it was last sorted. Detail props have no render handle and
+// are always computed.
+//-----------------------------------------------------------------------------
+inline void CClientLeafSystem::GetRenderableSortCenter( ClientRenderHandle_t handle, IClientRenderable *pRenderable, Vector &center )
+{
+	if ( handle >= m_RenderableCenterValid.Count() )
+	{
+		ComputeSortCenter( pRenderable, center );
+		return;
+	}
+
+	if ( !m_RenderableCenterValid[handle] )
+	{
+		ComputeSortCenter( pRenderable, center );
+		m_RenderableCenterX[handle] = center.x;
+		m_RenderableCenterY[handle] = center.y;
+		m_RenderableCenterZ[handle] = center.z;
+		m_RenderableCenterValid[handle] = true;
+		return;
+	}
+
+	center.Init( m_RenderableCenterX[handle], m_RenderableCenterY[handle], m_RenderableCenterZ[handle] );
+}
+
+
+//-----------------------------------------------------------------------------
+// Stable LSD radix sort of 32-bit keys, 11 bits per pass. Passes where every key
+// shares the same digit are skipped. Returns the buffer holding the sorted indices.
+//-----------------------------------------------------------------------------
+static unsigned short *RadixSortDepthKeys( uint32 *pKeys, uint32 *pKeysTemp, unsigned short *pIndices, unsigned short *pIndicesTemp, int nCount )
+{
+	int pHistogram[2048];
+	for ( int nShift = 0; nShift < 32; nShift += 11 )
+	{
+		memset( pHistogram, 0, sizeof( pHistogram ) );
+		for ( int i = 0; i < nCount; ++i )
+		{
+			pHistogram[ ( pKeys[i] >> nShift ) & 0x7FF ]++;
+		}
+
+		if ( pHistogram[ ( pKeys[0] >> nShift ) & 0x7FF ] == nCount )
+			continue;
+
+		int nOffset = 0;
+		for ( int i = 0; i < 2048; ++i )
+		{
+			int nBucket = pHistogram[i];
+			pHistogram[i] = nOffset;
+			nOffset += nBucket;
+		}
+
+		for ( int i = 0; i < nCount; ++i )
+		{
+			int nDest = pHistogram[ ( pKeys[i] >> nShift ) & 0x7FF ]++;
+			pKeysTemp[nDest] = pKeys[i];
+			pIndicesTemp[nDest] = pIndices[i];
+		}
+
+		::V_swap( pKeys, pKeysTemp );
+		::V_swap( pIndices, pIndicesTemp );
+	}
+
+	return pIndices;
+}
+
+
 //-----------------------------------------------------------------------------
 // Sort entities in a back-to-front ordering
 //-----------------------------------------------------------------------------
@@ -1693,52 +1969,78 @@ void CClientLeafSystem::SortEntities( const Vector &vecRenderOrigin, const Vecto
 	if ( nEntities <= 1 )
 		return;
 
-	float dists[CClientRenderablesList::MAX_GROUP_ENTITIES];
-
-	// First get a distance for each entity.
+	// Gather the centers into SoA lanes
+	float *pCenterX = (float *)m_SortCenterX;
+	float *pCenterY = (float *)m_SortCenterY;
+	float *pCenterZ = (float *)m_SortCenterZ;
 	int i;
 	for( i=0; i < nEntities; i++ )
 	{
-		IClientRenderable *pRenderable = pEntities[i].m_pRenderable;
-
-		// Compute the center of the object (needed for translucent brush models)
 		Vector boxcenter;
-		Vector mins,maxs;
-		pRenderable->GetRenderBounds( mins, maxs );
-		VectorAdd( mins, maxs, boxcenter );
-		VectorMA( pRenderable->GetRenderOrigin(), 0.5f, boxcenter, boxcenter );
+		GetRenderableSortCenter( pEntities[i].m_RenderHandle, pEntities[i].m_pRenderable, boxcenter );
+		pCenterX[i] = boxcenter.x;
+		pCenterY[i] = boxcenter.y;
+		pCenterZ[i] = boxcenter.z;
+	}
+	for ( ; i & 3; i++ )
+	{
+		pCenterX[i] = pCenterY[i] = pCenterZ[i] = 0.0f;
+	}
 
-		// Compute distance...
-		Vector delta;
-		VectorSubtract( boxcenter, vecRenderOrigin, delta );
-		dists[i] = DotProduct( delta, vecRenderForward );
+	// Compute the depths four at a time and turn them into keys that order the
+	// same way as unsigned ints: negative depths get all bits flipped, positive
+	// ones just the sign bit.
+	fltx4 originX = ReplicateX4( vecRenderOrigin.x );
+	fltx4 originY = ReplicateX4( vecRenderOrigin.y );
+	fltx4 originZ = ReplicateX4( vecRenderOrigin.z );
+	fltx4 forwardX = ReplicateX4( vecRenderForward.x );
+	fltx4 forwardY = ReplicateX4( vecRenderForward.y );
+	fltx4 forwardZ = ReplicateX4( vecRenderForward.z );
+	fltx4 signMask = LoadAlignedSIMD( g_SIMD_signmask );
+	int nBlocks = ( nEntities + 3 ) >> 2;
+	for ( i = 0; i < nBlocks; ++i )
+	{
+		fltx4 dist = MulSIMD( SubSIMD( m_SortCenterX[i], originX ), forwardX );
+		dist = MaddSIMD( SubSIMD( m_SortCenterY[i], originY ), forwardY, dist );
+		dist = MaddSIMD( SubSIMD( m_SortCenterZ[i], originZ ), forwardZ, dist );
+
+		fltx4 flip = OrSIMD( CmpLtSIMD( dist, Four_Zeros ), signMask );
+		m_SortKeys[i] = XorSIMD( dist, flip );
 	}
 
-	// H-sort.
-	int stepSize = 4;
-	while( stepSize )
+	uint32 *pKeys = (uint32 *)m_SortKeys;
+	unsigned short *pSorted = m_SortIndices;
+	if ( nEntities < 32 )
 	{
-		int end = nEntities - stepSize;
-		for( i=0; i < end; i += stepSize )
+		// Insertion sort is cheaper than the radix histograms for the handful of
+		// translucent renderables a single leaf usually contains.
+		for ( i = 0; i < nEntities; ++i )
 		{
-			if( dists[i] > dists[i+stepSize] )
+			uint32 nKey = pKeys[i];
+			int j = i;
+			for ( ; j > 0 && pKeys[j - 1] > nKey; --j )
 			{
-				::V_swap( pEntities[i], pEntities[i+stepSize] );
-				::V_swap( dists[i], dists[i+stepSize] );
-
-				if( i == 0 )
-				{
-					i = -stepSize;
-				}
-				else
-				{
-					i -= stepSize << 1;
-				}
+				pKeys[j] = pKeys[j - 1];
+				m_SortIndices[j] = m_SortIndices[j - 1];
 			}
+			pKeys[j] = nKey;
+			m_SortIndices[j] = i;
+		}
+	}
+	else
+	{
+		for ( i = 0; i < nEntities; ++i )
+		{
+			m_SortIndices[i] = i;
 		}
+		pSorted = RadixSortDepthKeys( pKeys, m_SortKeysTemp, m_SortIndices, m_SortIndicesTemp, nEntities );
+	}
 
-		stepSize >>= 1;
+	for ( i = 0; i < nEntities; ++i )
+	{
+		m_SortEntries[i] = pEntities[ pSorted[i] ];
 	}
+	memcpy( pEntities, m_SortEntries, nEntities * sizeof( CClientRenderablesList::CEntry ) );
 }
 
 
@@ -81,6 +81,8 @@
 #include "toolframework_client.h"
 #include "bonetoworldarray.h"
 #include "cmodel.h"
+#include "checksum_crc.h"
+#include "c_baseanimatingoverlay.h"
 
 
 // memdbgon must be the last include file in a .cpp file!!!
@@ -99,7 +101,13 @@ ConVar r_flashlightdepthres( "r_flashlightdepthres", "512" );
 ConVar r_flashlightdepthres( "r_flashlightdepthres", "1024" );
 #endif
 
-ConVar r_threaded_client_shadow_manager( "r_threaded_client_shadow_manager", "0" );
+ConVar r_threaded_client_shadow_manager( "r_threaded_client_shadow_manager", "0", 0, "Project dirty shadows and set up shadow caster bones on the job pool" );
+static ConVar r_threaded_client_shadow_manager_min( "r_threaded_client_shadow_manager_min", "8", 0, "Minimum number of shadow projections in a frame before they are computed on the job pool" );
+static ConVar r_shadow_atlas_repartition( "r_shadow_atlas_repartition", "1", FCVAR_CHEAT, "Re-cut idle shadow atlas blocks into the fragment size that is running out" );
+static ConVar r_shadow_atlas_repartition_age( "r_shadow_atlas_repartition_age", "8", FCVAR_CHEAT, "Frames a shadow atlas block must go unused before it can be re-cut" );
+static ConVar r_shadow_rtt_change_tolerance( "r_shadow_rtt_change_tolerance", "0.25", FCVAR_CHEAT, "How far (in world units) a bone of an animating caster must move relative to its origin before its render-to-texture shadow is redrawn. 0 redraws every frame." );
+static ConVar r_shadow_rtt_max_stale_frames( "r_shadow_rtt_max_stale_frames", "10", FCVAR_CHEAT, "Maximum number of frames an animating caster's render-to-texture shadow can go without being redrawn" );
+static ConVar r_shadow_rtt_stats( "r_shadow_rtt_stats", "0", FCVAR_CHEAT, "Display per-frame render-to-texture shadow redraw counts and time" );
 
 #ifdef _WIN32
 #pragma warning( disable: 4701 )
@@ -111,8 +119,11 @@ void ToolFramework_RecordMaterialParams( IMaterial *pMaterial );
 
 //-----------------------------------------------------------------------------
 // A texture allocator used to batch textures together
-// At the moment, the implementation simply allocates blocks of max 256x256
-// and each block stores an array of uniformly-sized textures
+// The page is divided into blocks of max 256x256 and each block stores an array
+// of uniformly-sized textures. Blocks start out with a fixed size distribution
+// but are re-cut on demand: when every fragment of the desired size was used
+// this frame, the least recently used idle block is evicted and re-divided
+// into fragments of that size.
 //-----------------------------------------------------------------------------
 typedef unsigned short TextureHandle_t;
 enum
@@ -155,6 +166,9 @@ public:
 
 	void			DebugPrintCache( void );
 
+	// Prints (and resets) redraw counters and atlas occupancy
+	void			PrintStats( void );
+
 private:
 	typedef unsigned short FragmentHandle_t;
 
@@ -195,6 +209,18 @@ private:
 	struct BlockInfo_t
 	{
 		unsigned short	m_FragmentPower;
+
+		// Last frame any fragment in this block was used
+		unsigned int	m_FrameUsed;
+	};
+
+	struct Stats_t
+	{
+		int m_nRedraws;				// UseTexture handed out a new fragment
+		int m_nRedrawsAvoided;		// UseTexture kept an existing fragment
+		int m_nLowerResFallbacks;	// Desired size was exhausted, used a smaller one
+		int m_nRepartitions;		// Blocks re-cut into a different fragment size
+		int m_nFrames;
 	};
 
 	struct Cache_t
@@ -205,6 +231,9 @@ private:
 	// Adds a block worth of fragments to the LRU
 	void AddBlockToLRU( int block );
 
+	// Evicts the least recently used idle block and re-cuts it into fragments of the given power
+	bool RepartitionBlock( int power );
+
 	// Unlink fragment from cache
 	void UnlinkFragmentFromCache( Cache_t& cache, FragmentHandle_t fragment );
 
@@ -229,6 +258,7 @@ private:
 	Cache_t		m_Cache[MAX_TEXTURE_POWER+1]; 
 	BlockInfo_t	m_Blocks[BLOCK_COUNT];
 	unsigned int m_CurrentFrame;
+	Stats_t		m_Stats;
 };
 
 //-----------------------------------------------------------------------------
@@ -313,6 +343,7 @@ void CTextureAllocator::Reset()
 	}
 
 	m_CurrentFrame = 0;
+	memset( &m_Stats, 0, sizeof(m_Stats) );
 }
 
 void CTextureAllocator::DeallocateAllTextures()
@@ -363,6 +394,8 @@ void CTextureAllocator::AddBlockToLRU( int block )
 	int power = m_Blocks[block].m_FragmentPower;
  	int size = (1 << power);
 
+	m_Blocks[block].m_FrameUsed = 0xFFFFFFFF;
+
 	// Compute the number of fragments in this block
 	int fragmentCount = MAX_TEXTURE_SIZE / size;
 	fragmentCount *= fragmentCount;
@@ -381,6 +414,54 @@ void CTextureAllocator::AddBlockToLRU( int block )
 }
 
 
+//-----------------------------------------------------------------------------
+// Evicts the least recently used idle block and re-cuts it into fragments
+// of the given power. Returns false if no block has been idle long enough.
+//-----------------------------------------------------------------------------
+bool CTextureAllocator::RepartitionBlock( int power )
+{
+	unsigned int nMinAge = MAX( r_shadow_atlas_repartition_age.GetInt(), 1 );
+
+	// Blocks that have never been used beat everything, otherwise take the oldest
+	int nBestBlock = -1;
+	unsigned int nBestAge = 0;
+	for ( int i = 0; i < BLOCK_COUNT; ++i )
+	{
+		const BlockInfo_t &block = m_Blocks[i];
+		if ( block.m_FragmentPower == power )
+			continue;
+
+		unsigned int nAge = ( block.m_FrameUsed == 0xFFFFFFFF ) ? 0xFFFFFFFF : m_CurrentFrame - block.m_FrameUsed;
+		if ( nAge < nMinAge || nAge <= nBestAge )
+			continue;
+
+		nBestBlock = i;
+		nBestAge = nAge;
+	}
+
+	if ( nBestBlock < 0 )
+		return false;
+
+	// Throw away the old fragments; any texture living there will get a new one next time it's used
+	Cache_t &oldCache = m_Cache[ m_Blocks[nBestBlock].m_FragmentPower ];
+	int nNumFragments = m_Fragments.TotalCount();
+	for ( int f = 0; f < nNumFragments; ++f )
+	{
+		if ( !m_Fragments.IsValidIndex( f ) || m_Fragments[f].m_Block != nBestBlock )
+			continue;
+
+		DisconnectTextureFromFragment( f );
+		UnlinkFragmentFromCache( oldCache, f );
+		m_Fragments.Free( f );
+	}
+
+	m_Blocks[nBestBlock].m_FragmentPower = power;
+	AddBlockToLRU( nBestBlock );
+	++m_Stats.m_nRepartitions;
+	return true;
+}
+
+
 //-----------------------------------------------------------------------------
 // Unlink fragment from cache
 //-----------------------------------------------------------------------------
@@ -402,6 +483,7 @@ void CTextureAllocator::MarkUsed( FragmentHandle_t fragment )
 	Cache_t& cache = m_Cache[power];
 	m_Fragments.LinkToTail( cache.m_List, fragment );
 	m_Fragments[fragment].m_FrameUsed = m_CurrentFrame;
+	m_Blocks[block].m_FrameUsed = m_CurrentFrame;
 }
 
 
@@ -540,10 +622,22 @@ bool CTextureAllocator::UseTexture( TextureHandle_t h, bool bWillRedraw, float f
 		{
 			// Move to the back of the LRU
 			MarkUsed( currentFragment );
+			++m_Stats.m_nRedrawsAvoided;
 			return false;
 		}
 	}
 
+	// If every fragment of the desired size is in use this frame, try to make more
+	// of them out of an idle block before falling back to a lower resolution
+	if ( r_shadow_atlas_repartition.GetBool() )
+	{
+		FragmentHandle_t head = m_Fragments.Head( m_Cache[nDesiredPower].m_List );
+		if ( (head == m_Fragments.InvalidIndex()) || (m_Fragments[head].m_FrameUsed == m_CurrentFrame) )
+		{
+			RepartitionBlock( nDesiredPower );
+		}
+	}
+
 //	Warning( "\n\nUseTexture B\n" );
 //	DebugPrintCache();
 
@@ -574,7 +668,14 @@ bool CTextureAllocator::UseTexture( TextureHandle_t h, bool bWillRedraw, float f
 //	Warning( "\n\nUseTexture C\n" );
 //	DebugPrintCache();
 
+	if ( power < nDesiredPower )
+	{
+		++m_Stats.m_nLowerResFallbacks;
+	}
+
 	// Ok, lets see if we're better off than we were...
+	// NOTE: Repartitioning may have taken away the current fragment
+	currentFragment = info.m_Fragment;
 	if (currentFragment != INVALID_FRAGMENT_HANDLE)
 	{
 		if (power <= nCurrentPower)
@@ -582,6 +683,7 @@ bool CTextureAllocator::UseTexture( TextureHandle_t h, bool bWillRedraw, float f
 			// Oops... we're not. Let's leave well enough alone
 			// Move to the back of the LRU
 			MarkUsed( currentFragment );
+			++m_Stats.m_nRedrawsAvoided;
 			return false;
 		}
 		else
@@ -607,6 +709,7 @@ bool CTextureAllocator::UseTexture( TextureHandle_t h, bool bWillRedraw, float f
 	MarkUsed( f );
 
 	// Indicate we need a redraw
+	++m_Stats.m_nRedraws;
 	return true;
 }
 
@@ -628,6 +731,62 @@ void CTextureAllocator::AdvanceFrame()
 	// Be sure that this is called as infrequently as possible (i.e. once per frame,
 	// NOT once per view) to prevent cache thrash when rendering multiple views in a single frame
 	m_CurrentFrame++;
+	m_Stats.m_nFrames++;
+}
+
+
+//-----------------------------------------------------------------------------
+// Prints (and resets) redraw counters and atlas occupancy
+//-----------------------------------------------------------------------------
+void CTextureAllocator::PrintStats( void )
+{
+	int nBlocksAtPower[MAX_TEXTURE_POWER+1];
+	int nUsedAtPower[MAX_TEXTURE_POWER+1];
+	memset( nBlocksAtPower, 0, sizeof(nBlocksAtPower) );
+	memset( nUsedAtPower, 0, sizeof(nUsedAtPower) );
+
+	for ( int i = 0; i < BLOCK_COUNT; ++i )
+	{
+		nBlocksAtPower[ m_Blocks[i].m_FragmentPower ]++;
+	}
+
+	// Occupancy counts texels owned by a texture; "this frame" counts ones actually drawn with
+	int nOccupiedTexels = 0;
+	int nLiveTexels = 0;
+	int nNumFragments = m_Fragments.TotalCount();
+	for ( int f = 0; f < nNumFragments; ++f )
+	{
+		if ( !m_Fragments.IsValidIndex( f ) || m_Fragments[f].m_Texture == INVALID_TEXTURE_HANDLE )
+			continue;
+
+		int power = GetFragmentPower( f );
+		int nTexels = 1 << ( power * 2 );
+		nOccupiedTexels += nTexels;
+		if ( m_Fragments[f].m_FrameUsed == m_CurrentFrame )
+		{
+			nLiveTexels += nTexels;
+			nUsedAtPower[power]++;
+		}
+	}
+
+	float flPageTexels = (float)( TEXTURE_PAGE_SIZE * TEXTURE_PAGE_SIZE );
+	int nFrames = MAX( m_Stats.m_nFrames, 1 );
+	Msg( "Shadow atlas over %d frames:\n", m_Stats.m_nFrames );
+	Msg( "  redraws:          %d (%.2f/frame)\n", m_Stats.m_nRedraws, (float)m_Stats.m_nRedraws / nFrames );
+	Msg( "  redraws avoided:  %d (%.2f/frame)\n", m_Stats.m_nRedrawsAvoided, (float)m_Stats.m_nRedrawsAvoided / nFrames );
+	Msg( "  lower res used:   %d\n", m_Stats.m_nLowerResFallbacks );
+	Msg( "  blocks re-cut:    %d\n", m_Stats.m_nRepartitions );
+	Msg( "  occupancy:        %.1f%% allocated, %.1f%% used this frame\n", 100.0f * nOccupiedTexels / flPageTexels, 100.0f * nLiveTexels / flPageTexels );
+	for ( int i = MIN_TEXTURE_POWER; i <= MAX_TEXTURE_POWER; ++i )
+	{
+		if ( nBlocksAtPower[i] )
+		{
+			int nPerBlock = ( MAX_TEXTURE_SIZE >> i ) * ( MAX_TEXTURE_SIZE >> i );
+			Msg( "  %3dx%-3d: %2d blocks, %4d/%4d fragments used this frame\n", 1 << i, 1 << i, nBlocksAtPower[i], nUsedAtPower[i], nBlocksAtPower[i] * nPerBlock );
+		}
+	}
+
+	memset( &m_Stats, 0, sizeof(m_Stats) );
 }
 
 
@@ -685,6 +844,22 @@ static ConVar r_shadows( "r_shadows", "1" ); // hook into engine's cvars..
 static ConVar r_shadowmaxrendered("r_shadowmaxrendered", "32");
 static ConVar r_shadows_gamecontrol( "r_shadows_gamecontrol", "-1", FCVAR_CHEAT );	 // hook into engine's cvars..
 
+//-----------------------------------------------------------------------------
+// Adds a shadow to all leaves along a ray
+//-----------------------------------------------------------------------------
+class CShadowLeafEnum : public ISpatialLeafEnumerator
+{
+public:
+	bool EnumerateLeaf( int leaf, int context )
+	{
+		m_LeafList.AddToTail( leaf );
+		return true;
+	}
+
+	CUtlVectorFixedGrowable< int, 512 > m_LeafList;
+};
+
+
 //-----------------------------------------------------------------------------
 // The class responsible for dealing with shadows on the client side
 // Oh, and let's take a moment and notice how happy Robin and John must be 
@@ -719,6 +894,9 @@ public:
 	virtual ClientShadowHandle_t CreateShadow( ClientEntityHandle_t entity, int flags );
 	virtual void DestroyShadow( ClientShadowHandle_t handle );
 
+	// Prints render to texture shadow atlas statistics
+	void	PrintShadowAtlasStats() { m_ShadowAllocator.PrintStats(); }
+
 	// Create flashlight (projected texture light source)
 	virtual ClientShadowHandle_t CreateFlashlight( const FlashlightState_t &lightState );
 	virtual void UpdateFlashlightState( ClientShadowHandle_t shadowHandle, const FlashlightState_t &lightState );
@@ -817,6 +995,13 @@ private:
 		CTextureReference		m_ShadowDepthTexture;
 		int						m_nRenderFrame;
 		EHANDLE					m_hTargetEntity;
+
+		// State of an animating caster at the time its texture was last drawn
+		int						m_nLastRedrawFrame;
+		Vector					m_LastShadowDir;
+		CUtlVector< Vector >	m_LastBonePositions;	// relative to the render origin
+		CRC32_t					m_LastPoseSignature;
+		bool					m_bLastPoseSignatureValid;
 	};
 
 private:
@@ -866,6 +1051,62 @@ private:
 	// Build a projected-texture flashlight
 	void BuildFlashlight( ClientShadowHandle_t handle );
 
+	// The math and leaf enumeration behind a shadow projection. Everything read off
+	// the renderable is gathered on the main thread, so computing a projection never
+	// calls into entity code and can run on the job pool.
+	enum ShadowProjectionType_t
+	{
+		SHADOW_PROJECTION_ORTHO = 0,
+		SHADOW_PROJECTION_RENDER_TO_TEXTURE,
+		SHADOW_PROJECTION_FLASHLIGHT,
+	};
+
+	struct ShadowProjection_t
+	{
+		ClientShadowHandle_t	m_Handle;
+		IClientRenderable		*m_pRenderable;
+		ShadowProjectionType_t	m_nType;
+
+		// Inputs
+		Vector					m_vecBasis[3];
+		Vector					m_vecShadowDir;
+		Vector					m_vecRenderOrigin;
+		Vector					m_vecMins;
+		Vector					m_vecMaxs;
+		float					m_flCastDistance;
+
+		// Results
+		Vector					m_vecLocalShadowDir;
+		Vector					m_vecWorldOrigin;
+		VMatrix					m_WorldToShadow;
+		VMatrix					m_WorldToTexture;
+		Vector2D				m_Size;
+		float					m_flMaxHeight;
+		float					m_flFalloffStart;
+		int						m_nFirstLeaf;
+		int						m_nLeafCount;
+	};
+
+	enum
+	{
+		MAX_PROJECTION_BATCHES = 32,
+	};
+
+	struct ShadowProjectionBatch_t
+	{
+		int				m_nFirst;
+		int				m_nCount;
+		CShadowLeafEnum	m_Leaves;
+	};
+
+	void GatherShadowProjection( ShadowProjection_t &projection, IClientRenderable* pRenderable, 
+		ClientShadowHandle_t handle, const Vector& mins, const Vector& maxs, ShadowProjectionType_t nType );
+	void ComputeShadowProjection( ShadowProjection_t &projection, CShadowLeafEnum *pLeaves );
+	void ApplyShadowProjection( const ShadowProjection_t &projection, const int *pLeafList );
+	void ApplyFlashlight( ClientShadowHandle_t handle, int nCount, const int *pLeafList );
+	void ComputeProjectionBatch( ShadowProjectionBatch_t *&pBatch );
+	void ProjectDeferredShadows();
+
 	// Does all the lovely stuff we need to do to have render-to-texture shadows
 	void SetupRenderToTextureShadow( ClientShadowHandle_t h );
 	void CleanUpRenderToTextureShadow( ClientShadowHandle_t h );
@@ -894,6 +1135,12 @@ private:
 	// Draws all children shadows into our own
 	bool DrawShadowHierarchy( IClientRenderable *pRenderable, const ClientShadow_t &shadow, bool bChild = false );
 
+	// Animating casters only redraw their texture once the change would be visible
+	bool ShouldCheckAnimatingShadow( const ClientShadow_t &shadow ) const;
+	void CheckAnimatingShadowForChanges( ClientShadowHandle_t handle, IClientRenderable *pRenderable );
+	void SnapshotAnimatingShadow( ClientShadowHandle_t handle, IClientRenderable *pRenderable );
+	int ComputeBonePositions( IClientRenderable *pRenderable, Vector *vecPositions );
+
 	// Setup stage for threading
 	bool BuildSetupListForRenderToTextureShadow( unsigned short clientShadowHandle, float flArea );
 	bool BuildSetupShadowHierarchy( IClientRenderable *pRenderable, const ClientShadow_t &shadow, bool bChild = false );
@@ -958,6 +1205,7 @@ private:
 	bool m_bRenderTargetNeedsClear;
 	bool m_bUpdatingDirtyShadows;
 	bool m_bThreaded;
+	bool m_bDeferProjections;
 	float m_flShadowCastDist;
 	float m_flMinShadowArea;
 	CUtlRBTree< ClientShadowHandle_t, unsigned short >	m_DirtyShadows;
@@ -972,6 +1220,15 @@ private:
 	CUtlVector< bool > m_DepthTextureCacheLocks;
 	int	m_nMaxDepthTextureShadows;
 
+	// Shadow projections queued while updating dirty shadows, computed on the job pool
+	CUtlVector< ShadowProjection_t > m_DeferredProjections;
+	ShadowProjectionBatch_t m_ProjectionBatches[MAX_PROJECTION_BATCHES];
+
+	// Render-to-texture redraw counters for the current frame
+	int m_nRTTShadowsRedrawn;
+	int m_nRTTShadowsReused;
+	float m_flRTTRedrawTime;
+
 	friend class CVisibleShadowList;
 	friend class CVisibleShadowFrustumList;
 };
@@ -1172,6 +1429,10 @@ CClientShadowMgr::CClientShadowMgr() :
 {
 	m_nDepthTextureResolution = r_flashlightdepthres.GetInt();
 	m_bThreaded = false;
+	m_bDeferProjections = false;
+	m_nRTTShadowsRedrawn = 0;
+	m_nRTTShadowsReused = 0;
+	m_flRTTRedrawTime = 0.0f;
 }
 
 
@@ -1197,6 +1458,11 @@ CON_COMMAND_F( r_shadowdir, "Set shadow direction", FCVAR_CHEAT )
 	}
 }
 
+CON_COMMAND( r_shadow_stats, "Prints render to texture shadow redraw counts and atlas occupancy since the last call" )
+{
+	s_ClientShadowMgr.PrintShadowAtlasStats();
+}
+
 CON_COMMAND_F( r_shadowangles, "Set shadow angles", FCVAR_CHEAT )
 {
 	Vector dir;
@@ -1817,6 +2083,10 @@ ClientShadowHandle_t CClientShadowMgr::CreateProjectedTexture( ClientEntityHandl
 	shadow.m_nRenderFrame = -1;
 	shadow.m_LastOrigin.Init( FLT_MAX, FLT_MAX, FLT_MAX );
 	shadow.m_LastAngles.Init( FLT_MAX, FLT_MAX, FLT_MAX );
+	shadow.m_nLastRedrawFrame = -1;
+	shadow.m_LastShadowDir.Init( 0, 0, 0 );
+	shadow.m_LastBonePositions.RemoveAll();
+	shadow.m_bLastPoseSignatureValid = false;
 	Assert( ( ( shadow.m_Flags & SHADOW_FLAGS_FLASHLIGHT ) == 0 ) != 
 			( ( shadow.m_Flags & SHADOW_FLAGS_SHADOW ) == 0 ) );
 
@@ -2238,22 +2508,6 @@ inline ShadowType_t CClientShadowMgr::GetActualShadowCastType( IClientRenderable
 }
 
 
-//-----------------------------------------------------------------------------
-// Adds a shadow to all leaves along a ray
-//-----------------------------------------------------------------------------
-class CShadowLeafEnum : public ISpatialLeafEnumerator
-{
-public:
-	bool EnumerateLeaf( int leaf, int context )
-	{
-		m_LeafList.AddToTail( leaf );
-		return true;
-	}
-
-	CUtlVectorFixedGrowable< int, 512 > m_LeafList;
-};
-
-
 //-----------------------------------------------------------------------------
 // Builds a list of leaves inside the shadow volume
 //-----------------------------------------------------------------------------
@@ -2276,107 +2530,254 @@ static void BuildShadowLeafList( CShadowLeafEnum *pEnum, const Vector& origin,
 
 
 //-----------------------------------------------------------------------------
-// Builds a simple blobby shadow
+// Builds a list of leaves inside the flashlight volume
 //-----------------------------------------------------------------------------
-void CClientShadowMgr::BuildOrthoShadow( IClientRenderable* pRenderable, 
-		ClientShadowHandle_t handle, const Vector& mins, const Vector& maxs)
+static void BuildFlashlightLeafList( CShadowLeafEnum *pEnum, const VMatrix &worldToShadow )
+{
+	// Use an AABB around the frustum to enumerate leaves.
+	Vector mins, maxs;
+	CalculateAABBFromProjectionMatrix( worldToShadow, &mins, &maxs );
+	ISpatialQuery* pQuery = engine->GetBSPTreeQuery();
+	pQuery->EnumerateLeavesInBox( mins, maxs, pEnum, 0 );
+}
+
+
+//-----------------------------------------------------------------------------
+// Reads everything a shadow projection needs off the renderable
+//-----------------------------------------------------------------------------
+void CClientShadowMgr::GatherShadowProjection( ShadowProjection_t &projection, IClientRenderable* pRenderable, 
+	ClientShadowHandle_t handle, const Vector& mins, const Vector& maxs, ShadowProjectionType_t nType )
 {
+	projection.m_Handle = handle;
+	projection.m_pRenderable = pRenderable;
+	projection.m_nType = nType;
+	projection.m_nFirstLeaf = 0;
+	projection.m_nLeafCount = 0;
+
+	if ( nType == SHADOW_PROJECTION_FLASHLIGHT )
+	{
+		// Flashlight matrices are built when the flashlight state is set
+		projection.m_WorldToShadow = m_Shadows[handle].m_WorldToShadow;
+		return;
+	}
+
 	// Get the object's basis
-	Vector vec[3];
-	AngleVectors( pRenderable->GetRenderAngles(), &vec[0], &vec[1], &vec[2] );
-	vec[1] *= -1.0f;
+	AngleVectors( pRenderable->GetRenderAngles(), &projection.m_vecBasis[0], &projection.m_vecBasis[1], &projection.m_vecBasis[2] );
+	projection.m_vecBasis[1] *= -1.0f;
+
+	projection.m_vecShadowDir = GetShadowDirection( pRenderable );
+	projection.m_vecRenderOrigin = pRenderable->GetRenderOrigin();
+	projection.m_vecMins = mins;
+	projection.m_vecMaxs = maxs;
+
+	// The entity may be overriding our shadow cast distance
+	projection.m_flCastDistance = GetShadowDistance( pRenderable );
+}
 
-	Vector vecShadowDir = GetShadowDirection( pRenderable );
+
+//-----------------------------------------------------------------------------
+// Computes the shadow matrices and the leaves the shadow touches.
+// Safe to call from a job; only touches the projection and the leaf list.
+//-----------------------------------------------------------------------------
+void CClientShadowMgr::ComputeShadowProjection( ShadowProjection_t &projection, CShadowLeafEnum *pLeaves )
+{
+	projection.m_nFirstLeaf = pLeaves->m_LeafList.Count();
+
+	if ( projection.m_nType == SHADOW_PROJECTION_FLASHLIGHT )
+	{
+		BuildFlashlightLeafList( pLeaves, projection.m_WorldToShadow );
+		projection.m_nLeafCount = pLeaves->m_LeafList.Count() - projection.m_nFirstLeaf;
+		return;
+	}
+
+	const Vector *vec = projection.m_vecBasis;
+	const Vector &vecShadowDir = projection.m_vecShadowDir;
+	const Vector &mins = projection.m_vecMins;
+	const Vector &maxs = projection.m_vecMaxs;
 
 	// Project the shadow casting direction into the space of the object
-	Vector localShadowDir;
+	Vector &localShadowDir = projection.m_vecLocalShadowDir;
 	localShadowDir[0] = DotProduct( vec[0], vecShadowDir );
 	localShadowDir[1] = DotProduct( vec[1], vecShadowDir );
 	localShadowDir[2] = DotProduct( vec[2], vecShadowDir );
 
-	// Figure out which vector has the largest component perpendicular
-	// to the shadow handle...
-	// Sort by how perpendicular it is
-	int vecIdx[3];
-	SortAbsVectorComponents( localShadowDir, vecIdx );
-
-	// Here's our shadow basis vectors; namely the ones that are
-	// most perpendicular to the shadow casting direction
-	Vector xvec = vec[vecIdx[0]];
-	Vector yvec = vec[vecIdx[1]];
-
-	// Project them into a plane perpendicular to the shadow direction
-	xvec -= vecShadowDir * DotProduct( vecShadowDir, xvec );
-	yvec -= vecShadowDir * DotProduct( vecShadowDir, yvec );
-	VectorNormalize( xvec );
-	VectorNormalize( yvec );
-
 	// Compute the box size
 	Vector boxSize;
 	VectorSubtract( maxs, mins, boxSize );
 
-	// We project the two longest sides into the vectors perpendicular
-	// to the projection direction, then add in the projection of the perp direction
-	Vector2D size( boxSize[vecIdx[0]], boxSize[vecIdx[1]] );
-	size.x *= fabs( DotProduct( vec[vecIdx[0]], xvec ) );
-	size.y *= fabs( DotProduct( vec[vecIdx[1]], yvec ) );
+	Vector xvec, yvec;
+	Vector2D &size = projection.m_Size;
+	Vector org;
+	float falloffStart;
 
-	// Add the third component into x and y
-	size.x += boxSize[vecIdx[2]] * fabs( DotProduct( vec[vecIdx[2]], xvec ) );
-	size.y += boxSize[vecIdx[2]] * fabs( DotProduct( vec[vecIdx[2]], yvec ) );
+	if ( projection.m_nType == SHADOW_PROJECTION_ORTHO )
+	{
+		// Figure out which vector has the largest component perpendicular
+		// to the shadow handle...
+		// Sort by how perpendicular it is
+		int vecIdx[3];
+		SortAbsVectorComponents( localShadowDir, vecIdx );
 
-	// Bloat a bit, since the shadow wants to extend outside the model a bit
-	size.x += 10.0f;
-	size.y += 10.0f;
+		// Here's our shadow basis vectors; namely the ones that are
+		// most perpendicular to the shadow casting direction
+		xvec = vec[vecIdx[0]];
+		yvec = vec[vecIdx[1]];
 
-	// Clamp the minimum size
-	Vector2DMax( size, Vector2D(10.0f, 10.0f), size );
+		// Project them into a plane perpendicular to the shadow direction
+		xvec -= vecShadowDir * DotProduct( vecShadowDir, xvec );
+		yvec -= vecShadowDir * DotProduct( vecShadowDir, yvec );
+		VectorNormalize( xvec );
+		VectorNormalize( yvec );
 
-	// Place the origin at the point with min dot product with shadow dir
-	Vector org;
-	float falloffStart = ComputeLocalShadowOrigin( pRenderable, mins, maxs, localShadowDir, 2.0f, org );
+		// We project the two longest sides into the vectors perpendicular
+		// to the projection direction, then add in the projection of the perp direction
+		size.Init( boxSize[vecIdx[0]], boxSize[vecIdx[1]] );
+		size.x *= fabs( DotProduct( vec[vecIdx[0]], xvec ) );
+		size.y *= fabs( DotProduct( vec[vecIdx[1]], yvec ) );
+
+		// Add the third component into x and y
+		size.x += boxSize[vecIdx[2]] * fabs( DotProduct( vec[vecIdx[2]], xvec ) );
+		size.y += boxSize[vecIdx[2]] * fabs( DotProduct( vec[vecIdx[2]], yvec ) );
+
+		// Bloat a bit, since the shadow wants to extend outside the model a bit
+		size.x += 10.0f;
+		size.y += 10.0f;
+
+		// Clamp the minimum size
+		Vector2DMax( size, Vector2D(10.0f, 10.0f), size );
+
+		// Place the origin at the point with min dot product with shadow dir
+		falloffStart = ComputeLocalShadowOrigin( projection.m_pRenderable, mins, maxs, localShadowDir, 2.0f, org );
+	}
+	else
+	{
+		float fProjMax = 0.0f;
+		for( int i = 0; i != 3; ++i )
+		{
+			Vector test = vec[i] - ( vecShadowDir * DotProduct( vecShadowDir, vec[i] ) );
+			test *= boxSize[i]; //doing after the projection to simplify projection math
+			float fLengthSqr = test.LengthSqr();
+			if( fLengthSqr > fProjMax )
+			{
+				fProjMax = fLengthSqr;
+				yvec = test;
+			}
+		}		
+
+		VectorNormalize( yvec );
+
+		// Compute the x vector
+		CrossProduct( yvec, vecShadowDir, xvec );
+
+		// We project the two longest sides into the vectors perpendicular
+		// to the projection direction, then add in the projection of the perp direction
+		size.x = boxSize.x * fabs( DotProduct( vec[0], xvec ) ) + 
+			boxSize.y * fabs( DotProduct( vec[1], xvec ) ) + 
+			boxSize.z * fabs( DotProduct( vec[2], xvec ) );
+		size.y = boxSize.x * fabs( DotProduct( vec[0], yvec ) ) + 
+			boxSize.y * fabs( DotProduct( vec[1], yvec ) ) + 
+			boxSize.z * fabs( DotProduct( vec[2], yvec ) );
+
+		size.x += 2.0f * TEXEL_SIZE_PER_CASTER_SIZE;
+		size.y += 2.0f * TEXEL_SIZE_PER_CASTER_SIZE;
+
+		// Place the origin at the point with min dot product with shadow dir
+		falloffStart = ComputeLocalShadowOrigin( projection.m_pRenderable, mins, maxs, localShadowDir, 1.0f, org );
+	}
 
 	// Transform the local origin into world coordinates
-	Vector worldOrigin = pRenderable->GetRenderOrigin( );
+	Vector &worldOrigin = projection.m_vecWorldOrigin;
+	worldOrigin = projection.m_vecRenderOrigin;
 	VectorMA( worldOrigin, org.x, vec[0], worldOrigin );
 	VectorMA( worldOrigin, org.y, vec[1], worldOrigin );
 	VectorMA( worldOrigin, org.z, vec[2], worldOrigin );
 
-	// FUNKY: A trick to reduce annoying texelization artifacts!?
-	float dx = 1.0f / TEXEL_SIZE_PER_CASTER_SIZE;
-	worldOrigin.x = (int)(worldOrigin.x / dx) * dx;
-	worldOrigin.y = (int)(worldOrigin.y / dx) * dx;
-	worldOrigin.z = (int)(worldOrigin.z / dx) * dx;
-
-	// NOTE: We gotta use the general matrix because xvec and yvec aren't perp
-	VMatrix matWorldToShadow, matWorldToTexture;
-	BuildGeneralWorldToShadowMatrix( m_Shadows[handle].m_WorldToShadow, worldOrigin, vecShadowDir, xvec, yvec );
-	BuildWorldToTextureMatrix( m_Shadows[handle].m_WorldToShadow, size, matWorldToTexture );
-	Vector2DCopy( size, m_Shadows[handle].m_WorldSize );
-	
+	if ( projection.m_nType == SHADOW_PROJECTION_ORTHO )
+	{
+		// FUNKY: A trick to reduce annoying texelization artifacts!?
+		float dx = 1.0f / TEXEL_SIZE_PER_CASTER_SIZE;
+		worldOrigin.x = (int)(worldOrigin.x / dx) * dx;
+		worldOrigin.y = (int)(worldOrigin.y / dx) * dx;
+		worldOrigin.z = (int)(worldOrigin.z / dx) * dx;
+
+		// NOTE: We gotta use the general matrix because xvec and yvec aren't perp
+		BuildGeneralWorldToShadowMatrix( projection.m_WorldToShadow, worldOrigin, vecShadowDir, xvec, yvec );
+	}
+	else
+	{
+		BuildOrthoWorldToShadowMatrix( projection.m_WorldToShadow, worldOrigin, vecShadowDir, xvec, yvec );
+	}
+	BuildWorldToTextureMatrix( projection.m_WorldToShadow, size, projection.m_WorldToTexture );
+
 	// Compute the falloff attenuation
 	// Area computation isn't exact since xvec is not perp to yvec, but close enough
 //	float shadowArea = size.x * size.y;	
+	projection.m_flFalloffStart = falloffStart;
+	projection.m_flMaxHeight = projection.m_flCastDistance + falloffStart; //3.0f * sqrt( shadowArea );
 
-	// The entity may be overriding our shadow cast distance
-	float flShadowCastDistance = GetShadowDistance( pRenderable );
-	float maxHeight = flShadowCastDistance + falloffStart; //3.0f * sqrt( shadowArea );
+	BuildShadowLeafList( pLeaves, worldOrigin, vecShadowDir, size, projection.m_flMaxHeight );
+	projection.m_nLeafCount = pLeaves->m_LeafList.Count() - projection.m_nFirstLeaf;
+}
 
-	CShadowLeafEnum leafList;
-	BuildShadowLeafList( &leafList, worldOrigin, vecShadowDir, size, maxHeight );
-	int nCount = leafList.m_LeafList.Count();
-	const int *pLeafList = leafList.m_LeafList.Base();
 
-	shadowmgr->ProjectShadow( m_Shadows[handle].m_ShadowHandle, worldOrigin,
-		vecShadowDir, matWorldToTexture, size, nCount, pLeafList, maxHeight, falloffStart, MAX_FALLOFF_AMOUNT, pRenderable->GetRenderOrigin() );
+//-----------------------------------------------------------------------------
+// Hands a computed projection to the engine and the client leaf system
+//-----------------------------------------------------------------------------
+void CClientShadowMgr::ApplyShadowProjection( const ShadowProjection_t &projection, const int *pLeafList )
+{
+	ClientShadowHandle_t handle = projection.m_Handle;
+	int nCount = projection.m_nLeafCount;
+
+	if ( projection.m_nType == SHADOW_PROJECTION_FLASHLIGHT )
+	{
+		ApplyFlashlight( handle, nCount, pLeafList );
+		return;
+	}
+
+	ClientShadow_t &shadow = m_Shadows[handle];
+	shadow.m_WorldToShadow = projection.m_WorldToShadow;
+	Vector2DCopy( projection.m_Size, shadow.m_WorldSize );
+
+	shadowmgr->ProjectShadow( shadow.m_ShadowHandle, projection.m_vecWorldOrigin, projection.m_vecShadowDir, 
+		projection.m_WorldToTexture, projection.m_Size, nCount, pLeafList, projection.m_flMaxHeight, 
+		projection.m_flFalloffStart, MAX_FALLOFF_AMOUNT, projection.m_vecRenderOrigin );
 
 	// Compute extra clip planes to prevent poke-thru
+	if ( projection.m_nType == SHADOW_PROJECTION_RENDER_TO_TEXTURE )
+	{
+		ComputeExtraClipPlanes( projection.m_pRenderable, handle, projection.m_vecBasis, 
+			projection.m_vecMins, projection.m_vecMaxs, projection.m_vecLocalShadowDir );
+	}
 // FIXME!!!!!!!!!!!!!!  Removing this for now since it seems to mess up the blobby shadows.
-//	ComputeExtraClipPlanes( pEnt, handle, vec, mins, maxs, localShadowDir );
+//	else
+//	{
+//		ComputeExtraClipPlanes( pEnt, handle, vec, mins, maxs, localShadowDir );
+//	}
 
 	// Add the shadow to the client leaf system so it correctly marks 
 	// leafs as being affected by a particular shadow
-	ClientLeafSystem()->ProjectShadow( m_Shadows[handle].m_ClientLeafShadowHandle, nCount, pLeafList );
+	ClientLeafSystem()->ProjectShadow( shadow.m_ClientLeafShadowHandle, nCount, pLeafList );
+}
+
+
+//-----------------------------------------------------------------------------
+// Builds a simple blobby shadow
+//-----------------------------------------------------------------------------
+void CClientShadowMgr::BuildOrthoShadow( IClientRenderable* pRenderable, 
+		ClientShadowHandle_t handle, const Vector& mins, const Vector& maxs)
+{
+	if ( m_bDeferProjections )
+	{
+		GatherShadowProjection( m_DeferredProjections[ m_DeferredProjections.AddToTail() ], pRenderable, handle, mins, maxs, SHADOW_PROJECTION_ORTHO );
+		return;
+	}
+
+	ShadowProjection_t projection;
+	GatherShadowProjection( projection, pRenderable, handle, mins, maxs, SHADOW_PROJECTION_ORTHO );
+
+	CShadowLeafEnum leafList;
+	ComputeShadowProjection( projection, &leafList );
+	ApplyShadowProjection( projection, leafList.m_LeafList.Base() );
 }
 
 
@@ -2464,98 +2865,22 @@ void CClientShadowMgr::BuildRenderToTextureShadow( IClientRenderable* pRenderabl
 		DrawRenderToTextureDebugInfo( pRenderable, mins, maxs );
 	}
 
-	// Get the object's basis
-	Vector vec[3];
-	AngleVectors( pRenderable->GetRenderAngles(), &vec[0], &vec[1], &vec[2] );
-	vec[1] *= -1.0f;
-
-	Vector vecShadowDir = GetShadowDirection( pRenderable );
-
 //	Debugging aid
 //	const model_t *pModel = pRenderable->GetModel();
 //	const char *pDebugName = modelinfo->GetModelName( pModel );
 
-	// Project the shadow casting direction into the space of the object
-	Vector localShadowDir;
-	localShadowDir[0] = DotProduct( vec[0], vecShadowDir );
-	localShadowDir[1] = DotProduct( vec[1], vecShadowDir );
-	localShadowDir[2] = DotProduct( vec[2], vecShadowDir );
-
-	// Compute the box size
-	Vector boxSize;
-	VectorSubtract( maxs, mins, boxSize );
-	
-	Vector yvec;
-	float fProjMax = 0.0f;
-	for( int i = 0; i != 3; ++i )
-	{
-		Vector test = vec[i] - ( vecShadowDir * DotProduct( vecShadowDir, vec[i] ) );
-		test *= boxSize[i]; //doing after the projection to simplify projection math
-		float fLengthSqr = test.LengthSqr();
-		if( fLengthSqr > fProjMax )
-		{
-			fProjMax = fLengthSqr;
-			yvec = test;
-		}
-	}		
-
-	VectorNormalize( yvec );
-
-	// Compute the x vector
-	Vector xvec;
-	CrossProduct( yvec, vecShadowDir, xvec );
-
-	// We project the two longest sides into the vectors perpendicular
-	// to the projection direction, then add in the projection of the perp direction
-	Vector2D size;
-	size.x = boxSize.x * fabs( DotProduct( vec[0], xvec ) ) + 
-		boxSize.y * fabs( DotProduct( vec[1], xvec ) ) + 
-		boxSize.z * fabs( DotProduct( vec[2], xvec ) );
-	size.y = boxSize.x * fabs( DotProduct( vec[0], yvec ) ) + 
-		boxSize.y * fabs( DotProduct( vec[1], yvec ) ) + 
-		boxSize.z * fabs( DotProduct( vec[2], yvec ) );
-
-	size.x += 2.0f * TEXEL_SIZE_PER_CASTER_SIZE;
-	size.y += 2.0f * TEXEL_SIZE_PER_CASTER_SIZE;
-
-	// Place the origin at the point with min dot product with shadow dir
-	Vector org;
-	float falloffStart = ComputeLocalShadowOrigin( pRenderable, mins, maxs, localShadowDir, 1.0f, org );
-
-	// Transform the local origin into world coordinates
-	Vector worldOrigin = pRenderable->GetRenderOrigin( );
-	VectorMA( worldOrigin, org.x, vec[0], worldOrigin );
-	VectorMA( worldOrigin, org.y, vec[1], worldOrigin );
-	VectorMA( worldOrigin, org.z, vec[2], worldOrigin );
-
-	VMatrix matWorldToTexture;
-	BuildOrthoWorldToShadowMatrix( m_Shadows[handle].m_WorldToShadow, worldOrigin, vecShadowDir, xvec, yvec );
-	BuildWorldToTextureMatrix( m_Shadows[handle].m_WorldToShadow, size, matWorldToTexture );
-	Vector2DCopy( size, m_Shadows[handle].m_WorldSize );
-
-	// Compute the falloff attenuation
-	// Area computation isn't exact since xvec is not perp to yvec, but close enough
-	// Extra factor of 4 in the maxHeight due to the size being half as big
-//	float shadowArea = size.x * size.y;	
+	if ( m_bDeferProjections )
+	{
+		GatherShadowProjection( m_DeferredProjections[ m_DeferredProjections.AddToTail() ], pRenderable, handle, mins, maxs, SHADOW_PROJECTION_RENDER_TO_TEXTURE );
+		return;
+	}
 
-	// The entity may be overriding our shadow cast distance
-	float flShadowCastDistance = GetShadowDistance( pRenderable );
-	float maxHeight = flShadowCastDistance + falloffStart; //3.0f * sqrt( shadowArea );
+	ShadowProjection_t projection;
+	GatherShadowProjection( projection, pRenderable, handle, mins, maxs, SHADOW_PROJECTION_RENDER_TO_TEXTURE );
 
 	CShadowLeafEnum leafList;
-	BuildShadowLeafList( &leafList, worldOrigin, vecShadowDir, size, maxHeight );
-	int nCount = leafList.m_LeafList.Count();
-	const int *pLeafList = leafList.m_LeafList.Base();
-
-	shadowmgr->ProjectShadow( m_Shadows[handle].m_ShadowHandle, worldOrigin, 
-		vecShadowDir, matWorldToTexture, size, nCount, pLeafList, maxHeight, falloffStart, MAX_FALLOFF_AMOUNT, pRenderable->GetRenderOrigin() );
-
-	// Compute extra clip planes to prevent poke-thru
-	ComputeExtraClipPlanes( pRenderable, handle, vec, mins, maxs, localShadowDir );
-
-	// Add the shadow to the client leaf system so it correctly marks 
-	// leafs as being affected by a particular shadow
-	ClientLeafSystem()->ProjectShadow( m_Shadows[handle].m_ClientLeafShadowHandle, nCount, pLeafList );
+	ComputeShadowProjection( projection, &leafList );
+	ApplyShadowProjection( projection, leafList.m_LeafList.Base() );
 }
 
 static void LineDrawHelper( const Vector &startShadowSpace, const Vector &endShadowSpace, 
@@ -2596,19 +2921,6 @@ static void DebugDrawFrustum( const Vector &vOrigin, const VMatrix &matWorldToFl
 }
 
 
-//-----------------------------------------------------------------------------
-// Builds a list of leaves inside the flashlight volume
-//-----------------------------------------------------------------------------
-static void BuildFlashlightLeafList( CShadowLeafEnum *pEnum, const VMatrix &worldToShadow )
-{
-	// Use an AABB around the frustum to enumerate leaves.
-	Vector mins, maxs;
-	CalculateAABBFromProjectionMatrix( worldToShadow, &mins, &maxs );
-	ISpatialQuery* pQuery = engine->GetBSPTreeQuery();
-	pQuery->EnumerateLeavesInBox( mins, maxs, pEnum, 0 );
-}
-
-
 void CClientShadowMgr::BuildFlashlight( ClientShadowHandle_t handle )
 {
 	// For the 360, we just draw flashlights with the main geometry
@@ -2626,17 +2938,37 @@ void CClientShadowMgr::BuildFlashlight( ClientShadowHandle_t handle )
 	bool bLightModels = r_flashlightmodels.GetBool();
 	bool bLightSpecificEntity = shadow.m_hTargetEntity.Get() != NULL;
 	bool bLightWorld = ( shadow.m_Flags & SHADOW_FLAGS_LIGHT_WORLD ) != 0;
-	int nCount = 0;
-	const int *pLeafList = 0;
+	if ( !bLightWorld && ( !bLightModels || bLightSpecificEntity ) )
+	{
+		ApplyFlashlight( handle, 0, NULL );
+		return;
+	}
 
-	CShadowLeafEnum leafList;
-	if ( bLightWorld || ( bLightModels && !bLightSpecificEntity ) )
+	if ( m_bDeferProjections )
 	{
-		BuildFlashlightLeafList( &leafList, shadow.m_WorldToShadow );
-		nCount = leafList.m_LeafList.Count();
-		pLeafList = leafList.m_LeafList.Base();
+		GatherShadowProjection( m_DeferredProjections[ m_DeferredProjections.AddToTail() ], NULL, handle, vec3_origin, vec3_origin, SHADOW_PROJECTION_FLASHLIGHT );
+		return;
 	}
 
+	ShadowProjection_t projection;
+	GatherShadowProjection( projection, NULL, handle, vec3_origin, vec3_origin, SHADOW_PROJECTION_FLASHLIGHT );
+
+	CShadowLeafEnum leafList;
+	ComputeShadowProjection( projection, &leafList );
+	ApplyFlashlight( handle, projection.m_nLeafCount, leafList.m_LeafList.Base() );
+}
+
+
+//-----------------------------------------------------------------------------
+// Adds a flashlight to the world and models in the leaves it touches
+//-----------------------------------------------------------------------------
+void CClientShadowMgr::ApplyFlashlight( ClientShadowHandle_t handle, int nCount, const int *pLeafList )
+{
+	ClientShadow_t &shadow = m_Shadows[handle];
+	bool bLightModels = r_flashlightmodels.GetBool();
+	bool bLightSpecificEntity = shadow.m_hTargetEntity.Get() != NULL;
+	bool bLightWorld = ( shadow.m_Flags & SHADOW_FLAGS_LIGHT_WORLD ) != 0;
+
 	if( bLightWorld )
 	{
 		shadowmgr->ProjectFlashlight( shadow.m_ShadowHandle, shadow.m_WorldToShadow, nCount, pLeafList );
@@ -2856,6 +3188,65 @@ bool CClientShadowMgr::ShouldUseParentShadow( IClientRenderable *pRenderable )
 }
 
 
+//-----------------------------------------------------------------------------
+// Computes a contiguous run of deferred shadow projections
+//-----------------------------------------------------------------------------
+void CClientShadowMgr::ComputeProjectionBatch( ShadowProjectionBatch_t *&pBatch )
+{
+	pBatch->m_Leaves.m_LeafList.RemoveAll();
+	int nEnd = pBatch->m_nFirst + pBatch->m_nCount;
+	for ( int i = pBatch->m_nFirst; i < nEnd; ++i )
+	{
+		ComputeShadowProjection( m_DeferredProjections[i], &pBatch->m_Leaves );
+	}
+}
+
+
+//-----------------------------------------------------------------------------
+// Computes the shadow projections queued up by PreRender on the job pool,
+// then hands them to the engine and leaf system in dirty list order
+//-----------------------------------------------------------------------------
+void CClientShadowMgr::ProjectDeferredShadows()
+{
+	int nProjections = m_DeferredProjections.Count();
+	int nBatches = MIN( MIN( g_pThreadPool->NumThreads() * 4, (int)MAX_PROJECTION_BATCHES ), nProjections );
+	nBatches = MAX( nBatches, 1 );
+
+	ShadowProjectionBatch_t *pBatches[MAX_PROJECTION_BATCHES];
+	int nFirst = 0;
+	for ( int i = 0; i < nBatches; ++i )
+	{
+		int nEnd = ( nProjections * ( i + 1 ) ) / nBatches;
+		m_ProjectionBatches[i].m_nFirst = nFirst;
+		m_ProjectionBatches[i].m_nCount = nEnd - nFirst;
+		pBatches[i] = &m_ProjectionBatches[i];
+		nFirst = nEnd;
+	}
+
+	{
+		VPROF_BUDGET( "CClientShadowMgr::ComputeShadowProjections", VPROF_BUDGETGROUP_SHADOW_RENDERING );
+		ParallelProcess( "CClientShadowMgr::ComputeShadowProjections", pBatches, nBatches, this, &CClientShadowMgr::ComputeProjectionBatch );
+	}
+
+	{
+		VPROF_BUDGET( "CClientShadowMgr::ApplyShadowProjections", VPROF_BUDGETGROUP_SHADOW_RENDERING );
+		for ( int i = 0; i < nBatches; ++i )
+		{
+			ShadowProjectionBatch_t &batch = m_ProjectionBatches[i];
+			const int *pLeaves = batch.m_Leaves.m_LeafList.Base();
+			int nEnd = batch.m_nFirst + batch.m_nCount;
+			for ( int j = batch.m_nFirst; j < nEnd; ++j )
+			{
+				const ShadowProjection_t &projection = m_DeferredProjections[j];
+				ApplyShadowProjection( projection, pLeaves + projection.m_nFirstLeaf );
+			}
+		}
+	}
+
+	m_DeferredProjections.RemoveAll();
+}
+
+
 //-----------------------------------------------------------------------------
 // Before we render any view, make sure all shadows are re-projected vs world
 //-----------------------------------------------------------------------------
@@ -2928,6 +3319,11 @@ void CClientShadowMgr::PreRender()
 
 	m_bUpdatingDirtyShadows = true;
 
+	// With enough dirty shadows, only gather the projection inputs while walking the
+	// dirty list; the matrices and leaf lists are then computed on the job pool
+	m_bDeferProjections = r_threaded_client_shadow_manager.GetBool() && g_pThreadPool->NumThreads() > 0 &&
+		m_DirtyShadows.Count() >= r_threaded_client_shadow_manager_min.GetInt();
+
 	unsigned short i = m_DirtyShadows.FirstInorder();
 	while ( i != m_DirtyShadows.InvalidIndex() )
 	{
@@ -2939,6 +3335,12 @@ void CClientShadowMgr::PreRender()
 	}
 	m_DirtyShadows.RemoveAll();
 
+	m_bDeferProjections = false;
+	if ( m_DeferredProjections.Count() )
+	{
+		ProjectDeferredShadows();
+	}
+
 	// Transparent shadows must remain dirty, since they were not re-projected
 	int nCount = m_TransparentShadows.Count();
 	for ( int i = 0; i < nCount; ++i )
@@ -3716,9 +4118,213 @@ bool CClientShadowMgr::BuildSetupListForRenderToTextureShadow( unsigned short cl
 		if ( BuildSetupShadowHierarchy( pRenderable, shadow ) )
 			return true;
 	}
+	else if ( ShouldCheckAnimatingShadow( shadow ) && m_ShadowAllocator.HasValidTexture( shadow.m_ShadowTexture ) )
+	{
+		// Set up the bones here as well so the change check in DrawRenderToTextureShadow
+		// doesn't have to do it serially
+		IClientRenderable *pRenderable = ClientEntityList().GetClientRenderableFromHandle( shadow.m_Entity );
+		BuildSetupShadowHierarchy( pRenderable, shadow );
+	}
 	return false;
 }
 
+
+//-----------------------------------------------------------------------------
+// Animating casters used to re-render their shadow every frame. Instead, their
+// pose and the shadow direction are compared against the last redraw, and the
+// texture is only dirtied once the change would be visible or it's too old.
+//-----------------------------------------------------------------------------
+bool CClientShadowMgr::ShouldCheckAnimatingShadow( const ClientShadow_t &shadow ) const
+{
+	return ( shadow.m_Flags & ( SHADOW_FLAGS_ANIMATING_SOURCE | SHADOW_FLAGS_TEXTURE_DIRTY ) ) == SHADOW_FLAGS_ANIMATING_SOURCE;
+}
+
+//-----------------------------------------------------------------------------
+// Checksum of everything that poses a plain animating caster, relative to its
+// origin. If it hasn't changed since the last redraw neither have the bones,
+// so they don't need setting up. Returns false for casters whose bones come
+// from somewhere else.
+//
+// Cycles, weights and pose parameters are normalized, and sweeping one across
+// its whole range moves a bone by about the shadow's size at most, so they're
+// bucketed in steps of the change tolerance over that size before hashing.
+// Angles get the same step in radians. An idle caster then keeps its
+// signature until it has moved about as far as a bone is allowed to.
+//-----------------------------------------------------------------------------
+static inline int QuantizePose( float flValue, float flStep )
+{
+	return (int)floorf( flValue / flStep );
+}
+
+static bool ComputePoseSignature( IClientRenderable *pRenderable, float flTolerance, const Vector2D &vecShadowSize, CRC32_t &signature )
+{
+	C_BaseEntity *pEntity = pRenderable->GetIClientUnknown()->GetBaseEntity();
+	C_BaseAnimating *pAnimating = pEntity ? pEntity->GetBaseAnimating() : NULL;
+	CStudioHdr *pStudioHdr = pAnimating ? pAnimating->GetModelPtr() : NULL;
+	if ( !pStudioHdr || pAnimating->IsRagdoll() || pAnimating->IsFollowingEntity() )
+		return false;
+
+	float flStep = flTolerance / MAX( MAX( vecShadowSize.x, vecShadowSize.y ), 1.0f );
+	float flAngleStep = RAD2DEG( flStep );
+
+	int nPose[3 + MAXSTUDIOPOSEPARAM + MAXSTUDIOBONECTRLS];
+	const QAngle &angles = pRenderable->GetRenderAngles();
+	nPose[0] = QuantizePose( angles.x, flAngleStep );
+	nPose[1] = QuantizePose( angles.y, flAngleStep );
+	nPose[2] = QuantizePose( angles.z, flAngleStep );
+	int nPoseCount = 3;
+
+	float flPoseParameter[MAXSTUDIOPOSEPARAM];
+	pAnimating->GetPoseParameters( pStudioHdr, flPoseParameter );
+	for ( int i = 0; i < pStudioHdr->GetNumPoseParameters(); ++i )
+	{
+		nPose[nPoseCount++] = QuantizePose( flPoseParameter[i], flStep );
+	}
+
+	float flControllers[MAXSTUDIOBONECTRLS];
+	pAnimating->GetBoneControllers( flControllers );
+	for ( int i = 0; i < pStudioHdr->numbonecontrollers(); ++i )
+	{
+		nPose[nPoseCount++] = QuantizePose( flControllers[i], flStep );
+	}
+
+	int nSequence[2] = { pAnimating->GetSequence(), QuantizePose( pAnimating->GetCycle(), flStep ) };
+
+	CRC32_Init( &signature );
+	CRC32_ProcessBuffer( &signature, nSequence, sizeof( nSequence ) );
+	CRC32_ProcessBuffer( &signature, nPose, nPoseCount * sizeof( int ) );
+
+	C_BaseAnimatingOverlay *pOverlay = dynamic_cast< C_BaseAnimatingOverlay * >( pAnimating );
+	if ( pOverlay )
+	{
+		for ( int i = 0; i < pOverlay->GetNumAnimOverlays(); ++i )
+		{
+			C_AnimationLayer *pLayer = pOverlay->GetAnimOverlay( i );
+			int nLayer[4] = { pLayer->m_nSequence, QuantizePose( pLayer->m_flCycle, flStep ), QuantizePose( pLayer->m_flWeight, flStep ), pLayer->m_nOrder };
+			CRC32_ProcessBuffer( &signature, nLayer, sizeof( nLayer ) );
+		}
+	}
+
+	CRC32_Final( &signature );
+	return true;
+}
+
+//-----------------------------------------------------------------------------
+// Bones that deform the model, relative to its origin. Only called once the
+// pose has changed; if the caster is drawn this frame the bones set up here
+// are the ones it renders with.
+//-----------------------------------------------------------------------------
+int CClientShadowMgr::ComputeBonePositions( IClientRenderable *pRenderable, Vector *vecPositions )
+{
+	C_BaseEntity *pEntity = pRenderable->GetIClientUnknown()->GetBaseEntity();
+	C_BaseAnimating *pAnimating = pEntity ? pEntity->GetBaseAnimating() : NULL;
+	CStudioHdr *pStudioHdr = pAnimating ? pAnimating->GetModelPtr() : NULL;
+	if ( !pStudioHdr )
+		return -1;
+
+	// Just the bones with vertices on them, which the shadow draw sets up anyway
+	const int nBoneMask = BONE_USED_BY_VERTEX_AT_LOD( 0 );
+
+	static matrix3x4_t s_BoneToWorld[MAXSTUDIOBONES];
+	if ( !pRenderable->SetupBones( s_BoneToWorld, MAXSTUDIOBONES, nBoneMask, gpGlobals->curtime ) )
+		return -1;
+
+	// Positions relative to the origin: the shadow texture moves with the caster,
+	// so only a change in pose or orientation needs a redraw
+	const Vector &vecOrigin = pRenderable->GetRenderOrigin();
+	int nBones = MIN( pStudioHdr->numbones(), MAXSTUDIOBONES );
+	for ( int i = 0; i < nBones; ++i )
+	{
+		if ( pStudioHdr->boneFlags( i ) & nBoneMask )
+		{
+			MatrixGetColumn( s_BoneToWorld[i], 3, vecPositions[i] );
+			vecPositions[i] -= vecOrigin;
+		}
+		else
+		{
+			vecPositions[i].Init();
+		}
+	}
+	return nBones;
+}
+
+void CClientShadowMgr::CheckAnimatingShadowForChanges( ClientShadowHandle_t handle, IClientRenderable *pRenderable )
+{
+	ClientShadow_t &shadow = m_Shadows[handle];
+	if ( !ShouldCheckAnimatingShadow( shadow ) )
+		return;
+
+	float flTolerance = r_shadow_rtt_change_tolerance.GetFloat();
+	bool bChanged = ( flTolerance <= 0.0f ) || ( shadow.m_nLastRedrawFrame < 0 ) ||
+		( gpGlobals->framecount - shadow.m_nLastRedrawFrame >= r_shadow_rtt_max_stale_frames.GetInt() );
+
+	if ( !bChanged )
+	{
+		// A change in direction moves the far end of the shadow by roughly its length times the delta
+		Vector vecDirDelta;
+		VectorSubtract( GetShadowDirection( pRenderable ), shadow.m_LastShadowDir, vecDirDelta );
+		float flLength = MAX( shadow.m_WorldSize.x, shadow.m_WorldSize.y );
+		bChanged = ( vecDirDelta.LengthSqr() * flLength * flLength > flTolerance * flTolerance );
+	}
+
+	CRC32_t poseSignature;
+	if ( !bChanged && shadow.m_bLastPoseSignatureValid && ComputePoseSignature( pRenderable, flTolerance, shadow.m_WorldSize, poseSignature ) &&
+		 poseSignature == shadow.m_LastPoseSignature )
+	{
+		// Same pose as the last redraw
+	}
+	else if ( !bChanged )
+	{
+		Vector vecPositions[MAXSTUDIOBONES];
+		int nBones = ComputeBonePositions( pRenderable, vecPositions );
+		if ( nBones != shadow.m_LastBonePositions.Count() )
+		{
+			bChanged = true;
+		}
+		else
+		{
+			float flToleranceSq = flTolerance * flTolerance;
+			for ( int i = 0; i < nBones; ++i )
+			{
+				if ( vecPositions[i].DistToSqr( shadow.m_LastBonePositions[i] ) > flToleranceSq )
+				{
+					bChanged = true;
+					break;
+				}
+			}
+		}
+	}
+
+	if ( bChanged )
+	{
+		shadow.m_Flags |= SHADOW_FLAGS_TEXTURE_DIRTY;
+	}
+	else
+	{
+		++m_nRTTShadowsReused;
+		VPROF_INCREMENT_COUNTER( "RTT shadows reused", 1 );
+	}
+}
+
+void CClientShadowMgr::SnapshotAnimatingShadow( ClientShadowHandle_t handle, IClientRenderable *pRenderable )
+{
+	ClientShadow_t &shadow = m_Shadows[handle];
+	shadow.m_nLastRedrawFrame = gpGlobals->framecount;
+	shadow.m_LastShadowDir = GetShadowDirection( pRenderable );
+	float flTolerance = r_shadow_rtt_change_tolerance.GetFloat();
+	shadow.m_bLastPoseSignatureValid = ( flTolerance > 0.0f ) && ComputePoseSignature( pRenderable, flTolerance, shadow.m_WorldSize, shadow.m_LastPoseSignature );
+
+	// The texture was just drawn, so these bones come straight from the cache
+	Vector vecPositions[MAXSTUDIOBONES];
+	int nBones = ComputeBonePositions( pRenderable, vecPositions );
+	if ( nBones < 0 )
+	{
+		shadow.m_LastBonePositions.RemoveAll();
+		return;
+	}
+	shadow.m_LastBonePositions.CopyArray( vecPositions, nBones );
+}
+
 //-----------------------------------------------------------------------------
 // This gets called with every shadow that potentially will need to re-render
 //-----------------------------------------------------------------------------
@@ -3734,6 +4340,12 @@ bool CClientShadowMgr::DrawRenderToTextureShadow( unsigned short clientShadowHan
 		shadowmgr->SetShadowMaterial( shadow.m_ShadowHandle, m_RenderShadow, m_RenderModelShadow, (void*)(uintp)clientShadowHandle );
 	}
 
+	IClientRenderable *pRenderable = ClientEntityList().GetClientRenderableFromHandle( shadow.m_Entity );
+	if ( pRenderable && m_ShadowAllocator.HasValidTexture( shadow.m_ShadowTexture ) )
+	{
+		CheckAnimatingShadowForChanges( clientShadowHandle, pRenderable );
+	}
+
 	// Mark texture as being used...
 	bool bDirtyTexture = (shadow.m_Flags & SHADOW_FLAGS_TEXTURE_DIRTY) != 0;
 	bool bDrewTexture = false;
@@ -3747,8 +4359,8 @@ bool CClientShadowMgr::DrawRenderToTextureShadow( unsigned short clientShadowHan
 
 	if ( bNeedsRedraw || bDirtyTexture )
 	{
-		// shadow to be redrawn; for now, we'll always do it.
-		IClientRenderable *pRenderable = ClientEntityList().GetClientRenderableFromHandle( shadow.m_Entity );
+		CFastTimer redrawTimer;
+		redrawTimer.Start();
 
 		CMatRenderContextPtr pRenderContext( materials );
 		
@@ -3781,13 +4393,24 @@ bool CClientShadowMgr::DrawRenderToTextureShadow( unsigned short clientShadowHan
 			DevMsg( "Didn't draw shadow hierarchy.. bad shadow texcoords probably going to happen..grab Brian!\n" );
 		}
 
-		// Only clear the dirty flag if the caster isn't animating
+		// Only clear the dirty flag if the caster isn't animating, unless we can
+		// tell whether its pose changed enough to matter
 		if ( (shadow.m_Flags & SHADOW_FLAGS_ANIMATING_SOURCE) == 0 )
 		{
 			shadow.m_Flags &= ~SHADOW_FLAGS_TEXTURE_DIRTY;
 		}
+		else if ( r_shadow_rtt_change_tolerance.GetFloat() > 0.0f && pRenderable )
+		{
+			SnapshotAnimatingShadow( clientShadowHandle, pRenderable );
+			shadow.m_Flags &= ~SHADOW_FLAGS_TEXTURE_DIRTY;
+		}
 
 		SetRenderToTextureShadowTexCoords( shadow.m_ShadowHandle, x, y, w, h );
+
+		redrawTimer.End();
+		++m_nRTTShadowsRedrawn;
+		m_flRTTRedrawTime += redrawTimer.GetDuration().GetMillisecondsF();
+		VPROF_INCREMENT_COUNTER( "RTT shadows redrawn", 1 );
 	}
 	else if ( bPreviouslyUsingLODShadow )
 	{
@@ -3825,6 +4448,15 @@ void CClientShadowMgr::AdvanceFrame()
 {
 	// We're starting the next frame
 	m_ShadowAllocator.AdvanceFrame();
+
+	if ( r_shadow_rtt_stats.GetBool() )
+	{
+		engine->Con_NPrintf( 0, "RTT shadows redrawn: %d (%.2f ms)", m_nRTTShadowsRedrawn, m_flRTTRedrawTime );
+		engine->Con_NPrintf( 1, "RTT shadows reused:  %d", m_nRTTShadowsReused );
+	}
+	m_nRTTShadowsRedrawn = 0;
+	m_nRTTShadowsReused = 0;
+	m_flRTTRedrawTime = 0.0f;
 }
 
 
@@ -3997,7 +4629,7 @@ void CClientShadowMgr::ComputeShadowTextures( const CViewSetup &view, int leafCo
 	if ( !m_RenderToTextureActive || (r_shadows.GetInt() == 0) || r_shadows_gamecontrol.GetInt() == 0 )
 		return;
 
-	m_bThreaded = false;//( r_threaded_client_shadow_manager.GetBool() && g_pThreadPool->NumIdleThreads() );
+	m_bThreaded = ( r_threaded_client_shadow_manager.GetBool() && g_pThreadPool->NumIdleThreads() );
 
 	MDLCACHE_CRITICAL_SECTION();
 	// First grab all shadow textures we may want to render
@@ -4043,7 +4675,7 @@ void CClientShadowMgr::ComputeShadowTextures( const CViewSetup &view, int leafCo
 	int nModelsRendered = 0;
 	int i;
 
-	if ( m_bThreaded && g_pThreadPool->NumIdleThreads() )
+	if ( m_bThreaded )
 	{
 		s_NPCShadowBoneSetups.RemoveAll();
 		s_NonNPCShadowBoneSetups.RemoveAll();
@@ -65,6 +65,7 @@
 #include "rendertexture.h"
 #include "viewpostprocess.h"
 #include "viewdebug.h"
+#include "tier1/framearena.h"
 
 #if defined USES_ECON_ITEMS
 #include "econ_wearable.h"
@@ -4582,7 +4583,8 @@ void CRendering3dView::DrawTranslucentRenderables( bool bInSkybox, bool bShadowD
 	VPROF_BUDGET( "CViewRender::DrawTranslucentRenderables", "DrawTranslucentRenderables" );
 	int iPrevLeaf = info.m_LeafCount - 1;
 	int nDetailLeafCount = 0;
-	LeafIndex_t *pDetailLeafList = (LeafIndex_t*)stackalloc( info.m_LeafCount * sizeof(LeafIndex_t) );
+	CFrameArenaScope scratch;
+	LeafIndex_t *pDetailLeafList = scratch.AllocArray<LeafIndex_t>( info.m_LeafCount );
 
 // 	bool bDrawUnderWater = (nFlags & DF_RENDER_UNDERWATER) != 0;
 // 	bool bDrawAboveWater = (nFlags & DF_RENDER_ABOVEWATER) != 0;
@@ -9,6 +9,7 @@
 #include "ServerNetworkProperty.h"
 #include "tier0/dbg.h"
 #include "gameinterface.h"
+#include "entityclustertable.h"
 
 // memdbgon must be the last include file in a .cpp file!!!
 #include "tier0/memdbgon.h"
@@ -47,6 +48,10 @@ CServerNetworkProperty::~CServerNetworkProperty()
 		m_pTransmitProxy->Release();
 	}*/
 
+	if ( m_pPev )
+	{
+		g_EntityClusterTable.Remove( entindex() );
+	}
 	engine->CleanUpEntityClusterList( &m_PVSInfo );
 
 	// remove the attached edict if it exists
@@ -144,6 +149,7 @@ void CServerNetworkProperty::RecomputePVSInformation()
 	{
 		m_pPev->m_fStateFlags &= ~FL_EDICT_DIRTY_PVS_INFORMATION;
 		engine->BuildEntityClusterList( edict(), &m_PVSInfo );
+		g_EntityClusterTable.Update( entindex(), m_PVSInfo );
 	}
 }
 
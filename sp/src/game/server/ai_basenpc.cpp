@@ -232,6 +232,7 @@ CAI_Manager g_AI_Manager;
 //-------------------------------------
 
 CAI_Manager::CAI_Manager()
+ :	m_nChangeSerial( 0 )
 {
 	m_AIs.EnsureCapacity( MAX_AIS );
 }
@@ -257,6 +258,7 @@ int CAI_Manager::NumAIs()
 void CAI_Manager::AddAI( CAI_BaseNPC *pAI )
 {
 	m_AIs.AddToTail( pAI );
+	m_nChangeSerial++;
 }
 
 //-------------------------------------
@@ -266,7 +268,10 @@ void CAI_Manager::RemoveAI( CAI_BaseNPC *pAI )
 	int i = m_AIs.Find( pAI );
 
 	if ( i != -1 )
+	{
 		m_AIs.FastRemove( i );
+		m_nChangeSerial++;
+	}
 }
 
 
@@ -3202,28 +3207,8 @@ void CAI_BaseNPC::UpdateEfficiency( bool bInPVS )
 	
 	if ( GetSoundInterests() & SOUND_DANGER )
 	{
-		int	iSound = CSoundEnt::ActiveList();
-		
-		while ( iSound != SOUNDLIST_EMPTY )
-		{
-			CSound *pCurrentSound = CSoundEnt::SoundPointerForIndex( iSound );
-
-			float hearingSensitivity = HearingSensitivity();
-			Vector vEarPosition = EarPosition();
-
-			if ( pCurrentSound && (SOUND_DANGER & pCurrentSound->SoundType()) )
-			{
-				float flHearDistanceSq = pCurrentSound->Volume() * hearingSensitivity;
-				flHearDistanceSq *= flHearDistanceSq;
-				if ( pCurrentSound->GetSoundOrigin().DistToSqr( vEarPosition ) <= flHearDistanceSq )
-				{
-					bPotentialDanger = true;
-					break;
-				}
-			}
-			
-			iSound = pCurrentSound->NextSound();
-		}
+		int iSound;
+		bPotentialDanger = ( CSoundEnt::GetSoundsInRange( EarPosition(), HearingSensitivity(), SOUND_DANGER, &iSound, 1 ) > 0 );
 	}
 
 	if ( bPotentialDanger )
@@ -3394,22 +3379,20 @@ void CAI_BaseNPC::UpdateSleepState( bool bInPVS )
 				// Should check for visible danger sounds
 				if ( (GetSoundInterests() & SOUND_DANGER) && !(HasSpawnFlags(SF_NPC_WAIT_TILL_SEEN)) )
 				{
-					int	iSound = CSoundEnt::ActiveList();
-					
-					while ( iSound != SOUNDLIST_EMPTY )
+					int sounds[MAX_WORLD_SOUNDS_POOL];
+					int nSounds = CSoundEnt::GetSoundsInRange( EarPosition(), HearingSensitivity(), SOUND_DANGER, sounds, ARRAYSIZE(sounds) );
+
+					for ( int i = 0; i < nSounds; i++ )
 					{
-						CSound *pCurrentSound = CSoundEnt::SoundPointerForIndex( iSound );
+						CSound *pCurrentSound = CSoundEnt::SoundPointerForIndex( sounds[i] );
 						Assert( pCurrentSound );
 
-						if ( (pCurrentSound->SoundType() & SOUND_DANGER) && 
-							 GetSenses()->CanHearSound( pCurrentSound ) &&
+						if ( GetSenses()->CanHearSound( pCurrentSound ) &&
 							 SoundIsVisible( pCurrentSound ))
 						{
 							Wake();
 							break;
 						}
-
-						iSound = pCurrentSound->NextSound();
 					}
 				}
 			}
@@ -3671,87 +3654,315 @@ void CAI_BaseNPC::RebalanceThinks()
 	}
 }
 
-static float g_NpcTimeThisFrame;
-static float g_StartTimeCurThink;
+//-----------------------------------------------------------------------------
+// Frame-budgeted think scheduling
+//
+// The first NPC to think in a tick plans that tick. Every NPC due to think is
+// ranked by priority and admitted against what is left of the frame's
+// ai_think_budget_ms (scaled up by host_timescale), using a running average of
+// its own think cost. NPCs that don't fit are held to the next frame.
+// Choreographed NPCs, and any NPC that has gone ai_think_max_defer without a
+// real think, are always admitted.
+//-----------------------------------------------------------------------------
 
-bool CAI_BaseNPC::PreNPCThink()
+#ifdef _DEBUG
+#define AI_THINK_BUDGET_DEFAULT "30"
+#else
+#define AI_THINK_BUDGET_DEFAULT ( ( !IsXbox() ) ? "10" : "12.5" )
+#endif
+
+ConVar	ai_think_budget_ms( "ai_think_budget_ms", AI_THINK_BUDGET_DEFAULT, FCVAR_NONE, "Per-frame budget for NPC thinks (in ms)." );
+ConVar	ai_think_max_defer( "ai_think_max_defer", "0.25", FCVAR_NONE, "Longest an NPC think may be held back by the think budget (in sec's)." );
+
+enum AIThinkPriority_t
 {
-	static int iPrevFrame = -1;
-	static float frameTimeLimit = FLT_MAX;
-	static const ConVar *pHostTimescale;
+	AITP_BACKGROUND,	// not near or in view of the player
+	AITP_VISIBLE,		// moving at full rate for the player
+	AITP_COMBAT,		// fighting, or recently attacked or hurt
+	AITP_CRITICAL,		// choreographed, or held back too long already
+
+	AITP_COUNT
+};
+
+static const char *g_ppszThinkPriorities[AITP_COUNT] =
+{
+	"background",
+	"visible",
+	"combat",
+	"critical",
+};
+
+struct AIThinkPlanInfo_t
+{
+	CAI_BaseNPC *	pNPC;
+	int				iPriority;
+	float			flLastRealThinkTime;
+};
+
+struct AIThinkBudgetStats_t
+{
+	int		nFrames;						// frames in which any NPC thought
+	int		nFramesOverBudget;
+	double	flTotalMs;
+	float	flPeakMs;
+	int		nPlans;
+	int		nThinks[AITP_COUNT];
+	int		nDeferred[AITP_COUNT];
+	int		nForced;						// critical thinks admitted past the budget
+};
+
+static AIThinkBudgetStats_t g_AIThinkStats;
 
-	if ( frameTimeLimit == FLT_MAX )
+//-------------------------------------
+// The budget is in real time, so it grows with host_timescale as the
+// old frame limit did; a fast-forwarded frame packs in more game time.
+//-------------------------------------
+
+static float AI_GetThinkBudgetMs()
+{
+	static const ConVar *pHostTimescale = cvar->FindVar( "host_timescale" );
+
+	float timescale = ( pHostTimescale ) ? pHostTimescale->GetFloat() : 1;
+	if ( timescale < 1 )
+		timescale = 1;
+
+	return ai_think_budget_ms.GetFloat() * timescale;
+}
+
+static int			g_iAIThinkFrame = -1;
+static int			g_iAIThinkPlanTick = -1;
+static float		g_flAIThinkMsThisFrame;
+static bool			g_bTimingCurThink;
+static CFastTimer	g_AICurThinkTimer;
+
+//-------------------------------------
+
+static void AI_EndThinkFrame()
+{
+	if ( g_flAIThinkMsThisFrame > 0 )
 	{
-		pHostTimescale = cvar->FindVar( "host_timescale" );
+		g_AIThinkStats.nFrames++;
+		g_AIThinkStats.flTotalMs += g_flAIThinkMsThisFrame;
+		g_AIThinkStats.flPeakMs = MAX( g_AIThinkStats.flPeakMs, g_flAIThinkMsThisFrame );
+		if ( g_flAIThinkMsThisFrame > AI_GetThinkBudgetMs() )
+			g_AIThinkStats.nFramesOverBudget++;
 	}
 
-	bool bUseThinkLimits = ( !m_bInChoreo && ShouldUseFrameThinkLimits() );
+	g_iAIThinkFrame = gpGlobals->framecount;
+	g_flAIThinkMsThisFrame = 0;
+}
 
-#ifdef _DEBUG
-	const float NPC_THINK_LIMIT = 30.0 / 1000.0;
-#else
-	const float NPC_THINK_LIMIT = ( !IsXbox() ) ? (10.0 / 1000.0) : (12.5 / 1000.0);
-#endif
+//-------------------------------------
+
+int CAI_BaseNPC::GetThinkPriority()
+{
+	if ( m_bInChoreo || gpGlobals->curtime - m_flLastRealThinkTime > ai_think_max_defer.GetFloat() )
+		return AITP_CRITICAL;
 
-	g_StartTimeCurThink = 0;
+	if ( m_NPCState == NPC_STATE_COMBAT ||
+		 gpGlobals->curtime - GetLastAttackTime() < 1.0 ||
+		 gpGlobals->curtime - m_flLastDamageTime < 1.0 )
+		return AITP_COMBAT;
 
-	if ( bUseThinkLimits && VCRGetMode() == VCR_Disabled )
+	// UpdateEfficiency() keeps full move rate only when in the PVS and facing or near the player
+	if ( GetMoveEfficiency() == AIME_NORMAL )
+		return AITP_VISIBLE;
+
+	return AITP_BACKGROUND;
+}
+
+//-------------------------------------
+
+static int __cdecl ThinkPlanCompare( const AIThinkPlanInfo_t *pLeft, const AIThinkPlanInfo_t *pRight )
+{
+	if ( pLeft->iPriority != pRight->iPriority )
+		return ( pLeft->iPriority > pRight->iPriority ) ? -1 : 1;
+
+	// Longest waiting first
+	if ( pLeft->flLastRealThinkTime != pRight->flLastRealThinkTime )
+		return ( pLeft->flLastRealThinkTime < pRight->flLastRealThinkTime ) ? -1 : 1;
+
+	return 0;
+}
+
+//-------------------------------------
+
+void CAI_BaseNPC::PlanThinks( CAI_BaseNPC *pThinking )
+{
+	AI_PROFILE_SCOPE( AI_Think_Plan );
+
+	static CUtlVector<AIThinkPlanInfo_t> planCandidates( 16, 64 );
+
+	g_iAIThinkPlanTick = gpGlobals->tickcount;
+	g_AIThinkStats.nPlans++;
+
+	// The NPC being dispatched has already had its think tick cleared
+	for ( int i = 0; i < g_AI_Manager.NumAIs(); i++ )
 	{
-		if ( m_iFrameBlocked == gpGlobals->framecount )
+		CAI_BaseNPC *pCandidate = g_AI_Manager.AccessAIs()[i];
+		int iNextThinkTick = pCandidate->GetNextThinkTick();
+
+		if ( pCandidate != pThinking &&
+			 ( pCandidate->m_pfnThink != (BASEPTR)&CAI_BaseNPC::CallNPCThink ||
+			   iNextThinkTick == TICK_NEVER_THINK || 
+			   iNextThinkTick > gpGlobals->tickcount ) )
 		{
-			DbgFrameLimitMsg( "Stalled %d (%d)\n", this, gpGlobals->framecount );
-			SetNextThink( gpGlobals->curtime );
-			return false;
+			continue;
 		}
-		else if ( gpGlobals->framecount != iPrevFrame )
+
+		int iInfo = planCandidates.AddToTail();
+		planCandidates[iInfo].pNPC = pCandidate;
+		planCandidates[iInfo].iPriority = pCandidate->GetThinkPriority();
+		planCandidates[iInfo].flLastRealThinkTime = pCandidate->m_flLastRealThinkTime;
+	}
+
+	planCandidates.Sort( ThinkPlanCompare );
+
+	float flRemainingMs = AI_GetThinkBudgetMs() - g_flAIThinkMsThisFrame;
+
+	for ( int i = 0; i < planCandidates.Count(); i++ )
+	{
+		CAI_BaseNPC *pNPC = planCandidates[i].pNPC;
+		float flCostMs = pNPC->m_flThinkCostMs;
+
+		pNPC->m_iThinkPriority = planCandidates[i].iPriority;
+
+		bool bCritical = ( pNPC->m_iThinkPriority == AITP_CRITICAL );
+
+		// Already held back this frame, leave it out unless it can't wait any longer
+		if ( pNPC->m_iFrameBlocked == gpGlobals->framecount && !bCritical )
+			continue;
+
+		if ( flCostMs <= flRemainingMs || bCritical )
 		{
-			DbgFrameLimitMsg( "--- FRAME: %d (%d)\n", this, gpGlobals->framecount );
-			float timescale = pHostTimescale->GetFloat();
-			if ( timescale < 1 )
-				timescale = 1;
+			if ( flCostMs > flRemainingMs )
+				g_AIThinkStats.nForced++;
 
-			iPrevFrame = gpGlobals->framecount;
-			frameTimeLimit = NPC_THINK_LIMIT * timescale;
-			g_NpcTimeThisFrame = 0;
+			pNPC->m_iFrameBlocked = -1;
+			pNPC->m_iThinkPlanTick = gpGlobals->tickcount;
+			flRemainingMs -= flCostMs;
 		}
 		else
 		{
-			if ( g_NpcTimeThisFrame > NPC_THINK_LIMIT )
+			DbgFrameLimitMsg( "Planned out %d (%d)\n", pNPC, gpGlobals->framecount );
+			pNPC->m_iFrameBlocked = gpGlobals->framecount;
+		}
+	}
+
+	planCandidates.RemoveAll();
+}
+
+//-------------------------------------
+
+bool CAI_BaseNPC::PreNPCThink()
+{
+	g_bTimingCurThink = false;
+
+	if ( VCRGetMode() != VCR_Disabled )
+	{
+		return true;
+	}
+
+	if ( gpGlobals->framecount != g_iAIThinkFrame )
+	{
+		DbgFrameLimitMsg( "--- FRAME: %d (%d)\n", this, gpGlobals->framecount );
+		AI_EndThinkFrame();
+	}
+
+	if ( !m_bInChoreo && ShouldUseFrameThinkLimits() )
+	{
+		if ( g_iAIThinkPlanTick != gpGlobals->tickcount )
+		{
+			PlanThinks( this );
+		}
+		else if ( m_iThinkPlanTick != gpGlobals->tickcount && m_iFrameBlocked != gpGlobals->framecount )
+		{
+			// Moved into this tick after it was planned; admit against what is left
+			m_iThinkPriority = GetThinkPriority();
+			if ( m_iThinkPriority < AITP_CRITICAL && g_flAIThinkMsThisFrame + m_flThinkCostMs > AI_GetThinkBudgetMs() )
 			{
-				float timeSinceLastRealThink = gpGlobals->curtime - m_flLastRealThinkTime;
-				// Don't bump anyone more that a quarter second
-				if ( timeSinceLastRealThink <= .25 )
-				{
-					DbgFrameLimitMsg( "Bumped %d (%d)\n", this, gpGlobals->framecount );
-					m_iFrameBlocked = gpGlobals->framecount;
-					SetNextThink( gpGlobals->curtime );
-					return false;
-				}
-				else
-				{
-					DbgFrameLimitMsg( "(Over %d )\n", this );
-				}
+				m_iFrameBlocked = gpGlobals->framecount;
 			}
 		}
+		else if ( m_iThinkPriority < AITP_COMBAT && g_flAIThinkMsThisFrame > AI_GetThinkBudgetMs() )
+		{
+			// Earlier thinks ran over their estimates
+			m_iFrameBlocked = gpGlobals->framecount;
+		}
+
+		if ( m_iFrameBlocked == gpGlobals->framecount )
+		{
+			DbgFrameLimitMsg( "Stalled %d (%d)\n", this, gpGlobals->framecount );
+			g_AIThinkStats.nDeferred[m_iThinkPriority]++;
+			SetNextThink( gpGlobals->curtime );
+			return false;
+		}
 
 		DbgFrameLimitMsg( "Running %d (%d)\n", this, gpGlobals->framecount );
-		g_StartTimeCurThink = engine->Time();
 
 		m_iFrameBlocked = -1;
 		m_nLastThinkTick = TIME_TO_TICKS( m_flLastRealThinkTime );
 	}
+	else
+	{
+		m_iThinkPriority = AITP_CRITICAL;
+	}
+
+	g_bTimingCurThink = true;
+	g_AICurThinkTimer.Start();
 
 	return true;
 }
 
+//-------------------------------------
+
 void CAI_BaseNPC::PostNPCThink( void ) 
 { 
-	if ( g_StartTimeCurThink != 0.0 && VCRGetMode() == VCR_Disabled )
+	if ( g_bTimingCurThink )
 	{
-		g_NpcTimeThisFrame += engine->Time() - g_StartTimeCurThink;
+		g_AICurThinkTimer.End();
+		g_bTimingCurThink = false;
+
+		float flThinkMs = g_AICurThinkTimer.GetDuration().GetMillisecondsF();
+
+		g_flAIThinkMsThisFrame += flThinkMs;
+		g_AIThinkStats.nThinks[m_iThinkPriority]++;
+
+		const float THINK_COST_SMOOTHING = 0.25;
+		m_flThinkCostMs += ( flThinkMs - m_flThinkCostMs ) * THINK_COST_SMOOTHING;
 	}
 }
 
+//-------------------------------------
+
+CON_COMMAND( report_ai_think_stats, "Report NPC think budget use. Pass 'reset' to clear the counters." )
+{
+	if ( !UTIL_IsCommandIssuedByServerAdmin() )
+		return;
+
+	if ( args.ArgC() > 1 && !Q_stricmp( args[1], "reset" ) )
+	{
+		memset( &g_AIThinkStats, 0, sizeof( g_AIThinkStats ) );
+		return;
+	}
+
+	const AIThinkBudgetStats_t &stats = g_AIThinkStats;
+	float flBudget = AI_GetThinkBudgetMs();
+	float flAverage = ( stats.nFrames ) ? stats.flTotalMs / stats.nFrames : 0;
+
+	Msg( "AI think budget: %.2f ms/frame (%s)\n", flBudget, ShouldUseFrameThinkLimits() ? "enforced" : "not enforced" );
+	Msg( "  frames: %d, over budget: %d\n", stats.nFrames, stats.nFramesOverBudget );
+	Msg( "  used: avg %.2f ms (%.0f%%), peak %.2f ms\n", flAverage, ( flBudget > 0 ) ? 100.0 * flAverage / flBudget : 0.0, stats.flPeakMs );
+	Msg( "  plans: %d, forced past budget: %d\n", stats.nPlans, stats.nForced );
+	Msg( "  %-12s %10s %10s\n", "priority", "thinks", "deferred" );
+	for ( int i = AITP_COUNT - 1; i >= 0; i-- )
+	{
+		Msg( "  %-12s %10d %10d\n", g_ppszThinkPriorities[i], stats.nThinks[i], stats.nDeferred[i] );
+	}
+}
+
+//-------------------------------------
+
 void CAI_BaseNPC::CallNPCThink( void ) 
 { 
 	RebalanceThinks();
@@ -10551,6 +10762,9 @@ BEGIN_DATADESC( CAI_BaseNPC )
 	DEFINE_FIELD( m_flLastRealThinkTime,		FIELD_TIME ),
 	//								m_iFrameBlocked (not saved)
 	//								m_bInChoreo (not saved)
+	//								m_flThinkCostMs (not saved)
+	//								m_iThinkPlanTick (not saved)
+	//								m_iThinkPriority (not saved)
 	//								m_bDoPostRestoreRefindPath (not saved)
 	//								gm_flTimeLastSpawn (static)
 	//								gm_nSpawnedThisFrame (static)
@@ -11372,6 +11586,9 @@ CAI_BaseNPC::CAI_BaseNPC(void)
 
 	m_iFrameBlocked = -1;
 	m_bInChoreo = true; // assume so until call to UpdateEfficiency()
+	m_flThinkCostMs = 0;
+	m_iThinkPlanTick = -1;
+	m_iThinkPriority = 0;
 	
 	SetCollisionGroup( COLLISION_GROUP_NPC );
 }
@@ -458,6 +458,9 @@ public:
 	void RemoveAI( CAI_BaseNPC *pAI );
 
 	bool FindAI( CAI_BaseNPC *pAI )	{ return ( m_AIs.Find( pAI ) != m_AIs.InvalidIndex() ); }
+
+	// Bumped whenever the AI array changes, so per-tick caches can detect it
+	int GetChangeSerial() const		{ return m_nChangeSerial; }
 	
 private:
 	enum
@@ -468,6 +471,7 @@ private:
 	typedef CUtlVector<CAI_BaseNPC *> CAIArray;
 	
 	CAIArray m_AIs;
+	int m_nChangeSerial;
 
 };
 
@@ -642,6 +646,9 @@ private:
 	bool				PreNPCThink();
 	void				PostNPCThink();
 
+	int					GetThinkPriority();
+	static void			PlanThinks( CAI_BaseNPC *pThinking );
+
 	bool				PreThink( void );
 	void				PerformSensing();
 	void				CheckOnGround( void );
@@ -769,6 +776,10 @@ private:
 	int					m_iFrameBlocked;
 	bool				m_bInChoreo;
 
+	float				m_flThinkCostMs;			// running average of this NPC's think cost
+	int					m_iThinkPlanTick;			// tick this NPC was last admitted by PlanThinks()
+	int					m_iThinkPriority;
+
 	static int			gm_iNextThinkRebalanceTick;
 	static float		gm_flTimeLastSpawn;
 	static int			gm_nSpawnedThisFrame;
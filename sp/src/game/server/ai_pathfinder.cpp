@@ -21,6 +21,7 @@
 #include "ai_dynamiclink.h"
 #include "ai_hint.h"
 #include "bitstring.h"
+#include "tier1/framearena.h"
 
 //@todo: bad dependency!
 #include "ai_navigator.h"
@@ -294,10 +295,11 @@ AI_Waypoint_t *CAI_Pathfinder::FindBestPath(int startID, int endID)
 	CVarBitVec	closeBS(nNodes);
 
 	// ------------- INITIALIZE ------------------------
-	float* nodeG = (float *)stackalloc( nNodes * sizeof(float) );
-	float* nodeH = (float *)stackalloc( nNodes * sizeof(float) );
-	float* nodeF = (float *)stackalloc( nNodes * sizeof(float) );
-	int*   nodeP = (int *)stackalloc( nNodes * sizeof(int) );		// Node parent 
+	CFrameArenaScope scratch;
+	float* nodeG = scratch.AllocArray<float>( nNodes );
+	float* nodeH = scratch.AllocArray<float>( nNodes );
+	float* nodeF = scratch.AllocArray<float>( nNodes );
+	int*   nodeP = scratch.AllocArray<int>( nNodes );		// Node parent 
 
 	for (int node=0;node<nNodes;node++)
 	{
@@ -391,7 +393,8 @@ AI_Waypoint_t* CAI_Pathfinder::FindShortRandomPath(int startID, float minPathLen
 	
 	MARK_TASK_EXPENSIVE();
 
-	int *nodeParent	= (int *)stackalloc( sizeof(int) * nNodes );
+	CFrameArenaScope scratch;
+	int *nodeParent	= scratch.AllocArray<int>( nNodes );
 	CVarBitVec closeBS(nNodes);
 	Vector vDirection = directionIn;
 
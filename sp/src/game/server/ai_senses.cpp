@@ -13,6 +13,7 @@
 #include "team.h"
 #include "ai_basenpc.h"
 #include "saverestore_utlvector.h"
+#include "mathlib/ssemath.h"
 
 #ifdef PORTAL
 	#include "portal_util_shared.h"
@@ -39,6 +40,312 @@ const float AI_MISC_SEARCH_TIME  = 0.45;
 
 CAI_SensedObjectsManager g_AI_SensedObjectsManager;
 
+//-----------------------------------------------------------------------------
+// Batched distance cull
+//
+// LookForNPCs() and LookForObjects() used to dereference every candidate for
+// every looking NPC just to read its origin. Candidate origins are instead
+// kept in SoA lanes and culled four at a time; only the survivors are touched,
+// and they are re-tested against their current origin.
+//
+// The lanes are rebuilt once per tick or when the candidate lists change.
+// Between rebuilds, any candidate whose abs origin changes (movement,
+// teleports, a moving parent) is reported by InvalidatePhysicsRecursive() and
+// its lane is refreshed before the next cull, so the survivors are exactly the
+// candidates the unbatched loops would have considered. ai_sense_cull_slack
+// only pads the SIMD compare against rounding differences with the exact
+// re-test.
+//
+// This removes the per-pair GetAbsOrigin() dereferences and nothing else.
+// FInViewCone() and FVisible() are still called serially from each NPC's
+// think: both are virtual and overridden widely, the LOS trace filters call
+// back into game code, and QuerySeeEntity()/WaitingUntilSeen() depend on think
+// order, so there is no separate sensing phase and no traces on the job pool.
+//-----------------------------------------------------------------------------
+
+ConVar ai_sense_batch_cull( "ai_sense_batch_cull", "1", 0, "Cull sensing candidates against a SIMD snapshot of their origins" );
+ConVar ai_sense_cull_slack( "ai_sense_cull_slack", "1", 0, "Padding added to the batched sensing cull radius to absorb float rounding" );
+
+struct AISenseLanes_t
+{
+	fltx4 x;
+	fltx4 y;
+	fltx4 z;
+	fltx4 always;	// lanes exempt from distance culling
+};
+
+typedef CUtlVectorFixedGrowable<int, 256> AISenseCullResult_t;
+
+class CAI_SenseCullSet
+{
+public:
+	CAI_SenseCullSet();
+
+	bool IsCurrent( int nSerial ) const	{ return ( m_nTick == gpGlobals->tickcount && m_nSerial == nSerial ); }
+	void Invalidate()					{ m_nTick = -1; }
+
+	void Begin( int nCount, int nSerial );
+	void Set( int i, CBaseEntity *pEntity, bool bAlways );
+	int Cull( const Vector &origin, float flRadius, AISenseCullResult_t *pResult ) const;
+
+	void NotePositionChanged( CBaseEntity *pEntity );
+	void RefreshMoved();
+
+private:
+	void SetOrigin( int i, const Vector &origin );
+
+	int m_nTick;
+	int m_nSerial;
+	int m_nCount;
+	CUtlVector< AISenseLanes_t, CUtlMemoryAligned< AISenseLanes_t, 16 > > m_Lanes;
+	CUtlVector<CBaseEntity *> m_Entities;
+	CUtlVector<bool> m_Moved;
+	CUtlVector<int> m_MovedSlots;
+	short m_EntrySlots[NUM_ENT_ENTRIES];	// handle entry index -> slot, verified against m_Entities
+};
+
+static CAI_SenseCullSet g_AI_SenseCullNPCs;
+static CAI_SenseCullSet g_AI_SenseCullObjects;
+
+struct AISenseStats_t
+{
+	int		nSnapshots;			// cull sets rebuilt
+	int		nGathers;			// NPC/object gathers run
+	int64	nRefreshes;			// snapshot entries refreshed after their candidate moved
+	int64	nPairsConsidered;	// viewer/candidate pairs before culling
+	int64	nPairsCulled;		// pairs rejected by the batched cull
+	int64	nLooks;				// pairs handed to Look()
+	int64	nFVisibleCalls;		// serial FVisible() calls made by CanSeeEntity()
+};
+
+static AISenseStats_t g_AI_SenseStats;
+
+//-------------------------------------
+
+CAI_SenseCullSet::CAI_SenseCullSet()
+ :	m_nTick( -1 ),
+	m_nSerial( -1 ),
+	m_nCount( 0 )
+{
+	memset( m_EntrySlots, 0xff, sizeof( m_EntrySlots ) );
+}
+
+//-------------------------------------
+
+void CAI_SenseCullSet::Begin( int nCount, int nSerial )
+{
+	m_nTick = gpGlobals->tickcount;
+	m_nSerial = nSerial;
+	m_nCount = nCount;
+
+	// Padding lanes sit far outside any look distance
+	AISenseLanes_t pad;
+	pad.x = pad.y = pad.z = ReplicateX4( 1.0e15f );
+	pad.always = LoadZeroSIMD();
+
+	m_Lanes.SetCount( ( nCount + 3 ) >> 2 );
+	for ( int i = 0; i < m_Lanes.Count(); i++ )
+	{
+		m_Lanes[i] = pad;
+	}
+
+	m_Entities.SetCount( nCount );
+	m_Moved.SetCount( nCount );
+	for ( int i = 0; i < nCount; i++ )
+	{
+		m_Entities[i] = NULL;
+		m_Moved[i] = false;
+	}
+	m_MovedSlots.RemoveAll();
+
+	g_AI_SenseStats.nSnapshots++;
+}
+
+//-------------------------------------
+
+void CAI_SenseCullSet::SetOrigin( int i, const Vector &origin )
+{
+	AISenseLanes_t &lanes = m_Lanes[i >> 2];
+	int iSub = i & 3;
+	SubFloat( lanes.x, iSub ) = origin.x;
+	SubFloat( lanes.y, iSub ) = origin.y;
+	SubFloat( lanes.z, iSub ) = origin.z;
+}
+
+//-------------------------------------
+
+void CAI_SenseCullSet::Set( int i, CBaseEntity *pEntity, bool bAlways )
+{
+	m_Entities[i] = pEntity;
+	m_EntrySlots[pEntity->GetRefEHandle().GetEntryIndex()] = i;
+
+	SetOrigin( i, pEntity->GetAbsOrigin() );
+	SubInt( m_Lanes[i >> 2].always, i & 3 ) = ( bAlways ) ? 0xffffffff : 0;
+}
+
+//-------------------------------------
+// Called from inside InvalidatePhysicsRecursive(), where the abs origin is
+// still dirty, so the lane is only flagged here and refreshed before the
+// next cull.
+
+void CAI_SenseCullSet::NotePositionChanged( CBaseEntity *pEntity )
+{
+	if ( m_nTick != gpGlobals->tickcount )
+		return;
+
+	int i = m_EntrySlots[pEntity->GetRefEHandle().GetEntryIndex()];
+	if ( i < 0 || i >= m_nCount || m_Entities[i] != pEntity || m_Moved[i] )
+		return;
+
+	m_Moved[i] = true;
+	m_MovedSlots.AddToTail( i );
+}
+
+//-------------------------------------
+
+void CAI_SenseCullSet::RefreshMoved()
+{
+	for ( int j = 0; j < m_MovedSlots.Count(); j++ )
+	{
+		int i = m_MovedSlots[j];
+		m_Moved[i] = false;
+		SetOrigin( i, m_Entities[i]->GetAbsOrigin() );
+	}
+
+	g_AI_SenseStats.nRefreshes += m_MovedSlots.Count();
+	m_MovedSlots.RemoveAll();
+}
+
+//-------------------------------------
+// Appends the indices of candidates within flRadius of origin, in order
+
+int CAI_SenseCullSet::Cull( const Vector &origin, float flRadius, AISenseCullResult_t *pResult ) const
+{
+	Assert( m_MovedSlots.Count() == 0 );
+
+	fltx4 ox = ReplicateX4( origin.x );
+	fltx4 oy = ReplicateX4( origin.y );
+	fltx4 oz = ReplicateX4( origin.z );
+	fltx4 radiusSq = ReplicateX4( flRadius * flRadius );
+
+	for ( int iLane = 0; iLane < m_Lanes.Count(); iLane++ )
+	{
+		const AISenseLanes_t &lanes = m_Lanes[iLane];
+		fltx4 dx = SubSIMD( lanes.x, ox );
+		fltx4 dy = SubSIMD( lanes.y, oy );
+		fltx4 dz = SubSIMD( lanes.z, oz );
+		fltx4 distSq = MaddSIMD( dx, dx, MaddSIMD( dy, dy, MulSIMD( dz, dz ) ) );
+
+		int mask = TestSignSIMD( OrSIMD( CmpLtSIMD( distSq, radiusSq ), lanes.always ) );
+		for ( int iSub = 0; mask; iSub++, mask >>= 1 )
+		{
+			if ( mask & 1 )
+			{
+				int i = ( iLane << 2 ) + iSub;
+				if ( i < m_nCount )
+				{
+					pResult->AddToTail( i );
+				}
+			}
+		}
+	}
+
+	return pResult->Count();
+}
+
+//-------------------------------------
+
+static float AI_SenseCullRadius( int iDistance )
+{
+	return (float)iDistance + MAX( ai_sense_cull_slack.GetFloat(), 0.0f );
+}
+
+//-------------------------------------
+
+static const CAI_SenseCullSet &AI_GetNPCCullSet()
+{
+	int serial = g_AI_Manager.GetChangeSerial();
+	if ( !g_AI_SenseCullNPCs.IsCurrent( serial ) )
+	{
+		CAI_BaseNPC **ppAIs = g_AI_Manager.AccessAIs();
+		int nAIs = g_AI_Manager.NumAIs();
+
+		g_AI_SenseCullNPCs.Begin( nAIs, serial );
+		for ( int i = 0; i < nAIs; i++ )
+		{
+			g_AI_SenseCullNPCs.Set( i, ppAIs[i], ppAIs[i]->ShouldNotDistanceCull() );
+		}
+	}
+	else
+	{
+		g_AI_SenseCullNPCs.RefreshMoved();
+	}
+	return g_AI_SenseCullNPCs;
+}
+
+//-------------------------------------
+// Mirrors GetFirst()/GetNext(), which stop at the first empty handle
+
+static const CAI_SenseCullSet &AI_GetObjectCullSet( int *pCount )
+{
+	int serial = g_AI_SensedObjectsManager.GetChangeSerial();
+	int nObjects = g_AI_SensedObjectsManager.NumObjects();
+	int i;
+
+	for ( i = 0; i < nObjects; i++ )
+	{
+		if ( !g_AI_SensedObjectsManager.GetSensedObject( i ) )
+			break;
+	}
+	*pCount = i;
+
+	if ( !g_AI_SenseCullObjects.IsCurrent( serial ) )
+	{
+		g_AI_SenseCullObjects.Begin( nObjects, serial );
+		for ( i = 0; i < *pCount; i++ )
+		{
+			g_AI_SenseCullObjects.Set( i, g_AI_SensedObjectsManager.GetSensedObject( i ), false );
+		}
+	}
+	else
+	{
+		g_AI_SenseCullObjects.RefreshMoved();
+	}
+	return g_AI_SenseCullObjects;
+}
+
+//-------------------------------------
+
+void AI_SenseNotePositionChanged( CBaseEntity *pEntity )
+{
+	g_AI_SenseCullNPCs.NotePositionChanged( pEntity );
+	g_AI_SenseCullObjects.NotePositionChanged( pEntity );
+}
+
+//-----------------------------------------------------------------------------
+
+CON_COMMAND( report_ai_sense_stats, "Report NPC sight culling counters. Pass 'reset' to clear them." )
+{
+	if ( !UTIL_IsCommandIssuedByServerAdmin() )
+		return;
+
+	if ( args.ArgC() > 1 && !Q_stricmp( args[1], "reset" ) )
+	{
+		memset( &g_AI_SenseStats, 0, sizeof( g_AI_SenseStats ) );
+		return;
+	}
+
+	const AISenseStats_t &stats = g_AI_SenseStats;
+	Msg( "AI sense stats (batched cull %s, slack %.0f)\n", ai_sense_batch_cull.GetBool() ? "on" : "off", ai_sense_cull_slack.GetFloat() );
+	Msg( "  snapshots:       %d\n", stats.nSnapshots );
+	Msg( "  moved refreshes: %lld\n", (long long)stats.nRefreshes );
+	Msg( "  gathers:         %d\n", stats.nGathers );
+	Msg( "  pairs considered: %lld\n", (long long)stats.nPairsConsidered );
+	Msg( "  pairs culled:    %lld (%.1f%%)\n", (long long)stats.nPairsCulled, ( stats.nPairsConsidered ) ? 100.0 * stats.nPairsCulled / stats.nPairsConsidered : 0.0 );
+	Msg( "  looks:           %lld\n", (long long)stats.nLooks );
+	Msg( "  FVisible calls (serial, in think order): %lld\n", (long long)stats.nFVisibleCalls );
+}
+
 //-----------------------------------------------------------------------------
 
 #pragma pack(push)
@@ -120,20 +427,20 @@ void CAI_Senses::Listen( void )
 	
 	if ( iSoundMask != SOUND_NONE && !(GetOuter()->HasSpawnFlags(SF_NPC_WAIT_TILL_SEEN)) )
 	{
-		int	iSound = CSoundEnt::ActiveList();
-		
-		while ( iSound != SOUNDLIST_EMPTY )
+		// Only sounds of interest that are loud enough to reach us come back, in active list order
+		int sounds[MAX_WORLD_SOUNDS_POOL];
+		int nSounds = CSoundEnt::GetSoundsInRange( GetOuter()->EarPosition(), GetOuter()->HearingSensitivity(), iSoundMask, sounds, ARRAYSIZE(sounds) );
+
+		for ( int i = 0; i < nSounds; i++ )
 		{
-			CSound *pCurrentSound = CSoundEnt::SoundPointerForIndex( iSound );
+			CSound *pCurrentSound = CSoundEnt::SoundPointerForIndex( sounds[i] );
 
-			if ( pCurrentSound	&& (iSoundMask & pCurrentSound->SoundType()) && CanHearSound( pCurrentSound ) )
+			if ( pCurrentSound && CanHearSound( pCurrentSound ) )
 			{
 	 			// the npc cares about this sound, and it's close enough to hear.
 				pCurrentSound->m_iNextAudible = m_iAudibleList;
-				m_iAudibleList = iSound;
+				m_iAudibleList = sounds[i];
 			}
-
-			iSound = pCurrentSound->NextSound();
 		}
 	}
 	
@@ -167,7 +474,11 @@ bool CAI_Senses::ShouldSeeEntity( CBaseEntity *pSightEnt )
 
 bool CAI_Senses::CanSeeEntity( CBaseEntity *pSightEnt )
 {
-	return ( GetOuter()->FInViewCone( pSightEnt ) && GetOuter()->FVisible( pSightEnt ) );
+	if ( !GetOuter()->FInViewCone( pSightEnt ) )
+		return false;
+
+	g_AI_SenseStats.nFVisibleCalls++;
+	return GetOuter()->FVisible( pSightEnt );
 }
 
 #ifdef PORTAL
@@ -359,6 +670,8 @@ void CAI_Senses::Look( int iDistance )
 
 bool CAI_Senses::Look( CBaseEntity *pSightEnt )
 {
+	g_AI_SenseStats.nLooks++;
+
 	if ( WaitingUntilSeen( pSightEnt ) )
 		return false;
 	
@@ -460,13 +773,37 @@ int CAI_Senses::LookForNPCs( int iDistance )
 
 			CAI_BaseNPC **ppAIs = g_AI_Manager.AccessAIs();
 			
-			for ( i = 0; i < g_AI_Manager.NumAIs(); i++ )
+			g_AI_SenseStats.nGathers++;
+			g_AI_SenseStats.nPairsConsidered += g_AI_Manager.NumAIs();
+
+			if ( ai_sense_batch_cull.GetBool() )
 			{
-				if ( ppAIs[i] != GetOuter() && ( ppAIs[i]->ShouldNotDistanceCull() || origin.DistToSqr(ppAIs[i]->GetAbsOrigin()) < distSq ) )
+				AISenseCullResult_t candidates;
+				AI_GetNPCCullSet().Cull( origin, AI_SenseCullRadius( iDistance ), &candidates );
+				g_AI_SenseStats.nPairsCulled += g_AI_Manager.NumAIs() - candidates.Count();
+
+				for ( int j = 0; j < candidates.Count(); j++ )
 				{
-					if ( Look( ppAIs[i] ) )
+					i = candidates[j];
+					if ( ppAIs[i] != GetOuter() && ( ppAIs[i]->ShouldNotDistanceCull() || origin.DistToSqr(ppAIs[i]->GetAbsOrigin()) < distSq ) )
 					{
-						nSeen++;
+						if ( Look( ppAIs[i] ) )
+						{
+							nSeen++;
+						}
+					}
+				}
+			}
+			else
+			{
+				for ( i = 0; i < g_AI_Manager.NumAIs(); i++ )
+				{
+					if ( ppAIs[i] != GetOuter() && ( ppAIs[i]->ShouldNotDistanceCull() || origin.DistToSqr(ppAIs[i]->GetAbsOrigin()) < distSq ) )
+					{
+						if ( Look( ppAIs[i] ) )
+						{
+							nSeen++;
+						}
 					}
 				}
 			}
@@ -516,18 +853,46 @@ int CAI_Senses::LookForObjects( int iDistance )
 
 		float distSq = ( iDistance * iDistance );
 		const Vector &origin = GetAbsOrigin();
-		int iter;
-		CBaseEntity *pEnt = g_AI_SensedObjectsManager.GetFirst( &iter );
-		while ( pEnt )
+
+		g_AI_SenseStats.nGathers++;
+
+		if ( ai_sense_batch_cull.GetBool() )
 		{
-			if ( pEnt->GetFlags() & BOX_QUERY_MASK )
+			int nObjects;
+			AISenseCullResult_t candidates;
+			AI_GetObjectCullSet( &nObjects ).Cull( origin, AI_SenseCullRadius( iDistance ), &candidates );
+			g_AI_SenseStats.nPairsConsidered += nObjects;
+
+			int j;
+			for ( j = 0; j < candidates.Count() && candidates[j] < nObjects; j++ )
 			{
-				if ( origin.DistToSqr(pEnt->GetAbsOrigin()) < distSq && Look( pEnt) )
+				CBaseEntity *pEnt = g_AI_SensedObjectsManager.GetSensedObject( candidates[j] );
+				if ( pEnt->GetFlags() & BOX_QUERY_MASK )
 				{
-					nSeen++;
+					if ( origin.DistToSqr(pEnt->GetAbsOrigin()) < distSq && Look( pEnt) )
+					{
+						nSeen++;
+					}
+				}
+			}
+			g_AI_SenseStats.nPairsCulled += nObjects - j;
+		}
+		else
+		{
+			int iter;
+			CBaseEntity *pEnt = g_AI_SensedObjectsManager.GetFirst( &iter );
+			while ( pEnt )
+			{
+				g_AI_SenseStats.nPairsConsidered++;
+				if ( pEnt->GetFlags() & BOX_QUERY_MASK )
+				{
+					if ( origin.DistToSqr(pEnt->GetAbsOrigin()) < distSq && Look( pEnt) )
+					{
+						nSeen++;
+					}
 				}
+				pEnt = g_AI_SensedObjectsManager.GetNext( &iter );
 			}
-			pEnt = g_AI_SensedObjectsManager.GetNext( &iter );
 		}
 		
 		EndGather( nSeen, &m_SeenMisc );
@@ -675,6 +1040,7 @@ void CAI_SensedObjectsManager::Init()
 	}
 
 	gEntList.AddListenerEntity( this );
+	m_nChangeSerial++;
 }
 
 //-----------------------------------------------------------------------------
@@ -683,6 +1049,7 @@ void CAI_SensedObjectsManager::Term()
 {
 	gEntList.RemoveListenerEntity( this );
 	m_SensedObjects.RemoveAll();
+	m_nChangeSerial++;
 }
 
 //-----------------------------------------------------------------------------
@@ -721,6 +1088,7 @@ void CAI_SensedObjectsManager::OnEntitySpawned( CBaseEntity *pEntity )
 	if ( ( pEntity->GetFlags() & FL_OBJECT ) && !pEntity->IsPlayer() && !pEntity->IsNPC() )
 	{
 		m_SensedObjects.AddToTail( pEntity );
+		m_nChangeSerial++;
 	}
 }
 
@@ -732,7 +1100,10 @@ void CAI_SensedObjectsManager::OnEntityDeleted( CBaseEntity *pEntity )
 	{
 		int i = m_SensedObjects.Find( pEntity );
 		if ( i != m_SensedObjects.InvalidIndex() )
+		{
 			m_SensedObjects.FastRemove( i );
+			m_nChangeSerial++;
+		}
 	}
 }
 
@@ -747,6 +1118,7 @@ void CAI_SensedObjectsManager::AddEntity( CBaseEntity *pEntity )
 	// Add the object flag so it gets removed when it dies
 	pEntity->AddFlag( FL_OBJECT );
 	m_SensedObjects.AddToTail( pEntity );
+	m_nChangeSerial++;
 }
 
 //=============================================================================
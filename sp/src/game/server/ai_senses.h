@@ -145,12 +145,18 @@ private:
 class CAI_SensedObjectsManager : public IEntityListener
 {
 public:
+	CAI_SensedObjectsManager() : m_nChangeSerial( 0 ) {}
+
 	void Init();
 	void Term();
 
 	CBaseEntity *	GetFirst( int *pIter );
 	CBaseEntity *	GetNext( int *pIter );
 
+	int				NumObjects() const				{ return m_SensedObjects.Count(); }
+	CBaseEntity *	GetSensedObject( int i ) const	{ return m_SensedObjects[i]; }
+	int				GetChangeSerial() const			{ return m_nChangeSerial; }
+
 	virtual void 	AddEntity( CBaseEntity *pEntity );
 
 private:
@@ -158,10 +164,15 @@ private:
 	virtual void 	OnEntityDeleted( CBaseEntity *pEntity );
 
 	CUtlVector<EHANDLE> m_SensedObjects;
+	int					m_nChangeSerial;
 };
 
 extern CAI_SensedObjectsManager g_AI_SensedObjectsManager;
 
+// Called by InvalidatePhysicsRecursive() when an entity's abs origin changes,
+// so the batched sight cull refreshes that entity before the next look
+void AI_SenseNotePositionChanged( CBaseEntity *pEntity );
+
 //-----------------------------------------------------------------------------
 
 
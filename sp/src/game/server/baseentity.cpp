@@ -60,6 +60,7 @@
 #include "datacache/imdlcache.h"
 #include "ModelSoundsCache.h"
 #include "env_debughistory.h"
+#include "entityio_trace.h"
 #include "tier1/utlstring.h"
 #include "utlhashtable.h"
 
@@ -3007,6 +3008,12 @@ FORCEINLINE bool NamesMatch( const char *pszQuery, string_t nameToMatch )
 	return false;
 }
 
+void CBaseEntity::SetName( string_t newName )
+{
+	m_iName = newName;
+	gEntList.UpdateNameIndex( this );
+}
+
 bool CBaseEntity::NameMatchesComplex( const char *pszNameOrWildcard )
 {
 	if ( !Q_stricmp( "!player", pszNameOrWildcard) )
@@ -3181,6 +3188,9 @@ int CBaseEntity::Restore( IRestore &restore )
 	// loops through the data description list, restoring each data desc block in order
 	int status = RestoreDataDescBlock( restore, GetDataDescMap() );
 
+	// m_iName was read straight into the field
+	gEntList.UpdateNameIndex( this );
+
 	// ---------------------------------------------------------------
 	// HACKHACK: We don't know the space of these vectors until now
 	// if they are worldspace, fix them up.
@@ -3859,6 +3869,59 @@ void CBaseEntity::OnEntityEvent( EntityEvent_t event, void *pEventData )
 ConVar ent_messages_draw( "ent_messages_draw", "0", FCVAR_CHEAT, "Visualizes all entity input/output activity." );
 
 
+//-----------------------------------------------------------------------------
+// Input dispatch tables. Each datamap gets a caseless hash from input name to
+// its typedescription, covering its base maps too, built the first time an
+// entity using that datamap receives an input. Where a derived class and a base
+// class declare the same input, the derived one wins, as with a walk of the chain.
+//-----------------------------------------------------------------------------
+typedef CUtlHashtable< const char *, typedescription_t *, CaselessStringHashFunctor, CaselessStringEqualFunctor > InputDispatchTable_t;
+static CUtlHashtable< datamap_t *, InputDispatchTable_t *, PointerHashFunctor, PointerEqualFunctor > s_InputDispatchTables;
+
+static typedescription_t *FindInputDescLinear( datamap_t *pMap, const char *szInputName )
+{
+	for ( datamap_t *dmap = pMap; dmap != NULL; dmap = dmap->baseMap )
+	{
+		for ( int i = 0; i < dmap->dataNumFields; i++ )
+		{
+			if ( ( dmap->dataDesc[i].flags & FTYPEDESC_INPUT ) && !Q_stricmp( dmap->dataDesc[i].externalName, szInputName ) )
+				return &dmap->dataDesc[i];
+		}
+	}
+
+	return NULL;
+}
+
+static InputDispatchTable_t *GetInputDispatchTable( datamap_t *pMap )
+{
+	UtlHashHandle_t h = s_InputDispatchTables.Find( pMap );
+	if ( h != s_InputDispatchTables.InvalidHandle() )
+		return s_InputDispatchTables.Element( h );
+
+	InputDispatchTable_t *pTable = new InputDispatchTable_t;
+	for ( datamap_t *dmap = pMap; dmap != NULL; dmap = dmap->baseMap )
+	{
+		for ( int i = 0; i < dmap->dataNumFields; i++ )
+		{
+			typedescription_t *pDesc = &dmap->dataDesc[i];
+			if ( ( pDesc->flags & FTYPEDESC_INPUT ) && pDesc->externalName && !pTable->HasElement( pDesc->externalName ) )
+			{
+				pTable->Insert( pDesc->externalName, pDesc );
+			}
+		}
+	}
+
+	s_InputDispatchTables.Insert( pMap, pTable );
+	return pTable;
+}
+
+static typedescription_t *FindInputDesc( datamap_t *pMap, const char *szInputName )
+{
+	InputDispatchTable_t *pTable = GetInputDispatchTable( pMap );
+	UtlHashHandle_t h = pTable->Find( szInputName );
+	return ( h != pTable->InvalidHandle() ) ? pTable->Element( h ) : NULL;
+}
+
 //-----------------------------------------------------------------------------
 // Purpose: calls the appropriate message mapped function in the entity according
 //			to the fired action.
@@ -3881,92 +3944,169 @@ bool CBaseEntity::AcceptInput( const char *szInputName, CBaseEntity *pActivator,
 		NDebugOverlay::Box( GetAbsOrigin(), Vector(-4, -4, -4), Vector(4, 4, 4), 0, 255, 0, 0, 3 );
 	}
 
-	// loop through the data description list, restoring each data desc block
-	for ( datamap_t *dmap = GetDataDescMap(); dmap != NULL; dmap = dmap->baseMap )
+	// look up the input in the data description chain
+	typedescription_t *pInputDesc = FindInputDesc( GetDataDescMap(), szInputName );
+	if ( pInputDesc )
 	{
-		// search through all the actions in the data description, looking for a match
-		for ( int i = 0; i < dmap->dataNumFields; i++ )
+		if ( ent_io_trace.GetBool() )
+		{
+			g_EntityIOTrace.RecordInput( this, pInputDesc->externalName, pCaller, Value );
+		}
+
+		// mapper debug message
+		if ( EntityIO_ShouldFormatDebugText() )
 		{
-			if ( dmap->dataDesc[i].flags & FTYPEDESC_INPUT )
+			char szBuffer[256];
+			if (pCaller != NULL)
 			{
-				if ( !Q_stricmp(dmap->dataDesc[i].externalName, szInputName) )
+				Q_snprintf( szBuffer, sizeof(szBuffer), "(%0.2f) input %s: %s.%s(%s)\n", gpGlobals->curtime, STRING(pCaller->m_iName), GetDebugName(), szInputName, Value.String() );
+			}
+			else
+			{
+				Q_snprintf( szBuffer, sizeof(szBuffer), "(%0.2f) input <NULL>: %s.%s(%s)\n", gpGlobals->curtime, GetDebugName(), szInputName, Value.String() );
+			}
+			DevMsg( 2, "%s", szBuffer );
+			ADD_DEBUG_HISTORY( HISTORY_ENTITY_IO, szBuffer );
+		}
+
+		if (m_debugOverlays & OVERLAY_MESSAGE_BIT)
+		{
+			DrawInputOverlay(szInputName,pCaller,Value);
+		}
+
+		// convert the value if necessary
+		if ( Value.FieldType() != pInputDesc->fieldType )
+		{
+			if ( !(Value.FieldType() == FIELD_VOID && pInputDesc->fieldType == FIELD_STRING) ) // allow empty strings
+			{
+				if ( !Value.Convert( (fieldtype_t)pInputDesc->fieldType ) )
 				{
-					// found a match
+					// bad conversion
+					Warning( "!! ERROR: bad input/output link:\n!! %s(%s,%s) doesn't match type from %s(%s)\n", 
+						STRING(m_iClassname), GetDebugName(), szInputName, 
+						( pCaller != NULL ) ? STRING(pCaller->m_iClassname) : "<null>",
+						( pCaller != NULL ) ? STRING(pCaller->m_iName) : "<null>" );
+					return false;
+				}
+			}
+		}
 
-					char szBuffer[256];
-					// mapper debug message
-					if (pCaller != NULL)
-					{
-						Q_snprintf( szBuffer, sizeof(szBuffer), "(%0.2f) input %s: %s.%s(%s)\n", gpGlobals->curtime, STRING(pCaller->m_iName), GetDebugName(), szInputName, Value.String() );
-					}
-					else
-					{
-						Q_snprintf( szBuffer, sizeof(szBuffer), "(%0.2f) input <NULL>: %s.%s(%s)\n", gpGlobals->curtime, GetDebugName(), szInputName, Value.String() );
-					}
-					DevMsg( 2, "%s", szBuffer );
-					ADD_DEBUG_HISTORY( HISTORY_ENTITY_IO, szBuffer );
+		// call the input handler, or if there is none just set the value
+		inputfunc_t pfnInput = pInputDesc->inputFunc;
 
-					if (m_debugOverlays & OVERLAY_MESSAGE_BIT)
-					{
-						DrawInputOverlay(szInputName,pCaller,Value);
-					}
+		if ( pfnInput )
+		{ 
+			// Package the data into a struct for passing to the input handler.
+			inputdata_t data;
+			data.pActivator = pActivator;
+			data.pCaller = pCaller;
+			data.value = Value;
+			data.nOutputID = outputID;
 
-					// convert the value if necessary
-					if ( Value.FieldType() != dmap->dataDesc[i].fieldType )
-					{
-						if ( !(Value.FieldType() == FIELD_VOID && dmap->dataDesc[i].fieldType == FIELD_STRING) ) // allow empty strings
-						{
-							if ( !Value.Convert( (fieldtype_t)dmap->dataDesc[i].fieldType ) )
-							{
-								// bad conversion
-								Warning( "!! ERROR: bad input/output link:\n!! %s(%s,%s) doesn't match type from %s(%s)\n", 
-									STRING(m_iClassname), GetDebugName(), szInputName, 
-									( pCaller != NULL ) ? STRING(pCaller->m_iClassname) : "<null>",
-									( pCaller != NULL ) ? STRING(pCaller->m_iName) : "<null>" );
-								return false;
-							}
-						}
-					}
+			(this->*pfnInput)( data );
+		}
+		else if ( pInputDesc->flags & FTYPEDESC_KEY )
+		{
+			// set the value directly
+			Value.SetOther( ((char*)this) + pInputDesc->fieldOffset[ TD_OFFSET_NORMAL ]);
+		
+			// TODO: if this becomes evil and causes too many full entity updates, then we should make
+			// a macro like this:
+			//
+			// define MAKE_INPUTVAR(x) void Note##x##Modified() { x.GetForModify(); }
+			//
+			// Then the datadesc points at that function and we call it here. The only pain is to add
+			// that function for all the DEFINE_INPUT calls.
+			NetworkStateChanged();
+		}
 
-					// call the input handler, or if there is none just set the value
-					inputfunc_t pfnInput = dmap->dataDesc[i].inputFunc;
+		return true;
+	}
 
-					if ( pfnInput )
-					{ 
-						// Package the data into a struct for passing to the input handler.
-						inputdata_t data;
-						data.pActivator = pActivator;
-						data.pCaller = pCaller;
-						data.value = Value;
-						data.nOutputID = outputID;
+	if ( ent_io_trace.GetBool() )
+	{
+		g_EntityIOTrace.RecordInputUnhandled( this, szInputName, pCaller );
+	}
 
-						(this->*pfnInput)( data );
-					}
-					else if ( dmap->dataDesc[i].flags & FTYPEDESC_KEY )
-					{
-						// set the value directly
-						Value.SetOther( ((char*)this) + dmap->dataDesc[i].fieldOffset[ TD_OFFSET_NORMAL ]);
-					
-						// TODO: if this becomes evil and causes too many full entity updates, then we should make
-						// a macro like this:
-						//
-						// define MAKE_INPUTVAR(x) void Note##x##Modified() { x.GetForModify(); }
-						//
-						// Then the datadesc points at that function and we call it here. The only pain is to add
-						// that function for all the DEFINE_INPUT calls.
-						NetworkStateChanged();
-					}
+	DevMsg( 2, "unhandled input: (%s) -> (%s,%s)\n", szInputName, STRING(m_iClassname), GetDebugName()/*,", from (%s,%s)" STRING(pCaller->m_iClassname), STRING(pCaller->m_iName)*/ );
+	return false;
+}
 
-					return true;
-				}
+//-----------------------------------------------------------------------------
+// Purpose: Times input lookups against every entity in the level, hashed and
+//			with the old walk of the datamap chain. Inputs are only looked up,
+//			not fired.
+//-----------------------------------------------------------------------------
+CON_COMMAND_F( ent_input_benchmark, "Time entity input dispatch lookups. Arguments: [iterations]", FCVAR_CHEAT )
+{
+	if ( !UTIL_IsCommandIssuedByServerAdmin() )
+		return;
+
+	static const char *s_pInputNames[] =
+	{
+		"Use", "Kill", "Toggle", "Enable", "FireUser1", "SetParent", "AddOutput", "NotAnInput",
+	};
+
+	int nIterations = ( args.ArgC() > 1 ) ? MAX( atoi( args[1] ), 1 ) : 100;
+
+	CUtlVector< datamap_t * > maps;
+	for ( CBaseEntity *pEntity = gEntList.FirstEnt(); pEntity; pEntity = gEntList.NextEnt( pEntity ) )
+	{
+		maps.AddToTail( pEntity->GetDataDescMap() );
+	}
+
+	if ( !maps.Count() )
+		return;
+
+	// Build the tables up front so they aren't part of the timing
+	for ( int i = 0; i < maps.Count(); i++ )
+	{
+		GetInputDispatchTable( maps[i] );
+	}
+
+	int nFoundLinear = 0;
+	int nFoundHashed = 0;
+	CFastTimer timer;
+
+	timer.Start();
+	for ( int n = 0; n < nIterations; n++ )
+	{
+		for ( int i = 0; i < maps.Count(); i++ )
+		{
+			for ( int j = 0; j < ARRAYSIZE( s_pInputNames ); j++ )
+			{
+				nFoundLinear += FindInputDescLinear( maps[i], s_pInputNames[j] ) ? 1 : 0;
 			}
 		}
 	}
+	timer.End();
+	float flLinear = timer.GetDuration().GetMillisecondsF();
 
-	DevMsg( 2, "unhandled input: (%s) -> (%s,%s)\n", szInputName, STRING(m_iClassname), GetDebugName()/*,", from (%s,%s)" STRING(pCaller->m_iClassname), STRING(pCaller->m_iName)*/ );
-	return false;
+	timer.Start();
+	for ( int n = 0; n < nIterations; n++ )
+	{
+		for ( int i = 0; i < maps.Count(); i++ )
+		{
+			for ( int j = 0; j < ARRAYSIZE( s_pInputNames ); j++ )
+			{
+				nFoundHashed += FindInputDesc( maps[i], s_pInputNames[j] ) ? 1 : 0;
+			}
+		}
+	}
+	timer.End();
+	float flHashed = timer.GetDuration().GetMillisecondsF();
+
+	int nLookups = nIterations * maps.Count() * ARRAYSIZE( s_pInputNames );
+	Msg( "ent_input_benchmark: %d lookups over %d entities, %d dispatch tables\n", nLookups, maps.Count(), s_InputDispatchTables.Count() );
+	Msg( "  datamap walk: %.3f ms (%.1f ns per lookup)\n", flLinear, flLinear * 1000000.0f / nLookups );
+	Msg( "  hashed:       %.3f ms (%.1f ns per lookup)\n", flHashed, flHashed * 1000000.0f / nLookups );
+	if ( nFoundLinear != nFoundHashed )
+	{
+		Warning( "ent_input_benchmark: lookups disagree (%d found by walk, %d hashed)\n", nFoundLinear, nFoundHashed );
+	}
 }
 
+
 //-----------------------------------------------------------------------------
 // Purpose: Input handler for the entity alpha.
 // Input  : nAlpha - Alpha value (0 - 255).
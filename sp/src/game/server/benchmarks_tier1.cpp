@@ -0,0 +1,1104 @@
+//========= Copyright Valve Corporation, All rights reserved. ============//
+//
+// Purpose: Console benchmarks for the tier1 and mathlib code the server
+//			leans on: memory pools, symbol tables, KeyValues, bitbuf and the
+//			SIMD kernels. Each one times the current code against the way it
+//			used to work.
+//
+// $NoKeywords: $
+//=============================================================================//
+
+#include "cbase.h"
+#include "tier1/mempool.h"
+#include "tier1/utlsymbol.h"
+#include "filesystem.h"
+#include "tier1/fmtstr.h"
+#include "coordsize.h"
+#include "mathlib/ssemath8.h"
+
+// memdbgon must be the last include file in a .cpp file!!!
+#include "tier0/memdbgon.h"
+
+//-----------------------------------------------------------------------------
+// Purpose: Multithreaded alloc/free benchmark for CMemoryPoolMT, against a
+//			pool that takes a lock around every call like it used to.
+//-----------------------------------------------------------------------------
+class CMemoryPoolLockedBench : public CUtlMemoryPool
+{
+public:
+	CMemoryPoolLockedBench( int blockSize, int numElements ) : CUtlMemoryPool( blockSize, numElements, UTLMEMORYPOOL_GROW_FAST, "CMemoryPoolLockedBench" ) {}
+
+	void *Alloc()				{ AUTO_LOCK( m_mutex ); return CUtlMemoryPool::Alloc(); }
+	void Free( void *pMem )		{ AUTO_LOCK( m_mutex ); CUtlMemoryPool::Free( pMem ); }
+	void Clear()				{ AUTO_LOCK( m_mutex ); CUtlMemoryPool::Clear(); }
+	void FlushThreadCache()		{}
+
+private:
+	CThreadFastMutex m_mutex;
+};
+
+#define MEMPOOL_BENCH_MAX_THREADS	16
+#define MEMPOOL_BENCH_LIVE			64
+#define MEMPOOL_BENCH_BLOCK_SIZE	48
+
+template< class POOL >
+struct MemPoolBenchThread_t
+{
+	POOL *				m_pPool;
+	int					m_nOps;
+	int					m_iPhase;
+	void **				m_pOwn;		// filled in phase 0
+	void **				m_pOther;	// another thread's blocks, freed in phase 1
+	int					m_nOther;
+
+	static unsigned Run( void *pParam )
+	{
+		MemPoolBenchThread_t *pThis = (MemPoolBenchThread_t *)pParam;
+		POOL *pPool = pThis->m_pPool;
+
+		if ( pThis->m_iPhase == 0 )
+		{
+			// Local churn with a small working set, then keep a batch alive
+			void *live[MEMPOOL_BENCH_LIVE];
+			memset( live, 0, sizeof( live ) );
+			unsigned int nSeed = (unsigned int)(uintp)pThis;
+			for ( int i = 0; i < pThis->m_nOps; i++ )
+			{
+				nSeed = nSeed * 1103515245 + 12345;
+				int iSlot = ( nSeed >> 16 ) % MEMPOOL_BENCH_LIVE;
+				if ( live[iSlot] )
+				{
+					pPool->Free( live[iSlot] );
+					live[iSlot] = NULL;
+				}
+				else
+				{
+					live[iSlot] = pPool->Alloc();
+				}
+			}
+			for ( int i = 0; i < MEMPOOL_BENCH_LIVE; i++ )
+			{
+				if ( live[i] )
+					pPool->Free( live[i] );
+			}
+			for ( int i = 0; i < pThis->m_nOps / 4; i++ )
+			{
+				pThis->m_pOwn[i] = pPool->Alloc();
+			}
+		}
+		else
+		{
+			// Free blocks that were allocated on another thread
+			for ( int i = 0; i < pThis->m_nOther; i++ )
+			{
+				pPool->Free( pThis->m_pOther[i] );
+			}
+		}
+		pPool->FlushThreadCache();
+		return 0;
+	}
+};
+
+template< class POOL >
+static void MemPoolBenchRunPhase( MemPoolBenchThread_t<POOL> *pThreads, int nThreads, int iPhase )
+{
+	ThreadHandle_t hThreads[MEMPOOL_BENCH_MAX_THREADS];
+	for ( int i = 0; i < nThreads; i++ )
+	{
+		pThreads[i].m_iPhase = iPhase;
+		hThreads[i] = CreateSimpleThread( &MemPoolBenchThread_t<POOL>::Run, &pThreads[i] );
+	}
+	for ( int i = 0; i < nThreads; i++ )
+	{
+		ThreadJoin( hThreads[i] );
+		ReleaseThreadHandle( hThreads[i] );
+	}
+}
+
+template< class POOL >
+static void MemPoolBenchRun( POOL *pPool, int nThreads, int nOps, float *pflChurnMs, float *pflCrossMs )
+{
+	int nKept = nOps / 4;
+	CUtlVector< void * > blocks;
+	blocks.SetCount( nThreads * MAX( nKept, 1 ) );
+
+	MemPoolBenchThread_t<POOL> threads[MEMPOOL_BENCH_MAX_THREADS];
+	for ( int i = 0; i < nThreads; i++ )
+	{
+		threads[i].m_pPool = pPool;
+		threads[i].m_nOps = nOps;
+		threads[i].m_pOwn = blocks.Base() + i * MAX( nKept, 1 );
+	}
+	for ( int i = 0; i < nThreads; i++ )
+	{
+		threads[i].m_pOther = threads[( i + 1 ) % nThreads].m_pOwn;
+		threads[i].m_nOther = nKept;
+	}
+
+	double flStart = Plat_FloatTime();
+	MemPoolBenchRunPhase( threads, nThreads, 0 );
+	double flMid = Plat_FloatTime();
+	MemPoolBenchRunPhase( threads, nThreads, 1 );
+	double flEnd = Plat_FloatTime();
+
+	*pflChurnMs = ( flMid - flStart ) * 1000.0f;
+	*pflCrossMs = ( flEnd - flMid ) * 1000.0f;
+}
+
+CON_COMMAND_F( mempool_mt_benchmark, "Times multithreaded alloc/free on CMemoryPoolMT against a locked pool. Usage: mempool_mt_benchmark [threads] [ops per thread]", FCVAR_CHEAT )
+{
+	if ( !UTIL_IsCommandIssuedByServerAdmin() )
+		return;
+
+	int nThreads = ( args.ArgC() > 1 ) ? atoi( args[1] ) : 4;
+	int nOps = ( args.ArgC() > 2 ) ? atoi( args[2] ) : 200000;
+	nThreads = clamp( nThreads, 1, MEMPOOL_BENCH_MAX_THREADS );
+	nOps = MAX( nOps, 4 );
+
+	float flLockedChurn, flLockedCross;
+	{
+		CMemoryPoolLockedBench pool( MEMPOOL_BENCH_BLOCK_SIZE, 256 );
+		MemPoolBenchRun( &pool, nThreads, nOps, &flLockedChurn, &flLockedCross );
+	}
+
+	float flMTChurn, flMTCross;
+	int nCount, nPeak;
+	{
+		CMemoryPoolMT pool( MEMPOOL_BENCH_BLOCK_SIZE, 256, UTLMEMORYPOOL_GROW_FAST, "mempool_mt_benchmark" );
+		MemPoolBenchRun( &pool, nThreads, nOps, &flMTChurn, &flMTCross );
+		nCount = pool.Count();
+		nPeak = pool.PeakCount();
+	}
+
+	Msg( "mempool_mt_benchmark: %d threads, %d ops each, %d byte blocks\n", nThreads, nOps, MEMPOOL_BENCH_BLOCK_SIZE );
+	Msg( "  locked pool:    churn %8.2f ms   cross-thread free %8.2f ms\n", flLockedChurn, flLockedCross );
+	Msg( "  CMemoryPoolMT:  churn %8.2f ms   cross-thread free %8.2f ms\n", flMTChurn, flMTCross );
+	Msg( "  speedup:        churn %8.2fx    cross-thread free %8.2fx\n",
+		flLockedChurn / MAX( flMTChurn, 0.001f ), flLockedCross / MAX( flMTCross, 0.001f ) );
+	Msg( "  CMemoryPoolMT count after run %d, peak %d\n", nCount, nPeak );
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Times the symbol table against the red-black tree it used to be,
+//			using the key names from the game's script and resource files.
+//-----------------------------------------------------------------------------
+#define SYMBOL_BENCH_MAX_THREADS	16
+
+static void SymbolBenchCollectKeys( KeyValues *pKeys, CUtlVector<CUtlString> &keys )
+{
+	for ( KeyValues *pKey = pKeys; pKey; pKey = pKey->GetNextKey() )
+	{
+		keys.AddToTail( pKey->GetName() );
+		if ( pKey->GetFirstSubKey() )
+		{
+			SymbolBenchCollectKeys( pKey->GetFirstSubKey(), keys );
+		}
+	}
+}
+
+static void SymbolBenchLoadFiles( const char *pszWildcard, CUtlVector<CUtlString> &keys, int *pnFiles, double *pflParseTime )
+{
+	char szDir[MAX_PATH];
+	V_ExtractFilePath( pszWildcard, szDir, sizeof( szDir ) );
+
+	FileFindHandle_t hFind;
+	for ( const char *pszFile = filesystem->FindFirstEx( pszWildcard, "GAME", &hFind ); pszFile; pszFile = filesystem->FindNext( hFind ) )
+	{
+		if ( filesystem->FindIsDirectory( hFind ) )
+			continue;
+
+		char szPath[MAX_PATH];
+		V_snprintf( szPath, sizeof( szPath ), "%s%s", szDir, pszFile );
+
+		KeyValues *pKeys = new KeyValues( pszFile );
+		double flStart = Plat_FloatTime();
+		bool bLoaded = pKeys->LoadFromFile( filesystem, szPath, "GAME" );
+		*pflParseTime += Plat_FloatTime() - flStart;
+
+		if ( bLoaded )
+		{
+			(*pnFiles)++;
+			SymbolBenchCollectKeys( pKeys, keys );
+		}
+		pKeys->deleteThis();
+	}
+	filesystem->FindClose( hFind );
+}
+
+typedef CUtlRBTree<const char *, int> SymbolBenchTree_t;
+
+struct SymbolBenchThread_t
+{
+	const CUtlVector<CUtlString> *	m_pKeys;
+	int								m_nPasses;
+	SymbolBenchTree_t *				m_pTree;		// searched under m_pLock if set
+	CThreadSpinRWLock *				m_pLock;
+	const CUtlSymbolTableMT *		m_pTable;
+	int								m_nFound;
+
+	static unsigned Run( void *pParam )
+	{
+		SymbolBenchThread_t *pThis = (SymbolBenchThread_t *)pParam;
+		const CUtlVector<CUtlString> &keys = *pThis->m_pKeys;
+		for ( int nPass = 0; nPass < pThis->m_nPasses; nPass++ )
+		{
+			for ( int i = 0; i < keys.Count(); i++ )
+			{
+				if ( pThis->m_pTree )
+				{
+					pThis->m_pLock->LockForRead();
+					pThis->m_nFound += ( pThis->m_pTree->Find( keys[i].Get() ) != pThis->m_pTree->InvalidIndex() );
+					pThis->m_pLock->UnlockRead();
+				}
+				else
+				{
+					pThis->m_nFound += pThis->m_pTable->Find( keys[i].Get() ).IsValid();
+				}
+			}
+		}
+		return 0;
+	}
+};
+
+static float SymbolBenchRunThreads( SymbolBenchThread_t *pThreads, int nThreads )
+{
+	ThreadHandle_t hThreads[SYMBOL_BENCH_MAX_THREADS];
+	double flStart = Plat_FloatTime();
+	for ( int i = 0; i < nThreads; i++ )
+	{
+		hThreads[i] = CreateSimpleThread( &SymbolBenchThread_t::Run, &pThreads[i] );
+	}
+	for ( int i = 0; i < nThreads; i++ )
+	{
+		ThreadJoin( hThreads[i] );
+		ReleaseThreadHandle( hThreads[i] );
+	}
+	return ( Plat_FloatTime() - flStart ) * 1000.0f;
+}
+
+CON_COMMAND_F( symbol_table_benchmark, "Times symbol lookups on the key names from scripts/ and resource/. Usage: symbol_table_benchmark [passes] [threads]", FCVAR_CHEAT )
+{
+	if ( !UTIL_IsCommandIssuedByServerAdmin() )
+		return;
+
+	int nPasses = ( args.ArgC() > 1 ) ? MAX( atoi( args[1] ), 1 ) : 20;
+	int nThreads = ( args.ArgC() > 2 ) ? clamp( atoi( args[2] ), 1, SYMBOL_BENCH_MAX_THREADS ) : 4;
+
+	CUtlVector<CUtlString> keys;
+	int nFiles = 0;
+	double flParseTime = 0;
+	SymbolBenchLoadFiles( "scripts/*.txt", keys, &nFiles, &flParseTime );
+	SymbolBenchLoadFiles( "resource/*.res", keys, &nFiles, &flParseTime );
+	SymbolBenchLoadFiles( "resource/ui/*.res", keys, &nFiles, &flParseTime );
+	if ( !keys.Count() )
+	{
+		Msg( "symbol_table_benchmark: no keys found in scripts/ or resource/\n" );
+		return;
+	}
+
+	// Both are case insensitive, like KeyValues key names
+	SymbolBenchTree_t tree( 0, 32, CaselessStringLessThan );
+	CUtlSymbolTableMT table( 0, 32, true );
+
+	double flStart = Plat_FloatTime();
+	for ( int i = 0; i < keys.Count(); i++ )
+	{
+		if ( tree.Find( keys[i].Get() ) == tree.InvalidIndex() )
+		{
+			tree.Insert( keys[i].Get() );
+		}
+	}
+	float flTreeAdd = ( Plat_FloatTime() - flStart ) * 1000.0f;
+
+	flStart = Plat_FloatTime();
+	for ( int i = 0; i < keys.Count(); i++ )
+	{
+		table.AddString( keys[i].Get() );
+	}
+	float flTableAdd = ( Plat_FloatTime() - flStart ) * 1000.0f;
+
+	int nTreeFound = 0;
+	flStart = Plat_FloatTime();
+	for ( int nPass = 0; nPass < nPasses; nPass++ )
+	{
+		for ( int i = 0; i < keys.Count(); i++ )
+		{
+			nTreeFound += ( tree.Find( keys[i].Get() ) != tree.InvalidIndex() );
+		}
+	}
+	float flTreeFind = ( Plat_FloatTime() - flStart ) * 1000.0f;
+
+	int nTableFound = 0;
+	flStart = Plat_FloatTime();
+	for ( int nPass = 0; nPass < nPasses; nPass++ )
+	{
+		for ( int i = 0; i < keys.Count(); i++ )
+		{
+			nTableFound += table.Find( keys[i].Get() ).IsValid();
+		}
+	}
+	float flTableFind = ( Plat_FloatTime() - flStart ) * 1000.0f;
+
+	// Concurrent lookups: the old table took a read lock around every find
+	CThreadSpinRWLock lock;
+	SymbolBenchThread_t threads[SYMBOL_BENCH_MAX_THREADS];
+	for ( int i = 0; i < nThreads; i++ )
+	{
+		threads[i].m_pKeys = &keys;
+		threads[i].m_nPasses = nPasses;
+		threads[i].m_pTree = &tree;
+		threads[i].m_pLock = &lock;
+		threads[i].m_pTable = &table;
+		threads[i].m_nFound = 0;
+	}
+	float flTreeMT = SymbolBenchRunThreads( threads, nThreads );
+	for ( int i = 0; i < nThreads; i++ )
+	{
+		threads[i].m_pTree = NULL;
+	}
+	float flTableMT = SymbolBenchRunThreads( threads, nThreads );
+
+	Msg( "symbol_table_benchmark: %d files parsed in %.2f ms, %d keys, %d unique\n", nFiles, flParseTime * 1000.0f, keys.Count(), table.GetNumStrings() );
+	Msg( "  %-28s %10s %10s\n", "", "rb tree", "hash" );
+	Msg( "  %-28s %8.2fms %8.2fms\n", "build", flTreeAdd, flTableAdd );
+	Msg( "  %-28s %8.2fms %8.2fms\n", CFmtStr( "find x%d", nPasses ).Access(), flTreeFind, flTableFind );
+	Msg( "  %-28s %8.2fms %8.2fms\n", CFmtStr( "find x%d on %d threads", nPasses, nThreads ).Access(), flTreeMT, flTableMT );
+	if ( nTreeFound != nTableFound )
+	{
+		Warning( "  lookup mismatch: rb tree found %d, hash found %d\n", nTreeFound, nTableFound );
+	}
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Times KeyValues::LoadFromFile against CKeyValuesDocument, parsing
+//			the text and loading from the binary cache, on the game's script
+//			and resource files. Also checks the trees come out the same.
+//-----------------------------------------------------------------------------
+static void KeyValuesBenchFindFiles( const char *pszWildcard, CUtlVector<CUtlString> &files )
+{
+	char szDir[MAX_PATH];
+	V_ExtractFilePath( pszWildcard, szDir, sizeof( szDir ) );
+
+	FileFindHandle_t hFind;
+	for ( const char *pszFile = filesystem->FindFirstEx( pszWildcard, "GAME", &hFind ); pszFile; pszFile = filesystem->FindNext( hFind ) )
+	{
+		if ( !filesystem->FindIsDirectory( hFind ) )
+		{
+			files.AddToTail( CFmtStr( "%s%s", szDir, pszFile ).Access() );
+		}
+	}
+	filesystem->FindClose( hFind );
+}
+
+// Returns the number of keys that differ
+static int KeyValuesBenchCompare( KeyValues *pA, KeyValues *pB )
+{
+	int nDiffs = 0;
+	for ( ; pA || pB; pA = pA ? pA->GetNextKey() : NULL, pB = pB ? pB->GetNextKey() : NULL )
+	{
+		if ( !pA || !pB || Q_stricmp( pA->GetName(), pB->GetName() ) || pA->GetDataType() != pB->GetDataType() )
+		{
+			nDiffs++;
+			continue;
+		}
+
+		if ( pA->GetDataType() == KeyValues::TYPE_NONE )
+		{
+			nDiffs += KeyValuesBenchCompare( pA->GetFirstSubKey(), pB->GetFirstSubKey() );
+		}
+		else if ( pA->GetDataType() == KeyValues::TYPE_UINT64 ? pA->GetUint64() != pB->GetUint64() : Q_strcmp( pA->GetString(), pB->GetString() ) != 0 )
+		{
+			nDiffs++;
+		}
+	}
+	return nDiffs;
+}
+
+CON_COMMAND_F( keyvalues_load_benchmark, "Times KeyValues loading on scripts/ and resource/ files. Usage: keyvalues_load_benchmark [passes]", FCVAR_CHEAT )
+{
+	if ( !UTIL_IsCommandIssuedByServerAdmin() )
+		return;
+
+	int nPasses = ( args.ArgC() > 1 ) ? MAX( atoi( args[1] ), 1 ) : 5;
+
+	CUtlVector<CUtlString> files;
+	KeyValuesBenchFindFiles( "scripts/*.txt", files );
+	KeyValuesBenchFindFiles( "resource/*.res", files );
+	KeyValuesBenchFindFiles( "resource/ui/*.res", files );
+	if ( !files.Count() )
+	{
+		Msg( "keyvalues_load_benchmark: no files found in scripts/ or resource/\n" );
+		return;
+	}
+
+	// One untimed pass to warm the file system and write the caches, and to
+	// check the document parser against the classic one
+	int nDiffs = 0;
+	for ( int i = 0; i < files.Count(); i++ )
+	{
+		KeyValues *pKeys = new KeyValues( files[i] );
+		bool bLoaded = pKeys->LoadFromFile( filesystem, files[i], "GAME" );
+
+		CKeyValuesDocument doc;
+		if ( bLoaded && doc.LoadFromFileCached( filesystem, files[i], "GAME" ) )
+		{
+			int nFileDiffs = KeyValuesBenchCompare( pKeys, doc.GetRoot() );
+			if ( nFileDiffs )
+			{
+				Warning( "  %s: %d keys differ\n", files[i].Get(), nFileDiffs );
+				nDiffs += nFileDiffs;
+			}
+		}
+		pKeys->deleteThis();
+	}
+
+	double flStart = Plat_FloatTime();
+	for ( int nPass = 0; nPass < nPasses; nPass++ )
+	{
+		for ( int i = 0; i < files.Count(); i++ )
+		{
+			KeyValues *pKeys = new KeyValues( files[i] );
+			pKeys->LoadFromFile( filesystem, files[i], "GAME" );
+			pKeys->deleteThis();
+		}
+	}
+	float flClassic = ( Plat_FloatTime() - flStart ) * 1000.0f;
+
+	int nMemory = 0;
+	flStart = Plat_FloatTime();
+	for ( int nPass = 0; nPass < nPasses; nPass++ )
+	{
+		for ( int i = 0; i < files.Count(); i++ )
+		{
+			CKeyValuesDocument doc;
+			doc.LoadFromFile( filesystem, files[i], "GAME" );
+			if ( !nPass )
+			{
+				nMemory += doc.GetMemoryUsed();
+			}
+		}
+	}
+	float flDocument = ( Plat_FloatTime() - flStart ) * 1000.0f;
+
+	int nCacheHits = 0;
+	int nCacheMemory = 0;
+	flStart = Plat_FloatTime();
+	for ( int nPass = 0; nPass < nPasses; nPass++ )
+	{
+		for ( int i = 0; i < files.Count(); i++ )
+		{
+			CKeyValuesDocument doc;
+			doc.LoadFromFileCached( filesystem, files[i], "GAME" );
+			if ( !nPass )
+			{
+				nCacheHits += doc.WasLoadedFromCache();
+				nCacheMemory += doc.GetMemoryUsed();
+			}
+		}
+	}
+	float flCached = ( Plat_FloatTime() - flStart ) * 1000.0f;
+
+	Msg( "keyvalues_load_benchmark: %d files x%d, %d loaded from cache\n", files.Count(), nPasses, nCacheHits );
+	Msg( "  %-20s %8.2fms\n", "KeyValues", flClassic );
+	Msg( "  %-20s %8.2fms %8d bytes\n", "document", flDocument, nMemory );
+	Msg( "  %-20s %8.2fms %8d bytes\n", "document, cached", flCached, nCacheMemory );
+	if ( nDiffs )
+	{
+		Warning( "  %d keys differ between KeyValues and document trees\n", nDiffs );
+	}
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Checks the packed bf_write / bf_read coord and normal routines
+//			against the original field-at-a-time versions on random input,
+//			then times both.
+//-----------------------------------------------------------------------------
+#define BITBUF_BENCH_BUFFER_SIZE	( 64 * 1024 )
+
+static void BitBufRefWriteBitCoord( bf_write &buf, const float f )
+{
+	int		signbit = (f <= -COORD_RESOLUTION);
+	int		intval = (int)abs(f);
+	int		fractval = abs((int)(f*COORD_DENOMINATOR)) & (COORD_DENOMINATOR-1);
+
+	buf.WriteOneBit( intval );
+	buf.WriteOneBit( fractval );
+
+	if ( intval || fractval )
+	{
+		buf.WriteOneBit( signbit );
+		if ( intval )
+		{
+			intval--;
+			buf.WriteUBitLong( (unsigned int)intval, COORD_INTEGER_BITS );
+		}
+		if ( fractval )
+		{
+			buf.WriteUBitLong( (unsigned int)fractval, COORD_FRACTIONAL_BITS );
+		}
+	}
+}
+
+static void BitBufRefWriteBitVec3Coord( bf_write &buf, const Vector& fa )
+{
+	int xflag = (fa[0] >= COORD_RESOLUTION) || (fa[0] <= -COORD_RESOLUTION);
+	int yflag = (fa[1] >= COORD_RESOLUTION) || (fa[1] <= -COORD_RESOLUTION);
+	int zflag = (fa[2] >= COORD_RESOLUTION) || (fa[2] <= -COORD_RESOLUTION);
+
+	buf.WriteOneBit( xflag );
+	buf.WriteOneBit( yflag );
+	buf.WriteOneBit( zflag );
+
+	if ( xflag )
+		BitBufRefWriteBitCoord( buf, fa[0] );
+	if ( yflag )
+		BitBufRefWriteBitCoord( buf, fa[1] );
+	if ( zflag )
+		BitBufRefWriteBitCoord( buf, fa[2] );
+}
+
+static void BitBufRefWriteBitNormal( bf_write &buf, float f )
+{
+	int	signbit = (f <= -NORMAL_RESOLUTION);
+	unsigned int fractval = abs( (int)(f*NORMAL_DENOMINATOR) );
+	if (fractval > NORMAL_DENOMINATOR)
+		fractval = NORMAL_DENOMINATOR;
+
+	buf.WriteOneBit( signbit );
+	buf.WriteUBitLong( fractval, NORMAL_FRACTIONAL_BITS );
+}
+
+static void BitBufRefWriteBitVec3Normal( bf_write &buf, const Vector& fa )
+{
+	int xflag = (fa[0] >= NORMAL_RESOLUTION) || (fa[0] <= -NORMAL_RESOLUTION);
+	int yflag = (fa[1] >= NORMAL_RESOLUTION) || (fa[1] <= -NORMAL_RESOLUTION);
+
+	buf.WriteOneBit( xflag );
+	buf.WriteOneBit( yflag );
+
+	if ( xflag )
+		BitBufRefWriteBitNormal( buf, fa[0] );
+	if ( yflag )
+		BitBufRefWriteBitNormal( buf, fa[1] );
+
+	buf.WriteOneBit( fa[2] <= -NORMAL_RESOLUTION );
+}
+
+static float BitBufRefReadBitCoord( bf_read &buf )
+{
+	int		intval = buf.ReadOneBit();
+	int		fractval = buf.ReadOneBit();
+	float	value = 0.0;
+
+	if ( intval || fractval )
+	{
+		int signbit = buf.ReadOneBit();
+		if ( intval )
+		{
+			intval = buf.ReadUBitLong( COORD_INTEGER_BITS ) + 1;
+		}
+		if ( fractval )
+		{
+			fractval = buf.ReadUBitLong( COORD_FRACTIONAL_BITS );
+		}
+
+		value = intval + ((float)fractval * COORD_RESOLUTION);
+		if ( signbit )
+			value = -value;
+	}
+	return value;
+}
+
+static void BitBufRefReadBitVec3Coord( bf_read &buf, Vector& fa )
+{
+	fa.Init( 0, 0, 0 );
+
+	int xflag = buf.ReadOneBit();
+	int yflag = buf.ReadOneBit();
+	int zflag = buf.ReadOneBit();
+
+	if ( xflag )
+		fa[0] = BitBufRefReadBitCoord( buf );
+	if ( yflag )
+		fa[1] = BitBufRefReadBitCoord( buf );
+	if ( zflag )
+		fa[2] = BitBufRefReadBitCoord( buf );
+}
+
+static float BitBufRefReadBitNormal( bf_read &buf )
+{
+	int	signbit = buf.ReadOneBit();
+	unsigned int fractval = buf.ReadUBitLong( NORMAL_FRACTIONAL_BITS );
+
+	float value = (float)fractval * NORMAL_RESOLUTION;
+	if ( signbit )
+		value = -value;
+	return value;
+}
+
+static void BitBufRefReadBitVec3Normal( bf_read &buf, Vector& fa )
+{
+	int xflag = buf.ReadOneBit();
+	int yflag = buf.ReadOneBit();
+
+	fa[0] = xflag ? BitBufRefReadBitNormal( buf ) : 0.0f;
+	fa[1] = yflag ? BitBufRefReadBitNormal( buf ) : 0.0f;
+
+	int znegative = buf.ReadOneBit();
+
+	float fafafbfb = fa[0] * fa[0] + fa[1] * fa[1];
+	if (fafafbfb < 1.0f)
+		fa[2] = sqrt( 1.0f - fafafbfb );
+	else
+		fa[2] = 0.0f;
+
+	if (znegative)
+		fa[2] = -fa[2];
+}
+
+// Mix of the cases the encoders branch on: zero, under a coord's resolution,
+// whole numbers, fractions, and values out of the integer field's range
+static float BitBufBenchRandomCoord()
+{
+	switch ( RandomInt( 0, 7 ) )
+	{
+	case 0:		return 0.0f;
+	case 1:		return RandomFloat( -(float)COORD_RESOLUTION, (float)COORD_RESOLUTION );
+	case 2:		return (float)RandomInt( -MAX_COORD_INTEGER, MAX_COORD_INTEGER );
+	case 3:		return RandomInt( -32, 32 ) * COORD_RESOLUTION;
+	case 4:		return RandomFloat( -2.0f, 2.0f );
+	case 5:		return RandomFloat( -2.0f * MAX_COORD_INTEGER, 2.0f * MAX_COORD_INTEGER );
+	default:	return RandomFloat( -MAX_COORD_INTEGER, MAX_COORD_INTEGER );
+	}
+}
+
+static void BitBufBenchRandomNormal( Vector &vec )
+{
+	switch ( RandomInt( 0, 3 ) )
+	{
+	case 0:
+		vec.Init();
+		vec[RandomInt( 0, 2 )] = RandomInt( 0, 1 ) ? 1.0f : -1.0f;
+		break;
+	case 1:
+		vec.Init( RandomFloat( -(float)NORMAL_RESOLUTION, (float)NORMAL_RESOLUTION ), RandomFloat( -1.0f, 1.0f ), RandomFloat( -1.0f, 1.0f ) );
+		VectorNormalize( vec );
+		break;
+	default:
+		vec.Init( RandomFloat( -1.0f, 1.0f ), RandomFloat( -1.0f, 1.0f ), RandomFloat( -1.0f, 1.0f ) );
+		VectorNormalize( vec );
+		break;
+	}
+}
+
+// Returns true if both buffers hold the same bits
+static bool BitBufBenchCompare( bf_write &a, bf_write &b )
+{
+	if ( a.GetNumBitsWritten() != b.GetNumBitsWritten() || a.IsOverflowed() != b.IsOverflowed() )
+		return false;
+
+	// Whole bytes, then whatever's written of the last one
+	int nBits = a.GetNumBitsWritten();
+	if ( memcmp( a.GetBasePointer(), b.GetBasePointer(), nBits >> 3 ) )
+		return false;
+
+	int nMask = ( 1 << ( nBits & 7 ) ) - 1;
+	return ( ( a.GetBasePointer()[nBits >> 3] ^ b.GetBasePointer()[nBits >> 3] ) & nMask ) == 0;
+}
+
+static bool BitBufBenchSameFloat( float a, float b )
+{
+	return *(uint32 *)&a == *(uint32 *)&b;
+}
+
+static bool BitBufBenchSameVector( const Vector &a, const Vector &b )
+{
+	return BitBufBenchSameFloat( a.x, b.x ) && BitBufBenchSameFloat( a.y, b.y ) && BitBufBenchSameFloat( a.z, b.z );
+}
+
+CON_COMMAND_F( bitbuf_benchmark, "Checks the packed bitbuf coord/normal encoders bit for bit against the original ones, then times them. Usage: bitbuf_benchmark [fuzz cases] [passes]", FCVAR_CHEAT )
+{
+	if ( !UTIL_IsCommandIssuedByServerAdmin() )
+		return;
+
+	int nCases = ( args.ArgC() > 1 ) ? MAX( atoi( args[1] ), 1 ) : 20000;
+	int nPasses = ( args.ArgC() > 2 ) ? MAX( atoi( args[2] ), 1 ) : 50;
+
+	// Room for the largest encoding of everything in one fuzz case: 200 bits
+	// per element covers a coord vector, a coord, a normal vector, a normal
+	// and an angle
+	const int nVecs = 64;
+	const int nBufferSize = ( nVecs * 200 + 32 ) / 8 + 4;
+	byte *pRef = new byte[nBufferSize];
+	byte *pNew = new byte[nBufferSize];
+
+	Vector vecs[nVecs], normals[nVecs], readVecs[nVecs];
+	QAngle angles[nVecs], readAngles[nVecs];
+
+	int nEncodeErrors = 0, nDecodeErrors = 0, nOverflowErrors = 0;
+	for ( int nCase = 0; nCase < nCases; nCase++ )
+	{
+		int nCount = RandomInt( 1, nVecs );
+		for ( int i = 0; i < nCount; i++ )
+		{
+			vecs[i].Init( BitBufBenchRandomCoord(), BitBufBenchRandomCoord(), BitBufBenchRandomCoord() );
+			angles[i].Init( BitBufBenchRandomCoord(), BitBufBenchRandomCoord(), BitBufBenchRandomCoord() );
+			BitBufBenchRandomNormal( normals[i] );
+		}
+
+		// Start at a random bit so every alignment gets covered. Shrinking the
+		// buffer now and then checks that both sides overflow together.
+		int nLeadBits = RandomInt( 1, 31 );
+		unsigned int nLead = RandomInt( 0, 0x7fffffff );
+		int nSize = RandomInt( 0, 15 ) ? nBufferSize : RandomInt( 1, nBufferSize / 4 ) * 4;
+
+		bf_write ref( pRef, nSize );
+		bf_write out( pNew, nSize );
+		ref.WriteUBitLong( nLead, nLeadBits, false );
+		out.WriteUBitLong( nLead, nLeadBits, false );
+
+		for ( int i = 0; i < nCount; i++ )
+		{
+			BitBufRefWriteBitVec3Coord( ref, vecs[i] );
+			BitBufRefWriteBitCoord( ref, vecs[i].x );
+			BitBufRefWriteBitVec3Normal( ref, normals[i] );
+			BitBufRefWriteBitNormal( ref, normals[i].y );
+			out.WriteBitVec3Coord( vecs[i] );
+			out.WriteBitCoord( vecs[i].x );
+			out.WriteBitVec3Normal( normals[i] );
+			out.WriteBitNormal( normals[i].y );
+		}
+		for ( int i = 0; i < nCount; i++ )
+		{
+			BitBufRefWriteBitVec3Coord( ref, Vector( angles[i].x, angles[i].y, angles[i].z ) );
+		}
+		out.WriteBitAngles( angles, nCount );
+
+		if ( ref.IsOverflowed() || out.IsOverflowed() )
+		{
+			nOverflowErrors += ( ref.IsOverflowed() != out.IsOverflowed() );
+			continue;
+		}
+		if ( !BitBufBenchCompare( ref, out ) )
+		{
+			if ( !nEncodeErrors )
+			{
+				Warning( "  encode mismatch in case %d at bit %d: ( %f %f %f )\n", nCase, nLeadBits, vecs[0].x, vecs[0].y, vecs[0].z );
+			}
+			nEncodeErrors++;
+			continue;
+		}
+
+		// Read back with both, checking values and positions agree
+		bf_read readRef( pRef, ref.GetNumBytesWritten(), ref.GetNumBitsWritten() );
+		bf_read readNew( pRef, ref.GetNumBytesWritten(), ref.GetNumBitsWritten() );
+		readRef.SeekRelative( nLeadBits );
+		readNew.SeekRelative( nLeadBits );
+
+		bool bMatch = true;
+		for ( int i = 0; i < nCount && bMatch; i++ )
+		{
+			Vector a, b, na, nb;
+			BitBufRefReadBitVec3Coord( readRef, a );
+			readNew.ReadBitVec3Coord( b );
+			float fa = BitBufRefReadBitCoord( readRef );
+			float fb = readNew.ReadBitCoord();
+			BitBufRefReadBitVec3Normal( readRef, na );
+			readNew.ReadBitVec3Normal( nb );
+			float fna = BitBufRefReadBitNormal( readRef );
+			float fnb = readNew.ReadBitNormal();
+			bMatch = BitBufBenchSameVector( a, b ) && BitBufBenchSameFloat( fa, fb ) && BitBufBenchSameVector( na, nb ) && BitBufBenchSameFloat( fna, fnb );
+		}
+
+		int iAngles = readNew.GetNumBitsRead();
+		readNew.ReadBitAngles( readAngles, nCount );
+		for ( int i = 0; i < nCount && bMatch; i++ )
+		{
+			BitBufRefReadBitVec3Coord( readRef, readVecs[i] );
+			bMatch = BitBufBenchSameVector( readVecs[i], Vector( readAngles[i].x, readAngles[i].y, readAngles[i].z ) );
+		}
+
+		if ( !bMatch || readRef.GetNumBitsRead() != readNew.GetNumBitsRead() || readNew.GetNumBitsRead() != ref.GetNumBitsWritten() || readNew.IsOverflowed() )
+		{
+			if ( !nDecodeErrors )
+			{
+				Warning( "  decode mismatch in case %d (angles at bit %d)\n", nCase, iAngles );
+			}
+			nDecodeErrors++;
+		}
+	}
+
+	// Timing: a buffer's worth of coord vectors, encoded and decoded both ways
+	byte *pTimeBuffer = new byte[BITBUF_BENCH_BUFFER_SIZE];
+	const int nTimeVecs = BITBUF_BENCH_BUFFER_SIZE * 8 / 72;
+	Vector *pTimeVecs = new Vector[nTimeVecs];
+	for ( int i = 0; i < nTimeVecs; i++ )
+	{
+		pTimeVecs[i].Init( BitBufBenchRandomCoord(), BitBufBenchRandomCoord(), BitBufBenchRandomCoord() );
+	}
+
+	bf_write timeBuf( pTimeBuffer, BITBUF_BENCH_BUFFER_SIZE );
+	double flStart = Plat_FloatTime();
+	for ( int nPass = 0; nPass < nPasses; nPass++ )
+	{
+		timeBuf.Reset();
+		for ( int i = 0; i < nTimeVecs; i++ )
+		{
+			BitBufRefWriteBitVec3Coord( timeBuf, pTimeVecs[i] );
+		}
+	}
+	float flRefWrite = ( Plat_FloatTime() - flStart ) * 1000.0f;
+
+	flStart = Plat_FloatTime();
+	for ( int nPass = 0; nPass < nPasses; nPass++ )
+	{
+		timeBuf.Reset();
+		for ( int i = 0; i < nTimeVecs; i++ )
+		{
+			timeBuf.WriteBitVec3Coord( pTimeVecs[i] );
+		}
+	}
+	float flWrite = ( Plat_FloatTime() - flStart ) * 1000.0f;
+
+	flStart = Plat_FloatTime();
+	for ( int nPass = 0; nPass < nPasses; nPass++ )
+	{
+		timeBuf.Reset();
+		timeBuf.WriteBitVec3Coords( pTimeVecs, nTimeVecs );
+	}
+	float flBatchWrite = ( Plat_FloatTime() - flStart ) * 1000.0f;
+
+	Vector vecSum = vec3_origin;
+	flStart = Plat_FloatTime();
+	for ( int nPass = 0; nPass < nPasses; nPass++ )
+	{
+		bf_read timeRead( pTimeBuffer, timeBuf.GetNumBytesWritten(), timeBuf.GetNumBitsWritten() );
+		for ( int i = 0; i < nTimeVecs; i++ )
+		{
+			Vector vec;
+			BitBufRefReadBitVec3Coord( timeRead, vec );
+			vecSum += vec;
+		}
+	}
+	float flRefRead = ( Plat_FloatTime() - flStart ) * 1000.0f;
+
+	flStart = Plat_FloatTime();
+	for ( int nPass = 0; nPass < nPasses; nPass++ )
+	{
+		bf_read timeRead( pTimeBuffer, timeBuf.GetNumBytesWritten(), timeBuf.GetNumBitsWritten() );
+		for ( int i = 0; i < nTimeVecs; i++ )
+		{
+			Vector vec;
+			timeRead.ReadBitVec3Coord( vec );
+			vecSum += vec;
+		}
+	}
+	float flRead = ( Plat_FloatTime() - flStart ) * 1000.0f;
+
+	flStart = Plat_FloatTime();
+	for ( int nPass = 0; nPass < nPasses; nPass++ )
+	{
+		bf_read timeRead( pTimeBuffer, timeBuf.GetNumBytesWritten(), timeBuf.GetNumBitsWritten() );
+		timeRead.ReadBitVec3Coords( pTimeVecs, nTimeVecs );
+	}
+	float flBatchRead = ( Plat_FloatTime() - flStart ) * 1000.0f;
+
+	delete[] pTimeVecs;
+	delete[] pTimeBuffer;
+	delete[] pRef;
+	delete[] pNew;
+
+	Msg( "bitbuf_benchmark: %d fuzz cases, %d encode and %d decode mismatches, %d overflow mismatches\n", nCases, nEncodeErrors, nDecodeErrors, nOverflowErrors );
+	Msg( "  %d vectors x%d (checksum %.1f)\n", nTimeVecs, nPasses, vecSum.x + vecSum.y + vecSum.z );
+	Msg( "  %-20s %10s %10s %10s\n", "", "original", "packed", "batched" );
+	Msg( "  %-20s %8.2fms %8.2fms %8.2fms\n", "WriteBitVec3Coord", flRefWrite, flWrite, flBatchWrite );
+	Msg( "  %-20s %8.2fms %8.2fms %8.2fms\n", "ReadBitVec3Coord", flRefRead, flRead, flBatchRead );
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Runs every batched SIMD kernel set this CPU supports on the same
+//			data, checks each against the four-wide loops bit for bit, and
+//			times them.
+//-----------------------------------------------------------------------------
+enum
+{
+	SIMD_BENCH_NOISE = 0,
+	SIMD_BENCH_ADD,
+	SIMD_BENCH_SCALE,
+	SIMD_BENCH_POW,
+
+	SIMD_BENCH_NUM_KERNELS
+};
+
+static const char *s_pszSIMDBenchKernelNames[SIMD_BENCH_NUM_KERNELS] = { "noise", "add", "scale", "pow" };
+
+// Exponents are in quarters, as Pow_FixedPoint_Exponent_SIMD takes them
+static const int s_nSIMDBenchExponents[] = { 1, 2, 3, 4, 9, 10, -3, -5, -8 };
+
+struct SIMDBenchData_t
+{
+	int				m_nVectors;		// FourVectors
+	FourVectors *	m_pPos;
+	FourVectors *	m_pSrc;
+	FourVectors *	m_pWork;
+	fltx4 *			m_pNoise;
+};
+
+// Returns the number of kernels whose output differs from pRef's
+static int SIMDBenchCheck( const SIMDKernels_t *pKernels, const SIMDKernels_t *pRef, const SIMDBenchData_t &data )
+{
+	FourVectors *pRefWork = (FourVectors *)MemAlloc_AllocAligned( data.m_nVectors * sizeof( FourVectors ), 16 );
+	fltx4 *pRefNoise = (fltx4 *)MemAlloc_AllocAligned( data.m_nVectors * sizeof( fltx4 ), 16 );
+	bool bMismatch[SIMD_BENCH_NUM_KERNELS] = { false, false, false, false };
+
+	// Odd counts too, so the tails get checked
+	for ( int nCount = data.m_nVectors; nCount >= data.m_nVectors - 1 && nCount > 0; nCount-- )
+	{
+		pRef->m_pfnNoise( pRefNoise, data.m_pPos, nCount );
+		pKernels->m_pfnNoise( data.m_pNoise, data.m_pPos, nCount );
+		bMismatch[SIMD_BENCH_NOISE] |= ( memcmp( pRefNoise, data.m_pNoise, nCount * sizeof( fltx4 ) ) != 0 );
+
+		memcpy( pRefWork, data.m_pSrc, nCount * sizeof( FourVectors ) );
+		memcpy( data.m_pWork, data.m_pSrc, nCount * sizeof( FourVectors ) );
+		pRef->m_pfnAdd( (float *)pRefWork, (float *)data.m_pPos, nCount * 12 );
+		pKernels->m_pfnAdd( (float *)data.m_pWork, (float *)data.m_pPos, nCount * 12 );
+		bMismatch[SIMD_BENCH_ADD] |= ( memcmp( pRefWork, data.m_pWork, nCount * sizeof( FourVectors ) ) != 0 );
+
+		Vector vecScale( RandomFloat( -2.0f, 2.0f ), RandomFloat( -2.0f, 2.0f ), RandomFloat( -2.0f, 2.0f ) );
+		pRef->m_pfnScale( pRefWork, nCount, vecScale );
+		pKernels->m_pfnScale( data.m_pWork, nCount, vecScale );
+		bMismatch[SIMD_BENCH_SCALE] |= ( memcmp( pRefWork, data.m_pWork, nCount * sizeof( FourVectors ) ) != 0 );
+
+		for ( int i = 0; i < ARRAYSIZE( s_nSIMDBenchExponents ); i++ )
+		{
+			memcpy( pRefWork, data.m_pSrc, nCount * sizeof( FourVectors ) );
+			memcpy( data.m_pWork, data.m_pSrc, nCount * sizeof( FourVectors ) );
+			pRef->m_pfnPowFixedPoint( (float *)pRefWork, nCount * 12, s_nSIMDBenchExponents[i] );
+			pKernels->m_pfnPowFixedPoint( (float *)data.m_pWork, nCount * 12, s_nSIMDBenchExponents[i] );
+			bMismatch[SIMD_BENCH_POW] |= ( memcmp( pRefWork, data.m_pWork, nCount * sizeof( FourVectors ) ) != 0 );
+		}
+	}
+
+	MemAlloc_FreeAligned( pRefWork );
+	MemAlloc_FreeAligned( pRefNoise );
+
+	int nMismatches = 0;
+	for ( int i = 0; i < SIMD_BENCH_NUM_KERNELS; i++ )
+	{
+		if ( bMismatch[i] )
+		{
+			Warning( "  %s: %s differs from %s\n", pKernels->m_pName, s_pszSIMDBenchKernelNames[i], pRef->m_pName );
+			nMismatches++;
+		}
+	}
+	return nMismatches;
+}
+
+static void SIMDBenchTime( const SIMDKernels_t *pKernels, const SIMDBenchData_t &data, int nPasses, float *pflTimes )
+{
+	int nFloats = data.m_nVectors * 12;
+
+	double flStart = Plat_FloatTime();
+	for ( int nPass = 0; nPass < nPasses; nPass++ )
+	{
+		pKernels->m_pfnNoise( data.m_pNoise, data.m_pPos, data.m_nVectors );
+	}
+	pflTimes[SIMD_BENCH_NOISE] = ( Plat_FloatTime() - flStart ) * 1000.0f;
+
+	memcpy( data.m_pWork, data.m_pSrc, data.m_nVectors * sizeof( FourVectors ) );
+	flStart = Plat_FloatTime();
+	for ( int nPass = 0; nPass < nPasses; nPass++ )
+	{
+		pKernels->m_pfnAdd( (float *)data.m_pWork, (float *)data.m_pSrc, nFloats );
+	}
+	pflTimes[SIMD_BENCH_ADD] = ( Plat_FloatTime() - flStart ) * 1000.0f;
+
+	// Exact, so repeating it doesn't drift towards denormals or infinity
+	Vector vecScale( 1.0f, -1.0f, 1.0f );
+	flStart = Plat_FloatTime();
+	for ( int nPass = 0; nPass < nPasses; nPass++ )
+	{
+		pKernels->m_pfnScale( data.m_pWork, data.m_nVectors, vecScale );
+	}
+	pflTimes[SIMD_BENCH_SCALE] = ( Plat_FloatTime() - flStart ) * 1000.0f;
+
+	// x^-0.75 over and over converges on 1
+	memcpy( data.m_pWork, data.m_pSrc, data.m_nVectors * sizeof( FourVectors ) );
+	flStart = Plat_FloatTime();
+	for ( int nPass = 0; nPass < nPasses; nPass++ )
+	{
+		pKernels->m_pfnPowFixedPoint( (float *)data.m_pWork, nFloats, -3 );
+	}
+	pflTimes[SIMD_BENCH_POW] = ( Plat_FloatTime() - flStart ) * 1000.0f;
+}
+
+CON_COMMAND_F( simd_kernels_benchmark, "Checks the eight-wide SIMD kernels against the four-wide ones, then times every set this CPU can run. Usage: simd_kernels_benchmark [vectors] [passes]", FCVAR_CHEAT )
+{
+	if ( !UTIL_IsCommandIssuedByServerAdmin() )
+		return;
+
+	int nVectors = ( args.ArgC() > 1 ) ? MAX( atoi( args[1] ), 8 ) : 16384;
+	int nPasses = ( args.ArgC() > 2 ) ? MAX( atoi( args[2] ), 1 ) : 100;
+
+	SIMDBenchData_t data;
+	data.m_nVectors = ( nVectors + 3 ) / 4;
+	data.m_pPos = (FourVectors *)MemAlloc_AllocAligned( data.m_nVectors * sizeof( FourVectors ), 16 );
+	data.m_pSrc = (FourVectors *)MemAlloc_AllocAligned( data.m_nVectors * sizeof( FourVectors ), 16 );
+	data.m_pWork = (FourVectors *)MemAlloc_AllocAligned( data.m_nVectors * sizeof( FourVectors ), 16 );
+	data.m_pNoise = (fltx4 *)MemAlloc_AllocAligned( data.m_nVectors * sizeof( fltx4 ), 16 );
+
+	// Noise positions anywhere in a map; pow inputs positive, with some zeros
+	// for the saturating reciprocal
+	float *pPos = (float *)data.m_pPos;
+	float *pSrc = (float *)data.m_pSrc;
+	for ( int i = 0; i < data.m_nVectors * 12; i++ )
+	{
+		pPos[i] = RandomFloat( -MAX_COORD_FLOAT, MAX_COORD_FLOAT ) / 16.0f;
+		pSrc[i] = RandomInt( 0, 63 ) ? RandomFloat( 0.0f, 4.0f ) : 0.0f;
+	}
+
+	const SIMDKernels_t *pRef = GetSIMDKernels( SIMD_KERNELS_4WIDE );
+	float flTimes[SIMD_KERNELS_NUM_TIERS][SIMD_BENCH_NUM_KERNELS];
+	int nMismatches = 0;
+	for ( int nTier = 0; nTier < SIMD_KERNELS_NUM_TIERS; nTier++ )
+	{
+		const SIMDKernels_t *pKernels = GetSIMDKernels( nTier );
+		if ( !pKernels )
+			continue;
+
+		if ( nTier != SIMD_KERNELS_4WIDE )
+		{
+			nMismatches += SIMDBenchCheck( pKernels, pRef, data );
+		}
+		SIMDBenchTime( pKernels, data, nPasses, flTimes[nTier] );
+	}
+
+	MemAlloc_FreeAligned( data.m_pPos );
+	MemAlloc_FreeAligned( data.m_pSrc );
+	MemAlloc_FreeAligned( data.m_pWork );
+	MemAlloc_FreeAligned( data.m_pNoise );
+
+	Msg( "simd_kernels_benchmark: %d vectors x%d, using %s, %d mismatched kernels\n", data.m_nVectors * 4, nPasses, GetSIMDKernels()->m_pName, nMismatches );
+	Msg( "  %-8s", "" );
+	for ( int nTier = 0; nTier < SIMD_KERNELS_NUM_TIERS; nTier++ )
+	{
+		Msg( " %12s", GetSIMDKernels( nTier ) ? GetSIMDKernels( nTier )->m_pName : "(n/a)" );
+	}
+	Msg( "\n" );
+	for ( int nKernel = 0; nKernel < SIMD_BENCH_NUM_KERNELS; nKernel++ )
+	{
+		Msg( "  %-8s", s_pszSIMDBenchKernelNames[nKernel] );
+		for ( int nTier = 0; nTier < SIMD_KERNELS_NUM_TIERS; nTier++ )
+		{
+			if ( GetSIMDKernels( nTier ) )
+			{
+				Msg( " %10.2fms", flTimes[nTier][nKernel] );
+			}
+			else
+			{
+				Msg( " %12s", "" );
+			}
+		}
+		Msg( "\n" );
+	}
+}
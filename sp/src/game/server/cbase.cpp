@@ -84,6 +84,7 @@ OUTPUTS:
 #include "tier1/strtools.h"
 #include "datacache/imdlcache.h"
 #include "env_debughistory.h"
+#include "entityio_trace.h"
 
 #include "tier0/vprof.h"
 
@@ -275,45 +276,58 @@ void CBaseEntityOutput::FireOutput(variant_t Value, CBaseEntity *pActivator, CBa
 			g_EventQueue.AddEvent( STRING(ev->m_iTarget), STRING(ev->m_iTargetInput), ValueOverride, ev->m_flDelay, pActivator, pCaller, ev->m_iIDStamp );
 		}
 
-		if ( ev->m_flDelay )
+		if ( ent_io_trace.GetBool() )
 		{
-			char szBuffer[256];
-			Q_snprintf( szBuffer,
-						sizeof(szBuffer),
-						"(%0.2f) output: (%s,%s) -> (%s,%s,%.1f)(%s)\n",
+			variant_t TraceValue = Value;
+			if ( ev->m_iParameter != NULL_STRING )
+			{
+				TraceValue.SetString( ev->m_iParameter );
+			}
+			g_EntityIOTrace.RecordOutput( pCaller, ev, TraceValue, ev->m_flDelay );
+		}
+
+		if ( EntityIO_ShouldFormatDebugText() )
+		{
+			if ( ev->m_flDelay )
+			{
+				char szBuffer[256];
+				Q_snprintf( szBuffer,
+							sizeof(szBuffer),
+							"(%0.2f) output: (%s,%s) -> (%s,%s,%.1f)(%s)\n",
 #ifdef TF_DLL
-						engine->GetServerTime(),
+							engine->GetServerTime(),
 #else
-						gpGlobals->curtime,
+							gpGlobals->curtime,
 #endif
-						pCaller ? STRING(pCaller->m_iClassname) : "NULL",
-						pCaller ? STRING(pCaller->GetEntityName()) : "NULL",
-						STRING(ev->m_iTarget),
-						STRING(ev->m_iTargetInput),
-						ev->m_flDelay,
-						STRING(ev->m_iParameter) );
+							pCaller ? STRING(pCaller->m_iClassname) : "NULL",
+							pCaller ? STRING(pCaller->GetEntityName()) : "NULL",
+							STRING(ev->m_iTarget),
+							STRING(ev->m_iTargetInput),
+							ev->m_flDelay,
+							STRING(ev->m_iParameter) );
 
-			DevMsg( 2, "%s", szBuffer );
-			ADD_DEBUG_HISTORY( HISTORY_ENTITY_IO, szBuffer );
-		}
-		else
-		{
-			char szBuffer[256];
-			Q_snprintf( szBuffer,
-						sizeof(szBuffer),
-						"(%0.2f) output: (%s,%s) -> (%s,%s)(%s)\n",
+				DevMsg( 2, "%s", szBuffer );
+				ADD_DEBUG_HISTORY( HISTORY_ENTITY_IO, szBuffer );
+			}
+			else
+			{
+				char szBuffer[256];
+				Q_snprintf( szBuffer,
+							sizeof(szBuffer),
+							"(%0.2f) output: (%s,%s) -> (%s,%s)(%s)\n",
 #ifdef TF_DLL
-						engine->GetServerTime(),
+							engine->GetServerTime(),
 #else
-						gpGlobals->curtime,
+							gpGlobals->curtime,
 #endif
-						pCaller ? STRING(pCaller->m_iClassname) : "NULL",
-						pCaller ? STRING(pCaller->GetEntityName()) : "NULL", STRING(ev->m_iTarget),
-						STRING(ev->m_iTargetInput),
-						STRING(ev->m_iParameter) );
+							pCaller ? STRING(pCaller->m_iClassname) : "NULL",
+							pCaller ? STRING(pCaller->GetEntityName()) : "NULL", STRING(ev->m_iTarget),
+							STRING(ev->m_iTargetInput),
+							STRING(ev->m_iParameter) );
 
-			DevMsg( 2, "%s", szBuffer );
-			ADD_DEBUG_HISTORY( HISTORY_ENTITY_IO, szBuffer );
+				DevMsg( 2, "%s", szBuffer );
+				ADD_DEBUG_HISTORY( HISTORY_ENTITY_IO, szBuffer );
+			}
 		}
 
 		if ( pCaller && pCaller->m_debugOverlays & OVERLAY_MESSAGE_BIT)
@@ -331,10 +345,18 @@ void CBaseEntityOutput::FireOutput(variant_t Value, CBaseEntity *pActivator, CBa
 			ev->m_nTimesToFire--;
 			if (ev->m_nTimesToFire == 0)
 			{
-				char szBuffer[256];
-				Q_snprintf( szBuffer, sizeof(szBuffer), "Removing from action list: (%s,%s) -> (%s,%s)\n", pCaller ? STRING(pCaller->m_iClassname) : "NULL", pCaller ? STRING(pCaller->GetEntityName()) : "NULL", STRING(ev->m_iTarget), STRING(ev->m_iTargetInput));
-				DevMsg( 2, "%s", szBuffer );
-				ADD_DEBUG_HISTORY( HISTORY_ENTITY_IO, szBuffer );
+				if ( ent_io_trace.GetBool() )
+				{
+					g_EntityIOTrace.RecordOutputExpired( pCaller, ev );
+				}
+
+				if ( EntityIO_ShouldFormatDebugText() )
+				{
+					char szBuffer[256];
+					Q_snprintf( szBuffer, sizeof(szBuffer), "Removing from action list: (%s,%s) -> (%s,%s)\n", pCaller ? STRING(pCaller->m_iClassname) : "NULL", pCaller ? STRING(pCaller->GetEntityName()) : "NULL", STRING(ev->m_iTarget), STRING(ev->m_iTargetInput));
+					DevMsg( 2, "%s", szBuffer );
+					ADD_DEBUG_HISTORY( HISTORY_ENTITY_IO, szBuffer );
+				}
 				bRemove = true;
 			}
 		}
@@ -642,10 +664,15 @@ DEFINE_FIXEDSIZE_ALLOCATOR( EventQueuePrioritizedEvent_t, 128, CUtlMemoryPool::G
 
 CEventQueue g_EventQueue;
 
-CEventQueue::CEventQueue()
+CEventQueue::CEventQueue() : m_CallerIndex( 0, 0, DefLessFunc( unsigned long ) ), m_TargetIndex( 0, 0, DefLessFunc( unsigned long ) ), 
+	m_TargetCache( 0, 0, CaselessStringLessThan )
 {
-	m_Events.m_flFireTime = -FLT_MAX;
-	m_Events.m_pNext = NULL;
+	m_nPeakCount = 0;
+	m_nAdded = 0;
+	m_nFired = 0;
+	m_nCancelled = 0;
+	m_nTargetCacheHits = 0;
+	m_nTargetCacheMisses = 0;
 
 	Init();
 }
@@ -759,21 +786,72 @@ void CEventQueue::Init( void )
 void CEventQueue::Clear( void )
 {
 	// delete all the events in the queue
-	EventQueuePrioritizedEvent_t *pe = m_Events.m_pNext;
-	
-	while ( pe != NULL )
+	for ( int i = 0; i < m_Heap.Count(); i++ )
 	{
-		EventQueuePrioritizedEvent_t *next = pe->m_pNext;
-		delete pe;
-		pe = next;
+		delete m_Heap[i];
+	}
+
+	m_Heap.RemoveAll();
+	m_CallerIndex.RemoveAll();
+	m_TargetIndex.RemoveAll();
+	m_nNextSerial = 0;
+
+	ClearTargetCache();
+}
+
+void CEventQueue::ClearTargetCache( void )
+{
+	for ( unsigned short i = m_TargetCache.FirstInorder(); i != m_TargetCache.InvalidIndex(); i = m_TargetCache.NextInorder( i ) )
+	{
+		delete m_TargetCache[i];
+	}
+	m_TargetCache.RemoveAll();
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: returns the entities a target name currently resolves to, refreshing
+//			them if a named entity has been added, removed or renamed since they
+//			were found. Procedural names depend on the event and aren't cached.
+//-----------------------------------------------------------------------------
+CEventQueue::TargetCache_t *CEventQueue::GetTargetCache( string_t iszTarget )
+{
+	const char *pszTarget = STRING( iszTarget );
+	if ( pszTarget[0] == '!' )
+		return NULL;
+
+	TargetCache_t *pCache;
+	unsigned short i = m_TargetCache.Find( pszTarget );
+	if ( i == m_TargetCache.InvalidIndex() )
+	{
+		pCache = new TargetCache_t;
+		pCache->m_nGeneration = gEntList.GetNameIndexGeneration() - 1;
+		m_TargetCache.Insert( STRING( AllocPooledString( pszTarget ) ), pCache );
+	}
+	else
+	{
+		pCache = m_TargetCache[i];
 	}
 
-	m_Events.m_pNext = NULL;
+	if ( pCache->m_nGeneration == gEntList.GetNameIndexGeneration() )
+	{
+		m_nTargetCacheHits++;
+		return pCache;
+	}
+
+	m_nTargetCacheMisses++;
+	pCache->m_Targets.RemoveAll();
+	for ( CBaseEntity *pTarget = gEntList.FindEntityByName( NULL, pszTarget ); pTarget; pTarget = gEntList.FindEntityByName( pTarget, pszTarget ) )
+	{
+		pCache->m_Targets.AddToTail( pTarget );
+	}
+	pCache->m_nGeneration = gEntList.GetNameIndexGeneration();
+	return pCache;
 }
 
 void CEventQueue::Dump( void )
 {
-	EventQueuePrioritizedEvent_t *pe = m_Events.m_pNext;
+	CUtlVector< EventQueuePrioritizedEvent_t * > events;
+	GetSortedEvents( events );
 
 	Msg("Dumping event queue. Current time is: %.2f\n",
 #ifdef TF_DLL
@@ -783,9 +861,9 @@ void CEventQueue::Dump( void )
 #endif
 		);
 
-	while ( pe != NULL )
+	for ( int i = 0; i < events.Count(); i++ )
 	{
-		EventQueuePrioritizedEvent_t *next = pe->m_pNext;
+		EventQueuePrioritizedEvent_t *pe = events[i];
 
 		Msg("   (%.2f) Target: '%s', Input: '%s', Parameter '%s'. Activator: '%s', Caller '%s'.  \n", 
 			pe->m_flFireTime, 
@@ -794,13 +872,46 @@ void CEventQueue::Dump( void )
 			pe->m_VariantValue.String(),
 			pe->m_pActivator ? pe->m_pActivator->GetDebugName() : "None", 
 			pe->m_pCaller ? pe->m_pCaller->GetDebugName() : "None"  );
-
-		pe = next;
 	}
 
 	Msg("Finished dump.\n");
 }
 
+void CEventQueue::PrintStats( void )
+{
+	int nMaxCallerEvents = 0;
+	for ( unsigned short i = m_CallerIndex.FirstInorder(); i != m_CallerIndex.InvalidIndex(); i = m_CallerIndex.NextInorder( i ) )
+	{
+		int nEvents = 0;
+		for ( EventQueuePrioritizedEvent_t *pe = m_CallerIndex[i]; pe; pe = pe->m_pNextByCaller )
+		{
+			nEvents++;
+		}
+		nMaxCallerEvents = MAX( nMaxCallerEvents, nEvents );
+	}
+
+	int nMaxTargetEvents = 0;
+	for ( unsigned short i = m_TargetIndex.FirstInorder(); i != m_TargetIndex.InvalidIndex(); i = m_TargetIndex.NextInorder( i ) )
+	{
+		int nEvents = 0;
+		for ( EventQueuePrioritizedEvent_t *pe = m_TargetIndex[i]; pe; pe = pe->m_pNextByTarget )
+		{
+			nEvents++;
+		}
+		nMaxTargetEvents = MAX( nMaxTargetEvents, nEvents );
+	}
+
+	Msg( "Event queue: %d pending (peak %d)\n", m_Heap.Count(), m_nPeakCount );
+	if ( m_Heap.Count() )
+	{
+		Msg( "  next event fires at %.2f\n", m_Heap[0]->m_flFireTime );
+	}
+	Msg( "  %d added, %d fired, %d cancelled\n", m_nAdded, m_nFired, m_nCancelled );
+	Msg( "  %d target names cached, %d cache hits, %d misses\n", m_TargetCache.Count(), m_nTargetCacheHits, m_nTargetCacheMisses );
+	Msg( "  %d callers with pending events (max %d events)\n", m_CallerIndex.Count(), nMaxCallerEvents );
+	Msg( "  %d direct targets with pending events (max %d events)\n", m_TargetIndex.Count(), nMaxTargetEvents );
+}
+
 
 //-----------------------------------------------------------------------------
 // Purpose: adds the action into the correct spot in the priority queue, targeting entity via string name
@@ -857,41 +968,258 @@ void CEventQueue::AddEvent( CBaseEntity *target, const char *action, float fireD
 
 
 //-----------------------------------------------------------------------------
-// Purpose: private function, adds an event into the list
-// Input  : *newEvent - the (already built) event to add
+// Purpose: returns true if pLeft should fire before pRight. Events with the same
+//			fire time go off in the order they were added.
 //-----------------------------------------------------------------------------
-void CEventQueue::AddEvent( EventQueuePrioritizedEvent_t *newEvent )
+bool CEventQueue::FiresBefore( const EventQueuePrioritizedEvent_t *pLeft, const EventQueuePrioritizedEvent_t *pRight )
 {
-	// loop through the actions looking for a place to insert
-	EventQueuePrioritizedEvent_t *pe;
-	for ( pe = &m_Events; pe->m_pNext != NULL; pe = pe->m_pNext )
+	if ( pLeft->m_flFireTime != pRight->m_flFireTime )
+		return pLeft->m_flFireTime < pRight->m_flFireTime;
+
+	return pLeft->m_nSerial < pRight->m_nSerial;
+}
+
+void CEventQueue::HeapSiftUp( int nIndex )
+{
+	EventQueuePrioritizedEvent_t *pe = m_Heap[nIndex];
+	while ( nIndex > 0 )
 	{
-		if ( pe->m_pNext->m_flFireTime > newEvent->m_flFireTime )
+		int nParent = ( nIndex - 1 ) >> 1;
+		if ( !FiresBefore( pe, m_Heap[nParent] ) )
+			break;
+
+		m_Heap[nIndex] = m_Heap[nParent];
+		m_Heap[nIndex]->m_iHeapIndex = nIndex;
+		nIndex = nParent;
+	}
+
+	m_Heap[nIndex] = pe;
+	pe->m_iHeapIndex = nIndex;
+}
+
+void CEventQueue::HeapSiftDown( int nIndex )
+{
+	EventQueuePrioritizedEvent_t *pe = m_Heap[nIndex];
+	int nCount = m_Heap.Count();
+	while ( true )
+	{
+		int nChild = ( nIndex << 1 ) + 1;
+		if ( nChild >= nCount )
+			break;
+
+		if ( nChild + 1 < nCount && FiresBefore( m_Heap[nChild + 1], m_Heap[nChild] ) )
 		{
+			nChild++;
+		}
+
+		if ( !FiresBefore( m_Heap[nChild], pe ) )
 			break;
+
+		m_Heap[nIndex] = m_Heap[nChild];
+		m_Heap[nIndex]->m_iHeapIndex = nIndex;
+		nIndex = nChild;
+	}
+
+	m_Heap[nIndex] = pe;
+	pe->m_iHeapIndex = nIndex;
+}
+
+static int __cdecl EventFireOrderCompare( EventQueuePrioritizedEvent_t * const *ppLeft, EventQueuePrioritizedEvent_t * const *ppRight )
+{
+	if ( (*ppLeft)->m_flFireTime != (*ppRight)->m_flFireTime )
+		return ( (*ppLeft)->m_flFireTime < (*ppRight)->m_flFireTime ) ? -1 : 1;
+
+	if ( (*ppLeft)->m_nSerial != (*ppRight)->m_nSerial )
+		return ( (*ppLeft)->m_nSerial < (*ppRight)->m_nSerial ) ? -1 : 1;
+
+	return 0;
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: copies out the pending events in the order they will fire
+//-----------------------------------------------------------------------------
+void CEventQueue::GetSortedEvents( CUtlVector< EventQueuePrioritizedEvent_t * > &events )
+{
+	events.CopyArray( m_Heap.Base(), m_Heap.Count() );
+	events.Sort( EventFireOrderCompare );
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: adds an event to the lists of its caller and direct target
+//-----------------------------------------------------------------------------
+void CEventQueue::LinkIntoIndices( EventQueuePrioritizedEvent_t *pe )
+{
+	pe->m_pPrevByCaller = pe->m_pNextByCaller = NULL;
+	pe->m_pPrevByTarget = pe->m_pNextByTarget = NULL;
+
+	if ( pe->m_pCaller.IsValid() )
+	{
+		unsigned short i = m_CallerIndex.Find( pe->m_pCaller.ToInt() );
+		if ( i == m_CallerIndex.InvalidIndex() )
+		{
+			m_CallerIndex.Insert( pe->m_pCaller.ToInt(), pe );
+		}
+		else
+		{
+			pe->m_pNextByCaller = m_CallerIndex[i];
+			pe->m_pNextByCaller->m_pPrevByCaller = pe;
+			m_CallerIndex[i] = pe;
 		}
 	}
 
-	Assert( pe );
+	if ( pe->m_pEntTarget.IsValid() )
+	{
+		unsigned short i = m_TargetIndex.Find( pe->m_pEntTarget.ToInt() );
+		if ( i == m_TargetIndex.InvalidIndex() )
+		{
+			m_TargetIndex.Insert( pe->m_pEntTarget.ToInt(), pe );
+		}
+		else
+		{
+			pe->m_pNextByTarget = m_TargetIndex[i];
+			pe->m_pNextByTarget->m_pPrevByTarget = pe;
+			m_TargetIndex[i] = pe;
+		}
+	}
+}
 
-	// insert
-	newEvent->m_pNext = pe->m_pNext;
-	newEvent->m_pPrev = pe;
-	pe->m_pNext = newEvent;
-	if ( newEvent->m_pNext )
+void CEventQueue::UnlinkFromIndices( EventQueuePrioritizedEvent_t *pe )
+{
+	if ( pe->m_pCaller.IsValid() )
 	{
-		newEvent->m_pNext->m_pPrev = newEvent;
+		if ( pe->m_pNextByCaller )
+		{
+			pe->m_pNextByCaller->m_pPrevByCaller = pe->m_pPrevByCaller;
+		}
+
+		if ( pe->m_pPrevByCaller )
+		{
+			pe->m_pPrevByCaller->m_pNextByCaller = pe->m_pNextByCaller;
+		}
+		else
+		{
+			unsigned short i = m_CallerIndex.Find( pe->m_pCaller.ToInt() );
+			Assert( i != m_CallerIndex.InvalidIndex() && m_CallerIndex[i] == pe );
+			if ( pe->m_pNextByCaller )
+			{
+				m_CallerIndex[i] = pe->m_pNextByCaller;
+			}
+			else
+			{
+				m_CallerIndex.RemoveAt( i );
+			}
+		}
 	}
+
+	if ( pe->m_pEntTarget.IsValid() )
+	{
+		if ( pe->m_pNextByTarget )
+		{
+			pe->m_pNextByTarget->m_pPrevByTarget = pe->m_pPrevByTarget;
+		}
+
+		if ( pe->m_pPrevByTarget )
+		{
+			pe->m_pPrevByTarget->m_pNextByTarget = pe->m_pNextByTarget;
+		}
+		else
+		{
+			unsigned short i = m_TargetIndex.Find( pe->m_pEntTarget.ToInt() );
+			Assert( i != m_TargetIndex.InvalidIndex() && m_TargetIndex[i] == pe );
+			if ( pe->m_pNextByTarget )
+			{
+				m_TargetIndex[i] = pe->m_pNextByTarget;
+			}
+			else
+			{
+				m_TargetIndex.RemoveAt( i );
+			}
+		}
+	}
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: private function, adds an event into the queue
+// Input  : *newEvent - the (already built) event to add
+//-----------------------------------------------------------------------------
+void CEventQueue::AddEvent( EventQueuePrioritizedEvent_t *newEvent )
+{
+	newEvent->m_nSerial = m_nNextSerial++;
+	newEvent->m_iHeapIndex = m_Heap.AddToTail( newEvent );
+	HeapSiftUp( newEvent->m_iHeapIndex );
+	LinkIntoIndices( newEvent );
+
+	m_nAdded++;
+	m_nPeakCount = MAX( m_nPeakCount, m_Heap.Count() );
 }
 
 void CEventQueue::RemoveEvent( EventQueuePrioritizedEvent_t *pe )
 {
-	Assert( pe->m_pPrev );
-	pe->m_pPrev->m_pNext = pe->m_pNext;
-	if ( pe->m_pNext )
+	int nIndex = pe->m_iHeapIndex;
+	Assert( m_Heap.IsValidIndex( nIndex ) && m_Heap[nIndex] == pe );
+
+	UnlinkFromIndices( pe );
+
+	// Move the last event into the hole and restore the heap
+	EventQueuePrioritizedEvent_t *pLast = m_Heap.Tail();
+	m_Heap.FastRemove( m_Heap.Count() - 1 );
+	if ( pLast != pe )
 	{
-		pe->m_pNext->m_pPrev = pe->m_pPrev;
+		m_Heap[nIndex] = pLast;
+		pLast->m_iHeapIndex = nIndex;
+		if ( nIndex > 0 && FiresBefore( pLast, m_Heap[( nIndex - 1 ) >> 1] ) )
+		{
+			HeapSiftUp( nIndex );
+		}
+		else
+		{
+			HeapSiftDown( nIndex );
+		}
 	}
+	pe->m_iHeapIndex = -1;
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: debugging; checks the heap order and the secondary indices
+//-----------------------------------------------------------------------------
+void CEventQueue::ValidateQueue( void )
+{
+	int nCallerEvents = 0;
+	int nTargetEvents = 0;
+	for ( int i = 0; i < m_Heap.Count(); i++ )
+	{
+		EventQueuePrioritizedEvent_t *pe = m_Heap[i];
+		Assert( pe->m_iHeapIndex == i );
+		Assert( i == 0 || !FiresBefore( pe, m_Heap[( i - 1 ) >> 1] ) );
+		if ( pe->m_pCaller.IsValid() )
+		{
+			nCallerEvents++;
+		}
+		if ( pe->m_pEntTarget.IsValid() )
+		{
+			nTargetEvents++;
+		}
+	}
+
+	for ( unsigned short i = m_CallerIndex.FirstInorder(); i != m_CallerIndex.InvalidIndex(); i = m_CallerIndex.NextInorder( i ) )
+	{
+		for ( EventQueuePrioritizedEvent_t *pe = m_CallerIndex[i]; pe; pe = pe->m_pNextByCaller )
+		{
+			Assert( pe->m_pCaller.ToInt() == m_CallerIndex.Key( i ) );
+			nCallerEvents--;
+		}
+	}
+
+	for ( unsigned short i = m_TargetIndex.FirstInorder(); i != m_TargetIndex.InvalidIndex(); i = m_TargetIndex.NextInorder( i ) )
+	{
+		for ( EventQueuePrioritizedEvent_t *pe = m_TargetIndex[i]; pe; pe = pe->m_pNextByTarget )
+		{
+			Assert( pe->m_pEntTarget.ToInt() == m_TargetIndex.Key( i ) );
+			nTargetEvents--;
+		}
+	}
+
+	Assert( nCallerEvents == 0 && nTargetEvents == 0 );
 }
 
 
@@ -905,7 +1233,7 @@ void CEventQueue::ServiceEvents( void )
 		return;
 	}
 
-	EventQueuePrioritizedEvent_t *pe = m_Events.m_pNext;
+	EventQueuePrioritizedEvent_t *pe = m_Heap.Count() ? m_Heap[0] : NULL;
 
 #ifdef TF_DLL
 	while ( pe != NULL && pe->m_flFireTime <= engine->GetServerTime() )
@@ -923,9 +1251,20 @@ void CEventQueue::ServiceEvents( void )
 			// In the context the event, the searching entity is also the caller
 			CBaseEntity *pSearchingEntity = pe->m_pCaller;
 			CBaseEntity *target = NULL;
+			TargetCache_t *pCache = GetTargetCache( pe->m_iTarget );
+			int iCached = 0;
 			while ( 1 )
 			{
-				target = gEntList.FindEntityByName( target, pe->m_iTarget, pSearchingEntity, pe->m_pActivator, pe->m_pCaller );
+				// Inputs can spawn, kill or rename entities; once the cached targets are stale,
+				// carry on searching from the last target like an uncached lookup would
+				if ( pCache && pCache->m_nGeneration == gEntList.GetNameIndexGeneration() )
+				{
+					target = ( iCached < pCache->m_Targets.Count() ) ? pCache->m_Targets[iCached++].Get() : NULL;
+				}
+				else
+				{
+					target = gEntList.FindEntityByName( target, pe->m_iTarget, pSearchingEntity, pe->m_pActivator, pe->m_pCaller );
+				}
 				if ( !target )
 					break;
 
@@ -963,24 +1302,33 @@ void CEventQueue::ServiceEvents( void )
 
 		if ( !targetFound )
 		{
-			const char *pClass ="", *pName = "";
-			
-			// might be NULL
-			if ( pe->m_pCaller )
+			if ( ent_io_trace.GetBool() )
 			{
-				pClass = STRING(pe->m_pCaller->m_iClassname);
-				pName = STRING(pe->m_pCaller->GetEntityName());
+				g_EntityIOTrace.RecordTargetNotFound( pe->m_iTarget, pe->m_iTargetInput, pe->m_pCaller );
+			}
+
+			if ( EntityIO_ShouldFormatDebugText() )
+			{
+				const char *pClass ="", *pName = "";
+				
+				// might be NULL
+				if ( pe->m_pCaller )
+				{
+					pClass = STRING(pe->m_pCaller->m_iClassname);
+					pName = STRING(pe->m_pCaller->GetEntityName());
+				}
+				
+				char szBuffer[256];
+				Q_snprintf( szBuffer, sizeof(szBuffer), "unhandled input: (%s) -> (%s), from (%s,%s); target entity not found\n", STRING(pe->m_iTargetInput), STRING(pe->m_iTarget), pClass, pName );
+				DevMsg( 2, "%s", szBuffer );
+				ADD_DEBUG_HISTORY( HISTORY_ENTITY_IO, szBuffer );
 			}
-			
-			char szBuffer[256];
-			Q_snprintf( szBuffer, sizeof(szBuffer), "unhandled input: (%s) -> (%s), from (%s,%s); target entity not found\n", STRING(pe->m_iTargetInput), STRING(pe->m_iTarget), pClass, pName );
-			DevMsg( 2, "%s", szBuffer );
-			ADD_DEBUG_HISTORY( HISTORY_ENTITY_IO, szBuffer );
 		}
 
-		// remove the event from the list (remembering that the queue may have been added to)
+		// remove the event from the queue (remembering that the queue may have been added to)
 		RemoveEvent( pe );
 		delete pe;
+		m_nFired++;
 
 		//
 		// If we are in debug mode, exit the loop if we have fired the correct number of events.
@@ -993,8 +1341,8 @@ void CEventQueue::ServiceEvents( void )
 			}
 		}
 
-		// restart the list (to catch any new items have probably been added to the queue)
-		pe = m_Events.m_pNext;	
+		// restart from the top (to catch any new items have probably been added to the queue)
+		pe = m_Heap.Count() ? m_Heap[0] : NULL;
 	}
 }
 
@@ -1010,6 +1358,89 @@ void CC_DumpEventQueue()
 }
 static ConCommand dumpeventqueue( "dumpeventqueue", CC_DumpEventQueue, "Dump the contents of the Entity I/O event queue to the console." );
 
+//-----------------------------------------------------------------------------
+// Purpose: Prints the Entity I/O event queue's size and counters.
+//-----------------------------------------------------------------------------
+void CC_EventQueueStats()
+{
+	if ( !UTIL_IsCommandIssuedByServerAdmin() )
+		return;
+
+	g_EventQueue.PrintStats();
+}
+static ConCommand ent_queue_stats( "ent_queue_stats", CC_EventQueueStats, "Print the size and counters of the Entity I/O event queue." );
+
+//-----------------------------------------------------------------------------
+// Purpose: Stress test for the event queue. Queues up events from and to the
+//			entities in the level on a scratch queue, then times cancelling them.
+//-----------------------------------------------------------------------------
+void CC_EventQueueBenchmark( const CCommand &args )
+{
+	if ( !UTIL_IsCommandIssuedByServerAdmin() )
+		return;
+
+	int nEvents = ( args.ArgC() > 1 ) ? MAX( atoi( args[1] ), 1 ) : 20000;
+
+	CUtlVector< CBaseEntity * > entities;
+	for ( CBaseEntity *pEntity = gEntList.FirstEnt(); pEntity && entities.Count() < 256; pEntity = gEntList.NextEnt( pEntity ) )
+	{
+		entities.AddToTail( pEntity );
+	}
+
+	if ( !entities.Count() )
+	{
+		Msg( "ent_queue_benchmark: no entities to queue events on.\n" );
+		return;
+	}
+
+	CEventQueue queue;
+	CFastTimer timer;
+
+	timer.Start();
+	for ( int i = 0; i < nEvents; i++ )
+	{
+		CBaseEntity *pCaller = entities[ RandomInt( 0, entities.Count() - 1 ) ];
+		CBaseEntity *pTarget = entities[ RandomInt( 0, entities.Count() - 1 ) ];
+		float flDelay = RandomFloat( 0.0f, 60.0f );
+		if ( i & 1 )
+		{
+			queue.AddEvent( pTarget, "Trigger", flDelay, pCaller, pCaller );
+		}
+		else
+		{
+			queue.AddEvent( STRING( pTarget->GetEntityName() ), "Trigger", variant_t(), flDelay, pCaller, pCaller );
+		}
+	}
+	timer.End();
+	float flAddTime = timer.GetDuration().GetMillisecondsF();
+
+	timer.Start();
+	int nPending = 0;
+	for ( int i = 0; i < entities.Count(); i++ )
+	{
+		nPending += queue.HasEventPending( entities[i], "Trigger" ) ? 1 : 0;
+	}
+	timer.End();
+	float flPendingTime = timer.GetDuration().GetMillisecondsF();
+
+	timer.Start();
+	for ( int i = 0; i < entities.Count(); i++ )
+	{
+		queue.CancelEventOn( entities[i], "Trigger" );
+		queue.CancelEvents( entities[i] );
+	}
+	timer.End();
+	float flCancelTime = timer.GetDuration().GetMillisecondsF();
+
+	queue.ValidateQueue();
+
+	Msg( "ent_queue_benchmark: %d events, %d entities\n", nEvents, entities.Count() );
+	Msg( "  add:     %.3f ms (%.3f us per event)\n", flAddTime, flAddTime * 1000.0f / nEvents );
+	Msg( "  pending: %.3f ms (%d targets with events)\n", flPendingTime, nPending );
+	Msg( "  cancel:  %.3f ms\n", flCancelTime );
+}
+static ConCommand ent_queue_benchmark( "ent_queue_benchmark", CC_EventQueueBenchmark, "Time adding, querying and cancelling events on a scratch Entity I/O queue. Arguments: [events]", FCVAR_CHEAT );
+
 //-----------------------------------------------------------------------------
 // Purpose: Removes all pending events from the I/O queue that were added by the
 //			given caller.
@@ -1022,7 +1453,11 @@ void CEventQueue::CancelEvents( CBaseEntity *pCaller )
 	if (!pCaller)
 		return;
 
-	EventQueuePrioritizedEvent_t *pCur = m_Events.m_pNext;
+	unsigned short i = m_CallerIndex.Find( pCaller->GetRefEHandle().ToInt() );
+	if ( i == m_CallerIndex.InvalidIndex() )
+		return;
+
+	EventQueuePrioritizedEvent_t *pCur = m_CallerIndex[i];
 
 	while (pCur != NULL)
 	{
@@ -1039,12 +1474,13 @@ void CEventQueue::CancelEvents( CBaseEntity *pCaller )
 		}
 
 		EventQueuePrioritizedEvent_t *pCurSave = pCur;
-		pCur = pCur->m_pNext;
+		pCur = pCur->m_pNextByCaller;
 
 		if (bDelete)
 		{
 			RemoveEvent( pCurSave );
 			delete pCurSave;
+			m_nCancelled++;
 		}
 	}
 }
@@ -1060,7 +1496,11 @@ void CEventQueue::CancelEventOn( CBaseEntity *pTarget, const char *sInputName )
 	if (!pTarget)
 		return;
 
-	EventQueuePrioritizedEvent_t *pCur = m_Events.m_pNext;
+	unsigned short i = m_TargetIndex.Find( pTarget->GetRefEHandle().ToInt() );
+	if ( i == m_TargetIndex.InvalidIndex() )
+		return;
+
+	EventQueuePrioritizedEvent_t *pCur = m_TargetIndex[i];
 
 	while (pCur != NULL)
 	{
@@ -1075,12 +1515,13 @@ void CEventQueue::CancelEventOn( CBaseEntity *pTarget, const char *sInputName )
 		}
 
 		EventQueuePrioritizedEvent_t *pCurSave = pCur;
-		pCur = pCur->m_pNext;
+		pCur = pCur->m_pNextByTarget;
 
 		if (bDelete)
 		{
 			RemoveEvent( pCurSave );
 			delete pCurSave;
+			m_nCancelled++;
 		}
 	}
 }
@@ -1095,7 +1536,11 @@ bool CEventQueue::HasEventPending( CBaseEntity *pTarget, const char *sInputName
 	if (!pTarget)
 		return false;
 
-	EventQueuePrioritizedEvent_t *pCur = m_Events.m_pNext;
+	unsigned short i = m_TargetIndex.Find( pTarget->GetRefEHandle().ToInt() );
+	if ( i == m_TargetIndex.InvalidIndex() )
+		return false;
+
+	EventQueuePrioritizedEvent_t *pCur = m_TargetIndex[i];
 
 	while (pCur != NULL)
 	{
@@ -1108,7 +1553,7 @@ bool CEventQueue::HasEventPending( CBaseEntity *pTarget, const char *sInputName
 				return true;
 		}
 
-		pCur = pCur->m_pNext;
+		pCur = pCur->m_pNextByTarget;
 	}
 
 	return false;
@@ -1143,29 +1588,31 @@ BEGIN_SIMPLE_DATADESC( EventQueuePrioritizedEvent_t )
 	DEFINE_FIELD( m_iOutputID, FIELD_INTEGER ),
 	DEFINE_CUSTOM_FIELD( m_VariantValue, variantFuncs ),
 
-//	DEFINE_FIELD( m_pNext, FIELD_??? ),
-//	DEFINE_FIELD( m_pPrev, FIELD_??? ),
+//	DEFINE_FIELD( m_nSerial, FIELD_INTEGER ),		// rebuilt from the save order on restore
+//	DEFINE_FIELD( m_iHeapIndex, FIELD_INTEGER ),
+//	DEFINE_FIELD( m_pNextByCaller, FIELD_??? ),
+//	DEFINE_FIELD( m_pPrevByCaller, FIELD_??? ),
+//	DEFINE_FIELD( m_pNextByTarget, FIELD_??? ),
+//	DEFINE_FIELD( m_pPrevByTarget, FIELD_??? ),
 END_DATADESC()
 
 
 int CEventQueue::Save( ISave &save )
 {
-	// count the number of items in the queue
-	EventQueuePrioritizedEvent_t *pe;
+	// save the events in the order they will fire, so restoring re-adds them in the same order
+	CUtlVector< EventQueuePrioritizedEvent_t * > events;
+	GetSortedEvents( events );
 
-	m_iListCount = 0;
-	for ( pe = m_Events.m_pNext; pe != NULL; pe = pe->m_pNext )
-	{
-		m_iListCount++;
-	}
+	m_iListCount = events.Count();
 
 	// save that value out to disk, so we know how many to restore
 	if ( !save.WriteFields( "EventQueue", this, NULL, m_DataMap.dataDesc, m_DataMap.dataNumFields ) )
 		return 0;
 	
 	// cycle through all the events, saving them all
-	for ( pe = m_Events.m_pNext; pe != NULL; pe = pe->m_pNext )
+	for ( int i = 0; i < events.Count(); i++ )
 	{
+		EventQueuePrioritizedEvent_t *pe = events[i];
 		if ( !save.WriteFields( "PEvent", pe, NULL, pe->m_DataMap.dataDesc, pe->m_DataMap.dataNumFields ) )
 			return 0;
 	}
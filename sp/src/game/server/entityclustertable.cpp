@@ -0,0 +1,126 @@
+//========= Copyright Valve Corporation, All rights reserved. ============//
+//
+// Purpose: Networked entities bucketed by the PVS clusters they touch
+//
+//=============================================================================//
+
+#include "cbase.h"
+#include "entityclustertable.h"
+#include "igamesystem.h"
+
+// memdbgon must be the last include file in a .cpp file!!!
+#include "tier0/memdbgon.h"
+
+CEntityClusterTable g_EntityClusterTable;
+
+//-----------------------------------------------------------------------------
+// Purpose: Moves an entity into the buckets of its new cluster list
+//-----------------------------------------------------------------------------
+void CEntityClusterTable::Update( int iEdict, const PVSInfo_t &info )
+{
+	Assert( iEdict >= 0 && iEdict < MAX_EDICTS );
+
+	AUTO_LOCK( m_Mutex );
+	RemoveClusters( iEdict );
+
+	// too many clusters, the engine keeps a headnode instead
+	if ( info.m_nClusterCount < 0 )
+		return;
+
+	CUtlVector<unsigned short> &clusters = m_EntityClusters[iEdict];
+	clusters.EnsureCapacity( info.m_nClusterCount );
+	for ( int i = 0; i < info.m_nClusterCount; i++ )
+	{
+		int nCluster = info.m_pClusters[i];
+		if ( nCluster >= m_ClusterEntities.Count() )
+		{
+			m_ClusterEntities.AddMultipleToTail( nCluster + 1 - m_ClusterEntities.Count() );
+		}
+		m_ClusterEntities[nCluster].AddToTail( iEdict );
+		clusters.AddToTail( nCluster );
+	}
+	m_Tracked.Set( iEdict );
+}
+
+void CEntityClusterTable::Remove( int iEdict )
+{
+	Assert( iEdict >= 0 && iEdict < MAX_EDICTS );
+
+	AUTO_LOCK( m_Mutex );
+	RemoveClusters( iEdict );
+}
+
+void CEntityClusterTable::RemoveClusters( int iEdict )
+{
+	CUtlVector<unsigned short> &clusters = m_EntityClusters[iEdict];
+	for ( int i = 0; i < clusters.Count(); i++ )
+	{
+		m_ClusterEntities[clusters[i]].FindAndFastRemove( iEdict );
+	}
+	clusters.RemoveAll();
+	m_Tracked.Clear( iEdict );
+}
+
+void CEntityClusterTable::Purge()
+{
+	AUTO_LOCK( m_Mutex );
+	m_ClusterEntities.Purge();
+	for ( int i = 0; i < MAX_EDICTS; i++ )
+	{
+		m_EntityClusters[i].Purge();
+	}
+	m_Tracked.ClearAll();
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Walks the set bits of a PVS a word at a time, marking everything
+//			in each visible cluster
+//-----------------------------------------------------------------------------
+void CEntityClusterTable::BuildVisibleSet( const byte *pPVS, int nPVSSize, CBitVec<MAX_EDICTS> *pVisible )
+{
+	pVisible->ClearAll();
+
+	AUTO_LOCK( m_Mutex );
+	int nClusters = MIN( m_ClusterEntities.Count(), nPVSSize * 8 );
+	for ( int nBase = 0; nBase < nClusters; nBase += 32 )
+	{
+		// PVS rows are bytes and needn't be dword aligned
+		const byte *pBytes = pPVS + ( nBase >> 3 );
+		int nBytes = MIN( 4, nPVSSize - ( nBase >> 3 ) );
+		unsigned int nBits = 0;
+		for ( int i = 0; i < nBytes; i++ )
+		{
+			nBits |= (unsigned int)pBytes[i] << ( i * 8 );
+		}
+
+		while ( nBits )
+		{
+			int nCluster = FirstBitInWord( nBits, nBase );
+			nBits &= nBits - 1;
+			if ( nCluster >= nClusters )
+				break;
+
+			const CUtlVector<unsigned short> &entities = m_ClusterEntities[nCluster];
+			for ( int i = 0; i < entities.Count(); i++ )
+			{
+				pVisible->Set( entities[i] );
+			}
+		}
+	}
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Clusters mean nothing across maps
+//-----------------------------------------------------------------------------
+class CEntityClusterTableSystem : public CAutoGameSystem
+{
+public:
+	CEntityClusterTableSystem() : CAutoGameSystem( "CEntityClusterTableSystem" ) {}
+
+	virtual void LevelShutdownPostEntity()
+	{
+		g_EntityClusterTable.Purge();
+	}
+};
+
+static CEntityClusterTableSystem s_EntityClusterTableSystem;
@@ -0,0 +1,50 @@
+//========= Copyright Valve Corporation, All rights reserved. ============//
+//
+// Purpose: Networked entities bucketed by the PVS clusters they touch, so the
+//			set of entities a client can see is built by walking the set bits
+//			of its PVS rather than testing each entity's cluster list.
+//
+//			An entity's buckets are refreshed whenever its cluster list is
+//			rebuilt, which happens lazily after it moves.
+//
+//=============================================================================//
+
+#ifndef ENTITYCLUSTERTABLE_H
+#define ENTITYCLUSTERTABLE_H
+#ifdef _WIN32
+#pragma once
+#endif
+
+#include "bitvec.h"
+#include "utlvector.h"
+#include "iservernetworkable.h"
+
+class CEntityClusterTable
+{
+public:
+	// Called after an entity's cluster list has been rebuilt
+	void Update( int iEdict, const PVSInfo_t &info );
+	void Remove( int iEdict );
+	void Purge();
+
+	// False for entities whose cluster list hasn't been built, or which touch
+	// too many clusters and are tested against the headnode instead. Their
+	// PVS tests have to go through CServerNetworkProperty::IsInPVS.
+	bool IsTracked( int iEdict ) const		{ return m_Tracked.IsBitSet( iEdict ); }
+
+	// Sets the bit of every tracked entity touching a cluster that's set in
+	// pPVS. Doesn't look at areas.
+	void BuildVisibleSet( const byte *pPVS, int nPVSSize, CBitVec<MAX_EDICTS> *pVisible );
+
+private:
+	void RemoveClusters( int iEdict );
+
+	CThreadFastMutex							m_Mutex;
+	CUtlVector< CUtlVector<unsigned short> >	m_ClusterEntities;				// entities in each cluster
+	CUtlVector<unsigned short>					m_EntityClusters[MAX_EDICTS];	// clusters of each entity
+	CBitVec<MAX_EDICTS>							m_Tracked;
+};
+
+extern CEntityClusterTable g_EntityClusterTable;
+
+#endif // ENTITYCLUSTERTABLE_H
@@ -0,0 +1,364 @@
+//========= Copyright Valve Corporation, All rights reserved. ============//
+//
+// Purpose: Binary trace of entity I/O. See entityio_trace.h.
+//
+//=============================================================================//
+
+#include "cbase.h"
+#include "entityio_trace.h"
+#include "entityoutput.h"
+#include "igamesystem.h"
+#include "tier1/utlmap.h"
+
+// memdbgon must be the last include file in a .cpp file!!!
+#include "tier0/memdbgon.h"
+
+ConVar ent_io_trace( "ent_io_trace", "1", FCVAR_NONE, "Record entity I/O into a ring buffer for ent_io_trace_dump and ent_io_trace_report." );
+
+CEntityIOTrace g_EntityIOTrace;
+
+//-----------------------------------------------------------------------------
+// Purpose: Pooled strings don't survive the level, so neither does the trace
+//-----------------------------------------------------------------------------
+class CEntityIOTraceSystem : public CAutoGameSystem
+{
+public:
+	CEntityIOTraceSystem( char const *name ) : CAutoGameSystem( name )
+	{
+	}
+
+	virtual void LevelShutdownPostEntity()
+	{
+		g_EntityIOTrace.Clear();
+	}
+};
+
+static CEntityIOTraceSystem g_EntityIOTraceSystem( "CEntityIOTraceSystem" );
+
+//-----------------------------------------------------------------------------
+
+static inline float EntityIO_CurTime()
+{
+#ifdef TF_DLL
+	return engine->GetServerTime();
+#else
+	return gpGlobals->curtime;
+#endif
+}
+
+//-----------------------------------------------------------------------------
+
+CEntityIOTrace::CEntityIOTrace()
+{
+	m_nRecorded = 0;
+}
+
+void CEntityIOTrace::Clear()
+{
+	m_nRecorded = 0;
+}
+
+//-----------------------------------------------------------------------------
+
+void CEntityIOTrace::SetEntity( TraceEntity_t *pTraceEntity, CBaseEntity *pEntity )
+{
+	if ( pEntity )
+	{
+		pTraceEntity->m_hEntity = pEntity;
+		pTraceEntity->m_iszClassname = pEntity->m_iClassname;
+		pTraceEntity->m_iszName = pEntity->GetEntityName();
+	}
+	else
+	{
+		pTraceEntity->m_hEntity = NULL;
+		pTraceEntity->m_iszClassname = NULL_STRING;
+		pTraceEntity->m_iszName = NULL_STRING;
+	}
+}
+
+CEntityIOTrace::TraceRecord_t *CEntityIOTrace::AllocRecord( int nType, CBaseEntity *pCaller )
+{
+	TraceRecord_t *pRecord = &m_Records[m_nRecorded & TRACE_MASK];
+	m_nRecorded++;
+
+	pRecord->m_nType = nType;
+	pRecord->m_flTime = EntityIO_CurTime();
+	pRecord->m_flDelay = 0;
+	SetEntity( &pRecord->m_Caller, pCaller );
+	return pRecord;
+}
+
+//-----------------------------------------------------------------------------
+
+void CEntityIOTrace::RecordOutput( CBaseEntity *pCaller, const CEventAction *pAction, const variant_t &value, float flDelay )
+{
+	TraceRecord_t *pRecord = AllocRecord( IOTRACE_OUTPUT, pCaller );
+	SetEntity( &pRecord->m_Target, NULL );
+	pRecord->m_Target.m_iszName = pAction->m_iTarget;
+	pRecord->m_pszInput = STRING( pAction->m_iTargetInput );
+	pRecord->m_flDelay = flDelay;
+	pRecord->m_Value = value;
+}
+
+void CEntityIOTrace::RecordOutputExpired( CBaseEntity *pCaller, const CEventAction *pAction )
+{
+	TraceRecord_t *pRecord = AllocRecord( IOTRACE_OUTPUT_EXPIRED, pCaller );
+	SetEntity( &pRecord->m_Target, NULL );
+	pRecord->m_Target.m_iszName = pAction->m_iTarget;
+	pRecord->m_pszInput = STRING( pAction->m_iTargetInput );
+	pRecord->m_Value = variant_t();
+}
+
+void CEntityIOTrace::RecordInput( CBaseEntity *pTarget, const char *pszInput, CBaseEntity *pCaller, const variant_t &value )
+{
+	TraceRecord_t *pRecord = AllocRecord( IOTRACE_INPUT, pCaller );
+	SetEntity( &pRecord->m_Target, pTarget );
+	pRecord->m_pszInput = pszInput;
+	pRecord->m_Value = value;
+}
+
+void CEntityIOTrace::RecordInputUnhandled( CBaseEntity *pTarget, const char *pszInput, CBaseEntity *pCaller )
+{
+	TraceRecord_t *pRecord = AllocRecord( IOTRACE_INPUT_UNHANDLED, pCaller );
+	SetEntity( &pRecord->m_Target, pTarget );
+	// The name may be in a transient buffer, and pooling it would grow the
+	// string pool with every misspelled input a map fires
+	Q_strncpy( pRecord->m_szUnhandledInput, pszInput, sizeof( pRecord->m_szUnhandledInput ) );
+	pRecord->m_pszInput = pRecord->m_szUnhandledInput;
+	pRecord->m_Value = variant_t();
+}
+
+void CEntityIOTrace::RecordTargetNotFound( string_t iszTarget, string_t iszInput, CBaseEntity *pCaller )
+{
+	TraceRecord_t *pRecord = AllocRecord( IOTRACE_TARGET_NOT_FOUND, pCaller );
+	SetEntity( &pRecord->m_Target, NULL );
+	pRecord->m_Target.m_iszName = iszTarget;
+	pRecord->m_pszInput = STRING( iszInput );
+	pRecord->m_Value = variant_t();
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Renders a record the way the live debug text reads
+//-----------------------------------------------------------------------------
+void CEntityIOTrace::FormatRecord( const TraceRecord_t &record, char *pszBuffer, int nBufferSize )
+{
+	const char *pszCallerClass = ( record.m_Caller.m_iszClassname != NULL_STRING ) ? STRING( record.m_Caller.m_iszClassname ) : "NULL";
+	const char *pszCallerName = ( record.m_Caller.m_iszName != NULL_STRING ) ? STRING( record.m_Caller.m_iszName ) : "NULL";
+	const char *pszTargetName = STRING( record.m_Target.m_iszName );
+
+	switch ( record.m_nType )
+	{
+	case IOTRACE_OUTPUT:
+		if ( record.m_flDelay )
+		{
+			Q_snprintf( pszBuffer, nBufferSize, "(%0.2f) output: (%s,%s) -> (%s,%s,%.1f)(%s)\n", record.m_flTime, pszCallerClass, pszCallerName, pszTargetName, record.m_pszInput, record.m_flDelay, record.m_Value.String() );
+		}
+		else
+		{
+			Q_snprintf( pszBuffer, nBufferSize, "(%0.2f) output: (%s,%s) -> (%s,%s)(%s)\n", record.m_flTime, pszCallerClass, pszCallerName, pszTargetName, record.m_pszInput, record.m_Value.String() );
+		}
+		break;
+
+	case IOTRACE_OUTPUT_EXPIRED:
+		Q_snprintf( pszBuffer, nBufferSize, "(%0.2f) Removing from action list: (%s,%s) -> (%s,%s)\n", record.m_flTime, pszCallerClass, pszCallerName, pszTargetName, record.m_pszInput );
+		break;
+
+	case IOTRACE_INPUT:
+		{
+			// Same as GetDebugName() on the target when it was recorded
+			const char *pszTargetDebugName = ( record.m_Target.m_iszName != NULL_STRING ) ? pszTargetName : STRING( record.m_Target.m_iszClassname );
+			if ( record.m_Caller.m_iszClassname != NULL_STRING )
+			{
+				Q_snprintf( pszBuffer, nBufferSize, "(%0.2f) input %s: %s.%s(%s)\n", record.m_flTime, STRING( record.m_Caller.m_iszName ), pszTargetDebugName, record.m_pszInput, record.m_Value.String() );
+			}
+			else
+			{
+				Q_snprintf( pszBuffer, nBufferSize, "(%0.2f) input <NULL>: %s.%s(%s)\n", record.m_flTime, pszTargetDebugName, record.m_pszInput, record.m_Value.String() );
+			}
+		}
+		break;
+
+	case IOTRACE_INPUT_UNHANDLED:
+		{
+			const char *pszTargetDebugName = ( record.m_Target.m_iszName != NULL_STRING ) ? pszTargetName : STRING( record.m_Target.m_iszClassname );
+			Q_snprintf( pszBuffer, nBufferSize, "(%0.2f) unhandled input: (%s) -> (%s,%s)\n", record.m_flTime, record.m_pszInput, STRING( record.m_Target.m_iszClassname ), pszTargetDebugName );
+		}
+		break;
+
+	case IOTRACE_TARGET_NOT_FOUND:
+		Q_snprintf( pszBuffer, nBufferSize, "(%0.2f) unhandled input: (%s) -> (%s), from (%s,%s); target entity not found\n", record.m_flTime, record.m_pszInput, pszTargetName,
+			( record.m_Caller.m_iszClassname != NULL_STRING ) ? STRING( record.m_Caller.m_iszClassname ) : "",
+			( record.m_Caller.m_iszName != NULL_STRING ) ? STRING( record.m_Caller.m_iszName ) : "" );
+		break;
+
+	default:
+		Assert( 0 );
+		pszBuffer[0] = 0;
+		break;
+	}
+}
+
+//-----------------------------------------------------------------------------
+
+bool CEntityIOTrace::MatchesFilter( const TraceRecord_t &record, const char *pszFilter )
+{
+	if ( !pszFilter || !pszFilter[0] )
+		return true;
+
+	string_t strings[] =
+	{
+		record.m_Caller.m_iszClassname,
+		record.m_Caller.m_iszName,
+		record.m_Target.m_iszClassname,
+		record.m_Target.m_iszName,
+	};
+
+	for ( int i = 0; i < ARRAYSIZE( strings ); i++ )
+	{
+		if ( strings[i] != NULL_STRING && Q_stristr( STRING( strings[i] ), pszFilter ) )
+			return true;
+	}
+
+	return ( record.m_pszInput && Q_stristr( record.m_pszInput, pszFilter ) );
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Prints the most recent records, oldest first
+//-----------------------------------------------------------------------------
+void CEntityIOTrace::Dump( int nMaxRecords, const char *pszFilter )
+{
+	unsigned int nAvailable = MIN( m_nRecorded, (unsigned int)TRACE_SIZE );
+	unsigned int nFirst = m_nRecorded - nAvailable;
+
+	// Walk back to find where the requested number of matches starts
+	int nMatched = 0;
+	unsigned int iStart = m_nRecorded;
+	while ( iStart > nFirst && nMatched < nMaxRecords )
+	{
+		iStart--;
+		if ( MatchesFilter( m_Records[iStart & TRACE_MASK], pszFilter ) )
+			nMatched++;
+	}
+
+	Msg( "Entity I/O trace: %u recorded, showing %d\n", m_nRecorded, nMatched );
+
+	char szBuffer[512];
+	for ( unsigned int i = iStart; i < m_nRecorded; i++ )
+	{
+		const TraceRecord_t &record = m_Records[i & TRACE_MASK];
+		if ( MatchesFilter( record, pszFilter ) )
+		{
+			FormatRecord( record, szBuffer, sizeof( szBuffer ) );
+			Msg( "%s", szBuffer );
+		}
+	}
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Per-entity I/O profile over what's left in the ring
+//-----------------------------------------------------------------------------
+struct EntityIOProfile_t
+{
+	string_t	iszClassname;
+	string_t	iszName;
+	int			nCounts[IOTRACE_NUM_TYPES];
+	int			nTotal;
+};
+
+struct EntityIOProfileKey_t
+{
+	string_t	iszClassname;
+	string_t	iszName;
+};
+
+static bool EntityIOProfileKeyLess( const EntityIOProfileKey_t &lhs, const EntityIOProfileKey_t &rhs )
+{
+	if ( lhs.iszClassname != rhs.iszClassname )
+		return ( STRING( lhs.iszClassname ) < STRING( rhs.iszClassname ) );
+	return ( STRING( lhs.iszName ) < STRING( rhs.iszName ) );
+}
+
+static int __cdecl EntityIOProfileCompare( const EntityIOProfile_t *pLeft, const EntityIOProfile_t *pRight )
+{
+	return pRight->nTotal - pLeft->nTotal;
+}
+
+void CEntityIOTrace::Report( int nMaxEntities )
+{
+	CUtlMap<EntityIOProfileKey_t, int> index( 0, 0, EntityIOProfileKeyLess );
+	CUtlVector<EntityIOProfile_t> profiles;
+
+	unsigned int nAvailable = MIN( m_nRecorded, (unsigned int)TRACE_SIZE );
+	float flFirstTime = 0, flLastTime = 0;
+
+	for ( unsigned int i = m_nRecorded - nAvailable; i < m_nRecorded; i++ )
+	{
+		const TraceRecord_t &record = m_Records[i & TRACE_MASK];
+
+		// Outputs are charged to the entity firing them, everything else to the receiver
+		const TraceEntity_t &owner = ( record.m_nType == IOTRACE_OUTPUT || record.m_nType == IOTRACE_OUTPUT_EXPIRED || record.m_nType == IOTRACE_TARGET_NOT_FOUND ) ? record.m_Caller : record.m_Target;
+
+		EntityIOProfileKey_t key;
+		key.iszClassname = owner.m_iszClassname;
+		key.iszName = owner.m_iszName;
+
+		unsigned short iIndex = index.Find( key );
+		if ( iIndex == index.InvalidIndex() )
+		{
+			int iProfile = profiles.AddToTail();
+			memset( &profiles[iProfile], 0, sizeof( EntityIOProfile_t ) );
+			profiles[iProfile].iszClassname = key.iszClassname;
+			profiles[iProfile].iszName = key.iszName;
+			iIndex = index.Insert( key, iProfile );
+		}
+
+		EntityIOProfile_t &profile = profiles[index[iIndex]];
+		profile.nCounts[record.m_nType]++;
+		profile.nTotal++;
+
+		if ( i == m_nRecorded - nAvailable )
+			flFirstTime = record.m_flTime;
+		flLastTime = record.m_flTime;
+	}
+
+	profiles.Sort( EntityIOProfileCompare );
+
+	Msg( "Entity I/O profile: %u records over %.2f sec, %d entities\n", nAvailable, flLastTime - flFirstTime, profiles.Count() );
+	Msg( "%-32s %-24s %8s %8s %8s %8s %8s\n", "classname", "name", "outputs", "expired", "inputs", "unhandl", "notarget" );
+
+	for ( int i = 0; i < profiles.Count() && i < nMaxEntities; i++ )
+	{
+		const EntityIOProfile_t &profile = profiles[i];
+		Msg( "%-32s %-24s %8d %8d %8d %8d %8d\n",
+			( profile.iszClassname != NULL_STRING ) ? STRING( profile.iszClassname ) : "<world>",
+			( profile.iszName != NULL_STRING ) ? STRING( profile.iszName ) : "",
+			profile.nCounts[IOTRACE_OUTPUT],
+			profile.nCounts[IOTRACE_OUTPUT_EXPIRED],
+			profile.nCounts[IOTRACE_INPUT],
+			profile.nCounts[IOTRACE_INPUT_UNHANDLED],
+			profile.nCounts[IOTRACE_TARGET_NOT_FOUND] );
+	}
+}
+
+//-----------------------------------------------------------------------------
+
+CON_COMMAND( ent_io_trace_dump, "Print recent entity I/O. Format: ent_io_trace_dump [count] [filter]" )
+{
+	if ( !UTIL_IsCommandIssuedByServerAdmin() )
+		return;
+
+	int nCount = ( args.ArgC() > 1 ) ? atoi( args[1] ) : 50;
+	const char *pszFilter = ( args.ArgC() > 2 ) ? args[2] : NULL;
+
+	g_EntityIOTrace.Dump( MAX( nCount, 1 ), pszFilter );
+}
+
+CON_COMMAND( ent_io_trace_report, "Summarize recent entity I/O per entity. Format: ent_io_trace_report [count]" )
+{
+	if ( !UTIL_IsCommandIssuedByServerAdmin() )
+		return;
+
+	int nCount = ( args.ArgC() > 1 ) ? atoi( args[1] ) : 20;
+
+	g_EntityIOTrace.Report( MAX( nCount, 1 ) );
+}
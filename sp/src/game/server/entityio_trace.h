@@ -0,0 +1,107 @@
+//========= Copyright Valve Corporation, All rights reserved. ============//
+//
+// Purpose: Binary trace of entity I/O. Outputs fired, inputs accepted and
+//			events that found no target are recorded into a ring buffer as
+//			handles, pooled strings and timestamps. Nothing is formatted
+//			until the trace is dumped or reported.
+//
+//=============================================================================//
+
+#ifndef ENTITYIO_TRACE_H
+#define ENTITYIO_TRACE_H
+#ifdef _WIN32
+#pragma once
+#endif
+
+#include "variant_t.h"
+#include "env_debughistory.h"
+
+class CBaseEntity;
+class CEventAction;
+
+enum EntityIOTraceType_t
+{
+	IOTRACE_OUTPUT = 0,			// output fired, event posted to the queue
+	IOTRACE_OUTPUT_EXPIRED,		// output removed after its last allowed fire
+	IOTRACE_INPUT,				// input accepted by an entity
+	IOTRACE_INPUT_UNHANDLED,	// entity has no such input
+	IOTRACE_TARGET_NOT_FOUND,	// queued event matched no entity
+
+	IOTRACE_NUM_TYPES
+};
+
+//-----------------------------------------------------------------------------
+// Purpose: Returns true if the live debug text for an I/O event will be
+//			shown anywhere, so it's only formatted when it's needed.
+//-----------------------------------------------------------------------------
+inline bool EntityIO_ShouldFormatDebugText()
+{
+#if defined( DISABLE_DEBUG_HISTORY )
+	return developer.GetInt() >= 2;
+#else
+	return true;
+#endif
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Fixed size ring of I/O records
+//-----------------------------------------------------------------------------
+class CEntityIOTrace
+{
+public:
+	CEntityIOTrace();
+
+	void Clear();
+
+	void RecordOutput( CBaseEntity *pCaller, const CEventAction *pAction, const variant_t &value, float flDelay );
+	void RecordOutputExpired( CBaseEntity *pCaller, const CEventAction *pAction );
+	void RecordInput( CBaseEntity *pTarget, const char *pszInput, CBaseEntity *pCaller, const variant_t &value );
+	void RecordInputUnhandled( CBaseEntity *pTarget, const char *pszInput, CBaseEntity *pCaller );
+	void RecordTargetNotFound( string_t iszTarget, string_t iszInput, CBaseEntity *pCaller );
+
+	void Dump( int nMaxRecords, const char *pszFilter );
+	void Report( int nMaxEntities );
+
+private:
+	enum
+	{
+		TRACE_SIZE = 2048,		// must be a power of two
+		TRACE_MASK = TRACE_SIZE - 1,
+
+		MAX_UNHANDLED_INPUT_NAME = 32,
+	};
+
+	struct TraceEntity_t
+	{
+		EHANDLE		m_hEntity;
+		string_t	m_iszClassname;
+		string_t	m_iszName;
+	};
+
+	struct TraceRecord_t
+	{
+		float			m_flTime;
+		float			m_flDelay;
+		int				m_nType;
+		TraceEntity_t	m_Caller;
+		TraceEntity_t	m_Target;		// only the name is known for outputs
+		const char *	m_pszInput;		// pooled, owned by a datadesc, or m_szUnhandledInput
+		variant_t		m_Value;
+
+		// Unhandled input names can come from a transient buffer, so they're copied here
+		char			m_szUnhandledInput[MAX_UNHANDLED_INPUT_NAME];
+	};
+
+	TraceRecord_t *	AllocRecord( int nType, CBaseEntity *pCaller );
+	static void		SetEntity( TraceEntity_t *pTraceEntity, CBaseEntity *pEntity );
+	static void		FormatRecord( const TraceRecord_t &record, char *pszBuffer, int nBufferSize );
+	static bool		MatchesFilter( const TraceRecord_t &record, const char *pszFilter );
+
+	TraceRecord_t	m_Records[TRACE_SIZE];
+	unsigned int	m_nRecorded;
+};
+
+extern CEntityIOTrace g_EntityIOTrace;
+extern ConVar ent_io_trace;
+
+#endif // ENTITYIO_TRACE_H
@@ -17,6 +17,7 @@
 #include "ai_initutils.h"
 #include "globalstate.h"
 #include "datacache/imdlcache.h"
+#include "tier1/generichash.h"
 
 #ifdef HL2_DLL
 #include "npc_playercompanion.h"
@@ -33,6 +34,8 @@ static CUtlVector<IServerNetworkable*> g_DeleteList;
 CGlobalEntityList gEntList;
 CBaseEntityList *g_pEntityList = &gEntList;
 
+static ConVar ent_name_index( "ent_name_index", "1", FCVAR_CHEAT, "Look up entities by name through the name index instead of walking the entity list" );
+
 class CAimTargetManager : public IEntityListener
 {
 public:
@@ -133,6 +136,17 @@ struct simthinkentry_t
 	unsigned short	unused0;
 	int				nextThinkTick;
 };
+
+// Think-only entries are also bucketed by next think tick so that a tick only
+// touches the entries that come due. Entries that are due (simulating entities,
+// and thinkers whose tick has arrived) sit on the due list until they change.
+#define SIMTHINK_WHEEL_SIZE		256		// must be a power of two
+#define SIMTHINK_WHEEL_MASK		( SIMTHINK_WHEEL_SIZE - 1 )
+#define SIMTHINK_DUE_LIST		SIMTHINK_WHEEL_SIZE
+#define SIMTHINK_NO_LINK		0xFFFF
+
+static ConVar sv_simthink_wheel( "sv_simthink_wheel", "1", 0, "Find thinking entities through the think tick wheel instead of scanning the whole sim/think list" );
+
 class CSimThinkManager : public IEntityListener
 {
 public:
@@ -146,7 +160,18 @@ public:
 		for ( int i = 0; i < ARRAYSIZE(m_entinfoIndex); i++ )
 		{
 			m_entinfoIndex[i] = 0xFFFF;
+			m_wheelNext[i] = SIMTHINK_NO_LINK;
+			m_wheelPrev[i] = SIMTHINK_NO_LINK;
+			m_wheelList[i] = SIMTHINK_NO_LINK;
+		}
+		for ( int i = 0; i < ARRAYSIZE(m_wheelHead); i++ )
+		{
+			m_wheelHead[i] = SIMTHINK_NO_LINK;
 		}
+		m_nLastScanTick = -1;
+		m_nStatTicks = 0;
+		m_nStatListed = m_nStatExamined = m_nStatDue = 0;
+		m_nStatTotalListed = m_nStatTotalExamined = m_nStatTotalDue = 0;
 	}
 	void LevelInitPreEntity()
 	{
@@ -175,6 +200,7 @@ public:
 		if ( listHandle != 0xFFFF )
 		{
 			Assert(m_simThinkList[listHandle].entEntry == index);
+			UnlinkFromWheel( index );
 			m_simThinkList.FastRemove( listHandle );
 			m_entinfoIndex[index] = 0xFFFF;
 			
@@ -192,6 +218,9 @@ public:
 
 	int ListCopy( CBaseEntity *pList[], int listMax )
 	{
+		if ( sv_simthink_wheel.GetBool() )
+			return ListCopyDue( pList, listMax );
+
 		int count = MIN(listMax, ListCount());
 		int out = 0;
 		for ( int i = 0; i < count; i++ )
@@ -199,16 +228,12 @@ public:
 			// only copy out entities that will simulate or think this frame
 			if ( m_simThinkList[i].nextThinkTick <= gpGlobals->tickcount )
 			{
-				Assert(m_simThinkList[i].nextThinkTick>=0);
-				int entinfoIndex = m_simThinkList[i].entEntry;
-				const CEntInfo *pInfo = gEntList.GetEntInfoPtrByIndex( entinfoIndex );
-				pList[out] = (CBaseEntity *)pInfo->m_pEntity;
-				Assert(m_simThinkList[i].nextThinkTick==0 || pList[out]->GetFirstThinkTick()==m_simThinkList[i].nextThinkTick);
-				Assert( gEntList.IsEntityPtr( pList[out] ) );
+				pList[out] = GetListEntity( i );
 				out++;
 			}
 		}
 
+		RecordStats( count, out );
 		return out;
 	}
 
@@ -254,13 +279,192 @@ public:
 				{
 					m_simThinkList[m_entinfoIndex[index]].nextThinkTick = 0;
 				}
+				UnlinkFromWheel( index );
 			}
+			LinkIntoWheel( index );
+		}
+	}
+
+	void ReportStats()
+	{
+		Msg( "Sim/think list: %d entries, %d on the due list\n", m_simThinkList.Count(), CountList( SIMTHINK_DUE_LIST ) );
+		Msg( "Last tick: %d listed, %d visited, %d thinking or simulating\n", m_nStatListed, m_nStatExamined, m_nStatDue );
+		if ( m_nStatTicks )
+		{
+			Msg( "Average over %d ticks: %.1f listed, %.1f visited, %.1f thinking or simulating\n", m_nStatTicks,
+				(float)m_nStatTotalListed / m_nStatTicks, (float)m_nStatTotalExamined / m_nStatTicks, (float)m_nStatTotalDue / m_nStatTicks );
 		}
 	}
 
+	void ResetStats()
+	{
+		m_nStatTicks = 0;
+		m_nStatTotalListed = m_nStatTotalExamined = m_nStatTotalDue = 0;
+	}
+
 private:
+	CBaseEntity *GetListEntity( int listHandle )
+	{
+		Assert(m_simThinkList[listHandle].nextThinkTick>=0);
+		int entinfoIndex = m_simThinkList[listHandle].entEntry;
+		const CEntInfo *pInfo = gEntList.GetEntInfoPtrByIndex( entinfoIndex );
+		CBaseEntity *pEntity = (CBaseEntity *)pInfo->m_pEntity;
+		Assert(m_simThinkList[listHandle].nextThinkTick==0 || pEntity->GetFirstThinkTick()==m_simThinkList[listHandle].nextThinkTick);
+		Assert( gEntList.IsEntityPtr( pEntity ) );
+		return pEntity;
+	}
+
+	void LinkIntoWheel( int index )
+	{
+		Assert( m_wheelList[index] == SIMTHINK_NO_LINK );
+		int nextThinkTick = m_simThinkList[m_entinfoIndex[index]].nextThinkTick;
+		int list = ( nextThinkTick <= m_nLastScanTick || nextThinkTick == 0 ) ? SIMTHINK_DUE_LIST : ( nextThinkTick & SIMTHINK_WHEEL_MASK );
+		LinkIntoList( index, list );
+	}
+
+	void LinkIntoList( int index, int list )
+	{
+		m_wheelList[index] = list;
+		m_wheelPrev[index] = SIMTHINK_NO_LINK;
+		m_wheelNext[index] = m_wheelHead[list];
+		if ( m_wheelHead[list] != SIMTHINK_NO_LINK )
+		{
+			m_wheelPrev[m_wheelHead[list]] = index;
+		}
+		m_wheelHead[list] = index;
+	}
+
+	void UnlinkFromWheel( int index )
+	{
+		int list = m_wheelList[index];
+		if ( list == SIMTHINK_NO_LINK )
+			return;
+
+		if ( m_wheelPrev[index] != SIMTHINK_NO_LINK )
+		{
+			m_wheelNext[m_wheelPrev[index]] = m_wheelNext[index];
+		}
+		else
+		{
+			m_wheelHead[list] = m_wheelNext[index];
+		}
+		if ( m_wheelNext[index] != SIMTHINK_NO_LINK )
+		{
+			m_wheelPrev[m_wheelNext[index]] = m_wheelPrev[index];
+		}
+		m_wheelNext[index] = m_wheelPrev[index] = m_wheelList[index] = SIMTHINK_NO_LINK;
+	}
+
+	int CountList( int list )
+	{
+		int count = 0;
+		for ( int index = m_wheelHead[list]; index != SIMTHINK_NO_LINK; index = m_wheelNext[index] )
+		{
+			count++;
+		}
+		return count;
+	}
+
+	// Moves every entry whose think tick has arrived onto the due list
+	int AdvanceWheel( int tick )
+	{
+		if ( tick < m_nLastScanTick )
+		{
+			// Clock went backwards, bucket everything again
+			m_nLastScanTick = tick - 1;
+			for ( int i = 0; i < m_simThinkList.Count(); i++ )
+			{
+				UnlinkFromWheel( m_simThinkList[i].entEntry );
+				LinkIntoWheel( m_simThinkList[i].entEntry );
+			}
+		}
+
+		int examined = 0;
+		int firstTick = m_nLastScanTick + 1;
+		int numTicks = MIN( tick - m_nLastScanTick, SIMTHINK_WHEEL_SIZE );
+		for ( int t = 0; t < numTicks; t++ )
+		{
+			int index = m_wheelHead[( firstTick + t ) & SIMTHINK_WHEEL_MASK];
+			while ( index != SIMTHINK_NO_LINK )
+			{
+				int next = m_wheelNext[index];
+				examined++;
+
+				// entries more than a lap out stay in their bucket
+				if ( m_simThinkList[m_entinfoIndex[index]].nextThinkTick <= tick )
+				{
+					UnlinkFromWheel( index );
+					LinkIntoList( index, SIMTHINK_DUE_LIST );
+				}
+				index = next;
+			}
+		}
+		m_nLastScanTick = tick;
+		return examined;
+	}
+
+	int ListCopyDue( CBaseEntity *pList[], int listMax )
+	{
+		int examined = AdvanceWheel( gpGlobals->tickcount );
+
+		// Hand the due entries out in list order, same as a full scan would
+		m_dueHandles.RemoveAll();
+		for ( int index = m_wheelHead[SIMTHINK_DUE_LIST]; index != SIMTHINK_NO_LINK; index = m_wheelNext[index] )
+		{
+			examined++;
+			int listHandle = m_entinfoIndex[index];
+			if ( listHandle < listMax )
+			{
+				m_dueHandles.AddToTail( listHandle );
+			}
+		}
+		m_dueHandles.Sort( SortListHandles );
+
+		for ( int i = 0; i < m_dueHandles.Count(); i++ )
+		{
+			pList[i] = GetListEntity( m_dueHandles[i] );
+		}
+
+		RecordStats( examined, m_dueHandles.Count() );
+		return m_dueHandles.Count();
+	}
+
+	static int SortListHandles( const unsigned short *pLeft, const unsigned short *pRight )
+	{
+		return (int)*pLeft - (int)*pRight;
+	}
+
+	void RecordStats( int examined, int due )
+	{
+		m_nStatListed = m_simThinkList.Count();
+		m_nStatExamined = examined;
+		m_nStatDue = due;
+
+		m_nStatTicks++;
+		m_nStatTotalListed += m_nStatListed;
+		m_nStatTotalExamined += examined;
+		m_nStatTotalDue += due;
+	}
+
 	unsigned short m_entinfoIndex[NUM_ENT_ENTRIES];
 	CUtlVector<simthinkentry_t>	m_simThinkList;
+
+	// Think tick wheel, threaded through entinfo indices
+	unsigned short m_wheelHead[SIMTHINK_WHEEL_SIZE + 1];
+	unsigned short m_wheelNext[NUM_ENT_ENTRIES];
+	unsigned short m_wheelPrev[NUM_ENT_ENTRIES];
+	unsigned short m_wheelList[NUM_ENT_ENTRIES];
+	int m_nLastScanTick;
+	CUtlVector<unsigned short> m_dueHandles;
+
+	// Per tick counters
+	int m_nStatListed;
+	int m_nStatExamined;
+	int m_nStatDue;
+	int m_nStatTicks;
+	int64 m_nStatTotalListed;
+	int64 m_nStatTotalExamined;
+	int64 m_nStatTotalDue;
 };
 
 CSimThinkManager g_SimThinkManager;
@@ -290,10 +494,20 @@ CBaseEntityClassList::~CBaseEntityClassList()
 {
 }
 
-CGlobalEntityList::CGlobalEntityList()
+CGlobalEntityList::CGlobalEntityList() : m_NameIndexBuckets( 0, 0, DefLessFunc( unsigned int ) )
 {
 	m_iHighestEnt = m_iNumEnts = m_iNumEdicts = 0;
 	m_bClearingEntities = false;
+
+	for ( int i = 0; i < NUM_ENT_ENTRIES; i++ )
+	{
+		m_NameIndex[i].m_nAddOrder = 0;
+		m_NameIndex[i].m_iName = NULL_STRING;
+		m_NameIndex[i].m_nHash = 0;
+		m_NameIndex[i].m_iNext = m_NameIndex[i].m_iPrev = -1;
+	}
+	m_nNextAddOrder = 0;
+	m_nNameIndexGeneration = 0;
 }
 
 
@@ -568,6 +782,159 @@ CBaseEntity *CGlobalEntityList::FindEntityProcedural( const char *szName, CBaseE
 }
 
 
+//-----------------------------------------------------------------------------
+// Purpose: Iterates the entities with a given (non-wildcard) name through the
+//			name index. Returns the same entities in the same order as walking
+//			the whole list.
+//-----------------------------------------------------------------------------
+CBaseEntity *CGlobalEntityList::FindEntityByNameIndexed( CBaseEntity *pStartEntity, const char *szName, IEntityFindFilter *pFilter )
+{
+	unsigned short iBucket = m_NameIndexBuckets.Find( HashStringCaseless( szName ) );
+	if ( iBucket == m_NameIndexBuckets.InvalidIndex() )
+		return NULL;
+
+	int iSlot = m_NameIndexBuckets[iBucket];
+	if ( pStartEntity )
+	{
+		unsigned int nStartOrder = m_NameIndex[ pStartEntity->GetRefEHandle().GetEntryIndex() ].m_nAddOrder;
+		while ( iSlot != -1 && m_NameIndex[iSlot].m_nAddOrder <= nStartOrder )
+		{
+			iSlot = m_NameIndex[iSlot].m_iNext;
+		}
+	}
+
+	for ( ; iSlot != -1; iSlot = m_NameIndex[iSlot].m_iNext )
+	{
+		CBaseEntity *ent = (CBaseEntity *)GetEntInfoPtrByIndex( iSlot )->m_pEntity;
+		if ( !ent )
+		{
+			DevWarning( "NULL entity in entity name index!\n" );
+			continue;
+		}
+
+		// Buckets can share a hash; this also applies the usual case-insensitive compare
+		if ( ent->NameMatches( szName ) )
+		{
+			if ( pFilter && !pFilter->ShouldFindEntity(ent) )
+				continue;
+
+			return ent;
+		}
+	}
+
+	return NULL;
+}
+
+
+//-----------------------------------------------------------------------------
+// Purpose: Adds an entity slot to the bucket for its name, keeping the bucket
+//			in active list order.
+//-----------------------------------------------------------------------------
+void CGlobalEntityList::AddToNameIndex( int iSlot, string_t iszName )
+{
+	NameIndexEntry_t &entry = m_NameIndex[iSlot];
+	Assert( entry.m_iName == NULL_STRING );
+
+	entry.m_iName = iszName;
+	entry.m_nHash = HashStringCaseless( STRING( iszName ) );
+	entry.m_iPrev = entry.m_iNext = -1;
+
+	unsigned short iBucket = m_NameIndexBuckets.Find( entry.m_nHash );
+	if ( iBucket == m_NameIndexBuckets.InvalidIndex() )
+	{
+		m_NameIndexBuckets.Insert( entry.m_nHash, iSlot );
+	}
+	else
+	{
+		int iPrev = -1;
+		int iNext = m_NameIndexBuckets[iBucket];
+		while ( iNext != -1 && m_NameIndex[iNext].m_nAddOrder < entry.m_nAddOrder )
+		{
+			iPrev = iNext;
+			iNext = m_NameIndex[iNext].m_iNext;
+		}
+
+		entry.m_iPrev = iPrev;
+		entry.m_iNext = iNext;
+		if ( iNext != -1 )
+		{
+			m_NameIndex[iNext].m_iPrev = iSlot;
+		}
+		if ( iPrev != -1 )
+		{
+			m_NameIndex[iPrev].m_iNext = iSlot;
+		}
+		else
+		{
+			m_NameIndexBuckets[iBucket] = iSlot;
+		}
+	}
+
+	m_nNameIndexGeneration++;
+}
+
+
+void CGlobalEntityList::RemoveFromNameIndex( int iSlot )
+{
+	NameIndexEntry_t &entry = m_NameIndex[iSlot];
+	if ( entry.m_iName == NULL_STRING )
+		return;
+
+	if ( entry.m_iNext != -1 )
+	{
+		m_NameIndex[entry.m_iNext].m_iPrev = entry.m_iPrev;
+	}
+
+	if ( entry.m_iPrev != -1 )
+	{
+		m_NameIndex[entry.m_iPrev].m_iNext = entry.m_iNext;
+	}
+	else
+	{
+		unsigned short iBucket = m_NameIndexBuckets.Find( entry.m_nHash );
+		Assert( iBucket != m_NameIndexBuckets.InvalidIndex() && m_NameIndexBuckets[iBucket] == iSlot );
+		if ( entry.m_iNext != -1 )
+		{
+			m_NameIndexBuckets[iBucket] = entry.m_iNext;
+		}
+		else
+		{
+			m_NameIndexBuckets.RemoveAt( iBucket );
+		}
+	}
+
+	entry.m_iName = NULL_STRING;
+	entry.m_iPrev = entry.m_iNext = -1;
+	m_nNameIndexGeneration++;
+}
+
+
+//-----------------------------------------------------------------------------
+// Purpose: Re-indexes an entity whose name may have changed. Called by
+//			SetName, the targetname keyvalue and restore.
+//-----------------------------------------------------------------------------
+void CGlobalEntityList::UpdateNameIndex( CBaseEntity *pEntity )
+{
+	const CBaseHandle &handle = pEntity->GetRefEHandle();
+	if ( handle == INVALID_EHANDLE_INDEX )
+		return;
+
+	int iSlot = handle.GetEntryIndex();
+	if ( GetEntInfoPtrByIndex( iSlot )->m_pEntity != pEntity )
+		return;
+
+	string_t iszName = pEntity->GetEntityName();
+	if ( m_NameIndex[iSlot].m_iName == iszName )
+		return;
+
+	RemoveFromNameIndex( iSlot );
+	if ( iszName != NULL_STRING )
+	{
+		AddToNameIndex( iSlot, iszName );
+	}
+}
+
+
 //-----------------------------------------------------------------------------
 // Purpose: Iterates the entities with a given name.
 // Input  : pStartEntity - Last entity found, NULL to start a new iteration.
@@ -590,6 +957,10 @@ CBaseEntity *CGlobalEntityList::FindEntityByName( CBaseEntity *pStartEntity, con
 
 		return NULL;
 	}
+
+	// Wildcards can match names in any bucket
+	if ( ent_name_index.GetBool() && !Q_strstr( szName, "*" ) )
+		return FindEntityByNameIndexed( pStartEntity, szName, pFilter );
 	
 	const CEntInfo *pInfo = pStartEntity ? GetEntInfoPtr( pStartEntity->GetRefEHandle() )->m_pNext : FirstEntInfo();
 
@@ -1095,6 +1466,14 @@ void CGlobalEntityList::OnAddEntity( IHandleEntity *pEnt, CBaseHandle handle )
 	
 	// NOTE: Must be a CBaseEntity on server
 	Assert( pBaseEnt );
+
+	int iSlot = handle.GetEntryIndex();
+	m_NameIndex[iSlot].m_nAddOrder = ++m_nNextAddOrder;
+	if ( pBaseEnt->GetEntityName() != NULL_STRING )
+	{
+		AddToNameIndex( iSlot, pBaseEnt->GetEntityName() );
+	}
+
 	//DevMsg(2,"Created %s\n", pBaseEnt->GetClassname() );
 	for ( i = m_entityListeners.Count()-1; i >= 0; i-- )
 	{
@@ -1125,6 +1504,8 @@ void CGlobalEntityList::OnRemoveEntity( IHandleEntity *pEnt, CBaseHandle handle
 	if ( pBaseEnt->edict() )
 		m_iNumEdicts--;
 
+	RemoveFromNameIndex( handle.GetEntryIndex() );
+
 	m_iNumEnts--;
 }
 
@@ -1615,6 +1996,18 @@ CON_COMMAND(report_touchlinks, "Lists all touchlinks")
 	list.ReportEntityList();
 }
 
+CON_COMMAND(report_simthink_stats, "Reports how many sim/think entries were visited vs. thinking per tick. Pass 'reset' to clear the averages.")
+{
+	if ( !UTIL_IsCommandIssuedByServerAdmin() )
+		return;
+
+	g_SimThinkManager.ReportStats();
+	if ( args.ArgC() > 1 && !Q_stricmp( args[1], "reset" ) )
+	{
+		g_SimThinkManager.ResetStats();
+	}
+}
+
 CON_COMMAND(report_simthinklist, "Lists all simulating/thinking entities")
 {
 	if ( !UTIL_IsCommandIssuedByServerAdmin() )
@@ -14,6 +14,7 @@
 #endif
 
 #include "baseentity.h"
+#include "utlmap.h"
 
 class IEntityListener;
 
@@ -81,6 +82,27 @@ private:
 	bool m_bClearingEntities;
 	CUtlVector<IEntityListener *>	m_entityListeners;
 
+	// Index of named entities, bucketed on a caseless hash of the name. Each bucket
+	// is kept in the same order as the active list so lookups find entities in the
+	// order a walk of the whole list would.
+	struct NameIndexEntry_t
+	{
+		unsigned int	m_nAddOrder;	// the active list only grows at the tail, so this is its order
+		string_t		m_iName;		// name this slot is indexed under; NULL_STRING if it isn't
+		unsigned int	m_nHash;
+		int				m_iNext;
+		int				m_iPrev;
+	};
+
+	NameIndexEntry_t m_NameIndex[NUM_ENT_ENTRIES];
+	CUtlMap< unsigned int, int > m_NameIndexBuckets;
+	unsigned int m_nNextAddOrder;
+	int m_nNameIndexGeneration;
+
+	void AddToNameIndex( int iSlot, string_t iszName );
+	void RemoveFromNameIndex( int iSlot );
+	CBaseEntity *FindEntityByNameIndexed( CBaseEntity *pStartEntity, const char *szName, IEntityFindFilter *pFilter );
+
 public:
 	IServerNetworkable* GetServerNetworkable( CBaseHandle hEnt ) const;
 	CBaseNetworkable* GetBaseNetworkable( CBaseHandle hEnt ) const;
@@ -158,6 +180,12 @@ public:
 	CBaseEntity *FindEntityByNetname( CBaseEntity *pStartEntity, const char *szModelName );
 
 	CBaseEntity *FindEntityProcedural( const char *szName, CBaseEntity *pSearchingEntity = NULL, CBaseEntity *pActivator = NULL, CBaseEntity *pCaller = NULL );
+
+	// Keeps the name index in sync with the entity's m_iName
+	void UpdateNameIndex( CBaseEntity *pEntity );
+
+	// Changes whenever a named entity is added, removed or renamed
+	int GetNameIndexGeneration() const { return m_nNameIndexGeneration; }
 	
 	CGlobalEntityList();
 
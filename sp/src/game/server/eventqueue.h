@@ -15,6 +15,7 @@
 #endif
 
 #include "mempool.h"
+#include "utlmap.h"
 
 struct EventQueuePrioritizedEvent_t
 {
@@ -28,8 +29,14 @@ struct EventQueuePrioritizedEvent_t
 
 	variant_t m_VariantValue;	// variable-type parameter
 
-	EventQueuePrioritizedEvent_t *m_pNext;
-	EventQueuePrioritizedEvent_t *m_pPrev;
+	unsigned int m_nSerial;		// breaks fire time ties in the order events were added
+	int m_iHeapIndex;			// position in the queue's heap
+
+	// Links in the per-caller and per-target lists used for cancellation
+	EventQueuePrioritizedEvent_t *m_pNextByCaller;
+	EventQueuePrioritizedEvent_t *m_pPrevByCaller;
+	EventQueuePrioritizedEvent_t *m_pNextByTarget;
+	EventQueuePrioritizedEvent_t *m_pPrevByTarget;
 
 	DECLARE_SIMPLE_DATADESC();
 
@@ -66,14 +73,49 @@ public:
 
 	void Dump( void );
 
+	void PrintStats( void );
+
 private:
+	typedef CUtlMap< unsigned long, EventQueuePrioritizedEvent_t * > EventIndex_t;
 
 	void AddEvent( EventQueuePrioritizedEvent_t *event );
 	void RemoveEvent( EventQueuePrioritizedEvent_t *pe );
 
+	// Binary heap ordered on fire time, then on the order the events were added
+	static bool FiresBefore( const EventQueuePrioritizedEvent_t *pLeft, const EventQueuePrioritizedEvent_t *pRight );
+	void HeapSiftUp( int nIndex );
+	void HeapSiftDown( int nIndex );
+	void GetSortedEvents( CUtlVector< EventQueuePrioritizedEvent_t * > &events );
+
+	// Per-caller and per-target lists, keyed on the entity handle
+	void LinkIntoIndices( EventQueuePrioritizedEvent_t *pe );
+	void UnlinkFromIndices( EventQueuePrioritizedEvent_t *pe );
+
+	// The entities a target name resolved to. Valid while the entity list's
+	// name index generation hasn't changed.
+	struct TargetCache_t
+	{
+		int m_nGeneration;
+		CUtlVector< EHANDLE > m_Targets;
+	};
+	TargetCache_t *GetTargetCache( string_t iszTarget );
+	void ClearTargetCache( void );
+
 	DECLARE_SIMPLE_DATADESC();
-	EventQueuePrioritizedEvent_t m_Events;
+	CUtlVector< EventQueuePrioritizedEvent_t * > m_Heap;
+	EventIndex_t m_CallerIndex;
+	EventIndex_t m_TargetIndex;
+	CUtlMap< const char *, TargetCache_t * > m_TargetCache;
+	unsigned int m_nNextSerial;
 	int m_iListCount;
+
+	// Counters reported by ent_queue_stats
+	int m_nPeakCount;
+	int m_nAdded;
+	int m_nFired;
+	int m_nCancelled;
+	int m_nTargetCacheHits;
+	int m_nTargetCacheMisses;
 };
 
 extern CEventQueue g_EventQueue;
@@ -89,6 +89,9 @@
 #include "tier3/tier3.h"
 #include "serverbenchmark_base.h"
 #include "querycache.h"
+#include "tier1/framearena.h"
+#include "entityclustertable.h"
+#include "bspfile.h"
 
 
 #ifdef TF_DLL
@@ -204,6 +207,7 @@ static ConVar s_UseNetworkVars( "UseNetworkVars", "1", FCVAR_CHEAT, "For profili
 extern ConVar sv_noclipduringpause;
 ConVar sv_massreport( "sv_massreport", "0" );
 ConVar sv_force_transmit_ents( "sv_force_transmit_ents", "0", FCVAR_CHEAT | FCVAR_DEVELOPMENTONLY, "Will transmit all entities to client, regardless of PVS conditions (will still skip based on transmit flags, however)." );
+ConVar sv_transmit_cluster_table( "sv_transmit_cluster_table", "1", 0, "Test entities against each client's PVS with a set built from the entity cluster table, instead of one entity at a time." );
 
 ConVar sv_autosave( "sv_autosave", "1", 0, "Set to 1 to autosave game on level transition. Does not affect autosave triggers." );
 ConVar *sv_maxreplay = NULL;
@@ -1179,6 +1183,22 @@ void CServerGameDLL::GameServerSteamAPIShutdown( void )
 #endif
 }
 
+//-----------------------------------------------------------------------------
+// Purpose: High-water marks of the per-thread frame scratch arenas
+//-----------------------------------------------------------------------------
+CON_COMMAND( frame_arena_report, "Reports frame scratch arena high-water marks. Usage: frame_arena_report [reset]" )
+{
+	if ( !UTIL_IsCommandIssuedByServerAdmin() )
+		return;
+
+	if ( args.ArgC() > 1 && !Q_stricmp( args[1], "reset" ) )
+	{
+		CFrameArena::ResetStats();
+		return;
+	}
+	CFrameArena::ReportStats();
+}
+
 //-----------------------------------------------------------------------------
 // Purpose: Called at the start of every game frame
 //-----------------------------------------------------------------------------
@@ -1215,6 +1235,9 @@ void CServerGameDLL::GameFrame( bool simulating )
 	extern void ServiceEventQueue( void );
 	extern void Physics_RunThinkFunctions( bool simulating );
 
+	// Last frame's unscoped scratch goes away
+	CFrameArena::NewFrame();
+
 	// Delete anything that was marked for deletion
 	//  outside of server frameloop (e.g., in response to concommand)
 	gEntList.CleanupDeleteList();
@@ -2376,6 +2399,76 @@ CBaseEntity* CServerGameEnts::EdictToBaseEntity( edict_t *pEdict )
 }
 
 
+//-----------------------------------------------------------------------------
+// Purpose: Returns true if nArea is one of the client's areas or is connected
+//			to one, as CServerNetworkProperty::IsInPVS tests it. pCache holds
+//			an answer per area for the client being checked, -1 if unknown.
+//-----------------------------------------------------------------------------
+static bool IsAreaNetworkedToClient( const CCheckTransmitInfo *pInfo, int nArea, signed char *pCache )
+{
+	bool bCached = ( nArea >= 0 && nArea < MAX_MAP_AREAS );
+	if ( bCached && pCache[nArea] >= 0 )
+		return pCache[nArea] != 0;
+
+	bool bNetworked = false;
+	for ( int i = 0; i < pInfo->m_AreasNetworked; i++ )
+	{
+		int clientArea = pInfo->m_Areas[i];
+		if ( clientArea == nArea || engine->CheckAreasConnected( clientArea, nArea ) )
+		{
+			bNetworked = true;
+			break;
+		}
+	}
+
+	if ( bCached )
+	{
+		pCache[nArea] = bNetworked;
+	}
+	return bNetworked;
+}
+
+//-----------------------------------------------------------------------------
+// Time spent in CheckTransmit for each client, reported and reset by
+// sv_checktransmit_stats
+//-----------------------------------------------------------------------------
+struct CheckTransmitStats_t
+{
+	double	m_flTotalMS;
+	float	m_flMaxMS;
+	int		m_nCalls;
+	int		m_nTableTests;		// PVS tests answered from the cluster table
+	int		m_nSlowTests;		// PVS tests that went through IsInPVS
+};
+
+static CheckTransmitStats_t s_CheckTransmitStats[MAX_PLAYERS + 1];
+
+CON_COMMAND( sv_checktransmit_stats, "Prints the time spent deciding what to send to each client since the last call, then resets it." )
+{
+	if ( !UTIL_IsCommandIssuedByServerAdmin() )
+		return;
+
+	Msg( "%-6s %-24s %8s %10s %10s %12s\n", "client", "name", "calls", "avg ms", "max ms", "table tests" );
+	for ( int i = 1; i <= MAX_PLAYERS; i++ )
+	{
+		CheckTransmitStats_t &stats = s_CheckTransmitStats[i];
+		if ( !stats.m_nCalls )
+			continue;
+
+		CBasePlayer *pPlayer = UTIL_PlayerByIndex( i );
+		int nTests = stats.m_nTableTests + stats.m_nSlowTests;
+		Msg( "%-6d %-24s %8d %10.4f %10.4f %11.1f%%\n",
+			i,
+			pPlayer ? pPlayer->GetPlayerName() : "",
+			stats.m_nCalls,
+			stats.m_flTotalMS / stats.m_nCalls,
+			stats.m_flMaxMS,
+			nTests ? 100.0f * stats.m_nTableTests / nTests : 0.0f );
+	}
+
+	memset( s_CheckTransmitStats, 0, sizeof( s_CheckTransmitStats ) );
+}
+
 /* Yuck.. ideally this would be in CServerNetworkProperty's header, but it requires CBaseEntity and
 // inlining it gives a nice speedup.
 inline void CServerNetworkProperty::CheckTransmit( CCheckTransmitInfo *pInfo )
@@ -2420,6 +2513,42 @@ void CServerGameEnts::CheckTransmit( CCheckTransmitInfo *pInfo, const unsigned s
 		    bIsReplay == ( pInfo->m_pTransmitAlways != NULL) );
 #endif
 
+	CFastTimer timer;
+	timer.Start();
+
+	int iClient = ENTINDEX( pInfo->m_pClientEnt );
+	CheckTransmitStats_t *pStats = ( iClient >= 1 && iClient <= MAX_PLAYERS ) ? &s_CheckTransmitStats[iClient] : NULL;
+	int nTableTests = 0, nSlowTests = 0;
+
+	// Everything that touches a cluster in the client's PVS, from the cluster
+	// table. Entities that moved since it was last updated are brought up to
+	// date first so they can use it too.
+	bool bUseClusterTable = sv_transmit_cluster_table.GetBool() && !sv_force_transmit_ents.GetBool();
+#ifndef _X360
+	bUseClusterTable = bUseClusterTable && !bIsHLTV && !bIsReplay;
+#endif
+	CBitVec<MAX_EDICTS> visibleEdicts;
+	signed char areaNetworked[MAX_MAP_AREAS];
+	if ( bUseClusterTable )
+	{
+		for ( int i=0; i < nEdicts; i++ )
+		{
+			edict_t *pEdict = &pBaseEdict[pEdictIndices[i]];
+			int nFlags = pEdict->m_fStateFlags;
+			if ( ( nFlags & FL_EDICT_DIRTY_PVS_INFORMATION ) && !( nFlags & ( FL_EDICT_DONTSEND | FL_EDICT_ALWAYS ) ) )
+			{
+				CServerNetworkProperty *pNetProp = static_cast<CServerNetworkProperty*>( pEdict->GetNetworkable() );
+				if ( pNetProp )
+				{
+					pNetProp->RecomputePVSInformation();
+				}
+			}
+		}
+
+		g_EntityClusterTable.BuildVisibleSet( (const byte *)pInfo->m_PVS, pInfo->m_nPVSSize, &visibleEdicts );
+		memset( areaNetworked, -1, sizeof( areaNetworked ) );
+	}
+
 	for ( int i=0; i < nEdicts; i++ )
 	{
 		int iEdict = pEdictIndices[i];
@@ -2505,6 +2634,10 @@ void CServerGameEnts::CheckTransmit( CCheckTransmitInfo *pInfo, const unsigned s
 		}
 #endif
 
+		// The visible set only holds entities whose clusters were current
+		// when it was built
+		bool bInVisibleSet = bUseClusterTable && !( pEdict->m_fStateFlags & FL_EDICT_DIRTY_PVS_INFORMATION ) && g_EntityClusterTable.IsTracked( iEdict );
+
 		// Always send entities in the player's 3d skybox.
 		// Sidenote: call of AreaNum() ensures that PVS data is up to date for this entity
 		bool bSameAreaAsSky = netProp->AreaNum() == skyBoxArea;
@@ -2514,7 +2647,21 @@ void CServerGameEnts::CheckTransmit( CCheckTransmitInfo *pInfo, const unsigned s
 			continue;
 		}
 
-		bool bInPVS = netProp->IsInPVS( pInfo );
+		bool bInPVS;
+		if ( bInVisibleSet )
+		{
+			// doors can legally straddle two areas
+			const PVSInfo_t *pPVSInfo = netProp->GetPVSInfo();
+			bInPVS = visibleEdicts.IsBitSet( iEdict ) &&
+				( IsAreaNetworkedToClient( pInfo, pPVSInfo->m_nAreaNum, areaNetworked ) ||
+				  ( pPVSInfo->m_nAreaNum2 && IsAreaNetworkedToClient( pInfo, pPVSInfo->m_nAreaNum2, areaNetworked ) ) );
+			nTableTests++;
+		}
+		else
+		{
+			bInPVS = netProp->IsInPVS( pInfo );
+			nSlowTests++;
+		}
 		if ( bInPVS || sv_force_transmit_ents.GetBool() )
 		{
 			// only send if entity is in PVS
@@ -2582,6 +2729,17 @@ void CServerGameEnts::CheckTransmit( CCheckTransmitInfo *pInfo, const unsigned s
 		}
 	}
 
+	timer.End();
+	if ( pStats )
+	{
+		float flMS = timer.GetDuration().GetMillisecondsF();
+		pStats->m_flTotalMS += flMS;
+		pStats->m_flMaxMS = MAX( pStats->m_flMaxMS, flMS );
+		pStats->m_nCalls++;
+		pStats->m_nTableTests += nTableTests;
+		pStats->m_nSlowTests += nSlowTests;
+	}
+
 //	Msg("A:%i, N:%i, F: %i, P: %i\n", always, dontSend, fullCheck, PVS );
 }
 
@@ -33,6 +33,7 @@
 #include "vphysicsupdateai.h"
 #include "tier0/vcrmode.h"
 #include "pushentity.h"
+#include "tier1/framearena.h"
 
 // memdbgon must be the last include file in a .cpp file!!!
 #include "tier0/memdbgon.h"
@@ -2047,7 +2048,8 @@ void Physics_RunThinkFunctions( bool simulating )
 		UTIL_DisableRemoveImmediate();
 		int listMax = SimThink_ListCount();
 		listMax = MAX(listMax,1);
-		CBaseEntity **list = (CBaseEntity **)stackalloc( sizeof(CBaseEntity *) * listMax );
+		CFrameArenaScope scratch;
+		CBaseEntity **list = scratch.AllocArray<CBaseEntity *>( listMax );
 		// iterate through all entities and have them think or simulate
 		
 		// UNDONE: This has problems with UTIL_RemoveImmediate() (now disabled during this loop).  
@@ -2064,7 +2066,6 @@ void Physics_RunThinkFunctions( bool simulating )
 			Physics_SimulateEntity( list[i] );
 		}
 
-		stackfree( list );
 		UTIL_EnableRemoveImmediate();
 	}
 
@@ -27,6 +27,23 @@ LINK_ENTITY_TO_CLASS( soundent, CSoundEnt );
 
 static CSoundEnt *g_pSoundEnt = NULL;
 
+bool CSoundEnt::s_bSpatialIndexDirty = true;
+
+ConVar ai_sound_grid( "ai_sound_grid", "1", FCVAR_CHEAT, "Answer NPC hearing queries from the sound grid instead of walking the whole active sound list" );
+
+// Hearing query counters, per tick
+struct SoundQueryStats_t
+{
+	int		m_nTick;
+	int		m_nQueries;
+	int		m_nActiveChecks;	// sounds a walk of the active list would have checked
+	int		m_nExamined;		// sounds actually checked
+	int		m_nReturned;		// sounds handed back to the listener
+};
+
+static SoundQueryStats_t s_CurQueryStats;
+static SoundQueryStats_t s_LastQueryStats;
+
 BEGIN_SIMPLE_DATADESC( CSound )
 
 	DEFINE_FIELD( m_hOwner,				FIELD_EHANDLE ),
@@ -71,6 +88,7 @@ void CSound::Reset ( void )
 	m_iType			= 0;
 	m_iVolume		= 0;
 	m_iNext			= SOUNDLIST_EMPTY;
+	CSoundEnt::MarkSpatialIndexDirty();
 }
 
 //=========================================================
@@ -189,6 +207,9 @@ BEGIN_DATADESC( CSoundEnt )
 	DEFINE_FIELD( m_iActiveSound,		FIELD_INTEGER ),
 	DEFINE_FIELD( m_cLastActiveSounds,	FIELD_INTEGER ),
 	DEFINE_EMBEDDED_ARRAY( m_SoundPool, MAX_WORLD_SOUNDS_SP ),
+	DEFINE_EMBEDDED_ARRAY( m_SoundPoolExtra, MAX_WORLD_SOUNDS_POOL - MAX_WORLD_SOUNDS_SP ),
+	//								m_GridHead, m_GridTypes, m_GridNext, m_GridCellsUsed (not saved, rebuilt)
+	//								m_SoundSerial, m_nNextSoundSerial (not saved, rebuilt)
 
 END_DATADESC()
 
@@ -224,6 +245,8 @@ void CSoundEnt::ShutdownSoundEnt()
 //-----------------------------------------------------------------------------
 CSoundEnt::CSoundEnt()
 {
+	m_nNextSoundSerial = 0;
+	ResetSpatialIndex();
 }
 
 CSoundEnt::~CSoundEnt()
@@ -253,6 +276,9 @@ void CSoundEnt::OnRestore()
 		UTIL_Remove( g_pSoundEnt );
 	}
 	g_pSoundEnt = this;
+
+	RepairSoundLists();
+	ResetSpatialIndex();
 }
 
 
@@ -273,17 +299,17 @@ void CSoundEnt::Think ( void )
 
 	while ( iSound != SOUNDLIST_EMPTY )
 	{
-		if ( (m_SoundPool[ iSound ].m_flExpireTime <= gpGlobals->curtime && (!m_SoundPool[ iSound ].m_bNoExpirationTime)) || !m_SoundPool[iSound].ValidateOwner() )
+		if ( (PoolSound( iSound ).m_flExpireTime <= gpGlobals->curtime && (!PoolSound( iSound ).m_bNoExpirationTime)) || !PoolSound( iSound ).ValidateOwner() )
 		{
-			int iNext = m_SoundPool[ iSound ].m_iNext;
+			int iNext = PoolSound( iSound ).m_iNext;
 
 			if( displaysoundlist.GetInt() == 1 )
 			{
-				Msg("  Removed Sound: %d (Time:%f)\n", m_SoundPool[ iSound ].SoundType(), gpGlobals->curtime );
+				Msg("  Removed Sound: %d (Time:%f)\n", PoolSound( iSound ).SoundType(), gpGlobals->curtime );
 			}
-			if( displaysoundlist.GetInt() == 2 && m_SoundPool[ iSound ].IsSoundType( SOUND_DANGER ) )
+			if( displaysoundlist.GetInt() == 2 && PoolSound( iSound ).IsSoundType( SOUND_DANGER ) )
 			{
-				Msg("  Removed Danger Sound: %d (time:%f)\n", m_SoundPool[ iSound ].SoundType(), gpGlobals->curtime );
+				Msg("  Removed Danger Sound: %d (time:%f)\n", PoolSound( iSound ).SoundType(), gpGlobals->curtime );
 			}
 
 			// move this sound back into the free list
@@ -304,7 +330,7 @@ void CSoundEnt::Think ( void )
 				g = 255;
 				b = 0;
 
-				CSound *pSound = &m_SoundPool[ iSound ];
+				CSound *pSound = &PoolSound( iSound );
 
 				if( pSound->IsSoundType( SOUND_DANGER ) )
 				{
@@ -344,7 +370,7 @@ void CSoundEnt::Think ( void )
 			}
 
 			iPreviousSound = iSound;
-			iSound = m_SoundPool[ iSound ].m_iNext;
+			iSound = PoolSound( iSound ).m_iNext;
 		}
 	}
 
@@ -374,17 +400,19 @@ void CSoundEnt::FreeSound ( int iSound, int iPrevious )
 	{
 		// iSound is not the head of the active list, so
 		// must fix the index for the Previous sound
-		g_pSoundEnt->m_SoundPool[ iPrevious ].m_iNext = g_pSoundEnt->m_SoundPool[ iSound ].m_iNext;
+		g_pSoundEnt->PoolSound( iPrevious ).m_iNext = g_pSoundEnt->PoolSound( iSound ).m_iNext;
 	}
 	else 
 	{
 		// the sound we're freeing IS the head of the active list.
-		g_pSoundEnt->m_iActiveSound = g_pSoundEnt->m_SoundPool [ iSound ].m_iNext;
+		g_pSoundEnt->m_iActiveSound = g_pSoundEnt->PoolSound( iSound ).m_iNext;
 	}
 
 	// make iSound the head of the Free list.
-	g_pSoundEnt->m_SoundPool[ iSound ].m_iNext = g_pSoundEnt->m_iFreeSound;
+	g_pSoundEnt->PoolSound( iSound ).m_iNext = g_pSoundEnt->m_iFreeSound;
 	g_pSoundEnt->m_iFreeSound = iSound;
+
+	MarkSpatialIndexDirty();
 }
 
 //=========================================================
@@ -409,14 +437,17 @@ int CSoundEnt::IAllocSound( void )
 	
 	iNewSound = m_iFreeSound;// copy the index of the next free sound
 
-	m_iFreeSound = m_SoundPool[ m_iFreeSound ].m_iNext;// move the index down into the free list. 
+	m_iFreeSound = PoolSound( m_iFreeSound ).m_iNext;// move the index down into the free list. 
 
-	m_SoundPool[ iNewSound ].m_iNext = m_iActiveSound;// point the new sound at the top of the active list.
+	PoolSound( iNewSound ).m_iNext = m_iActiveSound;// point the new sound at the top of the active list.
 
 	m_iActiveSound = iNewSound;// now make the new sound the top of the active list. You're done.
 
+	m_SoundSerial[ iNewSound ] = ++m_nNextSoundSerial;
+	MarkSpatialIndexDirty();
+
 #ifdef DEBUG
-	m_SoundPool[ iNewSound ].m_iMyIndex = iNewSound;
+	PoolSound( iNewSound ).m_iMyIndex = iNewSound;
 #endif // DEBUG
 
 	return iNewSound;
@@ -453,7 +484,7 @@ void CSoundEnt::InsertSound ( int iType, const Vector &vecOrigin, int iVolume, f
 
 	CSound *pSound;
 
-	pSound = &g_pSoundEnt->m_SoundPool[ iThisSound ];
+	pSound = &g_pSoundEnt->PoolSound( iThisSound );
 
 	pSound->SetSoundOrigin( vecOrigin );
 	pSound->m_iType = iType;
@@ -495,7 +526,7 @@ int CSoundEnt::FindOrAllocateSound( CBaseEntity *pOwner, int soundChannelIndex )
 
 	while ( iSound != SOUNDLIST_EMPTY )
 	{
-		CSound &sound = m_SoundPool[iSound];
+		CSound &sound = PoolSound( iSound );
 		
 		if ( sound.m_ownerChannelIndex == soundChannelIndex && sound.m_hOwner == pOwner )
 		{
@@ -520,12 +551,10 @@ void CSoundEnt::Initialize ( void )
 	m_cLastActiveSounds;
 	m_iFreeSound = 0;
 	m_iActiveSound = SOUNDLIST_EMPTY;
+	m_nNextSoundSerial = 0;
+	ResetSpatialIndex();
 
-	// In SP, we should only use the first 64 slots so save/load works right.
-	// In MP, have one for each player and 32 extras.
-	int nTotalSoundsInPool = MAX_WORLD_SOUNDS_SP;
-	if ( gpGlobals->maxClients > 1 )
-		nTotalSoundsInPool = MIN( MAX_WORLD_SOUNDS_MP, gpGlobals->maxClients + 32 );
+	int nTotalSoundsInPool = PoolSize();
 
 	if ( gpGlobals->maxClients+16 > nTotalSoundsInPool )
 	{
@@ -535,11 +564,11 @@ void CSoundEnt::Initialize ( void )
 	for ( i = 0 ; i < nTotalSoundsInPool ; i++ )
 	{
 		// clear all sounds, and link them into the free sound list.
-		m_SoundPool[ i ].Clear();
-		m_SoundPool[ i ].m_iNext = i + 1;
+		PoolSound( i ).Clear();
+		PoolSound( i ).m_iNext = i + 1;
 	}
 
-	m_SoundPool[ i - 1 ].m_iNext = SOUNDLIST_EMPTY;// terminate the list here.
+	PoolSound( i - 1 ).m_iNext = SOUNDLIST_EMPTY;// terminate the list here.
 
 	
 	// now reserve enough sounds for each client
@@ -553,7 +582,7 @@ void CSoundEnt::Initialize ( void )
 			return;
 		}
 
-		m_SoundPool[ iSound ].m_bNoExpirationTime = true;
+		PoolSound( iSound ).m_bNoExpirationTime = true;
 	}
 }
 
@@ -590,7 +619,7 @@ int CSoundEnt::ISoundsInList ( int iListType )
 	{
 		i++;
 
-		iThisSound = m_SoundPool[ iThisSound ].m_iNext;
+		iThisSound = PoolSound( iThisSound ).m_iNext;
 	}
 
 	return i;
@@ -633,7 +662,7 @@ CSound*	CSoundEnt::SoundPointerForIndex( int iIndex )
 		return NULL;
 	}
 
-	if ( iIndex > ( MAX_WORLD_SOUNDS_MP - 1 ) )
+	if ( iIndex > ( MAX_WORLD_SOUNDS_POOL - 1 ) )
 	{
 		Msg( "SoundPointerForIndex() - Index too large!\n" );
 		return NULL;
@@ -645,7 +674,7 @@ CSound*	CSoundEnt::SoundPointerForIndex( int iIndex )
 		return NULL;
 	}
 
-	return &g_pSoundEnt->m_SoundPool[ iIndex ];
+	return &g_pSoundEnt->PoolSound( iIndex );
 }
 
 //=========================================================
@@ -668,6 +697,267 @@ int CSoundEnt::ClientSoundIndex ( edict_t *pClient )
 	return iReturn;
 }
 
+//=========================================================
+// PoolSize - number of sounds in the pool this game uses.
+// In SP the whole pool is used. In MP, have one for each
+// player and 32 extras.
+//=========================================================
+int CSoundEnt::PoolSize( void )
+{
+	if ( gpGlobals->maxClients > 1 )
+		return MIN( MAX_WORLD_SOUNDS_MP, gpGlobals->maxClients + 32 );
+
+	return MAX_WORLD_SOUNDS_POOL;
+}
+
+//=========================================================
+// RepairSoundLists - after a restore, makes sure every slot
+// in the pool is on exactly one list. Saves from before the
+// pool grew only hold the first MAX_WORLD_SOUNDS_SP sounds,
+// so the rest of the pool comes back empty and is freed here.
+// Also rebuilds the allocation order of the active list.
+//=========================================================
+void CSoundEnt::RepairSoundLists( void )
+{
+	int nPoolSize = PoolSize();
+	bool bOnList[ MAX_WORLD_SOUNDS_POOL ];
+	memset( bOnList, 0, sizeof( bOnList ) );
+
+	int *pListHeads[2] = { &m_iActiveSound, &m_iFreeSound };
+	for ( int iList = 0; iList < 2; iList++ )
+	{
+		int iPrevious = SOUNDLIST_EMPTY;
+		int iSound = *pListHeads[iList];
+		while ( iSound != SOUNDLIST_EMPTY )
+		{
+			if ( iSound < 0 || iSound >= nPoolSize || bOnList[ iSound ] )
+			{
+				// Cut the list off at a bad link
+				if ( iPrevious == SOUNDLIST_EMPTY )
+					*pListHeads[iList] = SOUNDLIST_EMPTY;
+				else
+					PoolSound( iPrevious ).m_iNext = SOUNDLIST_EMPTY;
+				break;
+			}
+
+			bOnList[ iSound ] = true;
+			iPrevious = iSound;
+			iSound = PoolSound( iSound ).m_iNext;
+		}
+	}
+
+	for ( int i = nPoolSize - 1; i >= 0; i-- )
+	{
+		if ( bOnList[ i ] )
+			continue;
+
+		PoolSound( i ).Clear();
+		PoolSound( i ).m_iNext = m_iFreeSound;
+		m_iFreeSound = i;
+	}
+
+	// The head of the active list is the most recently allocated
+	int nActive = ISoundsInList( SOUNDLISTTYPE_ACTIVE );
+	m_nNextSoundSerial = nActive;
+	for ( int iSound = m_iActiveSound; iSound != SOUNDLIST_EMPTY; iSound = PoolSound( iSound ).m_iNext )
+	{
+		m_SoundSerial[ iSound ] = nActive--;
+	}
+}
+
+//=========================================================
+// Spatial index
+//=========================================================
+static inline int SoundGridCoord( float flCoord )
+{
+	int iCoord = (int)( ( flCoord + MAX_COORD_INTEGER ) * ( 1.0f / SOUNDENT_GRID_CELL_SIZE ) );
+	return clamp( iCoord, 0, SOUNDENT_GRID_DIM - 1 );
+}
+
+void CSoundEnt::ResetSpatialIndex( void )
+{
+	for ( int i = 0; i < ARRAYSIZE( m_GridHead ); i++ )
+	{
+		m_GridHead[i] = SOUNDLIST_EMPTY;
+		m_GridTypes[i] = 0;
+	}
+	m_GridCellsUsed.RemoveAll();
+	m_flGridMaxVolume = 0;
+	m_nGridSounds = 0;
+	MarkSpatialIndexDirty();
+}
+
+void CSoundEnt::BuildSpatialIndex( void )
+{
+	for ( int i = 0; i < m_GridCellsUsed.Count(); i++ )
+	{
+		m_GridHead[ m_GridCellsUsed[i] ] = SOUNDLIST_EMPTY;
+		m_GridTypes[ m_GridCellsUsed[i] ] = 0;
+	}
+	m_GridCellsUsed.RemoveAll();
+	m_flGridMaxVolume = 0;
+	m_nGridSounds = 0;
+
+	for ( int iSound = m_iActiveSound; iSound != SOUNDLIST_EMPTY; iSound = PoolSound( iSound ).m_iNext )
+	{
+		CSound &sound = PoolSound( iSound );
+		const Vector &vecOrigin = sound.GetSoundOrigin();
+		int iCell = SoundGridCoord( vecOrigin.y ) * SOUNDENT_GRID_DIM + SoundGridCoord( vecOrigin.x );
+
+		if ( m_GridHead[ iCell ] == SOUNDLIST_EMPTY )
+		{
+			m_GridCellsUsed.AddToTail( iCell );
+		}
+		m_GridNext[ iSound ] = m_GridHead[ iCell ];
+		m_GridHead[ iCell ] = iSound;
+		m_GridTypes[ iCell ] |= sound.SoundType();
+
+		m_flGridMaxVolume = MAX( m_flGridMaxVolume, (float)sound.Volume() );
+		m_nGridSounds++;
+	}
+
+	s_bSpatialIndexDirty = false;
+}
+
+int CSoundEnt::QuerySoundsInRange( const Vector &vecEarPosition, float flHearingScale, int iTypeMask, int *pSoundList, int nMaxSounds )
+{
+	int nFound = 0;
+	int nExamined = 0;
+
+	if ( !ai_sound_grid.GetBool() )
+	{
+		for ( int iSound = m_iActiveSound; iSound != SOUNDLIST_EMPTY; iSound = PoolSound( iSound ).m_iNext )
+		{
+			CSound &sound = PoolSound( iSound );
+			nExamined++;
+
+			if ( !( iTypeMask & sound.SoundType() ) )
+				continue;
+
+			float flHearDistanceSq = sound.Volume() * flHearingScale;
+			flHearDistanceSq *= flHearDistanceSq;
+			if ( sound.GetSoundOrigin().DistToSqr( vecEarPosition ) <= flHearDistanceSq && nFound < nMaxSounds )
+			{
+				pSoundList[ nFound++ ] = iSound;
+			}
+		}
+	}
+	else
+	{
+		if ( s_bSpatialIndexDirty )
+		{
+			BuildSpatialIndex();
+		}
+
+		float flRadius = m_flGridMaxVolume * fabs( flHearingScale );
+		int xMin = SoundGridCoord( vecEarPosition.x - flRadius );
+		int xMax = SoundGridCoord( vecEarPosition.x + flRadius );
+		int yMin = SoundGridCoord( vecEarPosition.y - flRadius );
+		int yMax = SoundGridCoord( vecEarPosition.y + flRadius );
+
+		// Walk whichever is smaller, the cells in range or the cells with sounds in them
+		int nCellsInRange = ( xMax - xMin + 1 ) * ( yMax - yMin + 1 );
+		bool bWalkUsedCells = ( m_GridCellsUsed.Count() < nCellsInRange );
+		int nCells = bWalkUsedCells ? m_GridCellsUsed.Count() : nCellsInRange;
+
+		for ( int i = 0; i < nCells; i++ )
+		{
+			int iCell;
+			if ( bWalkUsedCells )
+			{
+				iCell = m_GridCellsUsed[i];
+				int x = iCell % SOUNDENT_GRID_DIM;
+				int y = iCell / SOUNDENT_GRID_DIM;
+				if ( x < xMin || x > xMax || y < yMin || y > yMax )
+					continue;
+			}
+			else
+			{
+				iCell = ( yMin + i / ( xMax - xMin + 1 ) ) * SOUNDENT_GRID_DIM + xMin + i % ( xMax - xMin + 1 );
+			}
+
+			if ( !( m_GridTypes[ iCell ] & iTypeMask ) )
+				continue;
+
+			for ( int iSound = m_GridHead[ iCell ]; iSound != SOUNDLIST_EMPTY; iSound = m_GridNext[ iSound ] )
+			{
+				CSound &sound = PoolSound( iSound );
+				nExamined++;
+
+				if ( !( iTypeMask & sound.SoundType() ) )
+					continue;
+
+				float flHearDistanceSq = sound.Volume() * flHearingScale;
+				flHearDistanceSq *= flHearDistanceSq;
+				if ( sound.GetSoundOrigin().DistToSqr( vecEarPosition ) <= flHearDistanceSq && nFound < nMaxSounds )
+				{
+					pSoundList[ nFound++ ] = iSound;
+				}
+			}
+		}
+
+		// Put the results back in active list order (newest first)
+		for ( int i = 1; i < nFound; i++ )
+		{
+			int iSound = pSoundList[i];
+			int j = i - 1;
+			while ( j >= 0 && m_SoundSerial[ pSoundList[j] ] < m_SoundSerial[ iSound ] )
+			{
+				pSoundList[j + 1] = pSoundList[j];
+				j--;
+			}
+			pSoundList[j + 1] = iSound;
+		}
+	}
+
+	if ( s_CurQueryStats.m_nTick != gpGlobals->tickcount )
+	{
+		s_LastQueryStats = s_CurQueryStats;
+		memset( &s_CurQueryStats, 0, sizeof( s_CurQueryStats ) );
+		s_CurQueryStats.m_nTick = gpGlobals->tickcount;
+	}
+	s_CurQueryStats.m_nQueries++;
+	s_CurQueryStats.m_nActiveChecks += ai_sound_grid.GetBool() ? m_nGridSounds : nExamined;
+	s_CurQueryStats.m_nExamined += nExamined;
+	s_CurQueryStats.m_nReturned += nFound;
+
+	return nFound;
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Collects the active sounds of the given types that are loud enough
+//			to reach vecEarPosition, scaled by the listener's hearing.
+//-----------------------------------------------------------------------------
+int CSoundEnt::GetSoundsInRange( const Vector &vecEarPosition, float flHearingScale, int iTypeMask, int *pSoundList, int nMaxSounds )
+{
+	if ( !g_pSoundEnt )
+	{
+		return 0;
+	}
+
+	return g_pSoundEnt->QuerySoundsInRange( vecEarPosition, flHearingScale, iTypeMask, pSoundList, nMaxSounds );
+}
+
+void CSoundEnt::ReportQueryStats( void )
+{
+	if ( g_pSoundEnt )
+	{
+		Msg( "Sounds: %d active, %d free\n", g_pSoundEnt->ISoundsInList( SOUNDLISTTYPE_ACTIVE ), g_pSoundEnt->ISoundsInList( SOUNDLISTTYPE_FREE ) );
+	}
+
+	const SoundQueryStats_t &stats = ( s_CurQueryStats.m_nTick == gpGlobals->tickcount ) ? s_CurQueryStats : s_LastQueryStats;
+	Msg( "Tick %d: %d hearing queries, %d sound checks (%d for a full list walk), %d sounds heard\n",
+		stats.m_nTick, stats.m_nQueries, stats.m_nExamined, stats.m_nActiveChecks, stats.m_nReturned );
+}
+
+CON_COMMAND( report_soundent_stats, "Reports NPC hearing query counts for the last tick" )
+{
+	if ( !UTIL_IsCommandIssuedByServerAdmin() )
+		return;
+
+	CSoundEnt::ReportQueryStats();
+}
+
 //-----------------------------------------------------------------------------
 // Purpose: Return the loudest sound of the specified type at "earposition"
 //-----------------------------------------------------------------------------
@@ -21,9 +21,15 @@ enum
 	MAX_WORLD_SOUNDS_SP	= 64,	// Maximum number of sounds handled by the world at one time in single player.
 	// This is also the number of entries saved in a savegame file (for b/w compatibility).
 
-	MAX_WORLD_SOUNDS_MP	= 128	// The sound array size is set this large but we'll only use gpGlobals->maxPlayers+32 entries in mp.
+	MAX_WORLD_SOUNDS_MP	= 128,	// We'll only use gpGlobals->maxPlayers+32 entries in mp.
+
+	MAX_WORLD_SOUNDS_POOL = 256	// Total size of the sound array; single player uses all of it.
 };
 
+// The spatial index over active sounds is a flat grid across the map in x/y.
+#define SOUNDENT_GRID_CELL_SIZE		1024
+#define SOUNDENT_GRID_DIM			32
+
 enum
 {
 	SOUND_NONE				= 0,
@@ -110,7 +116,7 @@ class CSound
 public:
 	bool	DoesSoundExpire() const;
 	float	SoundExpirationTime() const;
-	void	SetSoundOrigin( const Vector &vecOrigin ) { m_vecOrigin = vecOrigin; }
+	void	SetSoundOrigin( const Vector &vecOrigin );
 	const	Vector& GetSoundOrigin( void ) { return m_vecOrigin; }
 	const	Vector& GetSoundReactOrigin( void );
 	bool	FIsSound( void );
@@ -239,16 +245,49 @@ public:
 	static CSound*	GetLoudestSoundOfType( int iType, const Vector &vecEarPosition );
 	static int		ClientSoundIndex ( edict_t *pClient );
 
+	// Fills pSoundList with the active sounds matching iTypeMask whose volume, scaled by
+	// flHearingScale, reaches vecEarPosition. Results are in active list order.
+	static int		GetSoundsInRange( const Vector &vecEarPosition, float flHearingScale, int iTypeMask, int *pSoundList, int nMaxSounds );
+	static void		MarkSpatialIndexDirty( void ) { s_bSpatialIndexDirty = true; }
+	static void		ReportQueryStats( void );
+
 	bool	IsEmpty( void );
 	int		ISoundsInList ( int iListType );
 	int		IAllocSound ( void );
 	int		FindOrAllocateSound( CBaseEntity *pOwner, int soundChannelIndex );
 	
 private:
+	CSound	&PoolSound( int iSound );
+	int		PoolSize( void );
+	void	RepairSoundLists( void );
+
+	void	ResetSpatialIndex( void );
+	void	BuildSpatialIndex( void );
+	int		QuerySoundsInRange( const Vector &vecEarPosition, float flHearingScale, int iTypeMask, int *pSoundList, int nMaxSounds );
+
 	int		m_iFreeSound;	// index of the first sound in the free sound list
 	int		m_iActiveSound; // indes of the first sound in the active sound list
 	int		m_cLastActiveSounds; // keeps track of the number of active sounds at the last update. (for diagnostic work)
-	CSound	m_SoundPool[ MAX_WORLD_SOUNDS_MP ];
+
+	// Only the first MAX_WORLD_SOUNDS_SP sounds were saved by older versions, so the pool is
+	// split to keep that part of the save layout. Index the pool through PoolSound().
+	CSound	m_SoundPool[ MAX_WORLD_SOUNDS_SP ];
+	CSound	m_SoundPoolExtra[ MAX_WORLD_SOUNDS_POOL - MAX_WORLD_SOUNDS_SP ];
+
+	// Spatial index over the active list. Not saved; rebuilt whenever a sound is
+	// added, removed or moved.
+	short	m_GridHead[ SOUNDENT_GRID_DIM * SOUNDENT_GRID_DIM ];
+	int		m_GridTypes[ SOUNDENT_GRID_DIM * SOUNDENT_GRID_DIM ];
+	short	m_GridNext[ MAX_WORLD_SOUNDS_POOL ];
+	CUtlVector<short> m_GridCellsUsed;
+	float	m_flGridMaxVolume;
+	int		m_nGridSounds;
+
+	// Allocation order, so query results can be returned in active list order
+	unsigned int m_SoundSerial[ MAX_WORLD_SOUNDS_POOL ];
+	unsigned int m_nNextSoundSerial;
+
+	static bool	s_bSpatialIndexDirty;
 };
 
 
@@ -260,5 +299,16 @@ inline bool CSoundEnt::IsEmpty( void )
 	return m_iActiveSound == SOUNDLIST_EMPTY; 
 }
 
+inline CSound &CSoundEnt::PoolSound( int iSound )
+{
+	return ( iSound < MAX_WORLD_SOUNDS_SP ) ? m_SoundPool[ iSound ] : m_SoundPoolExtra[ iSound - MAX_WORLD_SOUNDS_SP ];
+}
+
+inline void CSound::SetSoundOrigin( const Vector &vecOrigin )
+{
+	m_vecOrigin = vecOrigin;
+	CSoundEnt::MarkSpatialIndexDirty();
+}
+
 
 #endif //SOUNDENT_H
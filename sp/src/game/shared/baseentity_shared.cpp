@@ -29,6 +29,7 @@
 	#include "player_pickup.h"
 	#include "waterbullet.h"
 	#include "func_break.h"
+	#include "ai_senses.h"
 
 #ifdef HL2MP
 	#include "te_hl2mp_shotgun_shot.h"
@@ -440,7 +441,7 @@ bool CBaseEntity::KeyValue( const char *szKeyName, const char *szValue )
 	
 	if ( FStrEq( szKeyName, "targetname" ) )
 	{
-		m_iName = AllocPooledString( szValue );
+		SetName( AllocPooledString( szValue ) );
 		return true;
 	}
 
@@ -1432,6 +1433,7 @@ void CBaseEntity::InvalidatePhysicsRecursive( int nChangeFlags )
 
 #ifndef CLIENT_DLL
 		NetworkProp()->MarkPVSInformationDirty();
+		AI_SenseNotePositionChanged( this );
 #endif
 
 		// NOTE: This will also mark shadow projection + client leaf dirty
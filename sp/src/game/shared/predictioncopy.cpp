@@ -21,6 +21,7 @@
 #include "predictioncopy.h"
 #include "engine/ivmodelinfo.h"
 #include "tier1/fmtstr.h"
+#include "tier1/utlmap.h"
 
 // memdbgon must be the last include file in a .cpp file!!!
 #include "tier0/memdbgon.h"
@@ -994,7 +995,6 @@ void CPredictionCopy::CopyFields( int chain_count, datamap_t *pRootMap, typedesc
 	int				flags;
 	int				fieldOffsetSrc;
 	int				fieldOffsetDest;
-	int				fieldSize;
 
 	m_pCurrentMap = pRootMap;
 	if ( !m_pCurrentClassName )
@@ -1040,202 +1040,571 @@ void CPredictionCopy::CopyFields( int chain_count, datamap_t *pRootMap, typedesc
 
 		fieldOffsetDest = m_pCurrentField->fieldOffset[ m_nDestOffsetIndex ];
 		fieldOffsetSrc	= m_pCurrentField->fieldOffset[ m_nSrcOffsetIndex ];
-		fieldSize = m_pCurrentField->fieldSize;
 
 		pOutputData = (void *)((char *)m_pDest + fieldOffsetDest );
 		pInputData = (void const *)((char *)m_pSrc + fieldOffsetSrc );
 
-		// Assume we can report
-		m_bShouldReport = m_bReportErrors;
-		m_bShouldDescribe = true;
+		if ( m_pCurrentField->fieldType == FIELD_EMBEDDED )
+		{
+			typedescription_t *save = m_pCurrentField;
+			void *saveDest = m_pDest;
+			void const *saveSrc = m_pSrc;
+			const char *saveName = m_pCurrentClassName;
 
-		bool bShouldWatch = m_pWatchField == m_pCurrentField;
+			m_pCurrentClassName = m_pCurrentField->td->dataClassName;
 
-		difftype_t difftype;
+			// FIXME: Should this be done outside the FIELD_EMBEDDED case??
+			// Don't follow the pointer if we're reading from a compressed packet
+			m_pSrc = pInputData;
+			if ( ( flags & FTYPEDESC_PTR ) && (m_nSrcOffsetIndex == PC_DATA_NORMAL) )
+			{
+				m_pSrc = *((void**)m_pSrc);
+			}
 
-		switch( m_pCurrentField->fieldType )
-		{
-		case FIELD_EMBEDDED:
+			m_pDest = pOutputData;
+			if ( ( flags & FTYPEDESC_PTR ) && (m_nDestOffsetIndex == PC_DATA_NORMAL) )
 			{
-				typedescription_t *save = m_pCurrentField;
-				void *saveDest = m_pDest;
-				void const *saveSrc = m_pSrc;
-				const char *saveName = m_pCurrentClassName;
+				m_pDest = *((void**)m_pDest);
+			}
 
-				m_pCurrentClassName = m_pCurrentField->td->dataClassName;
+			CopyFields( chain_count, pRootMap, m_pCurrentField->td->dataDesc, m_pCurrentField->td->dataNumFields );
 
-				// FIXME: Should this be done outside the FIELD_EMBEDDED case??
-				// Don't follow the pointer if we're reading from a compressed packet
-				m_pSrc = pInputData;
-				if ( ( flags & FTYPEDESC_PTR ) && (m_nSrcOffsetIndex == PC_DATA_NORMAL) )
-				{
-					m_pSrc = *((void**)m_pSrc);
-				}
+			m_pCurrentClassName = saveName;
+			m_pCurrentField = save;
+			m_pDest = saveDest;
+			m_pSrc = saveSrc;
+			continue;
+		}
 
-				m_pDest = pOutputData;
-				if ( ( flags & FTYPEDESC_PTR ) && (m_nDestOffsetIndex == PC_DATA_NORMAL) )
-				{
-					m_pDest = *((void**)m_pDest);
-				}
+		TransferField( pOutputData, pInputData );
+	}
 
-				CopyFields( chain_count, pRootMap, m_pCurrentField->td->dataDesc, m_pCurrentField->td->dataNumFields );
+	m_pCurrentClassName = NULL;
+}
 
-				m_pCurrentClassName = saveName;
-				m_pCurrentField = save;
-				m_pDest = saveDest;
-				m_pSrc = saveSrc;
-			}
-			break;
-		case FIELD_FLOAT:
-			{
-				difftype = CompareFloat( (float *)pOutputData, (float const *)pInputData, fieldSize );
-				CopyFloat( difftype, (float *)pOutputData, (float const *)pInputData, fieldSize );
-				if ( m_bErrorCheck && m_bShouldDescribe ) DescribeFloat( difftype, (float *)pOutputData, (float const *)pInputData, fieldSize );
-				if ( bShouldWatch ) WatchFloat( difftype, (float *)pOutputData, (float const *)pInputData, fieldSize );
-			}
-			break;
+//-----------------------------------------------------------------------------
+// Purpose: Compares, copies and reports on m_pCurrentField, which mustn't be
+//			an embedded table
+//-----------------------------------------------------------------------------
+void CPredictionCopy::TransferField( void *pOutputData, void const *pInputData )
+{
+	int fieldSize = m_pCurrentField->fieldSize;
 
-		case FIELD_TIME:
-		case FIELD_TICK:
-			Assert( 0 );
-			break;
+	// Assume we can report
+	m_bShouldReport = m_bReportErrors;
+	m_bShouldDescribe = true;
 
-		case FIELD_STRING:
-			{
-				difftype = CompareString( (char *)pOutputData, (char const*)pInputData );
-				CopyString( difftype, (char *)pOutputData, (char const*)pInputData );
-				if ( m_bErrorCheck && m_bShouldDescribe ) DescribeString( difftype,(char *)pOutputData, (char const*)pInputData );
-				if ( bShouldWatch ) WatchString( difftype,(char *)pOutputData, (char const*)pInputData );
-			}
-			break;
+	bool bShouldWatch = m_pWatchField == m_pCurrentField;
 
-		case FIELD_MODELINDEX:
-			Assert( 0 );
-			break;
+	difftype_t difftype;
 
-		case FIELD_MODELNAME:
-		case FIELD_SOUNDNAME:
-			Assert( 0 );
-			break;
+	switch( m_pCurrentField->fieldType )
+	{
+	case FIELD_FLOAT:
+		{
+			difftype = CompareFloat( (float *)pOutputData, (float const *)pInputData, fieldSize );
+			CopyFloat( difftype, (float *)pOutputData, (float const *)pInputData, fieldSize );
+			if ( m_bErrorCheck && m_bShouldDescribe ) DescribeFloat( difftype, (float *)pOutputData, (float const *)pInputData, fieldSize );
+			if ( bShouldWatch ) WatchFloat( difftype, (float *)pOutputData, (float const *)pInputData, fieldSize );
+		}
+		break;
 
-		case FIELD_CUSTOM:
-			Assert( 0 );
-			break;
+	case FIELD_TIME:
+	case FIELD_TICK:
+		Assert( 0 );
+		break;
 
-		case FIELD_CLASSPTR:
-		case FIELD_EDICT:
-			Assert( 0 );
-			break;
+	case FIELD_STRING:
+		{
+			difftype = CompareString( (char *)pOutputData, (char const*)pInputData );
+			CopyString( difftype, (char *)pOutputData, (char const*)pInputData );
+			if ( m_bErrorCheck && m_bShouldDescribe ) DescribeString( difftype,(char *)pOutputData, (char const*)pInputData );
+			if ( bShouldWatch ) WatchString( difftype,(char *)pOutputData, (char const*)pInputData );
+		}
+		break;
 
-		case FIELD_POSITION_VECTOR:
-			Assert( 0 );
-			break;
+	case FIELD_MODELINDEX:
+		Assert( 0 );
+		break;
 
-		case FIELD_VECTOR:
-			{
-				difftype = CompareVector( (Vector *)pOutputData, (Vector const *)pInputData, fieldSize );
-				CopyVector( difftype, (Vector *)pOutputData, (Vector const *)pInputData, fieldSize );
-				if ( m_bErrorCheck && m_bShouldDescribe ) DescribeVector( difftype, (Vector *)pOutputData, (Vector const *)pInputData, fieldSize );
-				if ( bShouldWatch ) WatchVector( difftype, (Vector *)pOutputData, (Vector const *)pInputData, fieldSize );
-			}
-			break;
+	case FIELD_MODELNAME:
+	case FIELD_SOUNDNAME:
+		Assert( 0 );
+		break;
 
-		case FIELD_QUATERNION:
-			{
-				difftype = CompareQuaternion( (Quaternion *)pOutputData, (Quaternion const *)pInputData, fieldSize );
-				CopyQuaternion( difftype, (Quaternion *)pOutputData, (Quaternion const *)pInputData, fieldSize );
-				if ( m_bErrorCheck && m_bShouldDescribe ) DescribeQuaternion( difftype, (Quaternion *)pOutputData, (Quaternion const *)pInputData, fieldSize );
-				if ( bShouldWatch ) WatchQuaternion( difftype, (Quaternion *)pOutputData, (Quaternion const *)pInputData, fieldSize );
-			}
-			break;
+	case FIELD_CUSTOM:
+		Assert( 0 );
+		break;
 
-		case FIELD_COLOR32:
-			{
-				difftype = CompareData( 4*fieldSize, (char *)pOutputData, (const char *)pInputData );
-				CopyData( difftype, 4*fieldSize, (char *)pOutputData, (const char *)pInputData );
-				if ( m_bErrorCheck && m_bShouldDescribe ) DescribeData( difftype, 4*fieldSize, (char *)pOutputData, (const char *)pInputData );
-				if ( bShouldWatch ) WatchData( difftype, 4*fieldSize, (char *)pOutputData, (const char *)pInputData );
-			}
-			break;
+	case FIELD_CLASSPTR:
+	case FIELD_EDICT:
+		Assert( 0 );
+		break;
 
-		case FIELD_BOOLEAN:
-			{
-				difftype = CompareBool( (bool *)pOutputData, (bool const *)pInputData, fieldSize );
-				CopyBool( difftype, (bool *)pOutputData, (bool const *)pInputData, fieldSize );
-				if ( m_bErrorCheck && m_bShouldDescribe ) DescribeBool( difftype, (bool *)pOutputData, (bool const *)pInputData, fieldSize );
-				if ( bShouldWatch ) WatchBool( difftype, (bool *)pOutputData, (bool const *)pInputData, fieldSize );
-			}
-			break;
+	case FIELD_POSITION_VECTOR:
+		Assert( 0 );
+		break;
 
-		case FIELD_INTEGER:
-			{
-				difftype = CompareInt( (int *)pOutputData, (int const *)pInputData, fieldSize );
-				CopyInt( difftype, (int *)pOutputData, (int const *)pInputData, fieldSize );
-				if ( m_bErrorCheck && m_bShouldDescribe ) DescribeInt( difftype, (int *)pOutputData, (int const *)pInputData, fieldSize );
-				if ( bShouldWatch ) WatchInt( difftype, (int *)pOutputData, (int const *)pInputData, fieldSize );
-			}
-			break;
+	case FIELD_VECTOR:
+		{
+			difftype = CompareVector( (Vector *)pOutputData, (Vector const *)pInputData, fieldSize );
+			CopyVector( difftype, (Vector *)pOutputData, (Vector const *)pInputData, fieldSize );
+			if ( m_bErrorCheck && m_bShouldDescribe ) DescribeVector( difftype, (Vector *)pOutputData, (Vector const *)pInputData, fieldSize );
+			if ( bShouldWatch ) WatchVector( difftype, (Vector *)pOutputData, (Vector const *)pInputData, fieldSize );
+		}
+		break;
 
-		case FIELD_SHORT:
-			{
-				difftype = CompareShort( (short *)pOutputData, (short const *)pInputData, fieldSize );
-				CopyShort( difftype, (short *)pOutputData, (short const *)pInputData, fieldSize );
-				if ( m_bErrorCheck && m_bShouldDescribe ) DescribeShort( difftype, (short *)pOutputData, (short const *)pInputData, fieldSize );
-				if ( bShouldWatch ) WatchShort( difftype, (short *)pOutputData, (short const *)pInputData, fieldSize );
-			}
-			break;
+	case FIELD_QUATERNION:
+		{
+			difftype = CompareQuaternion( (Quaternion *)pOutputData, (Quaternion const *)pInputData, fieldSize );
+			CopyQuaternion( difftype, (Quaternion *)pOutputData, (Quaternion const *)pInputData, fieldSize );
+			if ( m_bErrorCheck && m_bShouldDescribe ) DescribeQuaternion( difftype, (Quaternion *)pOutputData, (Quaternion const *)pInputData, fieldSize );
+			if ( bShouldWatch ) WatchQuaternion( difftype, (Quaternion *)pOutputData, (Quaternion const *)pInputData, fieldSize );
+		}
+		break;
 
-		case FIELD_CHARACTER:
-			{
-				difftype = CompareData( fieldSize, ((char *)pOutputData), (const char *)pInputData );
-				CopyData( difftype, fieldSize, ((char *)pOutputData), (const char *)pInputData );
-				
-				int valOut = *((char *)pOutputData);
-				int valIn  = *((const char *)pInputData);
-				
-				if ( m_bErrorCheck && m_bShouldDescribe ) DescribeInt( difftype, &valOut, &valIn, fieldSize );
-				if ( bShouldWatch ) WatchData( difftype, fieldSize, ((char *)pOutputData), (const char *)pInputData );
-			}
-			break;
-		case FIELD_EHANDLE:
+	case FIELD_COLOR32:
+		{
+			difftype = CompareData( 4*fieldSize, (char *)pOutputData, (const char *)pInputData );
+			CopyData( difftype, 4*fieldSize, (char *)pOutputData, (const char *)pInputData );
+			if ( m_bErrorCheck && m_bShouldDescribe ) DescribeData( difftype, 4*fieldSize, (char *)pOutputData, (const char *)pInputData );
+			if ( bShouldWatch ) WatchData( difftype, 4*fieldSize, (char *)pOutputData, (const char *)pInputData );
+		}
+		break;
+
+	case FIELD_BOOLEAN:
+		{
+			difftype = CompareBool( (bool *)pOutputData, (bool const *)pInputData, fieldSize );
+			CopyBool( difftype, (bool *)pOutputData, (bool const *)pInputData, fieldSize );
+			if ( m_bErrorCheck && m_bShouldDescribe ) DescribeBool( difftype, (bool *)pOutputData, (bool const *)pInputData, fieldSize );
+			if ( bShouldWatch ) WatchBool( difftype, (bool *)pOutputData, (bool const *)pInputData, fieldSize );
+		}
+		break;
+
+	case FIELD_INTEGER:
+		{
+			difftype = CompareInt( (int *)pOutputData, (int const *)pInputData, fieldSize );
+			CopyInt( difftype, (int *)pOutputData, (int const *)pInputData, fieldSize );
+			if ( m_bErrorCheck && m_bShouldDescribe ) DescribeInt( difftype, (int *)pOutputData, (int const *)pInputData, fieldSize );
+			if ( bShouldWatch ) WatchInt( difftype, (int *)pOutputData, (int const *)pInputData, fieldSize );
+		}
+		break;
+
+	case FIELD_SHORT:
+		{
+			difftype = CompareShort( (short *)pOutputData, (short const *)pInputData, fieldSize );
+			CopyShort( difftype, (short *)pOutputData, (short const *)pInputData, fieldSize );
+			if ( m_bErrorCheck && m_bShouldDescribe ) DescribeShort( difftype, (short *)pOutputData, (short const *)pInputData, fieldSize );
+			if ( bShouldWatch ) WatchShort( difftype, (short *)pOutputData, (short const *)pInputData, fieldSize );
+		}
+		break;
+
+	case FIELD_CHARACTER:
+		{
+			difftype = CompareData( fieldSize, ((char *)pOutputData), (const char *)pInputData );
+			CopyData( difftype, fieldSize, ((char *)pOutputData), (const char *)pInputData );
+			
+			int valOut = *((char *)pOutputData);
+			int valIn  = *((const char *)pInputData);
+			
+			if ( m_bErrorCheck && m_bShouldDescribe ) DescribeInt( difftype, &valOut, &valIn, fieldSize );
+			if ( bShouldWatch ) WatchData( difftype, fieldSize, ((char *)pOutputData), (const char *)pInputData );
+		}
+		break;
+	case FIELD_EHANDLE:
+		{
+			difftype = CompareEHandle( (EHANDLE *)pOutputData, (EHANDLE const *)pInputData, fieldSize );
+			CopyEHandle( difftype, (EHANDLE *)pOutputData, (EHANDLE const *)pInputData, fieldSize );
+			if ( m_bErrorCheck && m_bShouldDescribe ) DescribeEHandle( difftype, (EHANDLE *)pOutputData, (EHANDLE const *)pInputData, fieldSize );
+			if ( bShouldWatch ) WatchEHandle( difftype, (EHANDLE *)pOutputData, (EHANDLE const *)pInputData, fieldSize );
+		}
+		break;
+	case FIELD_FUNCTION:
+		{
+		Assert( 0 );
+		}
+		break;
+	case FIELD_VOID:
+		{
+			// Don't do anything, it's an empty data description
+		}
+		break;
+	default:
+		{
+			Warning( "Bad field type\n" );
+			Assert(0);
+		}
+		break;
+	}
+}
+
+void CPredictionCopy::TransferData_R( int chaincount, datamap_t *dmap )
+{
+	// Copy from here first, then baseclasses
+	CopyFields( chaincount, dmap, dmap->dataDesc, dmap->dataNumFields );
+
+	if ( dmap->baseMap )
+	{
+		TransferData_R( chaincount, dmap->baseMap );
+	}
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: A datamap chain flattened for one copy type and pair of offset
+//			tables. The recursive walk above resolves overrides, type filters
+//			and embedded tables for every field on every call; a program does
+//			that once and leaves a list of offsets, with neighbouring fields
+//			merged into single memcpy/memcmp runs.
+//-----------------------------------------------------------------------------
+class CPredictionCopyProgram
+{
+public:
+	enum
+	{
+		OP_DATA = 0,	// plain bytes
+		OP_STRING,		// null terminated, copied up to the terminator
+		OP_INDIRECT,	// embedded table behind a pointer, run as its own program
+	};
+
+	struct Field_t
+	{
+		typedescription_t		*m_pField;
+		const char				*m_pClassName;
+		datamap_t				*m_pRootMap;
+		int						m_nKind;
+		int						m_nDestOffset;
+		int						m_nSrcOffset;
+		int						m_nSize;
+		bool					m_bDerefDest;
+		bool					m_bDerefSrc;
+		CPredictionCopyProgram	*m_pIndirect;
+	};
+
+	struct Op_t
+	{
+		int		m_nKind;
+		int		m_nDestOffset;
+		int		m_nSrcOffset;
+		int		m_nSize;
+		int		m_nFirstField;	// index into m_Fields
+		int		m_nFieldCount;
+	};
+
+	~CPredictionCopyProgram()
+	{
+		for ( int i = 0; i < m_Fields.Count(); i++ )
+		{
+			delete m_Fields[ i ].m_pIndirect;
+		}
+	}
+
+	CUtlVector< Field_t >	m_Fields;		// in the order the recursive walk visits them
+	CUtlVector< Op_t >		m_CopyOps;		// every field, by destination offset
+	CUtlVector< Op_t >		m_CompareOps;	// error checked fields, in walk order
+};
+
+//-----------------------------------------------------------------------------
+// Purpose: Bytes covered by a field that's transferred as a plain block, or 0
+//			if it isn't
+//-----------------------------------------------------------------------------
+static int PredictionCopyFieldBytes( const typedescription_t *pField )
+{
+	switch ( pField->fieldType )
+	{
+	case FIELD_FLOAT:		return sizeof( float ) * pField->fieldSize;
+	case FIELD_VECTOR:		return sizeof( Vector ) * pField->fieldSize;
+	case FIELD_QUATERNION:	return sizeof( Quaternion ) * pField->fieldSize;
+	case FIELD_COLOR32:		return 4 * pField->fieldSize;
+	case FIELD_BOOLEAN:		return sizeof( bool ) * pField->fieldSize;
+	case FIELD_INTEGER:		return sizeof( int ) * pField->fieldSize;
+	case FIELD_SHORT:		return sizeof( short ) * pField->fieldSize;
+	case FIELD_CHARACTER:	return pField->fieldSize;
+	case FIELD_EHANDLE:		return sizeof( EHANDLE ) * pField->fieldSize;
+	default:				return 0;
+	}
+}
+
+struct PredictionCopyCompile_t
+{
+	int		m_nType;
+	int		m_nDestOffsetIndex;
+	int		m_nSrcOffsetIndex;
+
+	// Stands in for override_count: fields named by an override_field seen so far
+	CUtlVector< typedescription_t * > m_Overridden;
+};
+
+static void CompileBuildOps( CPredictionCopyProgram *pProgram );
+
+//-----------------------------------------------------------------------------
+// Purpose: Mirrors CPredictionCopy::CopyFields, recording each field it would
+//			transfer instead of transferring it
+//-----------------------------------------------------------------------------
+static void CompileFields_R( PredictionCopyCompile_t &state, CPredictionCopyProgram *pProgram, datamap_t *pRootMap, const char *pClassName,
+	typedescription_t *pFields, int fieldCount, int nDestBase, int nSrcBase )
+{
+	for ( int i = 0; i < fieldCount; i++ )
+	{
+		typedescription_t *pField = &pFields[ i ];
+		int flags = pField->flags;
+
+		if ( pField->override_field != NULL )
+		{
+			state.m_Overridden.AddToTail( pField->override_field );
+		}
+
+		if ( state.m_Overridden.HasElement( pField ) )
+			continue;
+
+		if ( pField->fieldType != FIELD_EMBEDDED )
+		{
+			if ( flags & FTYPEDESC_PRIVATE )
+				continue;
+
+			if ( state.m_nType == PC_NON_NETWORKED_ONLY && ( flags & FTYPEDESC_INSENDTABLE ) )
+				continue;
+
+			if ( state.m_nType == PC_NETWORKED_ONLY && !( flags & FTYPEDESC_INSENDTABLE ) )
+				continue;
+		}
+
+		CPredictionCopyProgram::Field_t field;
+		field.m_pField = pField;
+		field.m_pClassName = pClassName;
+		field.m_pRootMap = pRootMap;
+		field.m_nDestOffset = nDestBase + pField->fieldOffset[ state.m_nDestOffsetIndex ];
+		field.m_nSrcOffset = nSrcBase + pField->fieldOffset[ state.m_nSrcOffsetIndex ];
+		field.m_nSize = 0;
+		field.m_bDerefDest = false;
+		field.m_bDerefSrc = false;
+		field.m_pIndirect = NULL;
+
+		if ( pField->fieldType == FIELD_EMBEDDED )
+		{
+			field.m_bDerefDest = ( flags & FTYPEDESC_PTR ) && state.m_nDestOffsetIndex == TD_OFFSET_NORMAL;
+			field.m_bDerefSrc = ( flags & FTYPEDESC_PTR ) && state.m_nSrcOffsetIndex == TD_OFFSET_NORMAL;
+
+			if ( !field.m_bDerefDest && !field.m_bDerefSrc )
 			{
-				difftype = CompareEHandle( (EHANDLE *)pOutputData, (EHANDLE const *)pInputData, fieldSize );
-				CopyEHandle( difftype, (EHANDLE *)pOutputData, (EHANDLE const *)pInputData, fieldSize );
-				if ( m_bErrorCheck && m_bShouldDescribe ) DescribeEHandle( difftype, (EHANDLE *)pOutputData, (EHANDLE const *)pInputData, fieldSize );
-				if ( bShouldWatch ) WatchEHandle( difftype, (EHANDLE *)pOutputData, (EHANDLE const *)pInputData, fieldSize );
+				// Embedded in place, so its fields are just further offsets into this object
+				CompileFields_R( state, pProgram, pRootMap, pField->td->dataClassName, pField->td->dataDesc, pField->td->dataNumFields,
+					field.m_nDestOffset, field.m_nSrcOffset );
+				continue;
 			}
-			break;
-		case FIELD_FUNCTION:
+
+			field.m_nKind = CPredictionCopyProgram::OP_INDIRECT;
+			field.m_pIndirect = new CPredictionCopyProgram;
+			CompileFields_R( state, field.m_pIndirect, pRootMap, pField->td->dataClassName, pField->td->dataDesc, pField->td->dataNumFields, 0, 0 );
+			CompileBuildOps( field.m_pIndirect );
+		}
+		else if ( pField->fieldType == FIELD_STRING )
+		{
+			field.m_nKind = CPredictionCopyProgram::OP_STRING;
+		}
+		else
+		{
+			// FIELD_VOID and the types CopyFields asserts on have nothing to move
+			field.m_nKind = CPredictionCopyProgram::OP_DATA;
+			field.m_nSize = PredictionCopyFieldBytes( pField );
+			if ( !field.m_nSize )
+				continue;
+		}
+
+		pProgram->m_Fields.AddToTail( field );
+	}
+}
+
+static int OpDestOffsetLessFunc( const CPredictionCopyProgram::Op_t *pLeft, const CPredictionCopyProgram::Op_t *pRight )
+{
+	return pLeft->m_nDestOffset - pRight->m_nDestOffset;
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Appends a field to an op list, extending the last run if the field
+//			follows straight on from it on both sides
+//-----------------------------------------------------------------------------
+static void CompileAppendOp( CUtlVector< CPredictionCopyProgram::Op_t > &ops, const CPredictionCopyProgram::Field_t &field, int nField, bool bRequireAdjacentIndex )
+{
+	if ( field.m_nKind == CPredictionCopyProgram::OP_DATA && ops.Count() )
+	{
+		CPredictionCopyProgram::Op_t &last = ops.Tail();
+		if ( last.m_nKind == CPredictionCopyProgram::OP_DATA &&
+			last.m_nDestOffset + last.m_nSize == field.m_nDestOffset &&
+			last.m_nSrcOffset + last.m_nSize == field.m_nSrcOffset &&
+			( !bRequireAdjacentIndex || last.m_nFirstField + last.m_nFieldCount == nField ) )
+		{
+			last.m_nSize += field.m_nSize;
+			last.m_nFieldCount++;
+			return;
+		}
+	}
+
+	CPredictionCopyProgram::Op_t op;
+	op.m_nKind = field.m_nKind;
+	op.m_nDestOffset = field.m_nDestOffset;
+	op.m_nSrcOffset = field.m_nSrcOffset;
+	op.m_nSize = field.m_nSize;
+	op.m_nFirstField = nField;
+	op.m_nFieldCount = 1;
+	ops.AddToTail( op );
+}
+
+static void CompileBuildOps( CPredictionCopyProgram *pProgram )
+{
+	// Copies can go in any order, so sort them to find the runs. Compares keep
+	// the walk order so errors come out as they always have, and a run only
+	// spans consecutive fields so it can fall back to them one at a time.
+	CUtlVector< CPredictionCopyProgram::Op_t > sorted;
+	for ( int i = 0; i < pProgram->m_Fields.Count(); i++ )
+	{
+		const CPredictionCopyProgram::Field_t &field = pProgram->m_Fields[ i ];
+
+		CompileAppendOp( sorted, field, i, true );
+		if ( field.m_nKind == CPredictionCopyProgram::OP_INDIRECT || !( field.m_pField->flags & FTYPEDESC_NOERRORCHECK ) )
+		{
+			CompileAppendOp( pProgram->m_CompareOps, field, i, true );
+		}
+	}
+
+	sorted.Sort( OpDestOffsetLessFunc );
+
+	for ( int i = 0; i < sorted.Count(); i++ )
+	{
+		const CPredictionCopyProgram::Op_t &op = sorted[ i ];
+		if ( op.m_nKind == CPredictionCopyProgram::OP_DATA && pProgram->m_CopyOps.Count() )
+		{
+			CPredictionCopyProgram::Op_t &last = pProgram->m_CopyOps.Tail();
+			if ( last.m_nKind == CPredictionCopyProgram::OP_DATA &&
+				last.m_nDestOffset + last.m_nSize == op.m_nDestOffset &&
+				last.m_nSrcOffset + last.m_nSize == op.m_nSrcOffset )
 			{
-			Assert( 0 );
+				last.m_nSize += op.m_nSize;
+				last.m_nFieldCount += op.m_nFieldCount;
+				continue;
 			}
+		}
+		pProgram->m_CopyOps.AddToTail( op );
+	}
+}
+
+static CPredictionCopyProgram *CompilePredictionCopyProgram( datamap_t *dmap, int nType, int nDestOffsetIndex, int nSrcOffsetIndex )
+{
+	PredictionCopyCompile_t state;
+	state.m_nType = nType;
+	state.m_nDestOffsetIndex = nDestOffsetIndex;
+	state.m_nSrcOffsetIndex = nSrcOffsetIndex;
+
+	CPredictionCopyProgram *pProgram = new CPredictionCopyProgram;
+	for ( datamap_t *pMap = dmap; pMap; pMap = pMap->baseMap )
+	{
+		CompileFields_R( state, pProgram, pMap, pMap->dataClassName, pMap->dataDesc, pMap->dataNumFields, 0, 0 );
+	}
+	CompileBuildOps( pProgram );
+	return pProgram;
+}
+
+struct PredictionCopyPrograms_t
+{
+	CPredictionCopyProgram *m_pPrograms[ PC_COPYTYPE_COUNT ][ TD_OFFSET_COUNT ][ TD_OFFSET_COUNT ];
+};
+
+// Datamaps are static, so their programs are built once and kept. Prediction
+// only runs on the main thread.
+static CUtlMap< datamap_t *, PredictionCopyPrograms_t > s_PredictionCopyPrograms( DefLessFunc( datamap_t * ) );
+
+static const CPredictionCopyProgram *GetPredictionCopyProgram( datamap_t *dmap, int nType, int nDestOffsetIndex, int nSrcOffsetIndex )
+{
+	// Packed offsets aren't filled in until the first entity using the map
+	// sets up its intermediate data
+	if ( ( nDestOffsetIndex == TD_OFFSET_PACKED || nSrcOffsetIndex == TD_OFFSET_PACKED ) && !dmap->packed_offsets_computed )
+		return NULL;
+
+	unsigned short i = s_PredictionCopyPrograms.Find( dmap );
+	if ( i == s_PredictionCopyPrograms.InvalidIndex() )
+	{
+		PredictionCopyPrograms_t programs;
+		memset( &programs, 0, sizeof( programs ) );
+		i = s_PredictionCopyPrograms.Insert( dmap, programs );
+	}
+
+	CPredictionCopyProgram *&pProgram = s_PredictionCopyPrograms[ i ].m_pPrograms[ nType ][ nDestOffsetIndex ][ nSrcOffsetIndex ];
+	if ( !pProgram )
+	{
+		pProgram = CompilePredictionCopyProgram( dmap, nType, nDestOffsetIndex, nSrcOffsetIndex );
+	}
+	return pProgram;
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Unconditional copy, for when there's no error checking
+//-----------------------------------------------------------------------------
+void CPredictionCopy::CopyProgram( const CPredictionCopyProgram *pProgram, char *pDest, const char *pSrc )
+{
+	for ( int i = 0; i < pProgram->m_CopyOps.Count(); i++ )
+	{
+		const CPredictionCopyProgram::Op_t &op = pProgram->m_CopyOps[ i ];
+		char *pOutputData = pDest + op.m_nDestOffset;
+		const char *pInputData = pSrc + op.m_nSrcOffset;
+
+		switch ( op.m_nKind )
+		{
+		case CPredictionCopyProgram::OP_DATA:
+			memcpy( pOutputData, pInputData, op.m_nSize );
 			break;
-		case FIELD_VOID:
-			{
-				// Don't do anything, it's an empty data description
-			}
+
+		case CPredictionCopyProgram::OP_STRING:
+			memcpy( pOutputData, pInputData, Q_strlen( pInputData ) + 1 );
 			break;
-		default:
+
+		case CPredictionCopyProgram::OP_INDIRECT:
 			{
-				Warning( "Bad field type\n" );
-				Assert(0);
+				const CPredictionCopyProgram::Field_t &field = pProgram->m_Fields[ op.m_nFirstField ];
+				CopyProgram( field.m_pIndirect,
+					field.m_bDerefDest ? *(char **)pOutputData : pOutputData,
+					field.m_bDerefSrc ? *(const char * const *)pInputData : pInputData );
 			}
 			break;
 		}
 	}
-
-	m_pCurrentClassName = NULL;
 }
 
-void CPredictionCopy::TransferData_R( int chaincount, datamap_t *dmap )
+//-----------------------------------------------------------------------------
+// Purpose: Error checked transfer. Runs whose bytes already match have
+//			nothing to copy or report; anything else goes field by field
+//			through TransferField so tolerances and reporting are unchanged.
+//-----------------------------------------------------------------------------
+void CPredictionCopy::CompareProgram( const CPredictionCopyProgram *pProgram, char *pDest, const char *pSrc )
 {
-	// Copy from here first, then baseclasses
-	CopyFields( chaincount, dmap, dmap->dataDesc, dmap->dataNumFields );
-
-	if ( dmap->baseMap )
+	for ( int i = 0; i < pProgram->m_CompareOps.Count(); i++ )
 	{
-		TransferData_R( chaincount, dmap->baseMap );
+		const CPredictionCopyProgram::Op_t &op = pProgram->m_CompareOps[ i ];
+
+		if ( op.m_nKind == CPredictionCopyProgram::OP_DATA &&
+			!memcmp( pDest + op.m_nDestOffset, pSrc + op.m_nSrcOffset, op.m_nSize ) )
+			continue;
+
+		if ( op.m_nKind == CPredictionCopyProgram::OP_INDIRECT )
+		{
+			const CPredictionCopyProgram::Field_t &field = pProgram->m_Fields[ op.m_nFirstField ];
+			char *pOutputData = pDest + field.m_nDestOffset;
+			const char *pInputData = pSrc + field.m_nSrcOffset;
+			CompareProgram( field.m_pIndirect,
+				field.m_bDerefDest ? *(char **)pOutputData : pOutputData,
+				field.m_bDerefSrc ? *(const char * const *)pInputData : pInputData );
+			continue;
+		}
+
+		for ( int j = 0; j < op.m_nFieldCount; j++ )
+		{
+			const CPredictionCopyProgram::Field_t &field = pProgram->m_Fields[ op.m_nFirstField + j ];
+			m_pCurrentField = field.m_pField;
+			m_pCurrentClassName = field.m_pClassName;
+			m_pCurrentMap = field.m_pRootMap;
+			TransferField( pDest + field.m_nDestOffset, pSrc + field.m_nSrcOffset );
+		}
 	}
+
+	m_pCurrentClassName = NULL;
 }
 
 static int g_nChainCount = 1;
@@ -1325,6 +1694,7 @@ typedescription_t *FindFieldByName( const char *fieldname, datamap_t *dmap )
 
 static ConVar pwatchent( "pwatchent", "-1", FCVAR_CHEAT, "Entity to watch for prediction system changes." );
 static ConVar pwatchvar( "pwatchvar", "", FCVAR_CHEAT, "Entity variable to watch in prediction system for changes." );
+static ConVar pflatcopy( "pflatcopy", "1", FCVAR_CHEAT, "Transfer prediction data with flattened, cached datamap walks." );
 
 //-----------------------------------------------------------------------------
 // Purpose: 
@@ -1391,6 +1761,24 @@ int CPredictionCopy::TransferData( const char *operation, int entindex, datamap_
 	
 	DetermineWatchField( operation, entindex, dmap );
 
+	// Watching and describing look at every field, so they take the full walk
+	if ( pflatcopy.GetBool() && !m_pWatchField && !m_FieldCompareFunc )
+	{
+		const CPredictionCopyProgram *pProgram = GetPredictionCopyProgram( dmap, m_nType, m_nDestOffsetIndex, m_nSrcOffsetIndex );
+		if ( pProgram )
+		{
+			if ( m_bErrorCheck )
+			{
+				CompareProgram( pProgram, (char *)m_pDest, (const char *)m_pSrc );
+			}
+			else if ( m_bPerformCopy )
+			{
+				CopyProgram( pProgram, (char *)m_pDest, (const char *)m_pSrc );
+			}
+			return m_nErrorCount;
+		}
+	}
+
 	TransferData_R( g_nChainCount, dmap );
 
 	return m_nErrorCount;
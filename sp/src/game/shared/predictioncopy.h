@@ -36,11 +36,15 @@ enum
 	PC_EVERYTHING = 0,
 	PC_NON_NETWORKED_ONLY,
 	PC_NETWORKED_ONLY,
+
+	PC_COPYTYPE_COUNT
 };
 
 #define PC_DATA_PACKED			true
 #define PC_DATA_NORMAL			false
 
+class CPredictionCopyProgram;
+
 typedef void ( *FN_FIELD_COMPARE )( const char *classname, const char *fieldname, const char *fieldtype,
 	bool networked, bool noterrorchecked, bool differs, bool withintolerance, const char *value );
 
@@ -132,6 +136,11 @@ private:
 	bool	CanCheck( void );
 
 	void	CopyFields( int chaincount, datamap_t *pMap, typedescription_t *pFields, int fieldCount );
+	void	TransferField( void *pOutputData, void const *pInputData );
+
+	// Flattened datamap walks, see CPredictionCopyProgram
+	void	CopyProgram( const CPredictionCopyProgram *pProgram, char *pDest, const char *pSrc );
+	void	CompareProgram( const CPredictionCopyProgram *pProgram, char *pDest, const char *pSrc );
 
 private:
 
@@ -24,6 +24,9 @@
 #include "vphysics/object_hash.h"
 #include "datacache/imdlcache.h"
 #include "tier0/vprof.h"
+#include "tier0/fasttimer.h"
+#include "tier1/utlhashtable.h"
+#include "tier1/utlmap.h"
 
 #if !defined( CLIENT_DLL )
 
@@ -94,6 +97,110 @@ static int gSizes[FIELD_TYPECOUNT] =
 };
 
 
+//-----------------------------------------------------------------------------
+// Per-class save/restore timing. Each datamap level of an object is timed
+// separately; embedded types are also counted in the class that contains them.
+//-----------------------------------------------------------------------------
+
+ConVar save_class_timing( "save_class_timing", "0", 0, "Accumulate per-class save/restore timing. Report with save_class_timing_report (cl_save_class_timing_report on the client)." );
+
+struct SaveRestoreClassTiming_t
+{
+	const char	*m_pszClassName;
+	int			m_nSaves;
+	int			m_nRestores;
+	CCycleCount	m_SaveTime;
+	CCycleCount	m_RestoreTime;
+};
+
+static CUtlMap< datamap_t *, SaveRestoreClassTiming_t > s_SaveRestoreClassTiming( DefLessFunc( datamap_t * ) );
+
+static void AccumulateClassTiming( datamap_t *pMap, bool bRestore, const CCycleCount &duration )
+{
+	unsigned short i = s_SaveRestoreClassTiming.Find( pMap );
+	if ( i == s_SaveRestoreClassTiming.InvalidIndex() )
+	{
+		SaveRestoreClassTiming_t timing;
+		timing.m_pszClassName = pMap->dataClassName;
+		timing.m_nSaves = 0;
+		timing.m_nRestores = 0;
+		timing.m_SaveTime.Init();
+		timing.m_RestoreTime.Init();
+		i = s_SaveRestoreClassTiming.Insert( pMap, timing );
+	}
+
+	SaveRestoreClassTiming_t &timing = s_SaveRestoreClassTiming[i];
+	if ( bRestore )
+	{
+		timing.m_nRestores++;
+		timing.m_RestoreTime += duration;
+	}
+	else
+	{
+		timing.m_nSaves++;
+		timing.m_SaveTime += duration;
+	}
+}
+
+static int ClassTimingSortFunc( SaveRestoreClassTiming_t * const *ppLeft, SaveRestoreClassTiming_t * const *ppRight )
+{
+	double flLeft = (*ppLeft)->m_SaveTime.GetMillisecondsF() + (*ppLeft)->m_RestoreTime.GetMillisecondsF();
+	double flRight = (*ppRight)->m_SaveTime.GetMillisecondsF() + (*ppRight)->m_RestoreTime.GetMillisecondsF();
+	if ( flLeft > flRight )
+		return -1;
+	return ( flLeft < flRight ) ? 1 : 0;
+}
+
+static void ReportClassTiming( const CCommand &args )
+{
+	if ( s_SaveRestoreClassTiming.Count() == 0 )
+	{
+		Msg( "No save/restore timing recorded (set save_class_timing 1).\n" );
+		return;
+	}
+
+	int nMaxLines = ( args.ArgC() > 1 ) ? atoi( args[1] ) : 40;
+
+	CUtlVector< SaveRestoreClassTiming_t * > sorted;
+	sorted.EnsureCapacity( s_SaveRestoreClassTiming.Count() );
+	FOR_EACH_MAP_FAST( s_SaveRestoreClassTiming, i )
+	{
+		sorted.AddToTail( &s_SaveRestoreClassTiming[i] );
+	}
+	sorted.Sort( ClassTimingSortFunc );
+
+	CCycleCount totalSave, totalRestore;
+	totalSave.Init();
+	totalRestore.Init();
+
+	Msg( "%-40s %8s %10s %8s %10s\n", "class", "saves", "save ms", "restores", "restore ms" );
+	for ( int i = 0; i < sorted.Count(); i++ )
+	{
+		const SaveRestoreClassTiming_t *pTiming = sorted[i];
+		totalSave += pTiming->m_SaveTime;
+		totalRestore += pTiming->m_RestoreTime;
+		if ( i < nMaxLines )
+		{
+			Msg( "%-40s %8d %10.3f %8d %10.3f\n", pTiming->m_pszClassName,
+				pTiming->m_nSaves, pTiming->m_SaveTime.GetMillisecondsF(),
+				pTiming->m_nRestores, pTiming->m_RestoreTime.GetMillisecondsF() );
+		}
+	}
+	Msg( "%d classes, %.3f ms saving, %.3f ms restoring\n", sorted.Count(), totalSave.GetMillisecondsF(), totalRestore.GetMillisecondsF() );
+
+	s_SaveRestoreClassTiming.RemoveAll();
+}
+
+#ifdef CLIENT_DLL
+CON_COMMAND( cl_save_class_timing_report, "Print and reset per-class save/restore timing. Optional arg: number of classes to list." )
+#else
+CON_COMMAND( save_class_timing_report, "Print and reset per-class save/restore timing. Optional arg: number of classes to list." )
+#endif
+{
+	ReportClassTiming( args );
+}
+
+
 // helpers to offset worldspace matrices
 static void VMatrixOffset( VMatrix &dest, const VMatrix &matrixIn, const Vector &offset )
 {
@@ -872,7 +979,15 @@ int CSave::DoWriteAll( const void *pLeafObject, datamap_t *pLeafMap, datamap_t *
 			return status;
 	}
 
-	return WriteFields( pCurMap->dataClassName, pLeafObject, pLeafMap, pCurMap->dataDesc, pCurMap->dataNumFields );
+	if ( !save_class_timing.GetBool() )
+		return WriteFields( pCurMap->dataClassName, pLeafObject, pLeafMap, pCurMap->dataDesc, pCurMap->dataNumFields );
+
+	CFastTimer timer;
+	timer.Start();
+	int result = WriteFields( pCurMap->dataClassName, pLeafObject, pLeafMap, pCurMap->dataDesc, pCurMap->dataNumFields );
+	timer.End();
+	AccumulateClassTiming( pCurMap, false, timer.GetDuration() );
+	return result;
 }
 	
 //-------------------------------------
@@ -927,10 +1042,39 @@ void CSave::BufferField( const char *pname, int size, const char *pdata )
 
 //-------------------------------------
 
+//-----------------------------------------------------------------------------
+// Record names are hashed into the save's symbol table on every write. The
+// table stores the name pointers themselves, and every name must stay valid
+// until the save is finished, so a remembered symbol whose slot still holds
+// the same pointer is exactly what FindCreateSymbol would return.
+//-----------------------------------------------------------------------------
+#define SAVE_SYMBOL_CACHE_SIZE	4096
+
+struct SaveSymbolCacheEntry_t
+{
+	const char	*m_pszName;
+	int			m_nSymbol;
+};
+
+static SaveSymbolCacheEntry_t s_SaveSymbolCache[SAVE_SYMBOL_CACHE_SIZE];
+
+static short FindCreateSaveSymbol( CSaveRestoreSegment *pData, const char *pname )
+{
+	SaveSymbolCacheEntry_t &entry = s_SaveSymbolCache[ PointerHashFunctor()( pname ) & ( SAVE_SYMBOL_CACHE_SIZE - 1 ) ];
+	if ( entry.m_pszName == pname && entry.m_nSymbol < pData->SizeSymbolTable() && pData->StringFromSymbol( entry.m_nSymbol ) == pname )
+		return entry.m_nSymbol;
+
+	entry.m_pszName = pname;
+	entry.m_nSymbol = pData->FindCreateSymbol( pname );
+	return entry.m_nSymbol;
+}
+
+//-------------------------------------
+
 void CSave::WriteHeader( const char *pname, int size )
 {
 	short shortSize = size;
-	short hashvalue = m_pData->FindCreateSymbol( pname );
+	short hashvalue = FindCreateSaveSymbol( m_pData, pname );
 	if ( size > SHRT_MAX || size < 0 )
 	{
 		Warning( "CSave::WriteHeader() size parameter exceeds 'short'!\n" );
@@ -1498,6 +1642,188 @@ bool CRestore::ShouldReadField( typedescription_t *pField )
 
 //-------------------------------------
 
+//-----------------------------------------------------------------------------
+// Precompiled restore data for a field table. Datadescs are static, so each
+// table is built the first time it is restored and kept for the life of the dll.
+//-----------------------------------------------------------------------------
+
+struct RestoreClearOp_t
+{
+	int				m_iField;		// field to empty individually, or -1 for a fill
+	int				m_nOffset;
+	int				m_nBytes;
+	unsigned char	m_nFill;
+};
+
+struct RestoreSymbolSlot_t
+{
+	int				m_nSymbol;
+	int				m_iField;
+};
+
+struct RestoreFieldTable_t
+{
+	typedescription_t	*m_pFields;
+	int					m_nFields;
+
+	// Field names that appear more than once can only be matched by the ordered search
+	bool				m_bAmbiguous;
+
+	CUtlHashtable< const char *, int, CaselessStringHashFunctor, CaselessStringEqualFunctor > m_FieldsByName;
+
+	// Direct mapped by save symbol. Symbols are only stable within one save, so
+	// a hit is confirmed against the field name before it is used.
+	CUtlVector< RestoreSymbolSlot_t > m_SymbolSlots;
+
+	// Fields whose saved form is a raw copy of memory
+	CUtlVector< bool >	m_bRawCopy;
+
+	// Empty passes, indexed by global restore mode
+	CUtlVector< RestoreClearOp_t > m_ClearOps[2];
+};
+
+static CUtlHashtable< typedescription_t *, RestoreFieldTable_t *, PointerHashFunctor, PointerEqualFunctor > s_RestoreFieldTables;
+
+static bool IsRawCopyField( const typedescription_t *pField )
+{
+	switch ( pField->fieldType )
+	{
+	case FIELD_FLOAT:
+	case FIELD_INTEGER:
+	case FIELD_BOOLEAN:
+	case FIELD_SHORT:
+	case FIELD_CHARACTER:
+	case FIELD_COLOR32:
+		return ( pField->fieldSizeInBytes > 0 && pField->fieldSizeInBytes == pField->fieldSize * gSizes[pField->fieldType] );
+
+	default:
+		return false;
+	}
+}
+
+static void BuildRestoreClearOps( RestoreFieldTable_t *pTable, bool bGlobal )
+{
+	CUtlVector< RestoreClearOp_t > &ops = pTable->m_ClearOps[ bGlobal ? 1 : 0 ];
+	for ( int i = 0; i < pTable->m_nFields; i++ )
+	{
+		const typedescription_t *pField = &pTable->m_pFields[i];
+
+		// Same test as CRestore::ShouldEmptyField
+		if ( !( pField->flags & FTYPEDESC_SAVE ) )
+			continue;
+		if ( bGlobal && ( pField->flags & FTYPEDESC_GLOBAL ) )
+			continue;
+
+		RestoreClearOp_t op;
+		if ( pField->fieldType == FIELD_CUSTOM || pField->fieldType == FIELD_EMBEDDED ||
+			 pField->fieldSizeInBytes != pField->fieldSize * gSizes[pField->fieldType] )
+		{
+			op.m_iField = i;
+			op.m_nOffset = 0;
+			op.m_nBytes = 0;
+			op.m_nFill = 0;
+			ops.AddToTail( op );
+			continue;
+		}
+
+		op.m_iField = -1;
+		op.m_nOffset = pField->fieldOffset[ TD_OFFSET_NORMAL ];
+		op.m_nBytes = pField->fieldSizeInBytes;
+		op.m_nFill = ( pField->fieldType != FIELD_EHANDLE ) ? 0 : 0xFF;
+		if ( op.m_nBytes == 0 )
+			continue;
+
+		// Extend the previous fill if this field starts where it ends
+		if ( ops.Count() )
+		{
+			RestoreClearOp_t &prev = ops.Tail();
+			if ( prev.m_iField < 0 && prev.m_nFill == op.m_nFill && prev.m_nOffset + prev.m_nBytes == op.m_nOffset )
+			{
+				prev.m_nBytes += op.m_nBytes;
+				continue;
+			}
+		}
+		ops.AddToTail( op );
+	}
+}
+
+static RestoreFieldTable_t *GetRestoreFieldTable( typedescription_t *pFields, int fieldCount )
+{
+	if ( !pFields || fieldCount <= 0 )
+		return NULL;
+
+	UtlHashHandle_t h = s_RestoreFieldTables.Find( pFields );
+	if ( h != s_RestoreFieldTables.InvalidHandle() )
+	{
+		RestoreFieldTable_t *pTable = s_RestoreFieldTables[h];
+		return ( pTable->m_nFields == fieldCount ) ? pTable : NULL;
+	}
+
+	RestoreFieldTable_t *pTable = new RestoreFieldTable_t;
+	pTable->m_pFields = pFields;
+	pTable->m_nFields = fieldCount;
+	pTable->m_bAmbiguous = false;
+	pTable->m_bRawCopy.SetCount( fieldCount );
+
+	for ( int i = 0; i < fieldCount; i++ )
+	{
+		typedescription_t *pField = &pFields[i];
+		pTable->m_bRawCopy[i] = IsRawCopyField( pField );
+
+		if ( !pField->fieldName )
+			continue;
+
+		if ( pTable->m_FieldsByName.HasElement( pField->fieldName ) )
+		{
+			pTable->m_bAmbiguous = true;
+			continue;
+		}
+		pTable->m_FieldsByName.Insert( pField->fieldName, i );
+	}
+
+	int nSlots = 8;
+	while ( nSlots < fieldCount * 2 )
+	{
+		nSlots <<= 1;
+	}
+	pTable->m_SymbolSlots.SetCount( nSlots );
+	for ( int i = 0; i < nSlots; i++ )
+	{
+		pTable->m_SymbolSlots[i].m_nSymbol = -1;
+		pTable->m_SymbolSlots[i].m_iField = -1;
+	}
+
+	BuildRestoreClearOps( pTable, false );
+	BuildRestoreClearOps( pTable, true );
+
+	s_RestoreFieldTables.Insert( pFields, pTable );
+	return pTable;
+}
+
+static typedescription_t *LookupRestoreField( RestoreFieldTable_t *pTable, int symbol, const char *pszFieldName )
+{
+	if ( !pszFieldName )
+		return NULL;
+
+	RestoreSymbolSlot_t &slot = pTable->m_SymbolSlots[ symbol & ( pTable->m_SymbolSlots.Count() - 1 ) ];
+	if ( slot.m_nSymbol == symbol )
+	{
+		typedescription_t *pField = &pTable->m_pFields[ slot.m_iField ];
+		if ( pField->fieldName == pszFieldName || stricmp( pField->fieldName, pszFieldName ) == 0 )
+			return pField;
+	}
+
+	UtlHashHandle_t h = pTable->m_FieldsByName.Find( pszFieldName );
+	if ( h == pTable->m_FieldsByName.InvalidHandle() )
+		return NULL;
+
+	slot.m_nSymbol = symbol;
+	slot.m_iField = pTable->m_FieldsByName[h];
+	return &pTable->m_pFields[ slot.m_iField ];
+}
+
+//-------------------------------------
+
 typedescription_t *CRestore::FindField( const char *pszFieldName, typedescription_t *pFields, int fieldCount, int *pCookie )
 {
 	int &fieldNumber = *pCookie;
@@ -1539,55 +1865,81 @@ bool CRestore::ShouldEmptyField( typedescription_t *pField )
 
 //-------------------------------------
 
-void CRestore::EmptyFields( void *pBaseData, typedescription_t *pFields, int fieldCount )
+void CRestore::EmptyField( void *pBaseData, typedescription_t *pField )
 {
-	int i;
-	for ( i = 0; i < fieldCount; i++ )
+	void *pFieldData = (char *)pBaseData + pField->fieldOffset[ TD_OFFSET_NORMAL ];
+	switch( pField->fieldType )
 	{
-		typedescription_t *pField = &pFields[i];
-		if ( !ShouldEmptyField( pField ) )
-			continue;
+	case FIELD_CUSTOM:
+		{
+			SaveRestoreFieldInfo_t fieldInfo =
+			{
+				pFieldData,
+				pBaseData,
+				pField
+			};
+			pField->pSaveRestoreOps->MakeEmpty( fieldInfo );
+		}
+		break;
 
-		void *pFieldData = (char *)pBaseData + pField->fieldOffset[ TD_OFFSET_NORMAL ];
-		switch( pField->fieldType )
+	case FIELD_EMBEDDED:
 		{
-		case FIELD_CUSTOM:
+			if ( (pField->flags & FTYPEDESC_PTR) && !*((void **)pFieldData) )
+				break;
+
+			int nFieldCount = pField->fieldSize;
+			char *pFieldMemory = (char *)( ( !(pField->flags & FTYPEDESC_PTR) ) ? pFieldData : *((void **)pFieldData) );
+			while ( --nFieldCount >= 0 )
 			{
-				SaveRestoreFieldInfo_t fieldInfo =
-				{
-					pFieldData,
-					pBaseData,
-					pField
-				};
-				pField->pSaveRestoreOps->MakeEmpty( fieldInfo );
+				EmptyFields( pFieldMemory, pField->td->dataDesc, pField->td->dataNumFields );
+				pFieldMemory += pField->fieldSizeInBytes;
 			}
-			break;
+		}
+		break;
 
-		case FIELD_EMBEDDED:
-			{
-				if ( (pField->flags & FTYPEDESC_PTR) && !*((void **)pFieldData) )
-					break;
+	default:
+		// NOTE: If you hit this assertion, you've got a bug where you're using 
+		// the wrong field type for your field
+		if ( pField->fieldSizeInBytes != pField->fieldSize * gSizes[pField->fieldType] )
+		{
+			Warning("WARNING! Field %s is using the wrong FIELD_ type!\nFix this or you'll see a crash.\n", pField->fieldName );
+			Assert( 0 );
+		}
+		memset( pFieldData, (pField->fieldType != FIELD_EHANDLE) ? 0 : 0xFF, pField->fieldSize * gSizes[pField->fieldType] );
+		break;
+	}
+}
 
-				int nFieldCount = pField->fieldSize;
-				char *pFieldMemory = (char *)( ( !(pField->flags & FTYPEDESC_PTR) ) ? pFieldData : *((void **)pFieldData) );
-				while ( --nFieldCount >= 0 )
-				{
-					EmptyFields( pFieldMemory, pField->td->dataDesc, pField->td->dataNumFields );
-					pFieldMemory += pField->fieldSizeInBytes;
-				}
-			}
-			break;
+//-------------------------------------
 
-		default:
-			// NOTE: If you hit this assertion, you've got a bug where you're using 
-			// the wrong field type for your field
-			if ( pField->fieldSizeInBytes != pField->fieldSize * gSizes[pField->fieldType] )
+void CRestore::EmptyFields( void *pBaseData, typedescription_t *pFields, int fieldCount )
+{
+	RestoreFieldTable_t *pTable = GetRestoreFieldTable( pFields, fieldCount );
+	if ( !pTable )
+	{
+		for ( int i = 0; i < fieldCount; i++ )
+		{
+			typedescription_t *pField = &pFields[i];
+			if ( ShouldEmptyField( pField ) )
 			{
-				Warning("WARNING! Field %s is using the wrong FIELD_ type!\nFix this or you'll see a crash.\n", pField->fieldName );
-				Assert( 0 );
+				EmptyField( pBaseData, pField );
 			}
-			memset( pFieldData, (pField->fieldType != FIELD_EHANDLE) ? 0 : 0xFF, pField->fieldSize * gSizes[pField->fieldType] );
-			break;
+		}
+		return;
+	}
+
+	// Contiguous plain fields were merged into single fills when the table was built
+	const CUtlVector< RestoreClearOp_t > &ops = pTable->m_ClearOps[ m_global ? 1 : 0 ];
+	for ( int i = 0; i < ops.Count(); i++ )
+	{
+		const RestoreClearOp_t &op = ops[i];
+		if ( op.m_iField < 0 )
+		{
+			memset( (char *)pBaseData + op.m_nOffset, op.m_nFill, op.m_nBytes );
+		}
+		else
+		{
+			EmptyField( pBaseData, &pFields[ op.m_iField ] );
 		}
 	}
 }
@@ -1650,6 +2002,10 @@ int CRestore::ReadFields( const char *pname, void *pBaseData, datamap_t *pRootMa
 	// Clear out base data
 	EmptyFields( pBaseData, pFields, fieldCount );
 	
+	RestoreFieldTable_t *pTable = GetRestoreFieldTable( pFields, fieldCount );
+	if ( pTable && pTable->m_bAmbiguous )
+		pTable = NULL;
+
 	// Skip over the struct name
 	int i;
 	int nFieldsSaved = ReadInt();						// Read field count
@@ -1660,10 +2016,25 @@ int CRestore::ReadFields( const char *pname, void *pBaseData, datamap_t *pRootMa
 	{
 		ReadHeader( &header );
 
-		typedescription_t *pField = FindField( m_pData->StringFromSymbol( header.symbol ), pFields, fieldCount, &searchCookie);
+		typedescription_t *pField;
+		if ( pTable )
+			pField = LookupRestoreField( pTable, header.symbol, m_pData->StringFromSymbol( header.symbol ) );
+		else
+			pField = FindField( m_pData->StringFromSymbol( header.symbol ), pFields, fieldCount, &searchCookie);
+
 		if ( pField && ShouldReadField( pField ) )
 		{
-			ReadField( header, ((char *)pBaseData + pField->fieldOffset[ TD_OFFSET_NORMAL ]), pRootMap, pField );
+			void *pDest = (char *)pBaseData + pField->fieldOffset[ TD_OFFSET_NORMAL ];
+
+			// Plain data saved at its full size is copied straight out of the buffer
+			if ( pTable && pTable->m_bRawCopy[ pField - pFields ] && header.size == pField->fieldSizeInBytes && m_pData->BytesAvailable() >= header.size )
+			{
+				m_pData->Read( pDest, header.size );
+			}
+			else
+			{
+				ReadField( header, pDest, pRootMap, pField );
+			}
 		}
 		else
 		{
@@ -1726,7 +2097,15 @@ int CRestore::DoReadAll( void *pLeafObject, datamap_t *pLeafMap, datamap_t *pCur
 			return status;
 	}
 
-	return ReadFields( pCurMap->dataClassName, pLeafObject, pLeafMap, pCurMap->dataDesc, pCurMap->dataNumFields );
+	if ( !save_class_timing.GetBool() )
+		return ReadFields( pCurMap->dataClassName, pLeafObject, pLeafMap, pCurMap->dataDesc, pCurMap->dataNumFields );
+
+	CFastTimer timer;
+	timer.Start();
+	int result = ReadFields( pCurMap->dataClassName, pLeafObject, pLeafMap, pCurMap->dataDesc, pCurMap->dataNumFields );
+	timer.End();
+	AccumulateClassTiming( pCurMap, true, timer.GetDuration() );
+	return result;
 }
 
 //-------------------------------------
@@ -2458,6 +2837,13 @@ void CEntitySaveRestoreBlockHandler::Save( ISave *pSave )
 	CGameSaveRestoreInfo *pSaveData = pSave->GetGameSaveRestoreInfo();
 	
 	// write entity list that was previously built by SaveInitEntities()
+	//
+	// NOTE: This walk has to run here, on the main thread, against live entities.
+	// Save() overrides and custom SaveRestoreOps read arbitrary game state, and
+	// the engine consumes this block as soon as the handler returns, so there is
+	// no window for encoding it on a worker. Blocks also hold per-save symbol
+	// numbers and entity table indices, so they can't be delta'd against a
+	// previous save either. Compression and the file write are the engine's.
 	for ( int i = 0; i < pSaveData->NumEntities(); i++ )
 	{
 		entitytable_t *pEntInfo = pSaveData->GetEntityInfo( i );
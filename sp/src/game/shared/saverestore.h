@@ -306,6 +306,7 @@ private:
 
 	bool			ShouldReadField( typedescription_t *pField );
 	bool 			ShouldEmptyField( typedescription_t *pField );
+	void			EmptyField( void *pBaseData, typedescription_t *pField );
 
 	//---------------------------------
 	// Game info methods
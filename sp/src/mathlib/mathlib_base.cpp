@@ -31,6 +31,7 @@
 
 #include "mathlib/ssemath.h"
 #include "mathlib/ssequaternion.h"
+#include "mathlib/ssemath8.h"
 
 // memdbgon must be the last include file in a .cpp file!!!
 #include "tier0/memdbgon.h"
@@ -3388,6 +3389,9 @@ void MathLib_Init( float gamma, float texGamma, float brightness, int overbright
 	{
 		s_bSSE2Enabled = false;
 	}
+
+	// Batched array kernels; turning off SSE2 also keeps them off AVX2
+	SelectSIMDKernels( s_bSSE2Enabled );
 #endif
 
 	s_bMathlibInitialized = true;
@@ -0,0 +1,43 @@
+//========= Copyright Valve Corporation, All rights reserved. ============//
+//
+// Purpose: Eight-wide kernels with fltx8 in an AVX register. Only used when
+//			CheckAVX2Technology() and CheckFMA3Technology() both pass.
+//
+//			gcc only generates AVX code for this file when it's built with
+//			-mavx2 -mfma (see mathlib.vpc); without them, or on compilers
+//			that lack the intrinsics, the table is left out. The file also
+//			needs -ffp-contract=off, or gcc fuses the multiplies and adds
+//			and the results stop matching the four-wide code.
+//
+//=====================================================================================//
+
+#if !defined( _X360 ) && ( defined( __AVX2__ ) || ( defined( _MSC_FULL_VER ) && _MSC_FULL_VER >= 170000000 ) )
+#define SIMD8_AVX2
+#endif
+
+#include "mathlib/ssemath8.h"
+
+#if defined( SIMD8_AVX2 )
+
+#include "simd8_kernels.h"
+
+// NOTE: This has to be the last file included!
+#include "tier0/memdbgon.h"
+
+
+static const SIMDKernels_t s_SIMDKernels8WideAVX2 =
+{
+	"8-wide AVX2",
+	SIMD8_AVX2_Impl::Noise,
+	SIMD8_AVX2_Impl::Add,
+	SIMD8_AVX2_Impl::Scale,
+	SIMD8_AVX2_Impl::PowFixedPoint,
+};
+
+const SIMDKernels_t *g_pSIMDKernels8WideAVX2 = &s_SIMDKernels8WideAVX2;
+
+#else
+
+const SIMDKernels_t *g_pSIMDKernels8WideAVX2 = NULL;
+
+#endif
@@ -0,0 +1,244 @@
+//========= Copyright Valve Corporation, All rights reserved. ============//
+//
+// Purpose: Eight-wide versions of the batched SIMD kernels. Included once by
+//			simd8_sse.cpp and once by simd8_avx2.cpp, each of which picks the
+//			fltx8 implementation and so the namespace these land in.
+//
+//			Everything here has to give the same answers as the four-wide
+//			routines it replaces, so there's no fused multiply-add. The AVX2
+//			build also mustn't call inline code from shared headers (see
+//			ssemath8.h), which is why the tails are done with plain floats.
+//
+//=====================================================================================//
+
+#ifndef SIMD8_KERNELS_H
+#define SIMD8_KERNELS_H
+#ifdef _WIN32
+#pragma once
+#endif
+
+#include "mathlib/ssemath8.h"
+#include "noisedata.h"
+
+namespace SIMD8_NAMESPACE
+{
+
+//-----------------------------------------------------------------------------
+// Noise, as NoiseSIMD in ssenoise.cpp
+//-----------------------------------------------------------------------------
+static ALIGN16 int32 s_NoiseIndexMask8[8] = { 0xffff, 0xffff, 0xffff, 0xffff, 0xffff, 0xffff, 0xffff, 0xffff };
+
+// returns 0..1
+static inline float GetLatticePointValue( int idx_x, int idx_y, int idx_z )
+{
+	int ret_idx = perm_a[idx_x & 0xff];
+	ret_idx = perm_b[( idx_y + ret_idx ) & 0xff];
+	ret_idx = perm_c[( idx_z + ret_idx ) & 0xff];
+	return impulse_xcoords[ret_idx];
+}
+
+static FORCEINLINE fltx8 NoiseSIMD8( const fltx8 &x, const fltx8 &y, const fltx8 &z )
+{
+	// use magic to convert to integer index; gives 8 bits of fraction
+	fltx8 magic = ReplicateX8( 1 << 15 );
+	fltx8 mask = LoadUnalignedSIMD8( s_NoiseIndexMask8 );
+
+	uint32 x_idx[8], y_idx[8], z_idx[8];
+	StoreUnalignedSIMD8( (float *)x_idx, AndSIMD8( mask, AddSIMD8( x, magic ) ) );
+	StoreUnalignedSIMD8( (float *)y_idx, AndSIMD8( mask, AddSIMD8( y, magic ) ) );
+	StoreUnalignedSIMD8( (float *)z_idx, AndSIMD8( mask, AddSIMD8( z, magic ) ) );
+
+	float lattice[8][8];
+	float frac[3][8];
+	for ( int i = 0; i < 8; i++ )
+	{
+		unsigned int xi = x_idx[i];
+		unsigned int yi = y_idx[i];
+		unsigned int zi = z_idx[i];
+		frac[0][i] = ( xi & 0xff ) * ( 1.0 / 256.0 );
+		frac[1][i] = ( yi & 0xff ) * ( 1.0 / 256.0 );
+		frac[2][i] = ( zi & 0xff ) * ( 1.0 / 256.0 );
+		xi >>= 8;
+		yi >>= 8;
+		zi >>= 8;
+
+		lattice[0][i] = GetLatticePointValue( xi, yi, zi );
+		lattice[1][i] = GetLatticePointValue( xi, yi, zi + 1 );
+		lattice[2][i] = GetLatticePointValue( xi, yi + 1, zi );
+		lattice[3][i] = GetLatticePointValue( xi, yi + 1, zi + 1 );
+		lattice[4][i] = GetLatticePointValue( xi + 1, yi, zi );
+		lattice[5][i] = GetLatticePointValue( xi + 1, yi, zi + 1 );
+		lattice[6][i] = GetLatticePointValue( xi + 1, yi + 1, zi );
+		lattice[7][i] = GetLatticePointValue( xi + 1, yi + 1, zi + 1 );
+	}
+
+	fltx8 xfrac = LoadUnalignedSIMD8( frac[0] );
+	fltx8 yfrac = LoadUnalignedSIMD8( frac[1] );
+	fltx8 zfrac = LoadUnalignedSIMD8( frac[2] );
+	fltx8 lattice000 = LoadUnalignedSIMD8( lattice[0] );
+	fltx8 lattice001 = LoadUnalignedSIMD8( lattice[1] );
+	fltx8 lattice010 = LoadUnalignedSIMD8( lattice[2] );
+	fltx8 lattice011 = LoadUnalignedSIMD8( lattice[3] );
+	fltx8 lattice100 = LoadUnalignedSIMD8( lattice[4] );
+	fltx8 lattice101 = LoadUnalignedSIMD8( lattice[5] );
+	fltx8 lattice110 = LoadUnalignedSIMD8( lattice[6] );
+	fltx8 lattice111 = LoadUnalignedSIMD8( lattice[7] );
+
+	// first, do x interpolation
+	fltx8 l2d00 = AddSIMD8( lattice000, MulSIMD8( xfrac, SubSIMD8( lattice100, lattice000 ) ) );
+	fltx8 l2d01 = AddSIMD8( lattice001, MulSIMD8( xfrac, SubSIMD8( lattice101, lattice001 ) ) );
+	fltx8 l2d10 = AddSIMD8( lattice010, MulSIMD8( xfrac, SubSIMD8( lattice110, lattice010 ) ) );
+	fltx8 l2d11 = AddSIMD8( lattice011, MulSIMD8( xfrac, SubSIMD8( lattice111, lattice011 ) ) );
+
+	// now, do y interpolation
+	fltx8 l1d0 = AddSIMD8( l2d00, MulSIMD8( yfrac, SubSIMD8( l2d10, l2d00 ) ) );
+	fltx8 l1d1 = AddSIMD8( l2d01, MulSIMD8( yfrac, SubSIMD8( l2d11, l2d01 ) ) );
+
+	// final z interpolation
+	fltx8 rslt = AddSIMD8( l1d0, MulSIMD8( zfrac, SubSIMD8( l1d1, l1d0 ) ) );
+
+	// map to -1..1
+	return MulSIMD8( ReplicateX8( 2.0f ), SubSIMD8( rslt, ReplicateX8( 0.5f ) ) );
+}
+
+static void Noise( fltx4 *pOut, FourVectors const *pPos, int nCount )
+{
+	int i = 0;
+	for ( ; i + 2 <= nCount; i += 2 )
+	{
+		EightVectors pos;
+		pos.LoadFourVectors( pPos[i], pPos[i + 1] );
+		fltx8 rslt = NoiseSIMD8( pos.x, pos.y, pos.z );
+		pOut[i] = LowerHalfSIMD8( rslt );
+		pOut[i + 1] = UpperHalfSIMD8( rslt );
+	}
+
+	if ( i < nCount )
+	{
+		EightVectors pos;
+		pos.LoadFourVectors( pPos[i], pPos[i] );
+		pOut[i] = LowerHalfSIMD8( NoiseSIMD8( pos.x, pos.y, pos.z ) );
+	}
+
+	EndSIMD8();
+}
+
+//-----------------------------------------------------------------------------
+// pDest += pSrc
+//-----------------------------------------------------------------------------
+static void Add( float *pDest, float const *pSrc, int nFloats )
+{
+	int i = 0;
+	for ( ; i + 8 <= nFloats; i += 8 )
+	{
+		StoreUnalignedSIMD8( pDest + i, AddSIMD8( LoadUnalignedSIMD8( pDest + i ), LoadUnalignedSIMD8( pSrc + i ) ) );
+	}
+
+	for ( ; i < nFloats; i++ )
+	{
+		pDest[i] += pSrc[i];
+	}
+
+	EndSIMD8();
+}
+
+//-----------------------------------------------------------------------------
+// Component-wise scale of an array of FourVectors
+//-----------------------------------------------------------------------------
+static void Scale( FourVectors *pDest, int nCount, Vector const &scale )
+{
+	// Two FourVectors are xxxx yyyy zzzz xxxx yyyy zzzz, so the scale
+	// repeats every three fltx8s
+	float flPattern[24];
+	for ( int j = 0; j < 4; j++ )
+	{
+		flPattern[j] = flPattern[12 + j] = scale.x;
+		flPattern[4 + j] = flPattern[16 + j] = scale.y;
+		flPattern[8 + j] = flPattern[20 + j] = scale.z;
+	}
+	fltx8 scale0 = LoadUnalignedSIMD8( flPattern );
+	fltx8 scale1 = LoadUnalignedSIMD8( flPattern + 8 );
+	fltx8 scale2 = LoadUnalignedSIMD8( flPattern + 16 );
+
+	float *pFloats = (float *)pDest;
+	int nFloats = nCount * ( sizeof( FourVectors ) / sizeof( float ) );
+	int i = 0;
+	for ( ; i + 24 <= nFloats; i += 24 )
+	{
+		StoreUnalignedSIMD8( pFloats + i, MulSIMD8( LoadUnalignedSIMD8( pFloats + i ), scale0 ) );
+		StoreUnalignedSIMD8( pFloats + i + 8, MulSIMD8( LoadUnalignedSIMD8( pFloats + i + 8 ), scale1 ) );
+		StoreUnalignedSIMD8( pFloats + i + 16, MulSIMD8( LoadUnalignedSIMD8( pFloats + i + 16 ), scale2 ) );
+	}
+
+	// odd FourVectors left over
+	for ( int j = 0; i < nFloats; i++, j++ )
+	{
+		pFloats[i] *= flPattern[j];
+	}
+
+	EndSIMD8();
+}
+
+//-----------------------------------------------------------------------------
+// Fixed point power, as Pow_FixedPoint_Exponent_SIMD in powsse.cpp
+//-----------------------------------------------------------------------------
+static FORCEINLINE fltx8 Pow_FixedPoint_Exponent_SIMD8( const fltx8 &x, int exponent )
+{
+	fltx8 rslt = ReplicateX8( 1.0f );						// x^0=1.0
+	int xp = abs( exponent );
+	if ( xp & 3 )											// fraction present?
+	{
+		fltx8 sq_rt = SqrtEstSIMD8( x );
+		if ( xp & 1 )										// .25?
+			rslt = SqrtEstSIMD8( sq_rt );					// x^.25
+		if ( xp & 2 )
+			rslt = MulSIMD8( rslt, sq_rt );
+	}
+	xp >>= 2;												// strip fraction
+	fltx8 curpower = x;										// curpower iterates through  x,x^2,x^4,x^8,x^16...
+
+	while ( 1 )
+	{
+		if ( xp & 1 )
+			rslt = MulSIMD8( rslt, curpower );
+		xp >>= 1;
+		if ( xp )
+			curpower = MulSIMD8( curpower, curpower );
+		else
+			break;
+	}
+	if ( exponent < 0 )
+		return ReciprocalEstSaturateSIMD8( rslt );			// pow(x,-b)=1/pow(x,b)
+	else
+		return rslt;
+}
+
+static void PowFixedPoint( float *pData, int nFloats, int nExponent )
+{
+	int i = 0;
+	for ( ; i + 8 <= nFloats; i += 8 )
+	{
+		StoreUnalignedSIMD8( pData + i, Pow_FixedPoint_Exponent_SIMD8( LoadUnalignedSIMD8( pData + i ), nExponent ) );
+	}
+
+	if ( i < nFloats )
+	{
+		// pad the last few out to a full fltx8
+		float flTail[8];
+		for ( int j = 0; j < 8; j++ )
+		{
+			flTail[j] = ( i + j < nFloats ) ? pData[i + j] : 1.0f;
+		}
+		StoreUnalignedSIMD8( flTail, Pow_FixedPoint_Exponent_SIMD8( LoadUnalignedSIMD8( flTail ), nExponent ) );
+		for ( int j = 0; i + j < nFloats; j++ )
+		{
+			pData[i + j] = flTail[j];
+		}
+	}
+
+	EndSIMD8();
+}
+
+}
+
+#endif // SIMD8_KERNELS_H
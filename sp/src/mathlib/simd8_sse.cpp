@@ -0,0 +1,22 @@
+//========= Copyright Valve Corporation, All rights reserved. ============//
+//
+// Purpose: Eight-wide kernels with fltx8 as a pair of fltx4s. Runs anywhere
+//			the four-wide code does.
+//
+//=====================================================================================//
+
+#include "mathlib/ssemath8.h"
+#include "simd8_kernels.h"
+
+// NOTE: This has to be the last file included!
+#include "tier0/memdbgon.h"
+
+
+const SIMDKernels_t g_SIMDKernels8WideSSE =
+{
+	"8-wide SSE",
+	SIMD8_SSE_Impl::Noise,
+	SIMD8_SSE_Impl::Add,
+	SIMD8_SSE_Impl::Scale,
+	SIMD8_SSE_Impl::PowFixedPoint,
+};
@@ -0,0 +1,101 @@
+//========= Copyright Valve Corporation, All rights reserved. ============//
+//
+// Purpose: Four-wide batched SIMD kernels, and picking which set to use
+//
+//=====================================================================================//
+
+#include "mathlib/ssemath8.h"
+#include "tier1/processor_detect.h"
+
+// NOTE: This has to be the last file included!
+#include "tier0/memdbgon.h"
+
+
+static void Noise4Wide( fltx4 *pOut, FourVectors const *pPos, int nCount )
+{
+	for ( int i = 0; i < nCount; i++ )
+	{
+		pOut[i] = NoiseSIMD( pPos[i] );
+	}
+}
+
+static void Add4Wide( float *pDest, float const *pSrc, int nFloats )
+{
+	for ( int i = 0; i < nFloats; i += 4 )
+	{
+		StoreAlignedSIMD( pDest + i, AddSIMD( LoadAlignedSIMD( pDest + i ), LoadAlignedSIMD( pSrc + i ) ) );
+	}
+}
+
+static void Scale4Wide( FourVectors *pDest, int nCount, Vector const &scale )
+{
+	FourVectors scalevalue;
+	scalevalue.DuplicateVector( scale );
+	for ( int i = 0; i < nCount; i++ )
+	{
+		pDest[i].VProduct( scalevalue );
+	}
+}
+
+static void PowFixedPoint4Wide( float *pData, int nFloats, int nExponent )
+{
+	for ( int i = 0; i < nFloats; i += 4 )
+	{
+		StoreAlignedSIMD( pData + i, Pow_FixedPoint_Exponent_SIMD( LoadAlignedSIMD( pData + i ), nExponent ) );
+	}
+}
+
+const SIMDKernels_t g_SIMDKernels4Wide =
+{
+	"4-wide",
+	Noise4Wide,
+	Add4Wide,
+	Scale4Wide,
+	PowFixedPoint4Wide,
+};
+
+
+//-----------------------------------------------------------------------------
+
+static const SIMDKernels_t *s_pSIMDKernels = &g_SIMDKernels4Wide;
+static bool s_bAVX2Supported = false;
+
+const SIMDKernels_t *GetSIMDKernels()
+{
+	return s_pSIMDKernels;
+}
+
+const SIMDKernels_t *GetSIMDKernels( int nTier )
+{
+	switch ( nTier )
+	{
+	case SIMD_KERNELS_4WIDE:
+		return &g_SIMDKernels4Wide;
+
+	case SIMD_KERNELS_8WIDE_SSE:
+		return &g_SIMDKernels8WideSSE;
+
+	case SIMD_KERNELS_8WIDE_AVX2:
+		return s_bAVX2Supported ? g_pSIMDKernels8WideAVX2 : NULL;
+	}
+	return NULL;
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Uses AVX2 when the CPU and OS both support it. Otherwise stays on
+//			the four-wide loops; the paired SSE build computes the same thing
+//			and is only there to share the eight-wide source.
+//-----------------------------------------------------------------------------
+void SelectSIMDKernels( bool bAllowAVX2 )
+{
+	s_bAVX2Supported = g_pSIMDKernels8WideAVX2 && CheckAVX2Technology() && CheckFMA3Technology();
+
+	if ( bAllowAVX2 && s_bAVX2Supported )
+	{
+		s_pSIMDKernels = g_pSIMDKernels8WideAVX2;
+	}
+	else
+	{
+		s_pSIMDKernels = &g_SIMDKernels4Wide;
+	}
+}
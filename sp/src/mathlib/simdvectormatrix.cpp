@@ -13,6 +13,7 @@
 #include "mathlib/mathlib.h"
 #include "mathlib/simdvectormatrix.h"
 #include "mathlib/ssemath.h"
+#include "mathlib/ssemath8.h"
 #include "tier0/dbg.h"
 
 void CSIMDVectorMatrix::CreateFromRGBA_FloatImageData(int srcwidth, int srcheight,
@@ -65,14 +66,7 @@ void CSIMDVectorMatrix::RaiseToPower( float power )
 	if ( nv )
 	{
 		int fixed_point_exp=(int) ( 4.0*power );
-		FourVectors *src=m_pData;
-		do
-		{
-			src->x=Pow_FixedPoint_Exponent_SIMD( src->x, fixed_point_exp );
-			src->y=Pow_FixedPoint_Exponent_SIMD( src->y, fixed_point_exp );
-			src->z=Pow_FixedPoint_Exponent_SIMD( src->z, fixed_point_exp );
-			src++;
-		} while (--nv);
+		GetSIMDKernels()->m_pfnPowFixedPoint( reinterpret_cast<float *>( m_pData ), nv * 12, fixed_point_exp );
 	}
 }
 
@@ -83,12 +77,7 @@ CSIMDVectorMatrix & CSIMDVectorMatrix::operator+=( CSIMDVectorMatrix const &src
 	int nv=NVectors();
 	if ( nv )
 	{
-		FourVectors *srcv=src.m_pData;
-		FourVectors *destv=m_pData;
-		do													// !! speed !! inline more iters
-		{
-			*( destv++ ) += *( srcv++ );
-		} while ( --nv );
+		GetSIMDKernels()->m_pfnAdd( reinterpret_cast<float *>( m_pData ), reinterpret_cast<float const *>( src.m_pData ), nv * 12 );
 	}
 	return *this;
 }
@@ -98,14 +87,7 @@ CSIMDVectorMatrix & CSIMDVectorMatrix::operator*=( Vector const &src )
 	int nv=NVectors();
 	if ( nv )
 	{
-		FourVectors scalevalue;
-		scalevalue.DuplicateVector( src );
-		FourVectors *destv=m_pData;
-		do													// !! speed !! inline more iters
-		{
-			destv->VProduct( scalevalue );
-			destv++;
-		} while ( --nv );
+		GetSIMDKernels()->m_pfnScale( m_pData, nv, src );
 	}
 	return *this;
 }
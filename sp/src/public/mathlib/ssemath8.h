@@ -0,0 +1,287 @@
+//========= Copyright Valve Corporation, All rights reserved. ============//
+//
+// Purpose: Eight-wide SIMD floats (fltx8) and the batched array kernels built
+//			on them.
+//
+// fltx8 is one AVX register in translation units that define SIMD8_AVX2
+// before including this header, and a pair of fltx4s everywhere else, so the
+// same kernel source builds for both. Each build lives in its own namespace
+// because the AVX one is compiled with different code generation flags and
+// must never be merged with the SSE one at link time. The AVX build may only
+// call into shared headers through the intrinsics; anything it instantiates
+// from ssemath.h or vector.h could be picked by the linker for SSE callers.
+//
+// Code outside the kernels doesn't use fltx8 directly. It goes through
+// GetSIMDKernels(), which MathLib_Init points at the widest set this CPU and
+// OS can run.
+//
+//===========================================================================//
+
+#ifndef SSEMATH8_H
+#define SSEMATH8_H
+#ifdef _WIN32
+#pragma once
+#endif
+
+#include "mathlib/ssemath.h"
+
+//-----------------------------------------------------------------------------
+// Batched kernels. Every entry produces exactly what the matching loop over
+// the four-wide routines does, so callers can switch sets freely.
+//-----------------------------------------------------------------------------
+struct SIMDKernels_t
+{
+	const char *m_pName;
+
+	// pOut[i] = NoiseSIMD( pPos[i] )
+	void (*m_pfnNoise)( fltx4 *pOut, FourVectors const *pPos, int nCount );
+
+	// pDest[i] += pSrc[i], nFloats a multiple of 4, both 16 byte aligned
+	void (*m_pfnAdd)( float *pDest, float const *pSrc, int nFloats );
+
+	// pDest[i] *= scale, component-wise
+	void (*m_pfnScale)( FourVectors *pDest, int nCount, Vector const &scale );
+
+	// pData[i] = Pow_FixedPoint_Exponent_SIMD( pData[i], nExponent ), same
+	// size and alignment rules as m_pfnAdd
+	void (*m_pfnPowFixedPoint)( float *pData, int nFloats, int nExponent );
+};
+
+enum SIMDKernelTier_t
+{
+	SIMD_KERNELS_4WIDE = 0,			// loops over the fltx4 routines
+	SIMD_KERNELS_8WIDE_SSE,			// fltx8 as a pair of fltx4s
+	SIMD_KERNELS_8WIDE_AVX2,		// fltx8 in one AVX register
+
+	SIMD_KERNELS_NUM_TIERS
+};
+
+// The set picked by MathLib_Init; four-wide until then
+const SIMDKernels_t *GetSIMDKernels();
+
+// A particular tier, or NULL if it wasn't built or this CPU can't run it
+const SIMDKernels_t *GetSIMDKernels( int nTier );
+
+// Called by MathLib_Init
+void SelectSIMDKernels( bool bAllowAVX2 );
+
+// Kernels in each build, in mathlib/simd8_*.cpp
+extern const SIMDKernels_t g_SIMDKernels4Wide;
+extern const SIMDKernels_t g_SIMDKernels8WideSSE;
+extern const SIMDKernels_t *g_pSIMDKernels8WideAVX2;	// NULL if the compiler couldn't build it
+
+
+//-----------------------------------------------------------------------------
+// fltx8
+//-----------------------------------------------------------------------------
+#if defined( SIMD8_AVX2 )
+
+#include <immintrin.h>
+
+#define SIMD8_NAMESPACE SIMD8_AVX2_Impl
+
+namespace SIMD8_NAMESPACE
+{
+
+typedef __m256 fltx8;
+
+FORCEINLINE fltx8 LoadAlignedSIMD8( const void *pSIMD )					{ return _mm256_load_ps( (const float *)pSIMD ); }
+FORCEINLINE fltx8 LoadUnalignedSIMD8( const void *pSIMD )				{ return _mm256_loadu_ps( (const float *)pSIMD ); }
+FORCEINLINE void StoreAlignedSIMD8( float *pSIMD, const fltx8 &a )		{ _mm256_store_ps( pSIMD, a ); }
+FORCEINLINE void StoreUnalignedSIMD8( float *pSIMD, const fltx8 &a )	{ _mm256_storeu_ps( pSIMD, a ); }
+
+// Two fltx4s side by side, and back
+FORCEINLINE fltx8 CombineSIMD8( const fltx4 &lo, const fltx4 &hi )		{ return _mm256_insertf128_ps( _mm256_castps128_ps256( lo ), hi, 1 ); }
+FORCEINLINE fltx4 LowerHalfSIMD8( const fltx8 &a )						{ return _mm256_castps256_ps128( a ); }
+FORCEINLINE fltx4 UpperHalfSIMD8( const fltx8 &a )						{ return _mm256_extractf128_ps( a, 1 ); }
+
+FORCEINLINE fltx8 LoadZeroSIMD8()										{ return _mm256_setzero_ps(); }
+FORCEINLINE fltx8 ReplicateX8( float flValue )							{ return _mm256_set1_ps( flValue ); }
+
+FORCEINLINE fltx8 AddSIMD8( const fltx8 &a, const fltx8 &b )			{ return _mm256_add_ps( a, b ); }
+FORCEINLINE fltx8 SubSIMD8( const fltx8 &a, const fltx8 &b )			{ return _mm256_sub_ps( a, b ); }
+FORCEINLINE fltx8 MulSIMD8( const fltx8 &a, const fltx8 &b )			{ return _mm256_mul_ps( a, b ); }
+FORCEINLINE fltx8 DivSIMD8( const fltx8 &a, const fltx8 &b )			{ return _mm256_div_ps( a, b ); }
+// a*b + c, fused, so it rounds once and won't match MaddSIMD bit for bit
+FORCEINLINE fltx8 FusedMaddSIMD8( const fltx8 &a, const fltx8 &b, const fltx8 &c ) { return _mm256_fmadd_ps( a, b, c ); }
+FORCEINLINE fltx8 MinSIMD8( const fltx8 &a, const fltx8 &b )			{ return _mm256_min_ps( a, b ); }
+FORCEINLINE fltx8 MaxSIMD8( const fltx8 &a, const fltx8 &b )			{ return _mm256_max_ps( a, b ); }
+
+FORCEINLINE fltx8 SqrtEstSIMD8( const fltx8 &a )						{ return _mm256_sqrt_ps( a ); }
+FORCEINLINE fltx8 SqrtSIMD8( const fltx8 &a )							{ return _mm256_sqrt_ps( a ); }
+FORCEINLINE fltx8 ReciprocalEstSIMD8( const fltx8 &a )					{ return _mm256_rcp_ps( a ); }
+
+FORCEINLINE fltx8 AndSIMD8( const fltx8 &a, const fltx8 &b )			{ return _mm256_and_ps( a, b ); }
+FORCEINLINE fltx8 AndNotSIMD8( const fltx8 &a, const fltx8 &b )			{ return _mm256_andnot_ps( a, b ); }	// ~a & b
+FORCEINLINE fltx8 OrSIMD8( const fltx8 &a, const fltx8 &b )				{ return _mm256_or_ps( a, b ); }
+
+FORCEINLINE fltx8 CmpEqSIMD8( const fltx8 &a, const fltx8 &b )			{ return _mm256_cmp_ps( a, b, _CMP_EQ_OQ ); }
+FORCEINLINE fltx8 CmpGtSIMD8( const fltx8 &a, const fltx8 &b )			{ return _mm256_cmp_ps( a, b, _CMP_GT_OS ); }
+FORCEINLINE fltx8 CmpLtSIMD8( const fltx8 &a, const fltx8 &b )			{ return _mm256_cmp_ps( a, b, _CMP_LT_OS ); }
+
+// Drops the upper YMM state so following SSE code doesn't pay for the
+// transition. Call before returning from a kernel.
+FORCEINLINE void EndSIMD8()												{ _mm256_zeroupper(); }
+
+FORCEINLINE float SubFloat8( const fltx8 &a, int idx )					{ return ( (const float *)&a )[idx]; }
+FORCEINLINE uint32 SubInt8( const fltx8 &a, int idx )					{ return ( (const uint32 *)&a )[idx]; }
+
+}
+
+#else
+
+#define SIMD8_NAMESPACE SIMD8_SSE_Impl
+
+namespace SIMD8_NAMESPACE
+{
+
+struct fltx8
+{
+	fltx4 m_lo;
+	fltx4 m_hi;
+};
+
+FORCEINLINE fltx8 MakeSIMD8( const fltx4 &lo, const fltx4 &hi )
+{
+	fltx8 r;
+	r.m_lo = lo;
+	r.m_hi = hi;
+	return r;
+}
+
+FORCEINLINE fltx8 LoadAlignedSIMD8( const void *pSIMD )					{ return MakeSIMD8( LoadAlignedSIMD( pSIMD ), LoadAlignedSIMD( (const float *)pSIMD + 4 ) ); }
+FORCEINLINE fltx8 LoadUnalignedSIMD8( const void *pSIMD )				{ return MakeSIMD8( LoadUnalignedSIMD( pSIMD ), LoadUnalignedSIMD( (const float *)pSIMD + 4 ) ); }
+FORCEINLINE void StoreAlignedSIMD8( float *pSIMD, const fltx8 &a )		{ StoreAlignedSIMD( pSIMD, a.m_lo ); StoreAlignedSIMD( pSIMD + 4, a.m_hi ); }
+FORCEINLINE void StoreUnalignedSIMD8( float *pSIMD, const fltx8 &a )	{ StoreUnalignedSIMD( pSIMD, a.m_lo ); StoreUnalignedSIMD( pSIMD + 4, a.m_hi ); }
+
+FORCEINLINE fltx8 CombineSIMD8( const fltx4 &lo, const fltx4 &hi )		{ return MakeSIMD8( lo, hi ); }
+FORCEINLINE fltx4 LowerHalfSIMD8( const fltx8 &a )						{ return a.m_lo; }
+FORCEINLINE fltx4 UpperHalfSIMD8( const fltx8 &a )						{ return a.m_hi; }
+
+FORCEINLINE fltx8 LoadZeroSIMD8()										{ return MakeSIMD8( LoadZeroSIMD(), LoadZeroSIMD() ); }
+FORCEINLINE fltx8 ReplicateX8( float flValue )							{ fltx4 v = ReplicateX4( flValue ); return MakeSIMD8( v, v ); }
+
+#define SIMD8_BINARY_OP( name, op4 ) \
+	FORCEINLINE fltx8 name( const fltx8 &a, const fltx8 &b )			{ return MakeSIMD8( op4( a.m_lo, b.m_lo ), op4( a.m_hi, b.m_hi ) ); }
+
+SIMD8_BINARY_OP( AddSIMD8, AddSIMD )
+SIMD8_BINARY_OP( SubSIMD8, SubSIMD )
+SIMD8_BINARY_OP( MulSIMD8, MulSIMD )
+SIMD8_BINARY_OP( DivSIMD8, DivSIMD )
+SIMD8_BINARY_OP( MinSIMD8, MinSIMD )
+SIMD8_BINARY_OP( MaxSIMD8, MaxSIMD )
+SIMD8_BINARY_OP( AndSIMD8, AndSIMD )
+SIMD8_BINARY_OP( AndNotSIMD8, AndNotSIMD )
+SIMD8_BINARY_OP( OrSIMD8, OrSIMD )
+SIMD8_BINARY_OP( CmpEqSIMD8, CmpEqSIMD )
+SIMD8_BINARY_OP( CmpGtSIMD8, CmpGtSIMD )
+SIMD8_BINARY_OP( CmpLtSIMD8, CmpLtSIMD )
+
+#undef SIMD8_BINARY_OP
+
+// No fused multiply-add without AVX2; rounds twice
+FORCEINLINE fltx8 FusedMaddSIMD8( const fltx8 &a, const fltx8 &b, const fltx8 &c ) { return AddSIMD8( MulSIMD8( a, b ), c ); }
+
+FORCEINLINE fltx8 SqrtEstSIMD8( const fltx8 &a )						{ return MakeSIMD8( SqrtEstSIMD( a.m_lo ), SqrtEstSIMD( a.m_hi ) ); }
+FORCEINLINE fltx8 SqrtSIMD8( const fltx8 &a )							{ return MakeSIMD8( SqrtSIMD( a.m_lo ), SqrtSIMD( a.m_hi ) ); }
+FORCEINLINE fltx8 ReciprocalEstSIMD8( const fltx8 &a )					{ return MakeSIMD8( ReciprocalEstSIMD( a.m_lo ), ReciprocalEstSIMD( a.m_hi ) ); }
+
+FORCEINLINE void EndSIMD8()												{}
+
+FORCEINLINE float SubFloat8( const fltx8 &a, int idx )					{ return ( (const float *)&a )[idx]; }
+FORCEINLINE uint32 SubInt8( const fltx8 &a, int idx )					{ return ( (const uint32 *)&a )[idx]; }
+
+}
+
+#endif // SIMD8_AVX2
+
+
+//-----------------------------------------------------------------------------
+// Operations common to both builds
+//-----------------------------------------------------------------------------
+namespace SIMD8_NAMESPACE
+{
+
+// (mask & new) | (~mask & old), like MaskedAssign
+FORCEINLINE fltx8 MaskedAssign8( const fltx8 &ReplacementMask, const fltx8 &NewValue, const fltx8 &OldValue )
+{
+	return OrSIMD8( AndSIMD8( ReplacementMask, NewValue ), AndNotSIMD8( ReplacementMask, OldValue ) );
+}
+
+// a*b + c with the same rounding as MaddSIMD
+FORCEINLINE fltx8 MaddSIMD8( const fltx8 &a, const fltx8 &b, const fltx8 &c )
+{
+	return AddSIMD8( MulSIMD8( a, b ), c );
+}
+
+// Like ReciprocalEstSaturateSIMD; 1/0 comes out as 1/FLT_EPSILON
+FORCEINLINE fltx8 ReciprocalEstSaturateSIMD8( const fltx8 &a )
+{
+	fltx8 zero_mask = CmpEqSIMD8( a, LoadZeroSIMD8() );
+	return ReciprocalEstSIMD8( OrSIMD8( a, AndSIMD8( ReplicateX8( FLT_EPSILON ), zero_mask ) ) );
+}
+
+//-----------------------------------------------------------------------------
+// Eight Vectors in structure of arrays form. The lower four lanes come from
+// the first FourVectors and the upper four from the second.
+//-----------------------------------------------------------------------------
+class EightVectors
+{
+public:
+	fltx8 x, y, z;
+
+	FORCEINLINE void LoadFourVectors( FourVectors const &a, FourVectors const &b )
+	{
+		x = CombineSIMD8( a.x, b.x );
+		y = CombineSIMD8( a.y, b.y );
+		z = CombineSIMD8( a.z, b.z );
+	}
+
+	FORCEINLINE void StoreFourVectors( FourVectors *pA, FourVectors *pB ) const
+	{
+		pA->x = LowerHalfSIMD8( x );
+		pA->y = LowerHalfSIMD8( y );
+		pA->z = LowerHalfSIMD8( z );
+		pB->x = UpperHalfSIMD8( x );
+		pB->y = UpperHalfSIMD8( y );
+		pB->z = UpperHalfSIMD8( z );
+	}
+
+	FORCEINLINE void DuplicateVector( Vector const &v )
+	{
+		x = ReplicateX8( v.x );
+		y = ReplicateX8( v.y );
+		z = ReplicateX8( v.z );
+	}
+
+	FORCEINLINE void operator+=( EightVectors const &b )
+	{
+		x = AddSIMD8( x, b.x );
+		y = AddSIMD8( y, b.y );
+		z = AddSIMD8( z, b.z );
+	}
+
+	FORCEINLINE void operator*=( fltx8 const &scale )
+	{
+		x = MulSIMD8( x, scale );
+		y = MulSIMD8( y, scale );
+		z = MulSIMD8( z, scale );
+	}
+
+	// component-wise multiply
+	FORCEINLINE void VProduct( EightVectors const &b )
+	{
+		x = MulSIMD8( x, b.x );
+		y = MulSIMD8( y, b.y );
+		z = MulSIMD8( z, b.z );
+	}
+
+	FORCEINLINE fltx8 operator*( EightVectors const &b ) const		// dot product
+	{
+		return MaddSIMD8( z, b.z, MaddSIMD8( y, b.y, MulSIMD8( x, b.x ) ) );
+	}
+};
+
+}
+
+#endif // SSEMATH8_H
@@ -35,10 +35,12 @@
 	for ( KeyValues * kvValue = kvRoot->GetFirstValue(); kvValue != NULL; kvValue = kvValue->GetNextValue() )
 
 class IBaseFileSystem;
+class IFileSystem;
 class CUtlBuffer;
 class Color;
 typedef void * FileHandle_t;
 class CKeyValuesGrowableStringTable;
+class CKeyValuesDocument;
 
 //-----------------------------------------------------------------------------
 // Purpose: Simple recursive data access class
@@ -302,6 +304,15 @@ private:
 	void FreeAllocatedValue();
 	void AllocateValueBlock(int size);
 
+	// Frees m_sValue unless it belongs to a document
+	void FreeStringValue();
+
+	// Destroys a node, returning its memory to the heap unless it lives in a document
+	static void DestroyKey( KeyValues *pKey );
+
+	// Works out the type of a value token read from text
+	static types_t ParseValueToken( const char *value, int len, int &ival, float &fval, uint64 &ullval );
+
 	int m_iKeyName;	// keyname is a symbol defined in KeyValuesSystem
 
 	// These are needed out of the union because the API returns string pointers
@@ -320,12 +331,20 @@ private:
 	char	   m_iDataType;
 	char	   m_bHasEscapeSequences; // true, if while parsing this KeyValue, Escape Sequences are used (default false)
 	char	   m_bEvaluateConditionals; // true, if while parsing this KeyValue, conditionals blocks are evaluated (default true)
-	char	   unused[1];
+	char	   m_iAllocFlags; // KV_ALLOC_* flags; was padding, so the layout is unchanged
 
 	KeyValues *m_pPeer;	// pointer to next key in list
 	KeyValues *m_pSub;	// pointer to Start of a new sub key list
 	KeyValues *m_pChain;// Search here if it's not in our list
 
+	enum
+	{
+		KV_ALLOC_DOCUMENT_NODE = 0x01,		// node memory belongs to a CKeyValuesDocument
+		KV_ALLOC_BORROWED_STRING = 0x02,	// m_sValue points into a CKeyValuesDocument
+	};
+
+	friend class CKeyValuesDocument;
+
 private:
 	// Statics to implement the optional growable string table
 	// Function pointers that will determine which mode we are in
@@ -421,6 +440,96 @@ inline bool  KeyValues::IsEmpty( int keySymbol )
 
 bool EvaluateConditional( const char *str );
 
+//-----------------------------------------------------------------------------
+// Purpose: A KeyValues file loaded in one piece for reading.
+//
+//	Nodes are allocated from blocks owned by the document, and string values
+//	point into the file's text, which is terminated in place, rather than
+//	being copied. LoadFromFileCached also saves the parsed tree in the binary
+//	format under kvcache/ in the write path, stamped with the source's CRC;
+//	while the source is unchanged later loads read that image and skip the
+//	text parser. Files using #include or #base go through the regular parser.
+//
+//	The tree can be edited like any other, but every node belongs to the
+//	document: don't deleteThis() the root, don't keep nodes after the
+//	document is gone, and don't hand nodes to another module, whose copy of
+//	KeyValues would free them into its own heap.
+//-----------------------------------------------------------------------------
+class CKeyValuesDocument
+{
+public:
+	CKeyValuesDocument();
+	~CKeyValuesDocument();
+
+	// Parse options; set them before loading
+	void UsesEscapeSequences( bool state )	{ m_bUsesEscapeSequences = state; }
+	void UsesConditionals( bool state )		{ m_bEvaluateConditionals = state; }
+
+	bool LoadFromFile( IBaseFileSystem *filesystem, const char *resourceName, const char *pathID = NULL );
+	bool LoadFromFileCached( IFileSystem *filesystem, const char *resourceName, const char *pathID = NULL );
+	bool LoadFromBuffer( char const *resourceName, const char *pBuffer, IBaseFileSystem *pFileSystem = NULL, const char *pPathID = NULL );
+
+	// First top level section, the others are its peers. NULL until loaded.
+	KeyValues *GetRoot() const				{ return m_pRoot; }
+
+	// Frees the tree and everything the document owns
+	void Purge();
+
+	bool WasLoadedFromCache() const			{ return m_bLoadedFromCache; }
+	int GetMemoryUsed() const;
+
+private:
+	enum ParseResult_t
+	{
+		PARSE_OK,
+		PARSE_NEEDS_CLASSIC,		// #include, #base or a unicode file
+	};
+
+	void *Alloc( int nBytes );
+	void NewBlock( int nBytes );
+	KeyValues *AllocKey( const char *pszName );
+	void FreeTree();
+
+	ParseResult_t ParseSource( char const *resourceName );
+	void ParseSection( KeyValues *pParent );
+	const char *ReadToken( bool &wasQuoted, bool &wasConditional );
+	char *TerminateToken( char *pStart, char *pEnd );
+
+	bool LoadFile( IBaseFileSystem *filesystem, const char *resourceName, const char *pathID, IFileSystem *pCacheFileSystem );
+	bool LoadClassic( IBaseFileSystem *filesystem, const char *resourceName, const char *pathID, const char *pBuffer );
+
+	bool LoadCache( IBaseFileSystem *filesystem, const char *pszCacheName, unsigned int nSourceCRC, int nSourceSize );
+	bool ReadCachedPeers( CUtlBuffer &buf, KeyValues **ppFirst );
+	void WriteCache( IFileSystem *filesystem, const char *pszCacheName, unsigned int nSourceCRC, int nSourceSize );
+	int GetCacheFlags() const;
+
+	KeyValues *			m_pRoot;
+
+	// Text being parsed, or the cache image after a cache hit
+	char *				m_pSource;
+	int					m_nSourceSize;
+	char *				m_pParse;
+	char *				m_pParseEnd;
+
+	// One token of lookahead; tokens are terminated in place so they
+	// can't be read twice
+	const char *		m_pPeekToken;
+	bool				m_bPeekQuoted;
+	bool				m_bPeekConditional;
+	bool				m_bHavePeek;
+
+	// Node and value storage
+	CUtlVector< char * >	m_Blocks;
+	char *				m_pBlockCur;
+	int					m_nBlockFree;
+	int					m_nAllocated;
+	int					m_nNodes;
+
+	bool				m_bUsesEscapeSequences;
+	bool				m_bEvaluateConditionals;
+	bool				m_bLoadedFromCache;
+};
+
 class CUtlSortVectorKeyValuesByName
 {
 public:
@@ -217,6 +217,12 @@ public:
 	void			WriteBitVec3Normal( const Vector& fa );
 	void			WriteBitAngles( const QAngle& fa );
 
+	// Same encoding as calling WriteBitVec3Coord / WriteBitAngles once per
+	// element, but the fields are packed into a 64-bit word and stored a
+	// dword at a time.
+	void			WriteBitVec3Coords( const Vector *pVecs, int nCount );
+	void			WriteBitAngles( const QAngle *pAngles, int nCount );
+
 
 // Byte functions.
 public:
@@ -592,6 +598,10 @@ public:
 	void			ReadBitVec3Normal( Vector& fa );
 	void			ReadBitAngles( QAngle& fa );
 
+	// Batched counterparts of ReadBitVec3Coord / ReadBitAngles
+	void			ReadBitVec3Coords( Vector *pVecs, int nCount );
+	void			ReadBitAngles( QAngle *pAngles, int nCount );
+
 	// Faster for comparisons but do not fully decode float values
 	unsigned int	ReadBitCoordBits();
 	unsigned int	ReadBitCoordMPBits( bool bIntegral, bool bLowPrecision );
@@ -803,6 +813,126 @@ BITBUF_INLINE int bf_read::CompareBits( bf_read * RESTRICT other, int numbits )
 }
 
 
+//-----------------------------------------------------------------------------
+// Used for packing several small fields into a bf_write at once. Fields are
+// gathered LSB first in a 64-bit accumulator and stored a whole dword at a
+// time, so a run of flags and short values costs one masked store per 32 bits
+// instead of one per field. The bits that land in the buffer are identical to
+// making the same sequence of calls on the bf_write itself.
+//
+// Nothing reaches the bf_write until 32 bits are pending or Flush() is
+// called (the destructor flushes), so don't write to it directly while an
+// accumulator is open on it.
+//-----------------------------------------------------------------------------
+class CBitWriteAccumulator
+{
+public:
+	CBitWriteAccumulator( bf_write *pBuf ) : m_pBuf( pBuf ), m_nPending( 0 ), m_nPendingBits( 0 ) {}
+	~CBitWriteAccumulator() { Flush(); }
+
+	// Bits of data above numbits are ignored
+	void			WriteUBitLong( unsigned int data, int numbits );
+	void			WriteOneBit( int nValue )	{ WriteUBitLong( nValue ? 1 : 0, 1 ); }
+
+	void			WriteBitAngle( float fAngle, int numbits );
+	void			WriteBitCoord( const float f );
+	void			WriteBitVec3Coord( const Vector& fa );
+	void			WriteBitNormal( float f );
+	void			WriteBitVec3Normal( const Vector& fa );
+	void			WriteBitAngles( const QAngle& fa );
+
+	// Stores whatever is pending, leaving the bf_write up to date
+	void			Flush();
+
+private:
+	bf_write		*m_pBuf;
+	uint64			m_nPending;
+	int				m_nPendingBits;	// always < 32 between calls
+};
+
+BITBUF_INLINE void CBitWriteAccumulator::WriteUBitLong( unsigned int data, int numbits )
+{
+	Assert( numbits > 0 && numbits <= 32 );
+
+	m_nPending |= ( (uint64)data & ( ( (uint64)1 << numbits ) - 1 ) ) << m_nPendingBits;
+	m_nPendingBits += numbits;
+	if ( m_nPendingBits >= 32 )
+	{
+		m_pBuf->WriteUBitLong( (unsigned int)m_nPending, 32, false );
+		m_nPending >>= 32;
+		m_nPendingBits -= 32;
+	}
+}
+
+inline void CBitWriteAccumulator::Flush()
+{
+	if ( m_nPendingBits )
+	{
+		m_pBuf->WriteUBitLong( (unsigned int)m_nPending, m_nPendingBits, false );
+		m_nPending = 0;
+		m_nPendingBits = 0;
+	}
+}
+
+
+//-----------------------------------------------------------------------------
+// Reads several small fields out of a bf_read through a 64-bit window. The
+// window is loaded with a couple of dword reads and fields are shifted out
+// of it, so decoding a vector touches the buffer once or twice rather than
+// once per flag and component.
+//
+// Reads past the end behave like bf_read's: the overflow flag is set, the
+// read position moves to the end and zero is returned. The bf_read's
+// position only advances on Commit() (the destructor commits), so don't read
+// from it directly while an accumulator is open on it.
+//-----------------------------------------------------------------------------
+class CBitReadAccumulator
+{
+public:
+	CBitReadAccumulator( bf_read *pBuf ) : m_pBuf( pBuf ) { Refill( pBuf->m_iCurBit ); }
+	~CBitReadAccumulator() { Commit(); }
+
+	unsigned int	ReadUBitLong( int numbits );
+	int				ReadOneBit()				{ return ReadUBitLong( 1 ); }
+
+	float			ReadBitAngle( int numbits );
+	float			ReadBitCoord();
+	void			ReadBitVec3Coord( Vector& fa );
+	float			ReadBitNormal();
+	void			ReadBitVec3Normal( Vector& fa );
+	void			ReadBitAngles( QAngle& fa );
+
+	// Moves the bf_read past everything read so far
+	void			Commit()					{ m_pBuf->m_iCurBit = m_iWindowBit + m_nUsed; }
+
+private:
+	void			Refill( int iBit );
+	unsigned int	Overrun();
+
+	bf_read			*m_pBuf;
+	uint64			m_nWindow;		// the 64 bits starting at m_iWindowBit, zero past the end
+	int				m_iWindowBit;
+	int				m_nUsed;		// bits of the window consumed
+};
+
+BITBUF_INLINE unsigned int CBitReadAccumulator::ReadUBitLong( int numbits )
+{
+	Assert( numbits > 0 && numbits <= 32 );
+
+	if ( m_nUsed + numbits > 64 )
+	{
+		Refill( m_iWindowBit + m_nUsed );
+	}
+
+	if ( m_iWindowBit + m_nUsed + numbits > m_pBuf->m_nDataBits )
+		return Overrun();
+
+	unsigned int r = (unsigned int)( m_nWindow >> m_nUsed ) & (unsigned int)( ( (uint64)1 << numbits ) - 1 );
+	m_nUsed += numbits;
+	return r;
+}
+
+
 #endif
 
 
@@ -0,0 +1,309 @@
+//========= Copyright Valve Corporation, All rights reserved. ============//
+//
+// Purpose: Per-thread linear scratch allocator, reset at frame boundaries.
+//
+// Each thread gets its own arena on first use. Allocations are bumped off a
+// CMemoryStack and are released either by the CFrameArenaScope that was open
+// when they were made, or by the first use of the arena after NewFrame() if
+// no scope was open. A block is only freed on its own if it's on top.
+//
+//=============================================================================//
+
+#ifndef FRAMEARENA_H
+#define FRAMEARENA_H
+
+#if defined( _WIN32 )
+#pragma once
+#endif
+
+#include "tier0/threadtools.h"
+#include "tier1/memstack.h"
+#include "tier1/utlvector.h"
+
+//-----------------------------------------------------------------------------
+
+struct FrameArenaMark_t
+{
+	MemoryStackMark_t	m_nStack;
+	int					m_nOverflow;
+};
+
+class CFrameArena
+{
+public:
+	CFrameArena( unsigned nMaxSize );
+	~CFrameArena();
+
+	// The calling thread's arena, created on first use
+	static CFrameArena *Get();
+
+	// Called by the main thread when a frame starts. Each arena resets the
+	// next time it's fetched, unless a scope is still open on it.
+	static void NewFrame();
+
+	void *Alloc( unsigned nBytes, bool bClear = false );
+	template< class T > T *AllocArray( int nCount, bool bClear = false ) { return (T *)Alloc( nCount * sizeof( T ), bClear ); }
+
+	// Grows or shrinks the most recent allocation in place. Returns false
+	// if pMem isn't on top of the arena, was made outside the innermost open
+	// scope, or there's no room.
+	bool Resize( void *pMem, unsigned nOldBytes, unsigned nNewBytes );
+
+	// Pops pMem if it's on top of the arena; otherwise it's reclaimed with
+	// the enclosing scope or frame
+	void Free( void *pMem, unsigned nBytes );
+
+	FrameArenaMark_t GetMark();
+	void FreeToMark( const FrameArenaMark_t &mark );
+
+	int GetUsed()						{ return m_Stack.GetUsed(); }
+
+	static void ReportStats();
+	static void ResetStats();
+
+private:
+	friend class CFrameArenaScope;
+
+	bool IsTop( void *pMem, unsigned nBytes );
+	bool HasRoom( unsigned nBytes );
+	void *AllocOverflow( unsigned nBytes, bool bClear );
+	void BeginFrame();
+	void NotePeak();
+
+	CMemoryStack		m_Stack;
+	CUtlVector<void *>	m_Overflow;		// heap blocks taken once the stack was full
+	int					m_nScopeDepth;
+	MemoryStackMark_t	m_nScopeMark;	// stack mark of the innermost open scope
+	int					m_nFrame;
+	ThreadId_t			m_nThreadId;
+	bool				m_bMainThread;
+
+	// High-water marks, in bytes
+	int					m_nFramePeak;
+	int					m_nLastFramePeak;
+	int					m_nPeak;
+	int					m_nOverflowCount;
+	int					m_nOverflowPeak;
+};
+
+//-----------------------------------------------------------------------------
+
+// CMemoryStack only reports running out on Win32, so check up front
+FORCEINLINE bool CFrameArena::HasRoom( unsigned nBytes )
+{
+	return nBytes <= (unsigned)( m_Stack.GetMaxSize() - m_Stack.GetUsed() );
+}
+
+FORCEINLINE void *CFrameArena::Alloc( unsigned nBytes, bool bClear )
+{
+	void *pMem = HasRoom( AlignValue( MAX( nBytes, 1u ), 16 ) ) ? m_Stack.Alloc( nBytes, bClear ) : NULL;
+	if ( !pMem )
+		return AllocOverflow( nBytes, bClear );
+
+	if ( m_Stack.GetUsed() > m_nFramePeak )
+	{
+		m_nFramePeak = m_Stack.GetUsed();
+	}
+	return pMem;
+}
+
+inline FrameArenaMark_t CFrameArena::GetMark()
+{
+	FrameArenaMark_t mark;
+	mark.m_nStack = m_Stack.GetCurrentAllocPoint();
+	mark.m_nOverflow = m_Overflow.Count();
+	return mark;
+}
+
+//-----------------------------------------------------------------------------
+// Everything allocated from this thread's arena while the scope is open is
+// released when it closes, including allocations made by callees.
+//
+//	CFrameArenaScope scratch;
+//	float *pCosts = scratch.AllocArray<float>( nNodes );
+//-----------------------------------------------------------------------------
+class CFrameArenaScope
+{
+public:
+	CFrameArenaScope() : m_pArena( CFrameArena::Get() )
+	{
+		m_Mark = m_pArena->GetMark();
+		m_nOuterMark = m_pArena->m_nScopeMark;
+		m_pArena->m_nScopeMark = m_Mark.m_nStack;
+		m_pArena->m_nScopeDepth++;
+	}
+
+	~CFrameArenaScope()
+	{
+		m_pArena->FreeToMark( m_Mark );
+		m_pArena->m_nScopeMark = m_nOuterMark;
+		m_pArena->m_nScopeDepth--;
+	}
+
+	CFrameArena *GetArena()				{ return m_pArena; }
+
+	void *Alloc( unsigned nBytes, bool bClear = false )					{ return m_pArena->Alloc( nBytes, bClear ); }
+	template< class T > T *AllocArray( int nCount, bool bClear = false )	{ return m_pArena->AllocArray<T>( nCount, bClear ); }
+
+private:
+	CFrameArena *		m_pArena;
+	FrameArenaMark_t	m_Mark;
+	MemoryStackMark_t	m_nOuterMark;
+};
+
+//-----------------------------------------------------------------------------
+// CUtlVector memory backed by the calling thread's arena.
+//
+//	CUtlVector< CBaseEntity *, CUtlMemoryFrameArena< CBaseEntity * > > list;
+//
+// Elements are relocated with memcpy like CUtlMemory. The vector must not
+// outlive the scope or frame it was created in.
+//-----------------------------------------------------------------------------
+template< class T, class I = int >
+class CUtlMemoryFrameArena
+{
+public:
+	CUtlMemoryFrameArena( int nGrowSize = 0, int nInitSize = 0 ) : m_pArena( CFrameArena::Get() ), m_pMemory( NULL ), m_nAllocationCount( 0 )
+	{
+		if ( nInitSize > 0 )
+		{
+			EnsureCapacity( nInitSize );
+		}
+	}
+	CUtlMemoryFrameArena( T *pMemory, int numElements ) : m_pArena( CFrameArena::Get() ), m_pMemory( NULL ), m_nAllocationCount( 0 ) { Assert( 0 ); }
+
+	~CUtlMemoryFrameArena()									{ Purge(); }
+
+	class Iterator_t
+	{
+	public:
+		Iterator_t( I i ) : index( i ) {}
+		I index;
+
+		bool operator==( const Iterator_t it ) const		{ return index == it.index; }
+		bool operator!=( const Iterator_t it ) const		{ return index != it.index; }
+	};
+	Iterator_t First() const								{ return Iterator_t( IsIdxValid( 0 ) ? 0 : InvalidIndex() ); }
+	Iterator_t Next( const Iterator_t &it ) const			{ return Iterator_t( IsIdxValid( it.index + 1 ) ? it.index + 1 : InvalidIndex() ); }
+	I GetIndex( const Iterator_t &it ) const				{ return it.index; }
+	bool IsIdxAfter( I i, const Iterator_t &it ) const		{ return i > it.index; }
+	bool IsValidIterator( const Iterator_t &it ) const		{ return IsIdxValid( it.index ); }
+	Iterator_t InvalidIterator() const						{ return Iterator_t( InvalidIndex() ); }
+
+	bool IsIdxValid( I i ) const							{ return ( i >= 0 ) && ( i < m_nAllocationCount ); }
+	static I InvalidIndex()									{ return ( I )-1; }
+
+	T* Base()												{ return m_pMemory; }
+	const T* Base() const									{ return m_pMemory; }
+
+	T& operator[]( I i )									{ Assert( IsIdxValid( i ) ); return m_pMemory[i]; }
+	const T& operator[]( I i ) const						{ Assert( IsIdxValid( i ) ); return m_pMemory[i]; }
+	T& Element( I i )										{ Assert( IsIdxValid( i ) ); return m_pMemory[i]; }
+	const T& Element( I i ) const							{ Assert( IsIdxValid( i ) ); return m_pMemory[i]; }
+
+	int NumAllocated() const								{ return m_nAllocationCount; }
+	int Count() const										{ return m_nAllocationCount; }
+
+	bool IsExternallyAllocated() const						{ return false; }
+	void SetGrowSize( int size )							{}
+
+	void Grow( int num = 1 )								{ Assert( num > 0 ); EnsureCapacity( m_nAllocationCount + MAX( num, m_nAllocationCount ) ); }
+
+	void EnsureCapacity( int num )
+	{
+		if ( num <= m_nAllocationCount )
+			return;
+
+		// The newest allocation can grow where it is
+		if ( m_pMemory && m_pArena->Resize( m_pMemory, m_nAllocationCount * sizeof( T ), num * sizeof( T ) ) )
+		{
+			m_nAllocationCount = num;
+			return;
+		}
+
+		T *pMemory = (T *)m_pArena->Alloc( num * sizeof( T ) );
+		if ( m_pMemory )
+		{
+			memcpy( pMemory, m_pMemory, m_nAllocationCount * sizeof( T ) );
+			m_pArena->Free( m_pMemory, m_nAllocationCount * sizeof( T ) );
+		}
+		m_pMemory = pMemory;
+		m_nAllocationCount = num;
+	}
+
+	void Purge()
+	{
+		if ( m_pMemory )
+		{
+			m_pArena->Free( m_pMemory, m_nAllocationCount * sizeof( T ) );
+			m_pMemory = NULL;
+			m_nAllocationCount = 0;
+		}
+	}
+
+	void Purge( int numElements )
+	{
+		if ( numElements <= 0 )
+		{
+			Purge();
+		}
+		else if ( numElements < m_nAllocationCount && m_pArena->Resize( m_pMemory, m_nAllocationCount * sizeof( T ), numElements * sizeof( T ) ) )
+		{
+			m_nAllocationCount = numElements;
+		}
+	}
+
+	void Swap( CUtlMemoryFrameArena< T, I > &mem )
+	{
+		V_swap( m_pArena, mem.m_pArena );
+		V_swap( m_pMemory, mem.m_pMemory );
+		V_swap( m_nAllocationCount, mem.m_nAllocationCount );
+	}
+
+private:
+	CFrameArena *	m_pArena;
+	T *				m_pMemory;
+	int				m_nAllocationCount;
+};
+
+//-----------------------------------------------------------------------------
+// STL-style allocator on an arena, for containers that take one
+//-----------------------------------------------------------------------------
+template< class T >
+class CFrameArenaAllocator
+{
+public:
+	typedef T				value_type;
+	typedef T *				pointer;
+	typedef const T *		const_pointer;
+	typedef T &				reference;
+	typedef const T &		const_reference;
+	typedef size_t			size_type;
+	typedef ptrdiff_t		difference_type;
+
+	template< class U > struct rebind { typedef CFrameArenaAllocator< U > other; };
+
+	CFrameArenaAllocator() : m_pArena( CFrameArena::Get() ) {}
+	explicit CFrameArenaAllocator( CFrameArena *pArena ) : m_pArena( pArena ) {}
+	template< class U > CFrameArenaAllocator( const CFrameArenaAllocator< U > &other ) : m_pArena( other.GetArena() ) {}
+
+	CFrameArena *GetArena() const							{ return m_pArena; }
+
+	pointer address( reference x ) const					{ return &x; }
+	const_pointer address( const_reference x ) const		{ return &x; }
+
+	pointer allocate( size_type n, const void * = 0 )		{ return (pointer)m_pArena->Alloc( n * sizeof( T ) ); }
+	void deallocate( pointer p, size_type n )				{ m_pArena->Free( p, n * sizeof( T ) ); }
+	size_type max_size() const								{ return 0x7fffffff / sizeof( T ); }
+
+	void construct( pointer p, const T &val )				{ new ( (void *)p ) T( val ); }
+	void destroy( pointer p )								{ p->~T(); }
+
+	template< class U > bool operator==( const CFrameArenaAllocator< U > &other ) const { return m_pArena == other.GetArena(); }
+	template< class U > bool operator!=( const CFrameArenaAllocator< U > &other ) const { return m_pArena != other.GetArena(); }
+
+private:
+	CFrameArena *m_pArena;
+};
+
+#endif // FRAMEARENA_H
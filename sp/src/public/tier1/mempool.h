@@ -106,24 +106,51 @@ protected:
 
 
 //-----------------------------------------------------------------------------
-// 
+// Thread-safe pool. Each thread keeps a small magazine of free blocks for the
+// pool and refills or drains it in batches against a lock-free free list; the
+// mutex is only taken to carve new blocks out of the blobs. Blocks may be
+// freed on any thread.
 //-----------------------------------------------------------------------------
+struct MemoryPoolMTMagazine_t;
+
 class CMemoryPoolMT : public CUtlMemoryPool
 {
 public:
-	CMemoryPoolMT(int blockSize, int numElements, int growMode = UTLMEMORYPOOL_GROW_FAST, const char *pszAllocOwner = NULL) : CUtlMemoryPool( blockSize, numElements, growMode, pszAllocOwner) {}
-
+	CMemoryPoolMT(int blockSize, int numElements, int growMode = UTLMEMORYPOOL_GROW_FAST, const char *pszAllocOwner = NULL, int nAlignment = 0);
+	~CMemoryPoolMT();
 
-	void*		Alloc()	{ AUTO_LOCK( m_mutex ); return CUtlMemoryPool::Alloc(); }
-	void*		Alloc( size_t amount )	{ AUTO_LOCK( m_mutex ); return CUtlMemoryPool::Alloc( amount ); }
-	void*		AllocZero()	{ AUTO_LOCK( m_mutex ); return CUtlMemoryPool::AllocZero(); }	
-	void*		AllocZero( size_t amount )	{ AUTO_LOCK( m_mutex ); return CUtlMemoryPool::AllocZero( amount ); }
-	void		Free(void *pMem) { AUTO_LOCK( m_mutex ); CUtlMemoryPool::Free( pMem ); }
+	void*		Alloc();
+	void*		Alloc( size_t amount );
+	void*		AllocZero();
+	void*		AllocZero( size_t amount );
+	void		Free(void *pMem);
 
 	// Frees everything
-	void		Clear() { AUTO_LOCK( m_mutex ); return CUtlMemoryPool::Clear(); }
+	void		Clear();
+
+	// Blocks handed out and not yet freed. Other threads fold their counts in
+	// whenever they refill or drain a magazine, so they can lag by a batch.
+	int			Count();
+	int			PeakCount();
+
+	// Returns the calling thread's cached blocks and folds its counts.
+	// Worker threads that are about to exit should call this.
+	void		FlushThreadCache();
+
 private:
-	CThreadFastMutex m_mutex; // @TODO: Rework to use tslist (toml 7/6/2007)
+	MemoryPoolMTMagazine_t *GetMagazine();
+	void		RefillMagazine( MemoryPoolMTMagazine_t *pMagazine );
+	void		DrainMagazine( MemoryPoolMTMagazine_t *pMagazine, int nKeep );
+	void		FoldCounts( MemoryPoolMTMagazine_t *pMagazine );
+	void*		AllocFromBlobs();
+	void		NoteInUse( int nDelta );
+
+	CTSListBase			m_FreeList;		// free blocks shared by all threads
+	CThreadFastMutex	m_mutex;		// guards the blobs and free list in CUtlMemoryPool
+	volatile int		m_nInUse;
+	volatile int		m_nPeakInUse;
+	int					m_nSerial;		// changes on Clear() so cached blocks are dropped
+	int					m_iCacheSlot;	// this pool's magazine in each thread, or -1 if none
 };
 
 
@@ -10,3 +10,8 @@ bool CheckSSETechnology(void);
 bool CheckSSE2Technology(void);
 bool Check3DNowTechnology(void);
 
+
+// These also check that the OS saves the YMM registers across context switches
+bool CheckAVXTechnology(void);
+bool CheckAVX2Technology(void);
+bool CheckFMA3Technology(void);
@@ -14,6 +14,7 @@
 
 #include "utlrbtree.h"
 #include "utlvector.h"
+#include "utlsymbol.h"
 
 //-----------------------------------------------------------------------------
 // Purpose: Allocates memory for strings, checking for duplicates first,
@@ -35,9 +36,8 @@ public:
 	const char * Find( const char *pszValue );
 
 protected:
-	typedef CUtlRBTree<const char *, unsigned short> CStrSet;
-
-	CStrSet m_Strings;
+	// Case insensitive; string data lives in the table's blocks
+	CUtlSymbolHashTable m_Strings;
 };
 
 //-----------------------------------------------------------------------------
@@ -78,6 +78,75 @@ protected:
 };
 
 
+//-----------------------------------------------------------------------------
+// CUtlSymbolHashTable:
+// description:
+//    Open-addressing hash from strings to dense ids, optionally case folded.
+//    The hash of every string is kept in its slot so probes only compare
+//    strings on a full hash match. String data is copied into blocks that
+//    never move. Find() and String() can run on any number of threads while
+//    one thread inserts; callers serialize inserts among themselves.
+//-----------------------------------------------------------------------------
+class CUtlSymbolHashTable
+{
+public:
+	CUtlSymbolHashTable( int initSize = 32, bool caseInsensitive = false );
+	~CUtlSymbolHashTable();
+
+	unsigned int Hash( const char *pString ) const;
+
+	// Returns the id for pString, or -1 if it's not in the table
+	int Find( const char *pString ) const					{ return Find( pString, Hash( pString ) ); }
+	int Find( const char *pString, unsigned int nHash ) const;
+
+	// Finds or adds pString. Returns -1 if the table already holds nMaxCount strings.
+	int Insert( const char *pString, int nMaxCount = 0x7fffffff );
+
+	const char *String( int id ) const
+	{
+		Assert( id >= 0 && id < m_nCount );
+		return m_ppStrings[id];
+	}
+
+	int Count() const										{ return m_nCount; }
+	bool IsCaseInsensitive() const							{ return m_bInsensitive; }
+
+	// Not safe against concurrent Find()
+	void RemoveAll();
+
+private:
+	struct Slot_t
+	{
+		volatile unsigned int	m_nHash;	// 0 if the slot is empty
+		volatile int			m_nId;
+	};
+
+	struct Table_t
+	{
+		int		m_nMask;
+		Slot_t	m_Slots[1];
+	};
+
+	const char *AllocString( const char *pString );
+	void GrowTable();
+	void GrowStrings();
+	static Table_t *AllocTable( int nSize );
+	static void InsertSlot( Table_t *pTable, unsigned int nHash, int id );
+
+	Table_t * volatile		m_pTable;
+	const char ** volatile	m_ppStrings;
+	volatile int			m_nCount;
+	int						m_nStringsAllocated;
+	int						m_nInitSize;
+	bool					m_bInsensitive;
+
+	char *					m_pBlockCur;
+	int						m_nBlockLeft;
+	CUtlVector<void *>		m_StringBlocks;
+	CUtlVector<void *>		m_Retired;		// old tables and arrays a reader may still hold
+};
+
+
 //-----------------------------------------------------------------------------
 // CUtlSymbolTable:
 // description:
@@ -108,67 +177,11 @@ public:
 
 	int GetNumStrings( void ) const
 	{
-		return m_Lookup.Count();
+		return m_Table.Count();
 	}
 
 protected:
-	class CStringPoolIndex
-	{
-	public:
-		inline CStringPoolIndex()
-		{
-		}
-
-		inline CStringPoolIndex( unsigned short iPool, unsigned short iOffset )
-		{
-			m_iPool = iPool;
-			m_iOffset = iOffset;
-		}
-
-		inline bool operator==( const CStringPoolIndex &other )	const
-		{
-			return m_iPool == other.m_iPool && m_iOffset == other.m_iOffset;
-		}
-
-		unsigned short m_iPool;		// Index into m_StringPools.
-		unsigned short m_iOffset;	// Index into the string pool.
-	};
-
-	class CLess
-	{
-	public:
-		CLess( int ignored = 0 ) {} // permits default initialization to NULL in CUtlRBTree
-		bool operator!() const { return false; }
-		bool operator()( const CStringPoolIndex &left, const CStringPoolIndex &right ) const;
-	};
-
-	// Stores the symbol lookup
-	class CTree : public CUtlRBTree<CStringPoolIndex, unsigned short, CLess>
-	{
-	public:
-		CTree(  int growSize, int initSize ) : CUtlRBTree<CStringPoolIndex, unsigned short, CLess>( growSize, initSize ) {}
-		friend class CUtlSymbolTable::CLess; // Needed to allow CLess to calculate pointer to symbol table
-	};
-
-	struct StringPool_t
-	{	
-		int m_TotalLen;		// How large is 
-		int m_SpaceUsed;
-		char m_Data[1];
-	};
-
-	CTree m_Lookup;
-	bool m_bInsensitive;
-	mutable const char* m_pUserSearchString;
-
-	// stores the string data
-	CUtlVector<StringPool_t*> m_StringPools;
-
-private:
-	int FindPoolWithSpace( int len ) const;
-	const char* StringFromIndex( const CStringPoolIndex &index ) const;
-
-	friend class CLess;
+	CUtlSymbolHashTable m_Table;
 };
 
 class CUtlSymbolTableMT : private CUtlSymbolTable
@@ -181,34 +194,33 @@ public:
 
 	CUtlSymbol AddString( const char* pString )
 	{
-		m_lock.LockForWrite();
-		CUtlSymbol result = CUtlSymbolTable::AddString( pString );
-		m_lock.UnlockWrite();
-		return result;
+		// Most strings are already there, so look without the lock first
+		CUtlSymbol result = CUtlSymbolTable::Find( pString );
+		if ( result.IsValid() || !pString )
+			return result;
+
+		AUTO_LOCK( m_mutex );
+		return CUtlSymbolTable::AddString( pString );
 	}
 
+	// Lock free, safe while another thread adds strings
 	CUtlSymbol Find( const char* pString ) const
 	{
-		m_lock.LockForRead();
-		CUtlSymbol result = CUtlSymbolTable::Find( pString );
-		m_lock.UnlockRead();
-		return result;
+		return CUtlSymbolTable::Find( pString );
 	}
 
 	const char* String( CUtlSymbol id ) const
 	{
-		m_lock.LockForRead();
-		const char *pszResult = CUtlSymbolTable::String( id );
-		m_lock.UnlockRead();
-		return pszResult;
+		return CUtlSymbolTable::String( id );
+	}
+
+	int GetNumStrings( void ) const
+	{
+		return CUtlSymbolTable::GetNumStrings();
 	}
 	
 private:
-#if defined(WIN32) || defined(_WIN32)
-	mutable CThreadSpinRWLock m_lock;
-#else
-	mutable CThreadRWLock m_lock;
-#endif
+	CThreadFastMutex m_mutex;	// serializes writers only
 };
 
 
@@ -26,6 +26,8 @@
 #include "utlvector.h"
 #include "utlbuffer.h"
 #include "utlhash.h"
+#include "utlsymbol.h"
+#include "checksum_crc.h"
 #include "UtlSortVector.h"
 #include "convar.h"
 
@@ -211,97 +213,40 @@ static CLeakTrack track;
 
 //-----------------------------------------------------------------------------
 // Purpose: An arbitrarily growable string table for KeyValues key names. 
-//	See the comment in the header for more info.
+//	See the comment in the header for more info. Lookups of existing names
+//	don't lock, so parsing on worker threads doesn't contend.
 //-----------------------------------------------------------------------------
 class CKeyValuesGrowableStringTable
 {
 public: 
 	// Constructor
-	CKeyValuesGrowableStringTable() :
-		#ifdef PLATFORM_64BITS
-			m_vecStrings( 0, 4 * 512 * 1024 )
-		#else
-			m_vecStrings( 0, 512 * 1024 )
-		#endif
-		, m_hashLookup( 2048, 0, 0, m_Functor, m_Functor )
+	CKeyValuesGrowableStringTable() : m_Table( 2048, true )
 	{
-		m_vecStrings.AddToTail( '\0' );
 	}
 
 	// Translates a string to an index
 	int GetSymbolForString( const char *name, bool bCreate = true )
 	{
-		AUTO_LOCK( m_mutex );
-
-		// Put the current details into our hash functor
-		m_Functor.SetCurString( name );
-		m_Functor.SetCurStringBase( (const char *)m_vecStrings.Base() );
-
-		if ( bCreate )
-		{
-			bool bInserted = false;
-			UtlHashHandle_t hElement = m_hashLookup.Insert( -1, &bInserted );
-			if ( bInserted )
-			{
-				int iIndex = m_vecStrings.AddMultipleToTail( V_strlen( name ) + 1, name );
-				m_hashLookup[ hElement ] = iIndex;
-			}
+		unsigned int nHash = m_Table.Hash( name );
+		int iSymbol = m_Table.Find( name, nHash );
+		if ( iSymbol != -1 || !bCreate )
+			return iSymbol;
 
-			return m_hashLookup[ hElement ];
-		}
-		else
-		{
-			UtlHashHandle_t hElement = m_hashLookup.Find( -1 );
-			if ( m_hashLookup.IsValidHandle( hElement ) )
-				return m_hashLookup[ hElement ];
-			else
-				return -1;
-		}
+		AUTO_LOCK( m_mutex );
+		return m_Table.Insert( name );
 	}
 
 	// Translates an index back to a string
 	const char *GetStringForSymbol( int symbol )
 	{
-		return (const char *)m_vecStrings.Base() + symbol;
+		if ( symbol < 0 || symbol >= m_Table.Count() )
+			return "";
+		return m_Table.String( symbol );
 	}
 
 private:
-	
-	// A class plugged into CUtlHash that allows us to change the behavior of the table
-	// and store only the index in the table.
-	class CLookupFunctor
-	{
-	public:
-		CLookupFunctor() : m_pchCurString( NULL ), m_pchCurBase( NULL ) {}
-
-		// Sets what we are currently inserting or looking for.
-		void SetCurString( const char *pchCurString ) { m_pchCurString = pchCurString; }
-		void SetCurStringBase( const char *pchCurBase ) { m_pchCurBase = pchCurBase; }
-
-		// The compare function.
-		bool operator()( int nLhs, int nRhs ) const
-		{
-			const char *pchLhs = nLhs > 0 ? m_pchCurBase + nLhs : m_pchCurString;
-			const char *pchRhs = nRhs > 0 ? m_pchCurBase + nRhs : m_pchCurString;
-			
-			return ( 0 == V_stricmp( pchLhs, pchRhs ) );
-		}
-
-		// The hash function.
-		unsigned int operator()( int nItem ) const
-		{
-			return HashStringCaseless( m_pchCurString );
-		}
-
-	private:
-		const char *m_pchCurString;
-		const char *m_pchCurBase;
-	};
-
-	CThreadFastMutex m_mutex;
-	CLookupFunctor	m_Functor;
-	CUtlHash<int, CLookupFunctor &, CLookupFunctor &> m_hashLookup;
-	CUtlVector<char> m_vecStrings;
+	CThreadFastMutex m_mutex;		// serializes inserts only
+	CUtlSymbolHashTable m_Table;
 };
 
 
@@ -449,8 +394,7 @@ void KeyValues::Init()
 	m_bHasEscapeSequences = false;
 	m_bEvaluateConditionals = true;
 
-	// for future proof
-	memset( unused, 0, sizeof(unused) );
+	m_iAllocFlags = 0;
 }
 
 //-----------------------------------------------------------------------------
@@ -474,22 +418,53 @@ void KeyValues::RemoveEverything()
 	{
 		datNext = dat->m_pPeer;
 		dat->m_pPeer = NULL;
-		delete dat;
+		DestroyKey( dat );
 	}
 
 	for ( dat = m_pPeer; dat && dat != this; dat = datNext )
 	{
 		datNext = dat->m_pPeer;
 		dat->m_pPeer = NULL;
-		delete dat;
+		DestroyKey( dat );
 	}
 
-	delete [] m_sValue;
-	m_sValue = NULL;
+	FreeStringValue();
 	delete [] m_wsValue;
 	m_wsValue = NULL;
 }
 
+//-----------------------------------------------------------------------------
+// Purpose: Frees the string value, unless it's borrowed from a document
+//-----------------------------------------------------------------------------
+void KeyValues::FreeStringValue()
+{
+	if ( !( m_iAllocFlags & KV_ALLOC_BORROWED_STRING ) )
+	{
+		delete [] m_sValue;
+	}
+	m_sValue = NULL;
+	m_iAllocFlags &= ~KV_ALLOC_BORROWED_STRING;
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Destroys a key. Keys that live in a CKeyValuesDocument only have
+//			their destructor run; the document releases their memory.
+//-----------------------------------------------------------------------------
+void KeyValues::DestroyKey( KeyValues *pKey )
+{
+	if ( !pKey )
+		return;
+
+	if ( pKey->m_iAllocFlags & KV_ALLOC_DOCUMENT_NODE )
+	{
+		pKey->~KeyValues();
+	}
+	else
+	{
+		delete pKey;
+	}
+}
+
 //-----------------------------------------------------------------------------
 // Purpose: 
 // Input  : *f - 
@@ -1507,7 +1482,7 @@ void KeyValues::SetColor( const char *keyName, Color value)
 void KeyValues::SetStringValue( char const *strValue )
 {
 	// delete the old value
-	delete [] m_sValue;
+	FreeStringValue();
 	// make sure we're not storing the WSTRING  - as we're converting over to STRING
 	delete [] m_wsValue;
 	m_wsValue = NULL;
@@ -1541,7 +1516,7 @@ void KeyValues::SetString( const char *keyName, const char *value )
 		}
 
 		// delete the old value
-		delete [] dat->m_sValue;
+		dat->FreeStringValue();
 		// make sure we're not storing the WSTRING  - as we're converting over to STRING
 		delete [] dat->m_wsValue;
 		dat->m_wsValue = NULL;
@@ -1572,8 +1547,7 @@ void KeyValues::SetWString( const char *keyName, const wchar_t *value )
 		// delete the old value
 		delete [] dat->m_wsValue;
 		// make sure we're not storing the STRING  - as we're converting over to WSTRING
-		delete [] dat->m_sValue;
-		dat->m_sValue = NULL;
+		dat->FreeStringValue();
 
 		if (!value)
 		{
@@ -1614,7 +1588,7 @@ void KeyValues::SetUint64( const char *keyName, uint64 value )
 	if ( dat )
 	{
 		// delete the old value
-		delete [] dat->m_sValue;
+		dat->FreeStringValue();
 		// make sure we're not storing the WSTRING  - as we're converting over to STRING
 		delete [] dat->m_wsValue;
 		dat->m_wsValue = NULL;
@@ -1764,8 +1738,10 @@ void KeyValues::RecursiveCopyKeyValues( KeyValues& src )
 
 KeyValues& KeyValues::operator=( KeyValues& src )
 {
+	char iAllocFlags = m_iAllocFlags & KV_ALLOC_DOCUMENT_NODE;
 	RemoveEverything();
 	Init();	// reset all values
+	m_iAllocFlags = iAllocFlags;
 	RecursiveCopyKeyValues( src );
 	return *this;
 }
@@ -1886,7 +1862,7 @@ bool KeyValues::IsEmpty(const char *keyName)
 //-----------------------------------------------------------------------------
 void KeyValues::Clear( void )
 {
-	delete m_pSub;
+	DestroyKey( m_pSub );
 	m_pSub = NULL;
 	m_iDataType = TYPE_NONE;
 }
@@ -1908,7 +1884,7 @@ KeyValues::types_t KeyValues::GetDataType(const char *keyName)
 //-----------------------------------------------------------------------------
 void KeyValues::deleteThis()
 {
-	delete this;
+	DestroyKey( this );
 }
 
 //-----------------------------------------------------------------------------
@@ -2245,6 +2221,62 @@ bool KeyValues::LoadFromBuffer( char const *resourceName, const char *pBuffer, I
 	return LoadFromBuffer( resourceName, buf, pFileSystem, pPathID );
 }
 
+//-----------------------------------------------------------------------------
+// Purpose: Determines whether a value token is an int, float, uint64 or string
+//-----------------------------------------------------------------------------
+KeyValues::types_t KeyValues::ParseValueToken( const char *value, int len, int &ival, float &fval, uint64 &ullval )
+{
+	// Here, let's determine if we got a float or an int....
+	char* pIEnd;	// pos where int scan ended
+	char* pFEnd;	// pos where float scan ended
+	const char* pSEnd = value + len ; // pos where token ends
+
+	ival = strtol( value, &pIEnd, 10 );
+	fval = (float)strtod( value, &pFEnd );
+	bool bOverflow = ( ival == LONG_MAX || ival == LONG_MIN ) && errno == ERANGE;
+#ifdef POSIX
+	// strtod supports hex representation in strings under posix but we DON'T
+	// want that support in keyvalues, so undo it here if needed
+	if ( len > 1 &&  tolower(value[1]) == 'x' )
+	{
+		fval = 0.0f;
+		pFEnd = (char *)value;
+	}
+#endif
+		
+	if ( *value == 0 )
+	{
+		return TYPE_STRING;	
+	}
+	else if ( ( 18 == len ) && ( value[0] == '0' ) && ( value[1] == 'x' ) )
+	{
+		// an 18-byte value prefixed with "0x" (followed by 16 hex digits) is an int64 value
+		int64 retVal = 0;
+		for( int i=2; i < 2 + 16; i++ )
+		{
+			char digit = value[i];
+			if ( digit >= 'a' ) 
+				digit -= 'a' - ( '9' + 1 );
+			else
+				if ( digit >= 'A' )
+					digit -= 'A' - ( '9' + 1 );
+			retVal = ( retVal * 16 ) + ( digit - '0' );
+		}
+		ullval = retVal;
+		return TYPE_UINT64;
+	}
+	else if ( (pFEnd > pIEnd) && (pFEnd == pSEnd) )
+	{
+		return TYPE_FLOAT;
+	}
+	else if (pIEnd == pSEnd && !bOverflow)
+	{
+		return TYPE_INT;
+	}
+
+	return TYPE_STRING;
+}
+
 //-----------------------------------------------------------------------------
 // Purpose: 
 //-----------------------------------------------------------------------------
@@ -2328,74 +2360,34 @@ void KeyValues::RecursiveLoadFromBuffer( char const *resourceName, CUtlBuffer &b
 				break;
 			}
 			
-			if (dat->m_sValue)
-			{
-				delete[] dat->m_sValue;
-				dat->m_sValue = NULL;
-			}
+			dat->FreeStringValue();
 
 			int len = Q_strlen( value );
+			int ival;
+			float fval;
+			uint64 ullval;
+			dat->m_iDataType = ParseValueToken( value, len, ival, fval, ullval );
 
-			// Here, let's determine if we got a float or an int....
-			char* pIEnd;	// pos where int scan ended
-			char* pFEnd;	// pos where float scan ended
-			const char* pSEnd = value + len ; // pos where token ends
-
-			int ival = strtol( value, &pIEnd, 10 );
-			float fval = (float)strtod( value, &pFEnd );
-			bool bOverflow = ( ival == LONG_MAX || ival == LONG_MIN ) && errno == ERANGE;
-#ifdef POSIX
-			// strtod supports hex representation in strings under posix but we DON'T
-			// want that support in keyvalues, so undo it here if needed
-			if ( len > 1 &&  tolower(value[1]) == 'x' )
-			{
-				fval = 0.0f;
-				pFEnd = (char *)value;
-			}
-#endif
-				
-			if ( *value == 0 )
+			switch ( dat->m_iDataType )
 			{
-				dat->m_iDataType = TYPE_STRING;	
-			}
-			else if ( ( 18 == len ) && ( value[0] == '0' ) && ( value[1] == 'x' ) )
-			{
-				// an 18-byte value prefixed with "0x" (followed by 16 hex digits) is an int64 value
-				int64 retVal = 0;
-				for( int i=2; i < 2 + 16; i++ )
-				{
-					char digit = value[i];
-					if ( digit >= 'a' ) 
-						digit -= 'a' - ( '9' + 1 );
-					else
-						if ( digit >= 'A' )
-							digit -= 'A' - ( '9' + 1 );
-					retVal = ( retVal * 16 ) + ( digit - '0' );
-				}
+			case TYPE_UINT64:
 				dat->m_sValue = new char[sizeof(uint64)];
-				*((uint64 *)dat->m_sValue) = retVal;
-				dat->m_iDataType = TYPE_UINT64;
-			}
-			else if ( (pFEnd > pIEnd) && (pFEnd == pSEnd) )
-			{
+				*((uint64 *)dat->m_sValue) = ullval;
+				break;
+
+			case TYPE_FLOAT:
 				dat->m_flValue = fval; 
-				dat->m_iDataType = TYPE_FLOAT;
-			}
-			else if (pIEnd == pSEnd && !bOverflow)
-			{
+				break;
+
+			case TYPE_INT:
 				dat->m_iValue = ival; 
-				dat->m_iDataType = TYPE_INT;
-			}
-			else
-			{
-				dat->m_iDataType = TYPE_STRING;
-			}
+				break;
 
-			if (dat->m_iDataType == TYPE_STRING)
-			{
+			default:
 				// copy in the string information
 				dat->m_sValue = new char[len+1];
 				Q_memcpy( dat->m_sValue, value, len+1 );
+				break;
 			}
 
 			// Look ahead one token for a conditional tag
@@ -2464,7 +2456,15 @@ bool KeyValues::WriteAsBinary( CUtlBuffer &buffer )
 		{
 		case TYPE_NONE:
 			{
-				dat->m_pSub->WriteAsBinary( buffer );
+				if ( dat->m_pSub )
+				{
+					dat->m_pSub->WriteAsBinary( buffer );
+				}
+				else
+				{
+					// empty section
+					buffer.PutUnsignedChar( TYPE_NUMTYPES );
+				}
 				break;
 			}
 		case TYPE_STRING:
@@ -2535,8 +2535,10 @@ bool KeyValues::ReadAsBinary( CUtlBuffer &buffer, int nStackDepth )
 	if ( !buffer.IsValid() ) // must be valid, no overflows etc
 		return false;
 
+	char iAllocFlags = m_iAllocFlags & KV_ALLOC_DOCUMENT_NODE;
 	RemoveEverything(); // remove current content
 	Init();	// reset
+	m_iAllocFlags = iAllocFlags;
 	
 	if ( nStackDepth > 100 )
 	{
@@ -2566,6 +2568,13 @@ bool KeyValues::ReadAsBinary( CUtlBuffer &buffer, int nStackDepth )
 		{
 		case TYPE_NONE:
 			{
+				// an empty section is just the end marker
+				const unsigned char *pNext = (const unsigned char *)buffer.PeekGet( sizeof(unsigned char), 0 );
+				if ( pNext && *pNext == TYPE_NUMTYPES )
+				{
+					buffer.GetUnsignedChar();
+					break;
+				}
 				dat->m_pSub = new KeyValues("");
 				dat->m_pSub->ReadAsBinary( buffer, nStackDepth + 1 );
 				break;
@@ -3026,4 +3035,849 @@ bool CKeyValuesDumpContextAsDevMsg::KvWriteText( char const *szText )
 		Msg( "%s", szText );
 	}
 	return true;
-}
\ No newline at end of file
+}
+
+
+//-----------------------------------------------------------------------------
+// CKeyValuesDocument
+//-----------------------------------------------------------------------------
+
+#define KEYVALUES_DOCUMENT_BLOCK_SIZE		( 16 * 1024 )
+#define KEYVALUES_DOCUMENT_MAX_FIRST_BLOCK	( 1024 * 1024 )
+
+#define KEYVALUES_CACHE_PATH_ID		"DEFAULT_WRITE_PATH"
+#define KEYVALUES_CACHE_MAGIC		MAKEID( 'K', 'V', 'B', 'C' )
+#define KEYVALUES_CACHE_VERSION		1
+
+// KeyValuesCacheHeader_t::m_nFlags
+#define KVCACHE_ESCAPE_SEQUENCES	0x01
+#define KVCACHE_CONDITIONALS		0x02
+#define KVCACHE_PLATFORM_WINDOWS	0x04
+#define KVCACHE_PLATFORM_OSX		0x08
+#define KVCACHE_PLATFORM_LINUX		0x10
+#define KVCACHE_PLATFORM_X360		0x20
+
+// Precedes the WriteAsBinary() stream in a cache file
+struct KeyValuesCacheHeader_t
+{
+	int			m_nMagic;
+	int			m_nVersion;
+	CRC32_t		m_nSourceCRC;		// of the text the tree was parsed from
+	int			m_nSourceSize;
+	int			m_nFlags;			// parse options and platform, which conditionals depend on
+	int			m_nNodes;			// upper bound, for sizing the node block
+	int			m_nDataSize;		// bytes following the header
+};
+
+//-----------------------------------------------------------------------------
+// Purpose: Constructor, destructor
+//-----------------------------------------------------------------------------
+CKeyValuesDocument::CKeyValuesDocument()
+{
+	m_pRoot = NULL;
+	m_pSource = NULL;
+	m_nSourceSize = 0;
+	m_pParse = NULL;
+	m_pParseEnd = NULL;
+	m_pPeekToken = NULL;
+	m_bPeekQuoted = false;
+	m_bPeekConditional = false;
+	m_bHavePeek = false;
+	m_pBlockCur = NULL;
+	m_nBlockFree = 0;
+	m_nAllocated = 0;
+	m_nNodes = 0;
+	m_bUsesEscapeSequences = false;
+	m_bEvaluateConditionals = true;
+	m_bLoadedFromCache = false;
+}
+
+CKeyValuesDocument::~CKeyValuesDocument()
+{
+	Purge();
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Releases the tree and its storage
+//-----------------------------------------------------------------------------
+void CKeyValuesDocument::FreeTree()
+{
+	// Runs every node's destructor, which frees anything edits put on the heap
+	KeyValues::DestroyKey( m_pRoot );
+	m_pRoot = NULL;
+
+	for ( int i = 0; i < m_Blocks.Count(); i++ )
+	{
+		free( m_Blocks[i] );
+	}
+	m_Blocks.Purge();
+	m_pBlockCur = NULL;
+	m_nBlockFree = 0;
+	m_nAllocated = 0;
+	m_nNodes = 0;
+}
+
+void CKeyValuesDocument::Purge()
+{
+	FreeTree();
+
+	free( m_pSource );
+	m_pSource = NULL;
+	m_nSourceSize = 0;
+	m_pParse = NULL;
+	m_pParseEnd = NULL;
+	m_bHavePeek = false;
+	m_bLoadedFromCache = false;
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Bytes held for the text or cache image and the node blocks.
+//			Key names live in the KeyValues symbol table and aren't counted.
+//-----------------------------------------------------------------------------
+int CKeyValuesDocument::GetMemoryUsed() const
+{
+	return m_nSourceSize + m_nAllocated;
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Bump allocation out of the document's blocks
+//-----------------------------------------------------------------------------
+void CKeyValuesDocument::NewBlock( int nBytes )
+{
+	char *pBlock = (char *)malloc( nBytes );
+	m_Blocks.AddToTail( pBlock );
+	m_pBlockCur = pBlock;
+	m_nBlockFree = nBytes;
+	m_nAllocated += nBytes;
+}
+
+void *CKeyValuesDocument::Alloc( int nBytes )
+{
+	nBytes = AlignValue( nBytes, 8 );
+	if ( nBytes > m_nBlockFree )
+	{
+		NewBlock( MAX( nBytes, KEYVALUES_DOCUMENT_BLOCK_SIZE ) );
+	}
+
+	void *pMem = m_pBlockCur;
+	m_pBlockCur += nBytes;
+	m_nBlockFree -= nBytes;
+	return pMem;
+}
+
+KeyValues *CKeyValuesDocument::AllocKey( const char *pszName )
+{
+	// KeyValues' own operator new would take it from the KeyValues heap
+	KeyValues *pKey = ::new ( Alloc( sizeof( KeyValues ) ) ) KeyValues( pszName );
+	pKey->m_iAllocFlags = KeyValues::KV_ALLOC_DOCUMENT_NODE;
+	pKey->m_bHasEscapeSequences = m_bUsesEscapeSequences;
+	pKey->m_bEvaluateConditionals = m_bEvaluateConditionals;
+	m_nNodes++;
+	return pKey;
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Load and parse a file
+//-----------------------------------------------------------------------------
+bool CKeyValuesDocument::LoadFromFile( IBaseFileSystem *filesystem, const char *resourceName, const char *pathID )
+{
+	return LoadFile( filesystem, resourceName, pathID, NULL );
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Load a file's cached image if the text hasn't changed since the
+//			cache was written, otherwise parse it and write the cache
+//-----------------------------------------------------------------------------
+bool CKeyValuesDocument::LoadFromFileCached( IFileSystem *filesystem, const char *resourceName, const char *pathID )
+{
+	return LoadFile( filesystem, resourceName, pathID, filesystem );
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Caches through pCacheFileSystem unless it's NULL
+//-----------------------------------------------------------------------------
+bool CKeyValuesDocument::LoadFile( IBaseFileSystem *filesystem, const char *resourceName, const char *pathID, IFileSystem *pCacheFileSystem )
+{
+	Assert( filesystem );
+	Purge();
+
+	FileHandle_t f = filesystem->Open( resourceName, "rb", pathID );
+	if ( !f )
+		return false;
+
+	s_LastFileLoadingFrom = (char*)resourceName;
+
+	// load file into a null-terminated buffer, which the tree will point into
+	int fileSize = filesystem->Size( f );
+	m_pSource = (char *)malloc( fileSize + 2 );
+	bool bRetOK = ( filesystem->Read( m_pSource, fileSize, f ) == fileSize );
+
+	filesystem->Close( f );	// close file after reading
+
+	if ( !bRetOK )
+	{
+		Purge();
+		return false;
+	}
+
+	m_pSource[fileSize] = 0; // null terminate file as EOF
+	m_pSource[fileSize+1] = 0; // double NULL terminating in case this is a unicode file
+	m_nSourceSize = fileSize;
+
+	// The cache mirrors the source's relative path
+	bool bUseCache = pCacheFileSystem && !V_IsAbsolutePath( resourceName ) && !V_strstr( resourceName, ".." );
+
+	char szCacheName[MAX_PATH];
+	CRC32_t nSourceCRC = 0;
+	if ( bUseCache )
+	{
+		V_snprintf( szCacheName, sizeof( szCacheName ), "kvcache/%s.kvb", resourceName );
+		V_FixSlashes( szCacheName );
+
+		// Checked before parsing, which terminates tokens in the text
+		nSourceCRC = CRC32_ProcessSingleBuffer( m_pSource, fileSize );
+		if ( LoadCache( filesystem, szCacheName, nSourceCRC, fileSize ) )
+			return true;
+	}
+
+	if ( ParseSource( resourceName ) == PARSE_NEEDS_CLASSIC )
+		return LoadClassic( filesystem, resourceName, pathID, NULL );
+
+	if ( bUseCache )
+	{
+		WriteCache( pCacheFileSystem, szCacheName, nSourceCRC, fileSize );
+	}
+	return true;
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Parse a copy of a text buffer
+//-----------------------------------------------------------------------------
+bool CKeyValuesDocument::LoadFromBuffer( char const *resourceName, const char *pBuffer, IBaseFileSystem *pFileSystem, const char *pPathID )
+{
+	Purge();
+
+	if ( !pBuffer )
+	{
+		pBuffer = "";
+	}
+
+	int nLen = Q_strlen( pBuffer );
+	m_pSource = (char *)malloc( nLen + 1 );
+	Q_memcpy( m_pSource, pBuffer, nLen + 1 );
+	m_nSourceSize = nLen;
+
+	if ( ParseSource( resourceName ) == PARSE_NEEDS_CLASSIC )
+		return LoadClassic( pFileSystem, resourceName, pPathID, pBuffer );
+
+	return true;
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Hands the file to the regular parser, for the cases where the
+//			result depends on more than this file's text
+//-----------------------------------------------------------------------------
+bool CKeyValuesDocument::LoadClassic( IBaseFileSystem *filesystem, const char *resourceName, const char *pathID, const char *pBuffer )
+{
+	Purge();
+
+	m_pRoot = new KeyValues( resourceName );
+	m_pRoot->UsesEscapeSequences( m_bUsesEscapeSequences );
+	m_pRoot->UsesConditionals( m_bEvaluateConditionals );
+
+	bool bRetOK = pBuffer ? m_pRoot->LoadFromBuffer( resourceName, pBuffer, filesystem, pathID ) : m_pRoot->LoadFromFile( filesystem, resourceName, pathID );
+	if ( !bRetOK )
+	{
+		Purge();
+	}
+	return bRetOK;
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Read a single token, terminating it in the text where possible.
+//			Follows the same rules as KeyValues::ReadToken().
+//-----------------------------------------------------------------------------
+const char *CKeyValuesDocument::ReadToken( bool &wasQuoted, bool &wasConditional )
+{
+	if ( m_bHavePeek )
+	{
+		m_bHavePeek = false;
+		wasQuoted = m_bPeekQuoted;
+		wasConditional = m_bPeekConditional;
+		return m_pPeekToken;
+	}
+
+	wasQuoted = false;
+	wasConditional = false;
+
+	char *p = m_pParse;
+
+	// eating white spaces and remarks loop
+	while ( true )
+	{
+		while ( p < m_pParseEnd && isspace( *(unsigned char *)p ) )
+		{
+			p++;
+		}
+
+		if ( p >= m_pParseEnd )
+		{
+			m_pParse = p;
+			return NULL;	// file ends after reading whitespaces
+		}
+
+		// stop if it's not a comment; a new token starts here
+		if ( p[0] != '/' || p + 1 >= m_pParseEnd || p[1] != '/' )
+			break;
+
+		// skip the rest of the line
+		p += 2;
+		while ( p < m_pParseEnd && *p++ != '\n' )
+			;
+	}
+
+	// read quoted strings specially
+	if ( *p == '\"' )
+	{
+		wasQuoted = true;
+		char *pStart = ++p;
+		char *pOut;
+		if ( m_bUsesEscapeSequences )
+		{
+			// Escapes only ever shorten the token, so it's unescaped where it lies
+			CUtlCharConversion *pConv = GetCStringCharConversion();
+			pOut = p;
+			while ( p < m_pParseEnd && *p != '\"' )
+			{
+				char c = *p++;
+				if ( c == pConv->GetEscapeChar() )
+				{
+					int nLength = 0;
+					c = ( p < m_pParseEnd ) ? pConv->FindConversion( p, &nLength ) : '\0';
+					p += nLength;
+				}
+				*pOut++ = c;
+			}
+		}
+		else
+		{
+			while ( p < m_pParseEnd && *p != '\"' )
+			{
+				p++;
+			}
+			pOut = p;
+		}
+
+		// step over the closing quote
+		m_pParse = ( p < m_pParseEnd ) ? p + 1 : p;
+		return TerminateToken( pStart, pOut );
+	}
+
+	if ( *p == '{' || *p == '}' )
+	{
+		// it's a control char, just return this one char and stop reading
+		m_pParse = p + 1;
+		return ( *p == '{' ) ? "{" : "}";
+	}
+
+	// read in the token until we hit a whitespace or a control character
+	char *pStart = p;
+	bool bConditionalStart = false;
+	while ( p < m_pParseEnd )
+	{
+		// break if any control character appears in non quoted tokens
+		if ( *p == '"' || *p == '{' || *p == '}' )
+			break;
+
+		if ( *p == '[' )
+			bConditionalStart = true;
+
+		if ( *p == ']' && bConditionalStart )
+		{
+			wasConditional = true;
+		}
+
+		// break on whitespace
+		if ( isspace( *(unsigned char *)p ) )
+			break;
+
+		p++;
+	}
+
+	if ( p - pStart > KEYVALUES_TOKEN_SIZE - 1 )
+	{
+		g_KeyValuesErrorStack.ReportError(" ReadToken overflow" );
+	}
+
+	if ( p < m_pParseEnd && !isspace( *(unsigned char *)p ) )
+	{
+		// The control character that ends the token is the next token, so
+		// this one has to be copied out rather than terminated in place
+		int nLength = MIN( p - pStart, KEYVALUES_TOKEN_SIZE - 1 );
+		char *pToken = (char *)Alloc( nLength + 1 );
+		Q_memcpy( pToken, pStart, nLength );
+		pToken[nLength] = 0;
+		m_pParse = p;
+		return pToken;
+	}
+
+	// the whitespace becomes the terminator
+	m_pParse = ( p < m_pParseEnd ) ? p + 1 : p;
+	return TerminateToken( pStart, p );
+}
+
+char *CKeyValuesDocument::TerminateToken( char *pStart, char *pEnd )
+{
+	// same limit as KeyValues::ReadToken
+	if ( pEnd - pStart > KEYVALUES_TOKEN_SIZE - 1 )
+	{
+		pEnd = pStart + KEYVALUES_TOKEN_SIZE - 1;
+	}
+	*pEnd = 0;
+	return pStart;
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Top level of the file; mirrors KeyValues::LoadFromBuffer()
+//-----------------------------------------------------------------------------
+CKeyValuesDocument::ParseResult_t CKeyValuesDocument::ParseSource( char const *resourceName )
+{
+	m_pParse = m_pSource;
+	m_pParseEnd = m_pSource + Q_strlen( m_pSource );
+	m_bHavePeek = false;
+
+	// Unicode files are translated by the regular parser
+	if ( m_pParseEnd - m_pParse > 2 && (uint8)m_pSource[0] == 0xFF && (uint8)m_pSource[1] == 0xFE )
+		return PARSE_NEEDS_CLASSIC;
+
+	// Most of the text becomes nodes, so start with a block about its size
+	NewBlock( clamp( m_nSourceSize, KEYVALUES_DOCUMENT_BLOCK_SIZE, KEYVALUES_DOCUMENT_MAX_FIRST_BLOCK ) );
+
+	m_pRoot = AllocKey( resourceName );
+
+	KeyValues *pPreviousKey = NULL;
+	KeyValues *pCurrentKey = m_pRoot;
+	bool wasQuoted;
+	bool wasConditional;
+	ParseResult_t result = PARSE_OK;
+	g_KeyValuesErrorStack.SetFilename( resourceName );
+	while ( true )
+	{
+		bool bAccepted = true;
+
+		// the first thing must be a key
+		const char *s = ReadToken( wasQuoted, wasConditional );
+		if ( !s || *s == 0 )
+			break;
+
+		// included files would make the tree depend on more than this text
+		if ( !Q_stricmp( s, "#include" ) || !Q_stricmp( s, "#base" ) )
+		{
+			result = PARSE_NEEDS_CLASSIC;
+			break;
+		}
+
+		if ( !pCurrentKey )
+		{
+			pCurrentKey = AllocKey( s );
+			if ( pPreviousKey )
+			{
+				pPreviousKey->SetNextKey( pCurrentKey );
+			}
+		}
+		else
+		{
+			pCurrentKey->SetName( s );
+		}
+
+		// get the '{'
+		s = ReadToken( wasQuoted, wasConditional );
+
+		if ( wasConditional )
+		{
+			bAccepted = !m_bEvaluateConditionals || EvaluateConditional( s );
+
+			// Now get the '{'
+			s = ReadToken( wasQuoted, wasConditional );
+		}
+
+		if ( s && *s == '{' && !wasQuoted )
+		{
+			// header is valid so load the file
+			ParseSection( pCurrentKey );
+		}
+		else
+		{
+			g_KeyValuesErrorStack.ReportError("LoadFromBuffer: missing {" );
+		}
+
+		if ( !bAccepted )
+		{
+			if ( pPreviousKey )
+			{
+				pPreviousKey->SetNextKey( NULL );
+			}
+			pCurrentKey->Clear();
+		}
+		else
+		{
+			pPreviousKey = pCurrentKey;
+			pCurrentKey = NULL;
+		}
+	}
+
+	g_KeyValuesErrorStack.SetFilename( "" );
+
+	return result;
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Mirrors KeyValues::RecursiveLoadFromBuffer(), except that nodes
+//			come from the document and string values stay in the text
+//-----------------------------------------------------------------------------
+void CKeyValuesDocument::ParseSection( KeyValues *pParent )
+{
+	CKeyErrorContext errorReport( pParent );
+	bool wasQuoted;
+	bool wasConditional;
+	// keep this out of the stack until a key is parsed
+	CKeyErrorContext errorKey( INVALID_KEY_SYMBOL );
+
+	// Sections are only parsed once, into new or cleared keys
+	Assert( !pParent->m_pSub );
+	KeyValues *pLastChild = NULL;
+
+	// Keep parsing until we hit the closing brace which terminates this block, or a parse error
+	while ( 1 )
+	{
+		bool bAccepted = true;
+
+		// get the key name
+		const char * name = ReadToken( wasQuoted, wasConditional );
+
+		if ( !name )	// EOF stop reading
+		{
+			g_KeyValuesErrorStack.ReportError("RecursiveLoadFromBuffer:  got EOF instead of keyname" );
+			break;
+		}
+
+		if ( !*name ) // empty token, maybe "" or EOF
+		{
+			g_KeyValuesErrorStack.ReportError("RecursiveLoadFromBuffer:  got empty keyname" );
+			break;
+		}
+
+		if ( *name == '}' && !wasQuoted )	// top level closed, stop reading
+			break;
+
+		KeyValues *dat = AllocKey( name );
+		pParent->AddSubkeyUsingKnownLastChild( dat, pLastChild );
+
+		errorKey.Reset( dat->GetNameSymbol() );
+
+		// get the value
+		const char * value = ReadToken( wasQuoted, wasConditional );
+
+		if ( wasConditional && value )
+		{
+			bAccepted = !m_bEvaluateConditionals || EvaluateConditional( value );
+
+			// get the real value
+			value = ReadToken( wasQuoted, wasConditional );
+		}
+
+		if ( !value )
+		{
+			g_KeyValuesErrorStack.ReportError("RecursiveLoadFromBuffer:  got NULL key" );
+			break;
+		}
+		
+		if ( *value == '}' && !wasQuoted )
+		{
+			g_KeyValuesErrorStack.ReportError("RecursiveLoadFromBuffer:  got } in key" );
+			break;
+		}
+
+		if ( *value == '{' && !wasQuoted )
+		{
+			// this isn't a key, it's a section
+			errorKey.Reset( INVALID_KEY_SYMBOL );
+			// sub value list
+			ParseSection( dat );
+		}
+		else 
+		{
+			if ( wasConditional )
+			{
+				g_KeyValuesErrorStack.ReportError("RecursiveLoadFromBuffer:  got conditional between key and value" );
+				break;
+			}
+
+			int ival;
+			float fval;
+			uint64 ullval;
+			dat->m_iDataType = KeyValues::ParseValueToken( value, Q_strlen( value ), ival, fval, ullval );
+
+			switch ( dat->m_iDataType )
+			{
+			case KeyValues::TYPE_UINT64:
+				dat->m_sValue = (char *)Alloc( sizeof(uint64) );
+				*((uint64 *)dat->m_sValue) = ullval;
+				dat->m_iAllocFlags |= KeyValues::KV_ALLOC_BORROWED_STRING;
+				break;
+
+			case KeyValues::TYPE_FLOAT:
+				dat->m_flValue = fval;
+				break;
+
+			case KeyValues::TYPE_INT:
+				dat->m_iValue = ival;
+				break;
+
+			default:
+				// the token was terminated where it lies in the text
+				dat->m_sValue = (char *)value;
+				dat->m_iAllocFlags |= KeyValues::KV_ALLOC_BORROWED_STRING;
+				break;
+			}
+
+			// Look ahead one token for a conditional tag
+			const char *peek = ReadToken( wasQuoted, wasConditional );
+			if ( wasConditional )
+			{
+				bAccepted = !m_bEvaluateConditionals || EvaluateConditional( peek );
+			}
+			else
+			{
+				m_pPeekToken = peek;
+				m_bPeekQuoted = wasQuoted;
+				m_bPeekConditional = false;
+				m_bHavePeek = true;
+			}
+		}
+
+		Assert( dat->m_pPeer == NULL );
+		if ( bAccepted )
+		{
+			Assert( pLastChild == NULL || pLastChild->m_pPeer == dat );
+			pLastChild = dat;
+		}
+		else
+		{
+			if ( pLastChild == NULL )
+			{
+				Assert( pParent->m_pSub == dat );
+				pParent->m_pSub = NULL;
+			}
+			else
+			{
+				Assert( pLastChild->m_pPeer == dat );
+				pLastChild->m_pPeer = NULL;
+			}
+
+			KeyValues::DestroyKey( dat );
+		}
+	}
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Cache flags for the current options on this platform
+//-----------------------------------------------------------------------------
+int CKeyValuesDocument::GetCacheFlags() const
+{
+	int nFlags = 0;
+	if ( m_bUsesEscapeSequences )
+		nFlags |= KVCACHE_ESCAPE_SEQUENCES;
+	if ( m_bEvaluateConditionals )
+		nFlags |= KVCACHE_CONDITIONALS;
+	if ( IsWindows() )
+		nFlags |= KVCACHE_PLATFORM_WINDOWS;
+	if ( IsOSX() )
+		nFlags |= KVCACHE_PLATFORM_OSX;
+	if ( IsLinux() )
+		nFlags |= KVCACHE_PLATFORM_LINUX;
+	if ( IsX360() )
+		nFlags |= KVCACHE_PLATFORM_X360;
+	return nFlags;
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Loads the cached tree if it was built from the same text with the
+//			same options. The image is read in one go and string values point
+//			into it, so nothing but the nodes is allocated.
+//-----------------------------------------------------------------------------
+bool CKeyValuesDocument::LoadCache( IBaseFileSystem *filesystem, const char *pszCacheName, unsigned int nSourceCRC, int nSourceSize )
+{
+	FileHandle_t f = filesystem->Open( pszCacheName, "rb", KEYVALUES_CACHE_PATH_ID );
+	if ( !f )
+		return false;
+
+	KeyValuesCacheHeader_t header;
+	int nFileSize = filesystem->Size( f );
+	bool bValid = nFileSize >= (int)sizeof( header ) &&
+		filesystem->Read( &header, sizeof( header ), f ) == sizeof( header ) &&
+		header.m_nMagic == KEYVALUES_CACHE_MAGIC &&
+		header.m_nVersion == KEYVALUES_CACHE_VERSION &&
+		header.m_nSourceCRC == nSourceCRC &&
+		header.m_nSourceSize == nSourceSize &&
+		header.m_nFlags == GetCacheFlags() &&
+		header.m_nDataSize == nFileSize - (int)sizeof( header ) &&
+		header.m_nNodes > 0;
+
+	char *pImage = NULL;
+	if ( bValid )
+	{
+		pImage = (char *)malloc( header.m_nDataSize );
+		bValid = ( filesystem->Read( pImage, header.m_nDataSize, f ) == header.m_nDataSize );
+	}
+	filesystem->Close( f );
+
+	if ( !bValid )
+	{
+		free( pImage );
+		return false;
+	}
+
+	NewBlock( header.m_nNodes * AlignValue( sizeof( KeyValues ), 8 ) );
+
+	CUtlBuffer buf( pImage, header.m_nDataSize, CUtlBuffer::READ_ONLY );
+	if ( !ReadCachedPeers( buf, &m_pRoot ) || !m_pRoot )
+	{
+		// Unreadable; the caller parses the text instead
+		DevWarning( "KeyValues: ignoring damaged cache file %s\n", pszCacheName );
+		FreeTree();
+		free( pImage );
+		return false;
+	}
+
+	// The text isn't needed any more
+	free( m_pSource );
+	m_pSource = pImage;
+	m_nSourceSize = header.m_nDataSize;
+	m_bLoadedFromCache = true;
+	return true;
+}
+
+// Returns the null terminated string at the read position, in place
+static const char *ReadCachedString( CUtlBuffer &buf )
+{
+	const char *pString = (const char *)buf.PeekGet( 0 );
+	int nRemaining = buf.GetBytesRemaining();
+	const char *pEnd = ( nRemaining > 0 ) ? (const char *)memchr( pString, 0, nRemaining ) : NULL;
+	if ( !pEnd )
+		return NULL;
+
+	buf.SeekGet( CUtlBuffer::SEEK_CURRENT, pEnd - pString + 1 );
+	return pString;
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Reads a list of peers written by KeyValues::WriteAsBinary(). The
+//			image was written from a tree the text parser built, so it nests
+//			no deeper than the parser already recursed for the same file.
+//-----------------------------------------------------------------------------
+bool CKeyValuesDocument::ReadCachedPeers( CUtlBuffer &buf, KeyValues **ppFirst )
+{
+	*ppFirst = NULL;
+
+	KeyValues *pLast = NULL;
+	while ( true )
+	{
+		int nType = buf.GetUnsignedChar();
+		if ( !buf.IsValid() )
+			return false;
+
+		if ( nType == KeyValues::TYPE_NUMTYPES )
+			return true; // no more peers
+
+		const char *pszName = ReadCachedString( buf );
+		if ( !pszName )
+			return false;
+
+		// Linked in before it's filled so a failure still frees it
+		KeyValues *dat = AllocKey( pszName );
+		if ( pLast )
+		{
+			pLast->m_pPeer = dat;
+		}
+		else
+		{
+			*ppFirst = dat;
+		}
+		pLast = dat;
+
+		dat->m_iDataType = nType;
+		switch ( nType )
+		{
+		case KeyValues::TYPE_NONE:
+			if ( !ReadCachedPeers( buf, &dat->m_pSub ) )
+				return false;
+			break;
+
+		case KeyValues::TYPE_STRING:
+			dat->m_sValue = (char *)ReadCachedString( buf );
+			if ( !dat->m_sValue )
+				return false;
+			dat->m_iAllocFlags |= KeyValues::KV_ALLOC_BORROWED_STRING;
+			break;
+
+		case KeyValues::TYPE_INT:
+			dat->m_iValue = buf.GetInt();
+			break;
+
+		case KeyValues::TYPE_FLOAT:
+			dat->m_flValue = buf.GetFloat();
+			break;
+
+		case KeyValues::TYPE_UINT64:
+			dat->m_sValue = (char *)Alloc( sizeof(uint64) );
+			*((uint64 *)dat->m_sValue) = buf.GetInt64();
+			dat->m_iAllocFlags |= KeyValues::KV_ALLOC_BORROWED_STRING;
+			break;
+
+		default:
+			// the text parser never produces anything else
+			dat->m_iDataType = KeyValues::TYPE_NONE;
+			return false;
+		}
+
+		if ( !buf.IsValid() )
+			return false;
+	}
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Saves the freshly parsed tree for the next load
+//-----------------------------------------------------------------------------
+void CKeyValuesDocument::WriteCache( IFileSystem *filesystem, const char *pszCacheName, unsigned int nSourceCRC, int nSourceSize )
+{
+	KeyValuesCacheHeader_t header;
+	header.m_nMagic = KEYVALUES_CACHE_MAGIC;
+	header.m_nVersion = KEYVALUES_CACHE_VERSION;
+	header.m_nSourceCRC = nSourceCRC;
+	header.m_nSourceSize = nSourceSize;
+	header.m_nFlags = GetCacheFlags();
+	header.m_nNodes = m_nNodes;
+	header.m_nDataSize = 0;
+
+	CUtlBuffer buf;
+	buf.Put( &header, sizeof( header ) );
+	if ( !m_pRoot->WriteAsBinary( buf ) )
+		return;
+
+	((KeyValuesCacheHeader_t *)buf.Base())->m_nDataSize = buf.TellPut() - sizeof( header );
+
+	char szCacheDir[MAX_PATH];
+	if ( V_ExtractFilePath( pszCacheName, szCacheDir, sizeof( szCacheDir ) ) )
+	{
+		filesystem->CreateDirHierarchy( szCacheDir, KEYVALUES_CACHE_PATH_ID );
+	}
+
+	// A short write leaves a size mismatch, which LoadCache rejects
+	FileHandle_t f = filesystem->Open( pszCacheName, "wb", KEYVALUES_CACHE_PATH_ID );
+	if ( f == FILESYSTEM_INVALID_HANDLE )
+		return;
+
+	filesystem->Write( buf.Base(), buf.TellPut(), f );
+	filesystem->Close( f );
+}
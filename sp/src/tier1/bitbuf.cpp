@@ -616,62 +616,46 @@ void bf_write::WriteBitCoordMP( const float f, bool bIntegral, bool bLowPrecisio
 	WriteUBitLong( bits, numbits );
 }
 
-void bf_write::WriteBitCoord (const float f)
+//-----------------------------------------------------------------------------
+// Coord and normal fields packed into one value, LSB first, in the order the
+// bits go on the wire. Returns the number of bits used.
+//-----------------------------------------------------------------------------
+static FORCEINLINE int EncodeBitCoord( const float f, unsigned int *pBits )
 {
-#if defined( BB_PROFILING )
-	VPROF( "bf_write::WriteBitCoord" );
-#endif
 	int		signbit = (f <= -COORD_RESOLUTION);
 	int		intval = (int)abs(f);
 	int		fractval = abs((int)(f*COORD_DENOMINATOR)) & (COORD_DENOMINATOR-1);
 
-
-	// Send the bit flags that indicate whether we have an integer part and/or a fraction part.
-	WriteOneBit( intval );
-	WriteOneBit( fractval );
-
-	if ( intval || fractval )
+	// Flags that indicate whether we have an integer part and/or a fraction part.
+	unsigned int bits = ( intval ? 1 : 0 ) | ( fractval ? 2 : 0 );
+	if ( !bits )
 	{
-		// Send the sign bit
-		WriteOneBit( signbit );
-
-		// Send the integer if we have one.
-		if ( intval )
-		{
-			// Adjust the integers from [1..MAX_COORD_VALUE] to [0..MAX_COORD_VALUE-1]
-			intval--;
-			WriteUBitLong( (unsigned int)intval, COORD_INTEGER_BITS );
-		}
-		
-		// Send the fraction if we have one
-		if ( fractval )
-		{
-			WriteUBitLong( (unsigned int)fractval, COORD_FRACTIONAL_BITS );
-		}
+		*pBits = 0;
+		return 2;
 	}
-}
 
-void bf_write::WriteBitVec3Coord( const Vector& fa )
-{
-	int		xflag, yflag, zflag;
+	// Sign bit
+	bits |= signbit << 2;
+	int numbits = 3;
 
-	xflag = (fa[0] >= COORD_RESOLUTION) || (fa[0] <= -COORD_RESOLUTION);
-	yflag = (fa[1] >= COORD_RESOLUTION) || (fa[1] <= -COORD_RESOLUTION);
-	zflag = (fa[2] >= COORD_RESOLUTION) || (fa[2] <= -COORD_RESOLUTION);
+	if ( intval )
+	{
+		// Adjust the integers from [1..MAX_COORD_VALUE] to [0..MAX_COORD_VALUE-1]
+		bits |= ( (unsigned int)( intval - 1 ) & ( ( 1 << COORD_INTEGER_BITS ) - 1 ) ) << numbits;
+		numbits += COORD_INTEGER_BITS;
+	}
 
-	WriteOneBit( xflag );
-	WriteOneBit( yflag );
-	WriteOneBit( zflag );
+	if ( fractval )
+	{
+		bits |= (unsigned int)fractval << numbits;
+		numbits += COORD_FRACTIONAL_BITS;
+	}
 
-	if ( xflag )
-		WriteBitCoord( fa[0] );
-	if ( yflag )
-		WriteBitCoord( fa[1] );
-	if ( zflag )
-		WriteBitCoord( fa[2] );
+	*pBits = bits;
+	return numbits;
 }
 
-void bf_write::WriteBitNormal( float f )
+static FORCEINLINE int EncodeBitNormal( float f, unsigned int *pBits )
 {
 	int	signbit = (f <= -NORMAL_RESOLUTION);
 
@@ -682,38 +666,72 @@ void bf_write::WriteBitNormal( float f )
 	if (fractval > NORMAL_DENOMINATOR)
 		fractval = NORMAL_DENOMINATOR;
 
-	// Send the sign bit
-	WriteOneBit( signbit );
+	// Sign bit, then the fractional component
+	*pBits = signbit | ( fractval << 1 );
+	return 1 + NORMAL_FRACTIONAL_BITS;
+}
 
-	// Send the fractional component
-	WriteUBitLong( fractval, NORMAL_FRACTIONAL_BITS );
+static FORCEINLINE int HasBitCoord( float f )
+{
+	return (f >= COORD_RESOLUTION) || (f <= -COORD_RESOLUTION);
 }
 
-void bf_write::WriteBitVec3Normal( const Vector& fa )
+static FORCEINLINE int HasBitNormal( float f )
 {
-	int		xflag, yflag;
+	return (f >= NORMAL_RESOLUTION) || (f <= -NORMAL_RESOLUTION);
+}
 
-	xflag = (fa[0] >= NORMAL_RESOLUTION) || (fa[0] <= -NORMAL_RESOLUTION);
-	yflag = (fa[1] >= NORMAL_RESOLUTION) || (fa[1] <= -NORMAL_RESOLUTION);
+void bf_write::WriteBitCoord (const float f)
+{
+#if defined( BB_PROFILING )
+	VPROF( "bf_write::WriteBitCoord" );
+#endif
+	unsigned int bits;
+	int numbits = EncodeBitCoord( f, &bits );
+	WriteUBitLong( bits, numbits, false );
+}
 
-	WriteOneBit( xflag );
-	WriteOneBit( yflag );
+void bf_write::WriteBitVec3Coord( const Vector& fa )
+{
+	CBitWriteAccumulator acc( this );
+	acc.WriteBitVec3Coord( fa );
+}
 
-	if ( xflag )
-		WriteBitNormal( fa[0] );
-	if ( yflag )
-		WriteBitNormal( fa[1] );
-	
-	// Write z sign bit
-	int	signbit = (fa[2] <= -NORMAL_RESOLUTION);
-	WriteOneBit( signbit );
+void bf_write::WriteBitNormal( float f )
+{
+	unsigned int bits;
+	int numbits = EncodeBitNormal( f, &bits );
+	WriteUBitLong( bits, numbits, false );
+}
+
+void bf_write::WriteBitVec3Normal( const Vector& fa )
+{
+	CBitWriteAccumulator acc( this );
+	acc.WriteBitVec3Normal( fa );
 }
 
 void bf_write::WriteBitAngles( const QAngle& fa )
 {
-	// FIXME:
-	Vector tmp( fa.x, fa.y, fa.z );
-	WriteBitVec3Coord( tmp );
+	CBitWriteAccumulator acc( this );
+	acc.WriteBitAngles( fa );
+}
+
+void bf_write::WriteBitVec3Coords( const Vector *pVecs, int nCount )
+{
+	CBitWriteAccumulator acc( this );
+	for ( int i = 0; i < nCount; i++ )
+	{
+		acc.WriteBitVec3Coord( pVecs[i] );
+	}
+}
+
+void bf_write::WriteBitAngles( const QAngle *pAngles, int nCount )
+{
+	CBitWriteAccumulator acc( this );
+	for ( int i = 0; i < nCount; i++ )
+	{
+		acc.WriteBitAngles( pAngles[i] );
+	}
 }
 
 void bf_write::WriteChar(int val)
@@ -860,6 +878,14 @@ void bf_read::SetOverflowFlag()
 
 unsigned int bf_read::CheckReadUBitLong(int numbits)
 {
+	if ( numbits > 0 && GetNumBitsLeft() >= numbits )
+	{
+		int iStartBit = m_iCurBit;
+		unsigned int r = ReadUBitLong( numbits );
+		m_iCurBit = iStartBit;
+		return r;
+	}
+
 	// Ok, just read bits out.
 	int i, nBitValue;
 	unsigned int r = 0;
@@ -961,6 +987,16 @@ float bf_read::ReadBitAngle( int numbits )
 
 unsigned int bf_read::PeekUBitLong( int numbits )
 {
+	// Whole words when it fits; running off the end goes a bit at a time so
+	// it's reported the same way it always was
+	if ( numbits > 0 && GetNumBitsLeft() >= numbits )
+	{
+		int iStartBit = m_iCurBit;
+		unsigned int r = ReadUBitLong( numbits );
+		m_iCurBit = iStartBit;
+		return r;
+	}
+
 	unsigned int r;
 	int i, nBitValue;
 #ifdef BIT_VERBOSE
@@ -1085,42 +1121,8 @@ float bf_read::ReadBitCoord (void)
 #if defined( BB_PROFILING )
 	VPROF( "bf_read::ReadBitCoord" );
 #endif
-	int		intval=0,fractval=0,signbit=0;
-	float	value = 0.0;
-
-
-	// Read the required integer and fraction flags
-	intval = ReadOneBit();
-	fractval = ReadOneBit();
-
-	// If we got either parse them, otherwise it's a zero.
-	if ( intval || fractval )
-	{
-		// Read the sign bit
-		signbit = ReadOneBit();
-
-		// If there's an integer, read it in
-		if ( intval )
-		{
-			// Adjust the integers from [0..MAX_COORD_VALUE-1] to [1..MAX_COORD_VALUE]
-			intval = ReadUBitLong( COORD_INTEGER_BITS ) + 1;
-		}
-
-		// If there's a fraction, read it in
-		if ( fractval )
-		{
-			fractval = ReadUBitLong( COORD_FRACTIONAL_BITS );
-		}
-
-		// Calculate the correct floating point value
-		value = intval + ((float)fractval * COORD_RESOLUTION);
-
-		// Fixup the sign if negative.
-		if ( signbit )
-			value = -value;
-	}
-
-	return value;
+	CBitReadAccumulator acc( this );
+	return acc.ReadBitCoord();
 }
 
 float bf_read::ReadBitCoordMP( bool bIntegral, bool bLowPrecision )
@@ -1270,75 +1272,44 @@ unsigned int bf_read::ReadBitCoordMPBits( bool bIntegral, bool bLowPrecision )
 
 void bf_read::ReadBitVec3Coord( Vector& fa )
 {
-	int		xflag, yflag, zflag;
-
-	// This vector must be initialized! Otherwise, If any of the flags aren't set, 
-	// the corresponding component will not be read and will be stack garbage.
-	fa.Init( 0, 0, 0 );
-
-	xflag = ReadOneBit();
-	yflag = ReadOneBit(); 
-	zflag = ReadOneBit();
-
-	if ( xflag )
-		fa[0] = ReadBitCoord();
-	if ( yflag )
-		fa[1] = ReadBitCoord();
-	if ( zflag )
-		fa[2] = ReadBitCoord();
+	CBitReadAccumulator acc( this );
+	acc.ReadBitVec3Coord( fa );
 }
 
 float bf_read::ReadBitNormal (void)
 {
-	// Read the sign bit
-	int	signbit = ReadOneBit();
-
-	// Read the fractional part
-	unsigned int fractval = ReadUBitLong( NORMAL_FRACTIONAL_BITS );
-
-	// Calculate the correct floating point value
-	float value = (float)fractval * NORMAL_RESOLUTION;
-
-	// Fixup the sign if negative.
-	if ( signbit )
-		value = -value;
-
-	return value;
+	CBitReadAccumulator acc( this );
+	return acc.ReadBitNormal();
 }
 
 void bf_read::ReadBitVec3Normal( Vector& fa )
 {
-	int xflag = ReadOneBit();
-	int yflag = ReadOneBit(); 
-
-	if (xflag)
-		fa[0] = ReadBitNormal();
-	else
-		fa[0] = 0.0f;
-
-	if (yflag)
-		fa[1] = ReadBitNormal();
-	else
-		fa[1] = 0.0f;
-
-	// The first two imply the third (but not its sign)
-	int znegative = ReadOneBit();
+	CBitReadAccumulator acc( this );
+	acc.ReadBitVec3Normal( fa );
+}
 
-	float fafafbfb = fa[0] * fa[0] + fa[1] * fa[1];
-	if (fafafbfb < 1.0f)
-		fa[2] = sqrt( 1.0f - fafafbfb );
-	else
-		fa[2] = 0.0f;
+void bf_read::ReadBitAngles( QAngle& fa )
+{
+	CBitReadAccumulator acc( this );
+	acc.ReadBitAngles( fa );
+}
 
-	if (znegative)
-		fa[2] = -fa[2];
+void bf_read::ReadBitVec3Coords( Vector *pVecs, int nCount )
+{
+	CBitReadAccumulator acc( this );
+	for ( int i = 0; i < nCount; i++ )
+	{
+		acc.ReadBitVec3Coord( pVecs[i] );
+	}
 }
 
-void bf_read::ReadBitAngles( QAngle& fa )
+void bf_read::ReadBitAngles( QAngle *pAngles, int nCount )
 {
-	Vector tmp;
-	ReadBitVec3Coord( tmp );
-	fa.Init( tmp.x, tmp.y, tmp.z );
+	CBitReadAccumulator acc( this );
+	for ( int i = 0; i < nCount; i++ )
+	{
+		acc.ReadBitAngles( pAngles[i] );
+	}
 }
 
 int64 bf_read::ReadLongLong()
@@ -1488,3 +1459,256 @@ int bf_read::CompareBitsAt( int offset, bf_read * RESTRICT other, int otherOffse
 	x ^= LoadLittleDWord( (unsigned long*)pData2End, 0 ) << (32 - iStartBit2);
 	return x & g_ExtraMasks[ numbits ];
 }
+
+
+// ---------------------------------------------------------------------------------------- //
+// CBitWriteAccumulator
+// ---------------------------------------------------------------------------------------- //
+
+void CBitWriteAccumulator::WriteBitAngle( float fAngle, int numbits )
+{
+	unsigned int shift = BitForBitnum(numbits);
+	int d = (int)( (fAngle / 360.0) * shift );
+	WriteUBitLong( (unsigned int)d & ( shift - 1 ), numbits );
+}
+
+void CBitWriteAccumulator::WriteBitCoord( const float f )
+{
+	unsigned int bits;
+	int numbits = EncodeBitCoord( f, &bits );
+	WriteUBitLong( bits, numbits );
+}
+
+void CBitWriteAccumulator::WriteBitVec3Coord( const Vector& fa )
+{
+	int xflag = HasBitCoord( fa[0] );
+	int yflag = HasBitCoord( fa[1] );
+	int zflag = HasBitCoord( fa[2] );
+
+	WriteUBitLong( xflag | ( yflag << 1 ) | ( zflag << 2 ), 3 );
+
+	if ( xflag )
+		WriteBitCoord( fa[0] );
+	if ( yflag )
+		WriteBitCoord( fa[1] );
+	if ( zflag )
+		WriteBitCoord( fa[2] );
+}
+
+void CBitWriteAccumulator::WriteBitNormal( float f )
+{
+	unsigned int bits;
+	int numbits = EncodeBitNormal( f, &bits );
+	WriteUBitLong( bits, numbits );
+}
+
+void CBitWriteAccumulator::WriteBitVec3Normal( const Vector& fa )
+{
+	int xflag = HasBitNormal( fa[0] );
+	int yflag = HasBitNormal( fa[1] );
+
+	WriteUBitLong( xflag | ( yflag << 1 ), 2 );
+
+	if ( xflag )
+		WriteBitNormal( fa[0] );
+	if ( yflag )
+		WriteBitNormal( fa[1] );
+
+	// Write z sign bit
+	WriteOneBit( fa[2] <= -NORMAL_RESOLUTION );
+}
+
+void CBitWriteAccumulator::WriteBitAngles( const QAngle& fa )
+{
+	// Angles go on the wire as a coord vector
+	int xflag = HasBitCoord( fa[0] );
+	int yflag = HasBitCoord( fa[1] );
+	int zflag = HasBitCoord( fa[2] );
+
+	WriteUBitLong( xflag | ( yflag << 1 ) | ( zflag << 2 ), 3 );
+
+	if ( xflag )
+		WriteBitCoord( fa[0] );
+	if ( yflag )
+		WriteBitCoord( fa[1] );
+	if ( zflag )
+		WriteBitCoord( fa[2] );
+}
+
+
+// ---------------------------------------------------------------------------------------- //
+// CBitReadAccumulator
+// ---------------------------------------------------------------------------------------- //
+
+void CBitReadAccumulator::Refill( int iBit )
+{
+	m_iWindowBit = iBit;
+	m_nUsed = 0;
+	m_nWindow = 0;
+
+	int nBitsLeft = m_pBuf->m_nDataBits - iBit;
+	if ( nBitsLeft <= 0 )
+		return;
+
+	// Only dwords holding at least one valid bit are loaded, as with ReadUBitLong
+	const unsigned long *pData = (const unsigned long *)m_pBuf->m_pData;
+	int iWord = iBit >> 5;
+	int iLastWord = ( m_pBuf->m_nDataBits - 1 ) >> 5;
+	int iStartBit = iBit & 31;
+
+	uint64 nLow = LoadLittleDWord( pData, iWord );
+	if ( iWord + 1 <= iLastWord )
+	{
+		nLow |= (uint64)LoadLittleDWord( pData, iWord + 1 ) << 32;
+	}
+	m_nWindow = nLow >> iStartBit;
+
+	if ( iStartBit && iWord + 2 <= iLastWord )
+	{
+		m_nWindow |= (uint64)LoadLittleDWord( pData, iWord + 2 ) << ( 64 - iStartBit );
+	}
+
+	if ( nBitsLeft < 64 )
+	{
+		m_nWindow &= ( (uint64)1 << nBitsLeft ) - 1;
+	}
+}
+
+unsigned int CBitReadAccumulator::Overrun()
+{
+	// Same as bf_read::ReadUBitLong: skip to the end and read zeros from here on
+	m_iWindowBit = MAX( m_pBuf->m_nDataBits, m_iWindowBit );
+	m_nUsed = 0;
+	m_nWindow = 0;
+	m_pBuf->SetOverflowFlag();
+	CallErrorHandler( BITBUFERROR_BUFFER_OVERRUN, m_pBuf->GetDebugName() );
+	return 0;
+}
+
+float CBitReadAccumulator::ReadBitAngle( int numbits )
+{
+	float shift = (float)( BitForBitnum(numbits) );
+	int i = ReadUBitLong( numbits );
+	return (float)i * (360.0 / shift);
+}
+
+float CBitReadAccumulator::ReadBitCoord()
+{
+	enum { MAX_BITS = 3 + COORD_INTEGER_BITS + COORD_FRACTIONAL_BITS };
+
+	int signbit, intval, fractval;
+	if ( m_nUsed + MAX_BITS > 64 )
+	{
+		Refill( m_iWindowBit + m_nUsed );
+	}
+
+	if ( m_iWindowBit + m_nUsed + MAX_BITS <= m_pBuf->m_nDataBits )
+	{
+		// The whole field is in the window, so take it apart in place
+		unsigned int bits = (unsigned int)( m_nWindow >> m_nUsed );
+		unsigned int flags = bits & 3;
+		if ( !flags )
+		{
+			m_nUsed += 2;
+			return 0.0f;
+		}
+
+		signbit = ( bits >> 2 ) & 1;
+		bits >>= 3;
+		m_nUsed += 3;
+
+		intval = 0;
+		if ( flags & 1 )
+		{
+			intval = ( bits & ( ( 1 << COORD_INTEGER_BITS ) - 1 ) ) + 1;
+			bits >>= COORD_INTEGER_BITS;
+			m_nUsed += COORD_INTEGER_BITS;
+		}
+
+		fractval = 0;
+		if ( flags & 2 )
+		{
+			fractval = bits & ( ( 1 << COORD_FRACTIONAL_BITS ) - 1 );
+			m_nUsed += COORD_FRACTIONAL_BITS;
+		}
+	}
+	else
+	{
+		// Near the end of the buffer; read field by field so an overrun
+		// stops in the same place it always did
+		unsigned int flags = ReadUBitLong( 2 );
+		if ( !flags )
+			return 0.0f;
+
+		signbit = ReadOneBit();
+
+		// Adjust the integers from [0..MAX_COORD_VALUE-1] to [1..MAX_COORD_VALUE]
+		intval = ( flags & 1 ) ? ReadUBitLong( COORD_INTEGER_BITS ) + 1 : 0;
+		fractval = ( flags & 2 ) ? ReadUBitLong( COORD_FRACTIONAL_BITS ) : 0;
+	}
+
+	// Calculate the correct floating point value
+	float value = intval + ((float)fractval * COORD_RESOLUTION);
+
+	// Fixup the sign if negative.
+	if ( signbit )
+		value = -value;
+
+	return value;
+}
+
+void CBitReadAccumulator::ReadBitVec3Coord( Vector& fa )
+{
+	// Components without a flag aren't sent
+	fa.Init( 0, 0, 0 );
+
+	unsigned int flags = ReadUBitLong( 3 );
+	if ( flags & 1 )
+		fa[0] = ReadBitCoord();
+	if ( flags & 2 )
+		fa[1] = ReadBitCoord();
+	if ( flags & 4 )
+		fa[2] = ReadBitCoord();
+}
+
+float CBitReadAccumulator::ReadBitNormal()
+{
+	// Sign bit, then the fractional part
+	unsigned int bits = ReadUBitLong( 1 + NORMAL_FRACTIONAL_BITS );
+
+	// Calculate the correct floating point value
+	float value = (float)( bits >> 1 ) * NORMAL_RESOLUTION;
+
+	// Fixup the sign if negative.
+	if ( bits & 1 )
+		value = -value;
+
+	return value;
+}
+
+void CBitReadAccumulator::ReadBitVec3Normal( Vector& fa )
+{
+	unsigned int flags = ReadUBitLong( 2 );
+
+	fa[0] = ( flags & 1 ) ? ReadBitNormal() : 0.0f;
+	fa[1] = ( flags & 2 ) ? ReadBitNormal() : 0.0f;
+
+	// The first two imply the third (but not its sign)
+	int znegative = ReadOneBit();
+
+	float fafafbfb = fa[0] * fa[0] + fa[1] * fa[1];
+	if (fafafbfb < 1.0f)
+		fa[2] = sqrt( 1.0f - fafafbfb );
+	else
+		fa[2] = 0.0f;
+
+	if (znegative)
+		fa[2] = -fa[2];
+}
+
+void CBitReadAccumulator::ReadBitAngles( QAngle& fa )
+{
+	Vector tmp;
+	ReadBitVec3Coord( tmp );
+	fa.Init( tmp.x, tmp.y, tmp.z );
+}
@@ -0,0 +1,249 @@
+//========= Copyright Valve Corporation, All rights reserved. ============//
+//
+// Purpose: Per-thread linear scratch allocator, reset at frame boundaries.
+//
+//=============================================================================//
+
+#include "tier0/dbg.h"
+#include "tier0/memalloc.h"
+#include "tier1/framearena.h"
+#include "tier0/memdbgon.h"
+
+//-----------------------------------------------------------------------------
+
+// Reserved address space per arena. Pages are only committed as used on
+// Win32; elsewhere the whole block is allocated up front.
+#define FRAMEARENA_MAIN_THREAD_SIZE		( 8 * 1024 * 1024 )
+#define FRAMEARENA_WORKER_THREAD_SIZE	( 1 * 1024 * 1024 )
+#define FRAMEARENA_COMMIT_SIZE			( 64 * 1024 )
+
+// Plain statics so they're usable by code that runs during static init
+static CThreadLocalPtr<CFrameArena> *s_pFrameArena;
+static CThreadFastMutex s_FrameArenaMutex;
+static CUtlVector<CFrameArena *> *s_pFrameArenas;
+static volatile int s_nFrameArenaFrame;
+
+//-----------------------------------------------------------------------------
+// Purpose: Returns the calling thread's arena
+//-----------------------------------------------------------------------------
+CFrameArena *CFrameArena::Get()
+{
+	if ( !s_pFrameArena )
+	{
+		CThreadLocalPtr<CFrameArena> *pFrameArena = new CThreadLocalPtr<CFrameArena>;
+		if ( !ThreadInterlockedAssignPointerIf( (void * volatile *)&s_pFrameArena, pFrameArena, NULL ) )
+		{
+			delete pFrameArena;
+		}
+	}
+
+	CFrameArena *pArena = *s_pFrameArena;
+	if ( !pArena )
+	{
+		// Not freed at thread exit; the arena stays registered for reporting
+		pArena = new CFrameArena( ThreadInMainThread() ? FRAMEARENA_MAIN_THREAD_SIZE : FRAMEARENA_WORKER_THREAD_SIZE );
+		*s_pFrameArena = pArena;
+
+		AUTO_LOCK( s_FrameArenaMutex );
+		if ( !s_pFrameArenas )
+		{
+			s_pFrameArenas = new CUtlVector<CFrameArena *>;
+		}
+		s_pFrameArenas->AddToTail( pArena );
+	}
+	else if ( pArena->m_nFrame != s_nFrameArenaFrame )
+	{
+		pArena->BeginFrame();
+	}
+	return pArena;
+}
+
+void CFrameArena::NewFrame()
+{
+	ThreadInterlockedIncrement( &s_nFrameArenaFrame );
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Constructor, destructor
+//-----------------------------------------------------------------------------
+CFrameArena::CFrameArena( unsigned nMaxSize )
+{
+	m_Stack.Init( nMaxSize, FRAMEARENA_COMMIT_SIZE, FRAMEARENA_COMMIT_SIZE, 16 );
+	m_nScopeDepth = 0;
+	m_nScopeMark = 0;
+	m_nFrame = s_nFrameArenaFrame;
+	m_nThreadId = ThreadGetCurrentId();
+	m_bMainThread = ThreadInMainThread();
+	m_nFramePeak = 0;
+	m_nLastFramePeak = 0;
+	m_nPeak = 0;
+	m_nOverflowCount = 0;
+	m_nOverflowPeak = 0;
+}
+
+CFrameArena::~CFrameArena()
+{
+	FrameArenaMark_t mark = { 0, 0 };
+	FreeToMark( mark );
+	m_Stack.Term();
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Drops last frame's unscoped allocations
+//-----------------------------------------------------------------------------
+void CFrameArena::BeginFrame()
+{
+	NotePeak();
+	m_nLastFramePeak = m_nFramePeak;
+	m_nFramePeak = 0;
+	m_nFrame = s_nFrameArenaFrame;
+
+	// A scope left open across the frame owns everything below it
+	if ( !m_nScopeDepth )
+	{
+		FrameArenaMark_t mark = { 0, 0 };
+		FreeToMark( mark );
+	}
+}
+
+void CFrameArena::NotePeak()
+{
+	if ( m_nFramePeak > m_nPeak )
+	{
+		m_nPeak = m_nFramePeak;
+	}
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: The stack is full, so fall back to the heap for this block. It's
+//			released along with the scope or frame like any other.
+//-----------------------------------------------------------------------------
+void *CFrameArena::AllocOverflow( unsigned nBytes, bool bClear )
+{
+	if ( !m_nOverflowCount )
+	{
+		DevWarning( "CFrameArena: thread %u ran out of its %d byte arena, using the heap\n", (unsigned)m_nThreadId, m_Stack.GetMaxSize() );
+	}
+
+	void *pMem = MemAlloc_AllocAligned( MAX( nBytes, 1u ), 16 );
+	if ( bClear )
+	{
+		memset( pMem, 0, nBytes );
+	}
+	m_Overflow.AddToTail( pMem );
+
+	m_nOverflowCount++;
+	if ( m_Overflow.Count() > m_nOverflowPeak )
+	{
+		m_nOverflowPeak = m_Overflow.Count();
+	}
+	return pMem;
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Whether pMem is the newest block and belongs to the innermost open
+//			scope. A block from outside that scope can't move or be popped,
+//			or the scope's mark would end up past the top of the stack.
+//-----------------------------------------------------------------------------
+bool CFrameArena::IsTop( void *pMem, unsigned nBytes )
+{
+	byte *pBase = (byte *)m_Stack.GetBase();
+	if ( pMem < pBase + m_nScopeMark || pMem >= pBase + m_Stack.GetUsed() )
+		return false;
+
+	return (byte *)pMem + AlignValue( MAX( nBytes, 1u ), 16 ) == pBase + m_Stack.GetUsed();
+}
+
+bool CFrameArena::Resize( void *pMem, unsigned nOldBytes, unsigned nNewBytes )
+{
+	if ( !IsTop( pMem, nOldBytes ) )
+		return false;
+
+	MemoryStackMark_t nStart = (byte *)pMem - (byte *)m_Stack.GetBase();
+	if ( nNewBytes <= nOldBytes )
+	{
+		m_Stack.FreeToAllocPoint( nStart + AlignValue( MAX( nNewBytes, 1u ), 16 ), false );
+		return true;
+	}
+
+	unsigned nGrowth = AlignValue( nNewBytes, 16 ) - AlignValue( MAX( nOldBytes, 1u ), 16 );
+	if ( !HasRoom( nGrowth ) )
+		return false;
+
+	if ( nGrowth )
+	{
+		m_Stack.Alloc( nGrowth );
+	}
+
+	if ( m_Stack.GetUsed() > m_nFramePeak )
+	{
+		m_nFramePeak = m_Stack.GetUsed();
+	}
+	return true;
+}
+
+void CFrameArena::Free( void *pMem, unsigned nBytes )
+{
+	if ( IsTop( pMem, nBytes ) )
+	{
+		m_Stack.FreeToAllocPoint( (byte *)pMem - (byte *)m_Stack.GetBase(), false );
+	}
+}
+
+void CFrameArena::FreeToMark( const FrameArenaMark_t &mark )
+{
+	m_Stack.FreeToAllocPoint( mark.m_nStack, false );
+
+	for ( int i = m_Overflow.Count(); --i >= mark.m_nOverflow; )
+	{
+		MemAlloc_FreeAligned( m_Overflow[i] );
+	}
+	if ( m_Overflow.Count() > mark.m_nOverflow )
+	{
+		m_Overflow.RemoveMultipleFromTail( m_Overflow.Count() - mark.m_nOverflow );
+	}
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: High-water marks of every thread's arena. Other threads' numbers
+//			are read without stopping them, so they're approximate.
+//-----------------------------------------------------------------------------
+void CFrameArena::ReportStats()
+{
+	AUTO_LOCK( s_FrameArenaMutex );
+	if ( !s_pFrameArenas || !s_pFrameArenas->Count() )
+	{
+		Msg( "No frame arenas in use\n" );
+		return;
+	}
+
+	Msg( "%-10s %6s %10s %12s %12s %10s %10s\n", "thread", "main", "reserved", "last frame", "peak", "overflows", "ovf peak" );
+	for ( int i = 0; i < s_pFrameArenas->Count(); i++ )
+	{
+		CFrameArena *pArena = (*s_pFrameArenas)[i];
+		Msg( "%-10u %6s %10d %12d %12d %10d %10d\n",
+			(unsigned)pArena->m_nThreadId,
+			pArena->m_bMainThread ? "yes" : "",
+			pArena->m_Stack.GetMaxSize(),
+			pArena->m_nLastFramePeak,
+			MAX( pArena->m_nPeak, pArena->m_nFramePeak ),
+			pArena->m_nOverflowCount,
+			pArena->m_nOverflowPeak );
+	}
+}
+
+void CFrameArena::ResetStats()
+{
+	AUTO_LOCK( s_FrameArenaMutex );
+	if ( !s_pFrameArenas )
+		return;
+
+	for ( int i = 0; i < s_pFrameArenas->Count(); i++ )
+	{
+		CFrameArena *pArena = (*s_pFrameArenas)[i];
+		pArena->m_nPeak = 0;
+		pArena->m_nLastFramePeak = 0;
+		pArena->m_nOverflowCount = 0;
+		pArena->m_nOverflowPeak = 0;
+	}
+}
@@ -310,3 +310,311 @@ void CUtlMemoryPool::Free( void *memBlock )
 }
 
 
+//-----------------------------------------------------------------------------
+// CMemoryPoolMT
+//
+// Every thread has one magazine per cached pool, found by the pool's slot.
+// A magazine stamped with another serial was left by a pool that has since
+// been cleared or destroyed; its blocks are gone, so it's simply reset.
+//-----------------------------------------------------------------------------
+
+#define MEMPOOLMT_MAGAZINE_SIZE		32
+#define MEMPOOLMT_BATCH_SIZE		( MEMPOOLMT_MAGAZINE_SIZE / 2 )
+#define MEMPOOLMT_MAX_CACHED_POOLS	64
+
+struct MemoryPoolMTMagazine_t
+{
+	int		m_nPoolSerial;
+	int		m_nCount;
+	int		m_nInUseDelta;		// allocs less frees not yet folded into the pool
+	void *	m_pBlocks[MEMPOOLMT_MAGAZINE_SIZE];
+};
+
+struct MemoryPoolMTThreadCache_t
+{
+	MemoryPoolMTMagazine_t m_Magazines[MEMPOOLMT_MAX_CACHED_POOLS];
+};
+
+// Plain statics so they're usable by pools constructed during static init
+static CThreadLocalPtr<MemoryPoolMTThreadCache_t> *s_pMemoryPoolMTThreadCache;
+static volatile int s_MemoryPoolMTSlots[MEMPOOLMT_MAX_CACHED_POOLS];
+static volatile int s_nMemoryPoolMTSerial;
+
+static MemoryPoolMTThreadCache_t *GetMemoryPoolMTThreadCache()
+{
+	if ( !s_pMemoryPoolMTThreadCache )
+	{
+		CThreadLocalPtr<MemoryPoolMTThreadCache_t> *pThreadCache = new CThreadLocalPtr<MemoryPoolMTThreadCache_t>;
+		if ( !ThreadInterlockedAssignPointerIf( (void * volatile *)&s_pMemoryPoolMTThreadCache, pThreadCache, NULL ) )
+		{
+			delete pThreadCache;
+		}
+	}
+
+	MemoryPoolMTThreadCache_t *pCache = *s_pMemoryPoolMTThreadCache;
+	if ( !pCache )
+	{
+		// Not freed at thread exit; blocks left in it return when the pool is cleared
+		pCache = new MemoryPoolMTThreadCache_t;
+		memset( pCache, 0, sizeof( MemoryPoolMTThreadCache_t ) );
+		*s_pMemoryPoolMTThreadCache = pCache;
+	}
+	return pCache;
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Constructor
+//-----------------------------------------------------------------------------
+CMemoryPoolMT::CMemoryPoolMT( int blockSize, int numElements, int growMode, const char *pszAllocOwner, int nAlignment ) :
+	CUtlMemoryPool( blockSize, numElements, growMode, pszAllocOwner, MAX( nAlignment, TSLIST_NODE_ALIGNMENT ) )
+{
+	m_nInUse = 0;
+	m_nPeakInUse = 0;
+	m_nSerial = ThreadInterlockedIncrement( &s_nMemoryPoolMTSerial );
+
+	// Pools beyond the cached limit go straight to the shared free list
+	m_iCacheSlot = -1;
+	for ( int i = 0; i < MEMPOOLMT_MAX_CACHED_POOLS; i++ )
+	{
+		if ( !s_MemoryPoolMTSlots[i] && ThreadInterlockedAssignIf( &s_MemoryPoolMTSlots[i], 1, 0 ) )
+		{
+			m_iCacheSlot = i;
+			break;
+		}
+	}
+}
+
+CMemoryPoolMT::~CMemoryPoolMT()
+{
+	MemoryPoolMTMagazine_t *pMagazine = GetMagazine();
+	if ( pMagazine )
+	{
+		FoldCounts( pMagazine );
+		pMagazine->m_nPoolSerial = 0;
+		ThreadInterlockedExchange( &s_MemoryPoolMTSlots[m_iCacheSlot], 0 );
+	}
+
+	// Blocks sitting in magazines or on the free list aren't leaks
+	m_BlocksAllocated = m_nInUse;
+	if ( m_BlocksAllocated > 0 )
+	{
+		ReportLeaks();
+	}
+
+	m_FreeList.Detach();
+	CUtlMemoryPool::Clear();
+}
+
+//-----------------------------------------------------------------------------
+
+MemoryPoolMTMagazine_t *CMemoryPoolMT::GetMagazine()
+{
+	if ( m_iCacheSlot < 0 )
+		return NULL;
+
+	MemoryPoolMTMagazine_t *pMagazine = &GetMemoryPoolMTThreadCache()->m_Magazines[m_iCacheSlot];
+	if ( pMagazine->m_nPoolSerial != m_nSerial )
+	{
+		pMagazine->m_nPoolSerial = m_nSerial;
+		pMagazine->m_nCount = 0;
+		pMagazine->m_nInUseDelta = 0;
+	}
+	return pMagazine;
+}
+
+void CMemoryPoolMT::NoteInUse( int nDelta )
+{
+	int nInUse = ThreadInterlockedExchangeAdd( &m_nInUse, nDelta ) + nDelta;
+
+	int nPeak = m_nPeakInUse;
+	while ( nInUse > nPeak && !ThreadInterlockedAssignIf( &m_nPeakInUse, nInUse, nPeak ) )
+	{
+		nPeak = m_nPeakInUse;
+	}
+}
+
+void CMemoryPoolMT::FoldCounts( MemoryPoolMTMagazine_t *pMagazine )
+{
+	if ( pMagazine->m_nInUseDelta )
+	{
+		NoteInUse( pMagazine->m_nInUseDelta );
+		pMagazine->m_nInUseDelta = 0;
+	}
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Carves a block out of the blobs, the only path that locks
+//-----------------------------------------------------------------------------
+void *CMemoryPoolMT::AllocFromBlobs()
+{
+	AUTO_LOCK( m_mutex );
+	return CUtlMemoryPool::Alloc();
+}
+
+void CMemoryPoolMT::RefillMagazine( MemoryPoolMTMagazine_t *pMagazine )
+{
+	while ( pMagazine->m_nCount < MEMPOOLMT_BATCH_SIZE )
+	{
+		void *pMem = m_FreeList.Pop();
+		if ( !pMem )
+			break;
+		pMagazine->m_pBlocks[pMagazine->m_nCount++] = pMem;
+	}
+
+	if ( !pMagazine->m_nCount )
+	{
+		AUTO_LOCK( m_mutex );
+		while ( pMagazine->m_nCount < MEMPOOLMT_BATCH_SIZE )
+		{
+			void *pMem = CUtlMemoryPool::Alloc();
+			if ( !pMem )
+				break;
+			pMagazine->m_pBlocks[pMagazine->m_nCount++] = pMem;
+		}
+	}
+}
+
+void CMemoryPoolMT::DrainMagazine( MemoryPoolMTMagazine_t *pMagazine, int nKeep )
+{
+	while ( pMagazine->m_nCount > nKeep )
+	{
+		m_FreeList.Push( (TSLNodeBase_t *)pMagazine->m_pBlocks[--pMagazine->m_nCount] );
+	}
+}
+
+//-----------------------------------------------------------------------------
+
+void *CMemoryPoolMT::Alloc()
+{
+	return Alloc( m_BlockSize );
+}
+
+void *CMemoryPoolMT::AllocZero()
+{
+	return AllocZero( m_BlockSize );
+}
+
+void *CMemoryPoolMT::Alloc( size_t amount )
+{
+	if ( amount > (unsigned int)m_BlockSize )
+		return NULL;
+
+	MemoryPoolMTMagazine_t *pMagazine = GetMagazine();
+	if ( !pMagazine )
+	{
+		void *pMem = m_FreeList.Pop();
+		if ( !pMem )
+		{
+			pMem = AllocFromBlobs();
+		}
+		if ( pMem )
+		{
+			NoteInUse( 1 );
+		}
+		return pMem;
+	}
+
+	if ( !pMagazine->m_nCount )
+	{
+		RefillMagazine( pMagazine );
+		if ( !pMagazine->m_nCount )
+			return NULL;
+	}
+
+	if ( ++pMagazine->m_nInUseDelta >= MEMPOOLMT_BATCH_SIZE )
+	{
+		FoldCounts( pMagazine );
+	}
+
+	return pMagazine->m_pBlocks[--pMagazine->m_nCount];
+}
+
+void *CMemoryPoolMT::AllocZero( size_t amount )
+{
+	void *mem = Alloc( amount );
+	if ( mem )
+	{
+		V_memset( mem, 0x00, amount );
+	}
+	return mem;
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Frees a block, which may have come from another thread
+//-----------------------------------------------------------------------------
+void CMemoryPoolMT::Free( void *pMem )
+{
+	if ( !pMem )
+		return;
+
+#ifdef _DEBUG
+	// invalidate the memory
+	memset( pMem, 0xDD, m_BlockSize );
+#endif
+
+	MemoryPoolMTMagazine_t *pMagazine = GetMagazine();
+	if ( !pMagazine )
+	{
+		m_FreeList.Push( (TSLNodeBase_t *)pMem );
+		NoteInUse( -1 );
+		return;
+	}
+
+	if ( pMagazine->m_nCount == MEMPOOLMT_MAGAZINE_SIZE )
+	{
+		DrainMagazine( pMagazine, MEMPOOLMT_MAGAZINE_SIZE - MEMPOOLMT_BATCH_SIZE );
+	}
+
+	pMagazine->m_pBlocks[pMagazine->m_nCount++] = pMem;
+
+	if ( --pMagazine->m_nInUseDelta <= -MEMPOOLMT_BATCH_SIZE )
+	{
+		FoldCounts( pMagazine );
+	}
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Frees everything. Not safe against concurrent Alloc or Free.
+//-----------------------------------------------------------------------------
+void CMemoryPoolMT::Clear()
+{
+	AUTO_LOCK( m_mutex );
+
+	// A new serial orphans whatever every thread has cached
+	m_nSerial = ThreadInterlockedIncrement( &s_nMemoryPoolMTSerial );
+	m_FreeList.Detach();
+	m_nInUse = 0;
+	CUtlMemoryPool::Clear();
+}
+
+//-----------------------------------------------------------------------------
+
+int CMemoryPoolMT::Count()
+{
+	MemoryPoolMTMagazine_t *pMagazine = GetMagazine();
+	if ( pMagazine )
+	{
+		FoldCounts( pMagazine );
+	}
+	return m_nInUse;
+}
+
+int CMemoryPoolMT::PeakCount()
+{
+	MemoryPoolMTMagazine_t *pMagazine = GetMagazine();
+	if ( pMagazine )
+	{
+		FoldCounts( pMagazine );
+	}
+	return m_nPeakInUse;
+}
+
+void CMemoryPoolMT::FlushThreadCache()
+{
+	MemoryPoolMTMagazine_t *pMagazine = GetMagazine();
+	if ( pMagazine )
+	{
+		FoldCounts( pMagazine );
+		DrainMagazine( pMagazine, 0 );
+	}
+}
@@ -272,3 +272,62 @@ bool Check3DNowTechnology(void)
 #pragma optimize( "", on )
 
 #endif // _WIN32
+
+//-----------------------------------------------------------------------------
+// AVX needs the OS to save the upper halves of the YMM registers as well as a
+// CPU that has them, so these check OSXSAVE and XCR0 along with the feature
+// bits. _xgetbv arrived in VS2010 SP1.
+//-----------------------------------------------------------------------------
+#if defined( _X360 ) || !defined( _MSC_FULL_VER ) || ( _MSC_FULL_VER < 160040219 )
+
+bool CheckAVXTechnology(void) { return false; }
+bool CheckAVX2Technology(void) { return false; }
+bool CheckFMA3Technology(void) { return false; }
+
+#else
+
+#include <intrin.h>
+
+static bool CheckAVXState()
+{
+	int info[4];
+	__cpuid( info, 1 );
+
+	// bit 27 is OSXSAVE, bit 28 is AVX
+	if ( ( info[2] & 0x18000000 ) != 0x18000000 )
+		return false;
+
+	// XMM and YMM state both enabled in XCR0
+	return ( _xgetbv( 0 ) & 6 ) == 6;
+}
+
+bool CheckAVXTechnology(void)
+{
+	return CheckAVXState();
+}
+
+bool CheckAVX2Technology(void)
+{
+	if ( !CheckAVXState() )
+		return false;
+
+	int info[4];
+	__cpuid( info, 0 );
+	if ( info[0] < 7 )
+		return false;
+
+	__cpuidex( info, 7, 0 );
+	return ( info[1] & ( 1 << 5 ) ) != 0;		// bit 5 of ebx is AVX2
+}
+
+bool CheckFMA3Technology(void)
+{
+	if ( !CheckAVXState() )
+		return false;
+
+	int info[4];
+	__cpuid( info, 1 );
+	return ( info[2] & ( 1 << 12 ) ) != 0;		// bit 12 of ecx is FMA
+}
+
+#endif
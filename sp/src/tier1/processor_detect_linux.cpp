@@ -9,6 +9,10 @@
 #define cpuid(in,a,b,c,d)												\
 	asm("pushl %%ebx\n\t" "cpuid\n\t" "movl %%ebx,%%esi\n\t" "pop %%ebx": "=a" (a), "=S" (b), "=c" (c), "=d" (d) : "a" (in));
 
+// cpuid with a sub-leaf in ecx
+#define cpuid_count(in,count,a,b,c,d)									\
+	asm("pushl %%ebx\n\t" "cpuid\n\t" "movl %%ebx,%%esi\n\t" "pop %%ebx": "=a" (a), "=S" (b), "=c" (c), "=d" (d) : "a" (in), "2" (count));
+
 bool CheckMMXTechnology(void)
 {
     unsigned long eax,ebx,edx,unused;
@@ -45,3 +49,51 @@ bool Check3DNowTechnology(void)
     }
     return false;
 }
+
+// AVX needs the OS to save the upper halves of the YMM registers as well as a
+// CPU that has them, so check OSXSAVE and XCR0 along with the feature bits
+static bool CheckAVXState()
+{
+	unsigned long eax,ebx,ecx,edx;
+	cpuid(1,eax,ebx,ecx,edx);
+
+	// bit 27 is OSXSAVE, bit 28 is AVX
+	if ( ( ecx & 0x18000000 ) != 0x18000000 )
+		return false;
+
+	// xgetbv, spelled out for assemblers that don't know it
+	unsigned long xcr0_lo, xcr0_hi;
+	asm(".byte 0x0f, 0x01, 0xd0" : "=a" (xcr0_lo), "=d" (xcr0_hi) : "c" (0));
+
+	// XMM and YMM state both enabled
+	return ( xcr0_lo & 6 ) == 6;
+}
+
+bool CheckAVXTechnology(void)
+{
+	return CheckAVXState();
+}
+
+bool CheckAVX2Technology(void)
+{
+	if ( !CheckAVXState() )
+		return false;
+
+	unsigned long eax,ebx,ecx,edx;
+	cpuid(0,eax,ebx,ecx,edx);
+	if ( eax < 7 )
+		return false;
+
+	cpuid_count(7,0,eax,ebx,ecx,edx);
+	return ebx & ( 1 << 5 );
+}
+
+bool CheckFMA3Technology(void)
+{
+	if ( !CheckAVXState() )
+		return false;
+
+	unsigned long eax,ebx,ecx,edx;
+	cpuid(1,eax,ebx,ecx,edx);
+	return ecx & ( 1 << 12 );
+}
@@ -14,20 +14,11 @@
 // memdbgon must be the last include file in a .cpp file!!!
 #include "tier0/memdbgon.h"
 
-//-----------------------------------------------------------------------------
-// Purpose: Comparison function for string sorted associative data structures
-//-----------------------------------------------------------------------------
-
-bool StrLess( const char * const &pszLeft, const char * const &pszRight )
-{
-	return ( Q_stricmp( pszLeft, pszRight) < 0 );
-}
-
 //-----------------------------------------------------------------------------
 //-----------------------------------------------------------------------------
 
 CStringPool::CStringPool()
-  : m_Strings( 32, 256, StrLess )
+  : m_Strings( 256, true )
 {
 }
 
@@ -51,29 +42,20 @@ unsigned int CStringPool::Count() const
 //-----------------------------------------------------------------------------
 const char * CStringPool::Find( const char *pszValue )
 {
-	unsigned short i = m_Strings.Find(pszValue);
-	if ( m_Strings.IsValidIndex(i) )
-		return m_Strings[i];
+	int i = m_Strings.Find( pszValue );
+	if ( i != -1 )
+		return m_Strings.String( i );
 
 	return NULL;
 }
 
 const char * CStringPool::Allocate( const char *pszValue )
 {
-	char	*pszNew;
-
-	unsigned short i 	= m_Strings.Find(pszValue);
-	bool		   bNew = (i == m_Strings.InvalidIndex());
-
-	if ( !bNew )
-		return m_Strings[i];
-
-	pszNew = strdup( pszValue );
-
-	if ( bNew )
-		m_Strings.Insert( pszNew );
+	int i = m_Strings.Insert( pszValue );
+	if ( i == -1 )
+		return NULL;
 
-	return pszNew;
+	return m_Strings.String( i );
 }
 
 //-----------------------------------------------------------------------------
@@ -81,12 +63,6 @@ const char * CStringPool::Allocate( const char *pszValue )
 
 void CStringPool::FreeAll()
 {
-	unsigned short i = m_Strings.FirstInorder();
-	while ( i != m_Strings.InvalidIndex() )
-	{
-		free( (void *)m_Strings[i] );
-		i = m_Strings.NextInorder(i);
-	}
 	m_Strings.RemoveAll();
 }
 
@@ -15,6 +15,8 @@
 #include "stringpool.h"
 #include "utlhashtable.h"
 #include "utlstring.h"
+#include "generichash.h"
+#include "mathlib/mathlib.h"
 
 // Ensure that everybody has the right compiler version installed. The version
 // number can be obtained by looking at the compiler output when you type 'cl'
@@ -36,8 +38,6 @@
 // memdbgon must be the last include file in a .cpp file!!!
 #include "tier0/memdbgon.h"
 
-#define INVALID_STRING_INDEX CStringPoolIndex( 0xFFFF, 0xFFFF )
-
 #define MIN_STRING_POOL_SIZE	2048
 
 //-----------------------------------------------------------------------------
@@ -123,139 +123,227 @@ bool CUtlSymbol::operator==( const char* pStr ) const
 
 
 //-----------------------------------------------------------------------------
-// symbol table stuff
+// hash table
 //-----------------------------------------------------------------------------
 
-inline const char* CUtlSymbolTable::StringFromIndex( const CStringPoolIndex &index ) const
+CUtlSymbolHashTable::CUtlSymbolHashTable( int initSize, bool caseInsensitive ) :
+	m_pTable( NULL ), m_ppStrings( NULL ), m_nCount( 0 ), m_nStringsAllocated( 0 ),
+	m_nInitSize( MAX( initSize, 16 ) ), m_bInsensitive( caseInsensitive ), m_pBlockCur( NULL ), m_nBlockLeft( 0 )
 {
-	Assert( index.m_iPool < m_StringPools.Count() );
-	Assert( index.m_iOffset < m_StringPools[index.m_iPool]->m_TotalLen );
+}
 
-	return &m_StringPools[index.m_iPool]->m_Data[index.m_iOffset];
+CUtlSymbolHashTable::~CUtlSymbolHashTable()
+{
+	RemoveAll();
 }
 
+unsigned int CUtlSymbolHashTable::Hash( const char *pString ) const
+{
+	unsigned int nHash = m_bInsensitive ? HashStringCaseless( pString ) : HashString( pString );
+
+	// Zero marks an empty slot
+	return nHash ? nHash : 1;
+}
 
-bool CUtlSymbolTable::CLess::operator()( const CStringPoolIndex &i1, const CStringPoolIndex &i2 ) const
+CUtlSymbolHashTable::Table_t *CUtlSymbolHashTable::AllocTable( int nSize )
 {
-	// Need to do pointer math because CUtlSymbolTable is used in CUtlVectors, and hence
-	// can be arbitrarily moved in memory on a realloc. Yes, this is portable. In reality,
-	// right now at least, because m_LessFunc is the first member of CUtlRBTree, and m_Lookup
-	// is the first member of CUtlSymbolTabke, this == pTable
-	CUtlSymbolTable *pTable = (CUtlSymbolTable *)( (byte *)this - offsetof(CUtlSymbolTable::CTree, m_LessFunc) ) - offsetof(CUtlSymbolTable, m_Lookup );
-	const char* str1 = (i1 == INVALID_STRING_INDEX) ? pTable->m_pUserSearchString :
-													  pTable->StringFromIndex( i1 );
-	const char* str2 = (i2 == INVALID_STRING_INDEX) ? pTable->m_pUserSearchString :
-													  pTable->StringFromIndex( i2 );
-
-	if ( !str1 && str2 )
-		return false;
-	if ( !str2 && str1 )
-		return true;
-	if ( !str1 && !str2 )
-		return false;
-	if ( !pTable->m_bInsensitive )
-		return V_strcmp( str1, str2 ) < 0;
-	else
-		return V_stricmp( str1, str2 ) < 0;
+	Assert( !( nSize & ( nSize - 1 ) ) );
+	Table_t *pTable = (Table_t *)malloc( sizeof( Table_t ) + ( nSize - 1 ) * sizeof( Slot_t ) );
+	pTable->m_nMask = nSize - 1;
+	memset( pTable->m_Slots, 0, nSize * sizeof( Slot_t ) );
+	return pTable;
+}
+
+void CUtlSymbolHashTable::InsertSlot( Table_t *pTable, unsigned int nHash, int id )
+{
+	int i = nHash & pTable->m_nMask;
+	while ( pTable->m_Slots[i].m_nHash )
+	{
+		i = ( i + 1 ) & pTable->m_nMask;
+	}
+
+	// A reader that sees the hash must also see the id
+	pTable->m_Slots[i].m_nId = id;
+	ThreadMemoryBarrier();
+	pTable->m_Slots[i].m_nHash = nHash;
 }
 
 
 //-----------------------------------------------------------------------------
-// constructor, destructor
+// Lock free. Writers publish the string, then the id, then the hash, so a
+// matching hash always leads to a complete entry.
 //-----------------------------------------------------------------------------
-CUtlSymbolTable::CUtlSymbolTable( int growSize, int initSize, bool caseInsensitive ) : 
-	m_Lookup( growSize, initSize ), m_bInsensitive( caseInsensitive ), m_StringPools( 8 )
+int CUtlSymbolHashTable::Find( const char *pString, unsigned int nHash ) const
 {
+	const Table_t *pTable = m_pTable;
+	if ( !pTable || !pString )
+		return -1;
+
+	ThreadMemoryBarrier();
+
+	for ( int i = nHash & pTable->m_nMask; ; i = ( i + 1 ) & pTable->m_nMask )
+	{
+		unsigned int nSlotHash = pTable->m_Slots[i].m_nHash;
+		if ( !nSlotHash )
+			return -1;
+
+		if ( nSlotHash == nHash )
+		{
+			ThreadMemoryBarrier();
+			int id = pTable->m_Slots[i].m_nId;
+			const char *pSlotString = m_ppStrings[id];
+			if ( m_bInsensitive ? !V_stricmp( pSlotString, pString ) : !V_strcmp( pSlotString, pString ) )
+				return id;
+		}
+	}
 }
 
-CUtlSymbolTable::~CUtlSymbolTable()
+
+//-----------------------------------------------------------------------------
+// Copies string data into blocks that are never moved or freed until RemoveAll
+//-----------------------------------------------------------------------------
+const char *CUtlSymbolHashTable::AllocString( const char *pString )
 {
-	// Release the stringpool string data
-	RemoveAll();
+	int len = V_strlen( pString ) + 1;
+	if ( len > m_nBlockLeft )
+	{
+		int nBlockSize = MAX( len, MIN_STRING_POOL_SIZE );
+		m_pBlockCur = (char *)malloc( nBlockSize );
+		m_nBlockLeft = nBlockSize;
+		m_StringBlocks.AddToTail( m_pBlockCur );
+	}
+
+	char *pResult = m_pBlockCur;
+	memcpy( pResult, pString, len );
+	m_pBlockCur += len;
+	m_nBlockLeft -= len;
+	return pResult;
 }
 
+void CUtlSymbolHashTable::GrowStrings()
+{
+	int nNewAllocated = m_nStringsAllocated ? m_nStringsAllocated * 2 : m_nInitSize;
+	const char **ppNewStrings = (const char **)malloc( nNewAllocated * sizeof( const char * ) );
+	if ( m_ppStrings )
+	{
+		memcpy( ppNewStrings, (const char **)m_ppStrings, m_nCount * sizeof( const char * ) );
+		m_Retired.AddToTail( (void *)m_ppStrings );
+	}
 
-CUtlSymbol CUtlSymbolTable::Find( const char* pString ) const
-{	
-	if (!pString)
-		return CUtlSymbol();
-	
-	// Store a special context used to help with insertion
-	m_pUserSearchString = pString;
-	
-	// Passing this special invalid symbol makes the comparison function
-	// use the string passed in the context
-	UtlSymId_t idx = m_Lookup.Find( INVALID_STRING_INDEX );
+	ThreadMemoryBarrier();
+	m_ppStrings = ppNewStrings;
+	m_nStringsAllocated = nNewAllocated;
+}
 
-#ifdef _DEBUG
-	m_pUserSearchString = NULL;
-#endif
+void CUtlSymbolHashTable::GrowTable()
+{
+	// Keep the load under one half so probe runs stay short
+	int nSize = m_pTable ? ( m_pTable->m_nMask + 1 ) * 2 : SmallestPowerOfTwoGreaterOrEqual( m_nInitSize * 2 );
+	Table_t *pNewTable = AllocTable( nSize );
+	for ( int id = 0; id < m_nCount; id++ )
+	{
+		InsertSlot( pNewTable, Hash( m_ppStrings[id] ), id );
+	}
 
-	return CUtlSymbol( idx );
-}
+	if ( m_pTable )
+	{
+		m_Retired.AddToTail( m_pTable );
+	}
 
+	ThreadMemoryBarrier();
+	m_pTable = pNewTable;
+}
 
-int CUtlSymbolTable::FindPoolWithSpace( int len )	const
+int CUtlSymbolHashTable::Insert( const char *pString, int nMaxCount )
 {
-	for ( int i=0; i < m_StringPools.Count(); i++ )
+	if ( !pString )
+		return -1;
+
+	unsigned int nHash = Hash( pString );
+	int id = Find( pString, nHash );
+	if ( id != -1 )
+		return id;
+
+	if ( m_nCount >= nMaxCount )
+		return -1;
+
+	id = m_nCount;
+	if ( id == m_nStringsAllocated )
 	{
-		StringPool_t *pPool = m_StringPools[i];
+		GrowStrings();
+	}
+	m_ppStrings[id] = AllocString( pString );
 
-		if ( (pPool->m_TotalLen - pPool->m_SpaceUsed) >= len )
-		{
-			return i;
-		}
+	ThreadMemoryBarrier();
+	m_nCount = id + 1;
+
+	if ( !m_pTable || m_nCount * 2 > m_pTable->m_nMask + 1 )
+	{
+		GrowTable();
 	}
+	else
+	{
+		InsertSlot( m_pTable, nHash, id );
+	}
+	return id;
+}
 
-	return -1;
+void CUtlSymbolHashTable::RemoveAll()
+{
+	free( m_pTable );
+	m_pTable = NULL;
+	free( (void *)m_ppStrings );
+	m_ppStrings = NULL;
+	m_nCount = 0;
+	m_nStringsAllocated = 0;
+
+	for ( int i = 0; i < m_StringBlocks.Count(); i++ )
+	{
+		free( m_StringBlocks[i] );
+	}
+	m_StringBlocks.RemoveAll();
+	m_pBlockCur = NULL;
+	m_nBlockLeft = 0;
+
+	for ( int i = 0; i < m_Retired.Count(); i++ )
+	{
+		free( m_Retired[i] );
+	}
+	m_Retired.RemoveAll();
 }
 
 
 //-----------------------------------------------------------------------------
-// Finds and/or creates a symbol based on the string
+// symbol table stuff
 //-----------------------------------------------------------------------------
 
-CUtlSymbol CUtlSymbolTable::AddString( const char* pString )
+CUtlSymbolTable::CUtlSymbolTable( int growSize, int initSize, bool caseInsensitive ) : 
+	m_Table( initSize, caseInsensitive )
 {
-	if (!pString) 
-		return CUtlSymbol( UTL_INVAL_SYMBOL );
-
-	CUtlSymbol id = Find( pString );
-	
-	if (id.IsValid())
-		return id;
+}
 
-	int len = V_strlen(pString) + 1;
+CUtlSymbolTable::~CUtlSymbolTable()
+{
+}
 
-	// Find a pool with space for this string, or allocate a new one.
-	int iPool = FindPoolWithSpace( len );
-	if ( iPool == -1 )
-	{
-		// Add a new pool.
-		int newPoolSize = max( len, MIN_STRING_POOL_SIZE );
-		StringPool_t *pPool = (StringPool_t*)malloc( sizeof( StringPool_t ) + newPoolSize - 1 );
-		pPool->m_TotalLen = newPoolSize;
-		pPool->m_SpaceUsed = 0;
-		iPool = m_StringPools.AddToTail( pPool );
-	}
 
-	// Copy the string in.
-	StringPool_t *pPool = m_StringPools[iPool];
-	Assert( pPool->m_SpaceUsed < 0xFFFF );	// This should never happen, because if we had a string > 64k, it
-											// would have been given its entire own pool.
-	
-	unsigned short iStringOffset = pPool->m_SpaceUsed;
+CUtlSymbol CUtlSymbolTable::Find( const char* pString ) const
+{	
+	int id = m_Table.Find( pString );
+	return CUtlSymbol( ( id == -1 ) ? UTL_INVAL_SYMBOL : (UtlSymId_t)id );
+}
 
-	memcpy( &pPool->m_Data[pPool->m_SpaceUsed], pString, len );
-	pPool->m_SpaceUsed += len;
 
-	// didn't find, insert the string into the vector.
-	CStringPoolIndex index;
-	index.m_iPool = iPool;
-	index.m_iOffset = iStringOffset;
+//-----------------------------------------------------------------------------
+// Finds and/or creates a symbol based on the string
+//-----------------------------------------------------------------------------
 
-	UtlSymId_t idx = m_Lookup.Insert( index );
-	return CUtlSymbol( idx );
+CUtlSymbol CUtlSymbolTable::AddString( const char* pString )
+{
+	// UTL_INVAL_SYMBOL is the last id a short can hold
+	int id = m_Table.Insert( pString, UTL_INVAL_SYMBOL );
+	AssertMsg( id != -1 || !pString, "CUtlSymbolTable is full\n" );
+	return CUtlSymbol( ( id == -1 ) ? UTL_INVAL_SYMBOL : (UtlSymId_t)id );
 }
 
 
@@ -268,8 +356,7 @@ const char* CUtlSymbolTable::String( CUtlSymbol id ) const
 	if (!id.IsValid()) 
 		return "";
 	
-	Assert( m_Lookup.IsValidIndex((UtlSymId_t)id) );
-	return StringFromIndex( m_Lookup[id] );
+	return m_Table.String( (UtlSymId_t)id );
 }
 
 
@@ -279,12 +366,7 @@ const char* CUtlSymbolTable::String( CUtlSymbol id ) const
 
 void CUtlSymbolTable::RemoveAll()
 {
-	m_Lookup.Purge();
-	
-	for ( int i=0; i < m_StringPools.Count(); i++ )
-		free( m_StringPools[i] );
-
-	m_StringPools.RemoveAll();
+	m_Table.RemoveAll();
 }
 
 
@@ -6,6 +6,14 @@
 // $NoKeywords: $
 //=============================================================================//
 
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
 #include "cmdlib.h"
 #include "mathlib/mathlib.h"
 #include "bsplib.h"
@@ -26,6 +34,8 @@
 #include "tier0/dbg.h"
 #include "lumpfiles.h"
 #include "vtf/vtf.h"
+#include "threads.h"
+#include "tier0/threadtools.h"
 
 //=============================================================================
 
@@ -703,6 +713,36 @@ template< class T > static void AddLump( int lumpnum, CUtlVector<T> &data, int v
 dheader_t		*g_pBSPHeader;
 FileHandle_t	g_hBSPFile;
 
+// Have LoadBSPFile map the file rather than read it onto the heap, and
+// decode the lumps on the tool threads
+bool			g_bBSPMemoryMap = true;
+bool			g_bBSPParallelLoad = true;
+
+// Set when g_pBSPHeader is a mapped view rather than a LoadFile buffer
+static bool		s_bBSPHeaderMapped;
+static int		s_nBSPFileSize;
+#ifdef _WIN32
+static HANDLE	s_hBSPFileMapping;
+#endif
+
+// Seconds spent decoding each lump by the last load, including any time
+// spent by the worker threads
+static float	s_flLumpLoadTime[HEADER_LUMPS];
+static int		s_nLumpLoadSize[HEADER_LUMPS];
+static float	s_flBSPOpenTime;
+static float	s_flBSPLoadTime;
+
+class CLumpLoadTimer
+{
+public:
+	CLumpLoadTimer( int lump ) : m_nLump( lump ), m_flStart( Plat_FloatTime() ) {}
+	~CLumpLoadTimer()	{ s_flLumpLoadTime[m_nLump] += Plat_FloatTime() - m_flStart; }
+
+private:
+	int		m_nLump;
+	double	m_flStart;
+};
+
 struct Lump_t
 {
 	void	*pLumps[HEADER_LUMPS];
@@ -1786,6 +1826,135 @@ void ValidateLump( int lump, int length, int size, int forceVersion )
 	}
 }
 
+//-----------------------------------------------------------------------------
+//	Deferred lump copies. While a batch is open CopyLumpInternal validates the
+//	lump and returns its count straight away, but leaves the copy or swap to
+//	FinishLumpCopies, which runs them on the tool threads. The destination
+//	must stay put until then, and nothing may read it in the meantime.
+//-----------------------------------------------------------------------------
+typedef void (*LumpCopyFn_t)( void *pDest, void *pSrc, int count );
+
+struct LumpCopyJob_t
+{
+	int				lump;
+	void			*pDest;
+	void			*pSrc;
+	unsigned int	length;
+	unsigned int	count;
+	LumpCopyFn_t	pfnCopy;	// NULL for a straight memcpy of length bytes
+};
+
+static bool							s_bDeferLumpCopies;
+static CUtlVector<LumpCopyJob_t>	s_LumpCopyJobs;
+static CInterlockedInt				s_nNextLumpCopyJob;
+
+template< class T >
+static void SwapBufferLumpCopy( void *pDest, void *pSrc, int count )
+{
+	g_Swap.SwapBufferToTargetEndian( (T*)pDest, (T*)pSrc, count );
+}
+
+template< class T >
+static void SwapFieldsLumpCopy( void *pDest, void *pSrc, int count )
+{
+	g_Swap.SwapFieldsToTargetEndian( (T*)pDest, pSrc, count );
+}
+
+static void SwapVisibilityLumpCopy( void *pDest, void *pSrc, int count )
+{
+	SwapVisibilityLump( (byte*)pDest, (byte*)pSrc, count );
+}
+
+static void SwapPhysdispLumpCopy( void *pDest, void *pSrc, int count )
+{
+	SwapPhysdispLump( (byte*)pDest, (byte*)pSrc, count );
+}
+
+// Queues the copy if a batch is open, otherwise does it now
+static void CopyLumpData( int lump, void *pDest, unsigned int length, unsigned int count, LumpCopyFn_t pfnCopy )
+{
+	LumpCopyJob_t job;
+	job.lump = lump;
+	job.pDest = pDest;
+	job.pSrc = (byte*)g_pBSPHeader + g_pBSPHeader->lumps[lump].fileofs;
+	job.length = length;
+	job.count = count;
+	job.pfnCopy = pfnCopy;
+
+	if ( s_bDeferLumpCopies && length )
+	{
+		s_LumpCopyJobs.AddToTail( job );
+		return;
+	}
+
+	CLumpLoadTimer timer( lump );
+	if ( pfnCopy )
+	{
+		pfnCopy( pDest, job.pSrc, count );
+	}
+	else
+	{
+		memcpy( pDest, job.pSrc, length );
+	}
+}
+
+static void LumpCopyThread( int iThread, void *pUserData )
+{
+	while ( 1 )
+	{
+		int i = s_nNextLumpCopyJob++;
+		if ( i >= s_LumpCopyJobs.Count() )
+			break;
+
+		const LumpCopyJob_t &job = s_LumpCopyJobs[i];
+		CLumpLoadTimer timer( job.lump );
+		if ( job.pfnCopy )
+		{
+			job.pfnCopy( job.pDest, job.pSrc, job.count );
+		}
+		else
+		{
+			memcpy( job.pDest, job.pSrc, job.length );
+		}
+	}
+}
+
+static int __cdecl LumpCopyJobSortFn( const LumpCopyJob_t *pLeft, const LumpCopyJob_t *pRight )
+{
+	// biggest first so the big lumps don't end up last on one thread
+	if ( pLeft->length != pRight->length )
+		return ( pLeft->length > pRight->length ) ? -1 : 1;
+	return pLeft->lump - pRight->lump;
+}
+
+static void BeginLumpCopies( void )
+{
+	Assert( !s_bDeferLumpCopies && !s_LumpCopyJobs.Count() );
+	s_bDeferLumpCopies = g_bBSPParallelLoad && numthreads > 1;
+}
+
+static void FinishLumpCopies( void )
+{
+	s_bDeferLumpCopies = false;
+	if ( !s_LumpCopyJobs.Count() )
+		return;
+
+	s_LumpCopyJobs.Sort( LumpCopyJobSortFn );
+	s_nNextLumpCopyJob = 0;
+
+	if ( s_LumpCopyJobs.Count() > 1 )
+	{
+		RunThreads_Start( LumpCopyThread, NULL );
+		RunThreads_End();
+	}
+	else
+	{
+		LumpCopyThread( 0, NULL );
+	}
+
+	s_LumpCopyJobs.RemoveAll();
+}
+
 //-----------------------------------------------------------------------------
 //	Add Lumps of integral types without datadescs
 //-----------------------------------------------------------------------------
@@ -1809,27 +1978,30 @@ int CopyLumpInternal( int fieldType, int lump, T *dest, int forceVersion )
 		switch( lump )
 		{
 		case LUMP_VISIBILITY:
-			SwapVisibilityLump( (byte*)dest, ((byte*)g_pBSPHeader + ofs), count );
+			CopyLumpData( lump, dest, length, count, SwapVisibilityLumpCopy );
 			break;
 		
 		case LUMP_PHYSCOLLIDE:
-			// SwapPhyscollideLump may change size
-			SwapPhyscollideLump( (byte*)dest, ((byte*)g_pBSPHeader + ofs), count );
-			length = count;
+			{
+				// SwapPhyscollideLump may change size, so it can't be deferred
+				CLumpLoadTimer timer( lump );
+				SwapPhyscollideLump( (byte*)dest, ((byte*)g_pBSPHeader + ofs), count );
+				length = count;
+			}
 			break;
 
 		case LUMP_PHYSDISP:
-			SwapPhysdispLump( (byte*)dest, ((byte*)g_pBSPHeader + ofs), count );
+			CopyLumpData( lump, dest, length, count, SwapPhysdispLumpCopy );
 			break;
 
 		default:
-			g_Swap.SwapBufferToTargetEndian( dest, (T*)((byte*)g_pBSPHeader + ofs), count );
+			CopyLumpData( lump, dest, length, count, SwapBufferLumpCopy<T> );
 			break;
 		}
 	}
 	else
 	{
-		memcpy( dest, (byte*)g_pBSPHeader + ofs, length );
+		CopyLumpData( lump, dest, length, count, NULL );
 	}
 
 	// Return actual count of elements
@@ -1879,18 +2051,17 @@ int CopyLumpInternal( int lump, T *dest, int forceVersion )
 	g_Lumps.bLumpParsed[lump] = true;
 
 	unsigned int length = g_pBSPHeader->lumps[lump].filelen;
-	unsigned int ofs = g_pBSPHeader->lumps[lump].fileofs;
 	unsigned int count = length / sizeof(T);
 	
 	ValidateLump( lump, length, sizeof(T), forceVersion );
 
 	if ( g_bSwapOnLoad )
 	{
-		g_Swap.SwapFieldsToTargetEndian( dest, (T*)((byte*)g_pBSPHeader + ofs), count );
+		CopyLumpData( lump, dest, length, count, SwapFieldsLumpCopy<T> );
 	}
 	else
 	{
-		memcpy( dest, (byte*)g_pBSPHeader + ofs, length );
+		CopyLumpData( lump, dest, length, count, NULL );
 	}
 
 	return count;
@@ -1975,6 +2146,7 @@ int LoadLeafs( void )
 	{
 	case 0:
 		{
+			CLumpLoadTimer timer( LUMP_LEAFS );
 			g_Lumps.bLumpParsed[LUMP_LEAFS] = true;
 			int length = g_pBSPHeader->lumps[LUMP_LEAFS].filelen;
 			int size = sizeof( dleaf_version_0_t );
@@ -2117,16 +2289,116 @@ void ValidateHeader( const char *filename, const dheader_t *pHeader )
 	}
 }
 
+//-----------------------------------------------------------------------------
+//	Maps the whole file copy-on-write, so the in-place swaps done while
+//	loading never reach the disk. Only plain absolute paths are mapped;
+//	anything that relies on the base paths goes through LoadFile.
+//-----------------------------------------------------------------------------
+static dheader_t *MapBSPFile( const char *filename )
+{
+	int pathLength;
+	if ( !V_IsAbsolutePath( filename ) || CmdLib_HasBasePath( filename, pathLength ) )
+		return NULL;
+
+#ifdef _WIN32
+	HANDLE hFile = CreateFileA( filename, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL );
+	if ( hFile == INVALID_HANDLE_VALUE )
+		return NULL;
+
+	DWORD nSizeHigh = 0;
+	DWORD nSize = GetFileSize( hFile, &nSizeHigh );
+	if ( nSize == INVALID_FILE_SIZE || nSizeHigh || nSize < sizeof( dheader_t ) || nSize > INT_MAX )
+	{
+		CloseHandle( hFile );
+		return NULL;
+	}
+
+	// the mapping keeps the file open
+	HANDLE hMapping = CreateFileMapping( hFile, NULL, PAGE_WRITECOPY, 0, 0, NULL );
+	CloseHandle( hFile );
+	if ( !hMapping )
+		return NULL;
+
+	void *pView = MapViewOfFile( hMapping, FILE_MAP_COPY, 0, 0, 0 );
+	if ( !pView )
+	{
+		CloseHandle( hMapping );
+		return NULL;
+	}
+	s_hBSPFileMapping = hMapping;
+#else
+	int fd = open( filename, O_RDONLY );
+	if ( fd < 0 )
+		return NULL;
+
+	struct stat st;
+	if ( fstat( fd, &st ) != 0 || st.st_size < (off_t)sizeof( dheader_t ) || st.st_size > INT_MAX )
+	{
+		close( fd );
+		return NULL;
+	}
+	int nSize = (int)st.st_size;
+
+	void *pView = mmap( NULL, nSize, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0 );
+	close( fd );
+	if ( pView == MAP_FAILED )
+		return NULL;
+#endif
+
+	s_nBSPFileSize = nSize;
+	s_bBSPHeaderMapped = true;
+	return (dheader_t *)pView;
+}
+
+static void ReadBSPFile( const char *filename, bool bMemoryMap )
+{
+	g_pBSPHeader = bMemoryMap ? MapBSPFile( filename ) : NULL;
+	if ( !g_pBSPHeader )
+	{
+		s_bBSPHeaderMapped = false;
+		s_nBSPFileSize = LoadFile( filename, (void **)&g_pBSPHeader );
+	}
+}
+
+static void FreeBSPFile( void )
+{
+	if ( !g_pBSPHeader )
+		return;
+
+	if ( s_bBSPHeaderMapped )
+	{
+#ifdef _WIN32
+		UnmapViewOfFile( g_pBSPHeader );
+		CloseHandle( s_hBSPFileMapping );
+		s_hBSPFileMapping = NULL;
+#else
+		munmap( g_pBSPHeader, s_nBSPFileSize );
+#endif
+		s_bBSPHeaderMapped = false;
+	}
+	else
+	{
+		free( g_pBSPHeader );
+	}
+
+	g_pBSPHeader = NULL;
+	s_nBSPFileSize = 0;
+}
+
 //-----------------------------------------------------------------------------
 //	Low level BSP opener for external parsing. Parses headers, but nothing else.
-//	You must close the BSP, via CloseBSPFile().
+//	You must close the BSP, via CloseBSPFile(). A mapped file stays open
+//	until then, so don't map one that's about to be written over.
 //-----------------------------------------------------------------------------
-void OpenBSPFile( const char *filename )
+void OpenBSPFile( const char *filename, bool bMemoryMap )
 {
 	Lumps_Init();
+	memset( s_flLumpLoadTime, 0, sizeof( s_flLumpLoadTime ) );
 
 	// load the file header
-	LoadFile( filename, (void **)&g_pBSPHeader );
+	double flStart = Plat_FloatTime();
+	ReadBSPFile( filename, bMemoryMap );
+	s_flBSPOpenTime = Plat_FloatTime() - flStart;
 
 	if ( g_bSwapOnLoad )
 	{
@@ -2137,6 +2409,11 @@ void OpenBSPFile( const char *filename )
 	ValidateHeader( filename, g_pBSPHeader );
 
 	g_MapRevision = g_pBSPHeader->mapRevision;
+
+	for ( int i = 0; i < HEADER_LUMPS; i++ )
+	{
+		s_nLumpLoadSize[i] = g_pBSPHeader->lumps[i].filelen;
+	}
 }
 
 //-----------------------------------------------------------------------------
@@ -2144,8 +2421,33 @@ void OpenBSPFile( const char *filename )
 //-----------------------------------------------------------------------------
 void CloseBSPFile( void )
 {
-	free( g_pBSPHeader );
-	g_pBSPHeader = NULL;
+	FreeBSPFile();
+}
+
+//-----------------------------------------------------------------------------
+//	Lump data straight out of the open BSP, without a copy. Only valid until
+//	CloseBSPFile. Returns NULL if the lump is empty or the file is being
+//	swapped on load, in which case the lump has to go through CopyLump.
+//-----------------------------------------------------------------------------
+const void *GetLumpView( int lump, int *pLength )
+{
+	if ( pLength )
+	{
+		*pLength = 0;
+	}
+
+	if ( !g_pBSPHeader || lump < 0 || lump >= HEADER_LUMPS || g_bSwapOnLoad )
+		return NULL;
+
+	const lump_t &l = g_pBSPHeader->lumps[lump];
+	if ( l.filelen <= 0 || l.fileofs < 0 || l.fileofs + l.filelen > s_nBSPFileSize )
+		return NULL;
+
+	if ( pLength )
+	{
+		*pLength = l.filelen;
+	}
+	return (byte *)g_pBSPHeader + l.fileofs;
 }
 
 //-----------------------------------------------------------------------------
@@ -2153,7 +2455,13 @@ void CloseBSPFile( void )
 //-----------------------------------------------------------------------------
 void LoadBSPFile( const char *filename )
 {
-	OpenBSPFile( filename );
+	double flStart = Plat_FloatTime();
+
+	OpenBSPFile( filename, g_bBSPMemoryMap );
+
+	// Everything up to the map flags only fills in its own arrays, so the
+	// copies and swaps can all run at once
+	BeginLumpCopies();
 
 	nummodels = CopyLump( LUMP_MODELS, dmodels );
 	numvertexes = CopyLump( LUMP_VERTEXES, dvertexes );
@@ -2216,6 +2524,8 @@ void LoadBSPFile( const char *filename )
 	g_nOverlayCount = CopyLump( LUMP_OVERLAYS, g_Overlays );
 	g_nWaterOverlayCount = CopyLump( LUMP_WATEROVERLAYS, g_WaterOverlays );
 	CopyLump( LUMP_OVERLAY_FADES, g_OverlayFades );
+
+	FinishLumpCopies();
 	
 	dflagslump_t flags_lump;
 	
@@ -2226,7 +2536,10 @@ void LoadBSPFile( const char *filename )
 
 	g_LevelFlags = flags_lump.m_LevelFlags;
 
-	LoadOcclusionLump();
+	{
+		CLumpLoadTimer timer( LUMP_OCCLUSION );
+		LoadOcclusionLump();
+	}
 
 	CopyLump( FIELD_SHORT, LUMP_LEAFMINDISTTOWATER, g_LeafMinDistToWater );
 
@@ -2241,13 +2554,25 @@ void LoadBSPFile( const char *filename )
 	}
 	*/
 		
-	// Load PAK file lump into appropriate data structure
+	// Load PAK file lump into appropriate data structure. The zip keeps its
+	// own copy, so parse it where it lies unless it needs swapping first.
 	byte *pakbuffer = NULL;
-	int paksize = CopyVariableLump<byte>( FIELD_CHARACTER, LUMP_PAKFILE, ( void ** )&pakbuffer );
+	int paksize;
+	const void *pPakView = GetLumpView( LUMP_PAKFILE, &paksize );
+	if ( pPakView )
+	{
+		g_Lumps.bLumpParsed[LUMP_PAKFILE] = true;
+	}
+	else
+	{
+		paksize = CopyVariableLump<byte>( FIELD_CHARACTER, LUMP_PAKFILE, ( void ** )&pakbuffer );
+	}
+
 	if ( paksize > 0 )
 	{
+		CLumpLoadTimer timer( LUMP_PAKFILE );
 		GetPakFile()->ActivateByteSwapping( IsX360() );
-		GetPakFile()->ParseFromBuffer( pakbuffer, paksize );
+		GetPakFile()->ParseFromBuffer( pPakView ? (void *)pPakView : pakbuffer, paksize );
 	}
 	else
 	{
@@ -2256,7 +2581,10 @@ void LoadBSPFile( const char *filename )
 
 	free( pakbuffer );
 
-	g_GameLumps.ParseGameLump( g_pBSPHeader );
+	{
+		CLumpLoadTimer timer( LUMP_GAME_LUMP );
+		g_GameLumps.ParseGameLump( g_pBSPHeader );
+	}
 
 	// NOTE: Do NOT call CopyLump after Lumps_Parse() it parses all un-Copied lumps
 	// parse any additional lumps
@@ -2266,6 +2594,8 @@ void LoadBSPFile( const char *filename )
 	CloseBSPFile();
 
 	g_Swap.ActivateByteSwapping( false );
+
+	s_flBSPLoadTime = Plat_FloatTime() - flStart;
 }
 
 //-----------------------------------------------------------------------------
@@ -2376,6 +2706,78 @@ void UnloadBSPFile()
 	ReleasePakFileLumps();
 }
 
+//-----------------------------------------------------------------------------
+//	Where the last LoadBSPFile spent its time. Lumps decoded in parallel are
+//	timed on their own thread, so the lump times can add up to more than
+//	the total.
+//-----------------------------------------------------------------------------
+void PrintBSPLoadTimes( void )
+{
+	Msg( "%-32s %10s %10s\n", "lump", "bytes", "ms" );
+	for ( int i = 0; i < HEADER_LUMPS; i++ )
+	{
+		if ( s_flLumpLoadTime[i] > 0.0f )
+		{
+			Msg( "%-32s %10d %10.3f\n", GetLumpName( i ), s_nLumpLoadSize[i], s_flLumpLoadTime[i] * 1000.0f );
+		}
+	}
+	Msg( "%-32s %10s %10.3f\n", "(open)", "", s_flBSPOpenTime * 1000.0f );
+	Msg( "%-32s %10s %10.3f\n", "(total)", "", s_flBSPLoadTime * 1000.0f );
+}
+
+//-----------------------------------------------------------------------------
+//	Loads and unloads the map nPasses times reading it onto the heap and
+//	copying lumps one at a time, then the same again mapping the file and
+//	copying lumps on the tool threads, and prints the average time for each
+//	lump. Leaves nothing loaded.
+//-----------------------------------------------------------------------------
+void BenchmarkBSPLoad( const char *filename, int nPasses )
+{
+	bool bOldMemoryMap = g_bBSPMemoryMap;
+	bool bOldParallelLoad = g_bBSPParallelLoad;
+
+	float flLumpTime[2][HEADER_LUMPS];
+	float flOpenTime[2], flTotalTime[2];
+	memset( flLumpTime, 0, sizeof( flLumpTime ) );
+
+	nPasses = MAX( nPasses, 1 );
+	UnloadBSPFile();
+
+	for ( int nMode = 0; nMode < 2; nMode++ )
+	{
+		g_bBSPMemoryMap = g_bBSPParallelLoad = ( nMode != 0 );
+		flOpenTime[nMode] = flTotalTime[nMode] = 0.0f;
+
+		for ( int nPass = 0; nPass < nPasses; nPass++ )
+		{
+			LoadBSPFile( filename );
+			for ( int i = 0; i < HEADER_LUMPS; i++ )
+			{
+				flLumpTime[nMode][i] += s_flLumpLoadTime[i];
+			}
+			flOpenTime[nMode] += s_flBSPOpenTime;
+			flTotalTime[nMode] += s_flBSPLoadTime;
+			UnloadBSPFile();
+		}
+	}
+
+	g_bBSPMemoryMap = bOldMemoryMap;
+	g_bBSPParallelLoad = bOldParallelLoad;
+
+	float flScale = 1000.0f / nPasses;
+	Msg( "%s, %d passes, %d threads, average ms per load:\n", filename, nPasses, numthreads );
+	Msg( "%-32s %10s %10s\n", "lump", "serial", "mapped" );
+	for ( int i = 0; i < HEADER_LUMPS; i++ )
+	{
+		if ( flLumpTime[0][i] > 0.0f || flLumpTime[1][i] > 0.0f )
+		{
+			Msg( "%-32s %10.3f %10.3f\n", GetLumpName( i ), flLumpTime[0][i] * flScale, flLumpTime[1][i] * flScale );
+		}
+	}
+	Msg( "%-32s %10.3f %10.3f\n", "(open)", flOpenTime[0] * flScale, flOpenTime[1] * flScale );
+	Msg( "%-32s %10.3f %10.3f\n", "(total)", flTotalTime[0] * flScale, flTotalTime[1] * flScale );
+}
+
 //-----------------------------------------------------------------------------
 //	LoadBSPFileFilesystemOnly
 //-----------------------------------------------------------------------------
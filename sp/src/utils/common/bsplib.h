@@ -40,6 +40,11 @@ class IZip;
 // this is only true in vrad
 extern bool g_bHDR;
 
+// LoadBSPFile maps the file and decodes lumps on the tool threads unless
+// these are cleared
+extern bool g_bBSPMemoryMap;
+extern bool g_bBSPParallelLoad;
+
 // default width/height of luxels in world units.
 #define DEFAULT_LUXEL_SIZE ( 16.0f )
 
@@ -286,13 +291,16 @@ int					TexDataStringTable_AddOrFindString( const char *pString );
 void	DecompressVis (byte *in, byte *decompressed);
 int		CompressVis (byte *vis, byte *dest);
 
-void	OpenBSPFile( const char *filename );
+void	OpenBSPFile( const char *filename, bool bMemoryMap = false );
 void	CloseBSPFile(void);
+const void *GetLumpView( int lump, int *pLength = NULL );	// between OpenBSPFile and CloseBSPFile; NULL if the lump needs swapping
 void	LoadBSPFile( const char *filename );
 void	LoadBSPFile_FileSystemOnly( const char *filename );
 void	LoadBSPFileTexinfo( const char *filename );
 void	WriteBSPFile( const char *filename, char *pUnused = NULL );
 void	PrintBSPFileSizes(void);
+void	PrintBSPLoadTimes(void);
+void	BenchmarkBSPLoad( const char *filename, int nPasses );
 void	PrintBSPPackDirectory(void);
 void	ReleasePakFileLumps(void);
 bool	SwapBSPFile( const char *filename, const char *swapFilename, bool bSwapOnLoad, VTFConvertFunc_t pVTFConvertFunc, VHVFixupFunc_t pVHVFixupFunc, CompressFunc_t pCompressFunc );
@@ -56,6 +56,8 @@ double		g_VisRadius = 4096.0f * 4096.0f;
 
 bool		g_bLowPriority = false;
 
+int			g_nLoadBenchmarkPasses = 0;
+
 //=============================================================================
 
 void PlaneFromWinding (winding_t *w, plane_t *plane)
@@ -953,6 +955,11 @@ int ParseCommandLine( int argc, char **argv )
 		{
 			g_bLowPriority = true;
 		}
+		else if( !Q_stricmp( argv[i], "-loadbenchmark" ) )
+		{
+			g_nLoadBenchmarkPasses = atoi( argv[i+1] );
+			i++;
+		}
 		else if ( !Q_stricmp( argv[i], "-FullMinidumps" ) )
 		{
 			EnableFullMinidumps( true );
@@ -1034,6 +1041,7 @@ void PrintUsage( int argc, char **argv )
 		"  -tmpout         : Make portals come from \\tmp\\<mapname>.\n"
 		"  -trace <start cluster> <end cluster> : Writes a linefile that traces the vis from one cluster to another for debugging map vis.\n"
 		"  -FullMinidumps  : Write large minidumps on crash.\n"
+		"  -loadbenchmark <passes> : Time loading the bsp serially and mapped/threaded before starting.\n"
 		"  -x360		   : Generate Xbox360 version of vsp\n"
 		"  -nox360		   : Disable generation Xbox360 version of vsp (default)\n"
 		"\n"
@@ -1119,6 +1127,11 @@ int RunVVis( int argc, char **argv )
 
 	char	targetPath[1024];
 	GetPlatformMapPath( source, targetPath, 0, 1024 );
+	if ( g_nLoadBenchmarkPasses > 0 )
+	{
+		BenchmarkBSPLoad( targetPath, g_nLoadBenchmarkPasses );
+	}
+
 	Msg ("reading %s\n", targetPath);
 	LoadBSPFile (targetPath);
 	if (numnodes == 0 || numfaces == 0)